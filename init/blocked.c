@@ -35,6 +35,56 @@
 #include "blocked.h"
 
 
+/* Prototypes for static functions */
+static int blocked_destroy (Blocked *blocked);
+
+
+/**
+ * blocked_pool_max:
+ *
+ * Largest number of released Blocked structures kept in blocked_pool for
+ * reuse; zero disables the pool.
+ **/
+unsigned int blocked_pool_max = BLOCKED_POOL_MAX;
+
+/**
+ * blocked_pooled:
+ *
+ * Number of structures kept in blocked_pool.
+ **/
+unsigned int blocked_pooled = 0;
+
+/**
+ * blocked_in_use:
+ *
+ * Number of structures allocated or taken from the pool and not yet
+ * released or freed.
+ **/
+unsigned int blocked_in_use = 0;
+
+/**
+ * blocked_peak:
+ *
+ * Largest number of structures that have been in use at once.
+ **/
+unsigned int blocked_peak = 0;
+
+/**
+ * blocked_reused:
+ *
+ * Number of structures taken from the pool rather than allocated.
+ **/
+unsigned int blocked_reused = 0;
+
+/**
+ * blocked_pool:
+ *
+ * Structures released with blocked_release(), each referenced by this
+ * list until blocked_new() hands it to a new parent.
+ **/
+static NihList *blocked_pool = NULL;
+
+
 /**
  * blocked_new:
  * @parent: parent of blocked structure,
@@ -50,6 +100,9 @@
  * block which will be used as the parent for this block.  When @parent
  * is freed, the returned block will be freed too.
  *
+ * Structures returned to the pool by blocked_release() are reused in
+ * preference to allocating a new one whenever @parent is not NULL.
+ *
  * Returns: new Blocked structure or NULL if insufficient memory.
  **/
 Blocked *
@@ -61,12 +114,28 @@ blocked_new (const void  *parent,
 
 	nih_assert (data != NULL);
 
-	blocked = nih_new (parent, Blocked);
-	if (! blocked)
-		return NULL;
+	if (parent && blocked_pool && (! NIH_LIST_EMPTY (blocked_pool))) {
+		blocked = (Blocked *)nih_list_remove (blocked_pool->next);
+
+		/* Take the new reference before dropping that of the pool
+		 * so that the structure is never left without a parent.
+		 */
+		nih_ref (blocked, parent);
+		nih_unref (blocked, blocked_pool);
+
+		blocked_pooled--;
+		blocked_reused++;
+	} else {
+		blocked = nih_new (parent, Blocked);
+		if (! blocked)
+			return NULL;
+
+		nih_list_init (&blocked->entry);
+		nih_alloc_set_destructor (blocked, blocked_destroy);
+	}
 
-	nih_list_init (&blocked->entry);
-	nih_alloc_set_destructor (blocked, nih_list_destroy);
+	if (++blocked_in_use > blocked_peak)
+		blocked_peak = blocked_in_use;
 
 	blocked->type = type;
 	switch (blocked->type) {
@@ -93,6 +162,77 @@ blocked_new (const void  *parent,
 	return blocked;
 }
 
+/**
+ * blocked_destroy:
+ * @blocked: Blocked structure being destroyed.
+ *
+ * Removes @blocked from its list and no longer counts it as in use; called
+ * when @blocked is freed directly or along with its parent, but not when
+ * it is returned to the pool by blocked_release().
+ *
+ * Returns: zero.
+ **/
+static int
+blocked_destroy (Blocked *blocked)
+{
+	nih_assert (blocked != NULL);
+
+	nih_list_destroy (&blocked->entry);
+
+	if (blocked_in_use)
+		blocked_in_use--;
+
+	return 0;
+}
+
+/**
+ * blocked_release:
+ * @blocked: Blocked structure that has been handled,
+ * @parent: parent @blocked was allocated with.
+ *
+ * Called once the object @blocked refers to has been unblocked to remove
+ * it from its list and drop its reference to any D-Bus message.
+ *
+ * Rather than being freed, @blocked is kept for reuse by the next call
+ * to blocked_new(), since a structure is made and released for each job
+ * started or stopped by an event and for the event itself; it is freed
+ * when @parent is NULL or blocked_pool_max structures are already kept.
+ **/
+void
+blocked_release (Blocked    *blocked,
+		 const void *parent)
+{
+	nih_assert (blocked != NULL);
+
+	if ((! parent) || (blocked_pooled >= blocked_pool_max)) {
+		nih_free (blocked);
+		return;
+	}
+
+	nih_assert (nih_alloc_parent (blocked, parent));
+
+	switch (blocked->type) {
+	case BLOCKED_JOB:
+	case BLOCKED_EVENT:
+		break;
+	default:
+		nih_unref (blocked->message, blocked);
+		break;
+	}
+
+	blocked->data = NULL;
+
+	if (! blocked_pool)
+		blocked_pool = NIH_MUST (nih_list_new (NULL));
+
+	nih_list_add (blocked_pool, &blocked->entry);
+	nih_ref (blocked, blocked_pool);
+	nih_unref (blocked, parent);
+
+	blocked_pooled++;
+	blocked_in_use--;
+}
+
 
 /**
  * blocked_enum_to_str:
@@ -29,6 +29,14 @@
 #include "event.h"
 
 
+/**
+ * BLOCKED_POOL_MAX:
+ *
+ * Default largest number of released Blocked structures kept for reuse.
+ **/
+#define BLOCKED_POOL_MAX 256
+
+
 /**
  * BlockedType:
  *
@@ -76,8 +84,16 @@ typedef struct blocked {
 
 NIH_BEGIN_EXTERN
 
+extern unsigned int blocked_pool_max;
+extern unsigned int blocked_pooled;
+extern unsigned int blocked_in_use;
+extern unsigned int blocked_peak;
+extern unsigned int blocked_reused;
+
+
 Blocked *blocked_new (const void *parent, BlockedType type, void *data)
 	__attribute__ ((warn_unused_result));
+void     blocked_release (Blocked *blocked, const void *parent);
 
 const char *
 blocked_type_enum_to_str (BlockedType type)
@@ -29,8 +29,13 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/select.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
 
 #include <nih/macros.h>
 #include <nih/logging.h>
@@ -38,6 +43,7 @@
 #include <nih/hash.h>
 #include <nih/alloc.h>
 #include <nih/io.h>
+#include <nih/error.h>
 
 #include <dbus/dbus.h>
 
@@ -81,10 +87,95 @@ char *cgroup_manager_address = NULL;
  **/
 NihDBusProxy *cgroup_manager = NULL;
 
+/**
+ * cgroup_backend:
+ *
+ * Backend used to create cgroups and place job processes in them.
+ **/
+CGroupBackend cgroup_backend = CGROUP_BACKEND_AUTO;
+
+/**
+ * cgroup_fs_root:
+ *
+ * Directory below which the cgroup hierarchies are mounted.
+ **/
+const char *cgroup_fs_root = CGROUP_FS_ROOT;
+
+/**
+ * cgroup_fs_self:
+ *
+ * File listing the cgroups of init in each hierarchy.
+ **/
+const char *cgroup_fs_self = CGROUP_FS_SELF;
+
+/**
+ * cgroup_fs_bases:
+ *
+ * Cgroups of init when first looked for, each as "CONTROLLERS:PATH" with
+ * CONTROLLERS empty for the unified hierarchy, see cgroup_fs_base().
+ **/
+static char **cgroup_fs_bases = NULL;
+
+/**
+ * cgroup_fs_scoped:
+ *
+ * TRUE once init has moved itself into CGROUP_FS_SCOPE.
+ **/
+static int cgroup_fs_scoped = FALSE;
+
+/**
+ * cgroup_fs_unified:
+ *
+ * TRUE if a unified (v2) hierarchy is mounted at cgroup_fs_root, FALSE
+ * if per-controller (v1) hierarchies are mounted below it, or -1 if
+ * the cgroup filesystem has not been found yet.
+ **/
+static int cgroup_fs_unified = -1;
+
+/**
+ * cgroup_fs_controllers:
+ *
+ * Space-separated list of controllers available in the unified
+ * hierarchy, as read from its root cgroup.controllers file.
+ **/
+static char *cgroup_fs_controllers = NULL;
+
 static void cgroup_manager_disconnected (DBusConnection *connection);
 
 static void cgroup_name_remap (char *str);
 
+static int   cgroup_fs_detect     (void)
+	__attribute__ ((warn_unused_result));
+static int   cgroup_fs_path_valid (const char *path)
+	__attribute__ ((warn_unused_result));
+static int   cgroup_fs_bases_read (void)
+	__attribute__ ((warn_unused_result));
+static char *cgroup_fs_base       (const void *parent, const char *controller)
+	__attribute__ ((warn_unused_result));
+static char *cgroup_fs_dir        (const void *parent, const char *controller,
+				   const char *path)
+	__attribute__ ((warn_unused_result));
+static int   cgroup_fs_write      (const char *dir, const char *file,
+				   const char *value)
+	__attribute__ ((warn_unused_result));
+static int   cgroup_fs_read       (const char *dir, const char *file,
+				   const char *key, uint64_t *value)
+	__attribute__ ((warn_unused_result));
+static int   cgroup_fs_signal     (const char *dir, int signum, pid_t pgid)
+	__attribute__ ((warn_unused_result));
+static int   cgroup_fs_kill       (const char *dir, int signum, pid_t pgid,
+				   int unified)
+	__attribute__ ((warn_unused_result));
+static int   cgroup_fs_contains   (const char *dir, pid_t pid)
+	__attribute__ ((warn_unused_result));
+static char *cgroup_fs_parent     (const void *parent)
+	__attribute__ ((warn_unused_result));
+static int   cgroup_fs_create     (const char *controller, const char *path)
+	__attribute__ ((warn_unused_result));
+static int   cgroup_fs_chown      (const char *controller, const char *path,
+				   uid_t uid, gid_t gid)
+	__attribute__ ((warn_unused_result));
+
 /**
  * cgroup_support_enabled:
  *
@@ -99,257 +190,1943 @@ cgroup_support_enabled (void)
 }
 
 /**
- * cgroup_new:
- * @parent: parent of new CGroup object,
- * @controller: cgroup controller name.
+ * cgroup_available:
  *
- * Allocates and returns a new CGroup object.
+ * Determine if cgroups can be created for jobs, either since the cgroup
+ * filesystem is mounted and may be driven directly, or since the cgroup
+ * manager has been contacted.
  *
- * If @parent is not NULL, it should be a pointer to another allocated
- * block which will be used as the parent for this block.  When @parent
- * is freed, the returned block will be freed too.
+ * Returns: TRUE if jobs specifying cgroups may be started, else FALSE.
+ **/
+int
+cgroup_available (void)
+{
+	if (cgroup_fs_available ())
+		return TRUE;
+
+	if (cgroup_backend == CGROUP_BACKEND_CGROUPFS)
+		return FALSE;
+
+	return cgroup_manager_available ();
+}
+
+/**
+ * cgroup_backend_from_name:
+ * @name: name of backend.
  *
- * Returns: newly allocated CGroup or NULL if insufficient memory.
+ * Convert @name into a CGroupBackend.
+ *
+ * Returns: CGroupBackend value or -1 if @name is not known.
  **/
-CGroup *
-cgroup_new (void *parent, const char *controller)
+int
+cgroup_backend_from_name (const char *name)
 {
-	CGroup *cgroup;
+	nih_assert (name);
+
+	if (! strcmp (name, "auto")) {
+		return CGROUP_BACKEND_AUTO;
+	} else if (! strcmp (name, "cgmanager")) {
+		return CGROUP_BACKEND_CGMANAGER;
+	} else if (! strcmp (name, "cgroupfs")) {
+		return CGROUP_BACKEND_CGROUPFS;
+	}
+
+	return -1;
+}
+
+/**
+ * cgroup_fs_available:
+ *
+ * Determine if cgroups should be created by writing to the cgroup
+ * filesystem directly rather than by asking the cgroup manager.
+ *
+ * The filesystem is looked for until it is found, since it is mounted
+ * by a job once init is running; the result is then inherited by each
+ * job process so that spawning does not need to look again.
+ *
+ * Returns: TRUE if the cgroup filesystem is to be used, else FALSE.
+ **/
+int
+cgroup_fs_available (void)
+{
+	if (cgroup_backend == CGROUP_BACKEND_CGMANAGER)
+		return FALSE;
+
+	if (cgroup_fs_unified < 0)
+		cgroup_fs_unified = cgroup_fs_detect ();
+
+	return cgroup_fs_unified >= 0;
+}
+
+/**
+ * cgroup_fs_reset:
+ *
+ * Forget the layout of the cgroup filesystem so that it is looked for
+ * again, for example after changing cgroup_fs_root.
+ **/
+void
+cgroup_fs_reset (void)
+{
+	cgroup_fs_unified = -1;
+
+	if (cgroup_fs_controllers) {
+		nih_free (cgroup_fs_controllers);
+		cgroup_fs_controllers = NULL;
+	}
+
+	if (cgroup_fs_bases) {
+		nih_free (cgroup_fs_bases);
+		cgroup_fs_bases = NULL;
+	}
+
+	cgroup_fs_scoped = FALSE;
+}
 
+/**
+ * cgroup_unified:
+ * @controller: cgroup controller.
+ *
+ * Determine which interface settings for @controller should use.  The
+ * cgroup manager only supports per-controller hierarchies, as do those
+ * mounted for a controller alone, so the unified interface is only used
+ * when @controller is available in a unified hierarchy that cgroups are
+ * created in directly.
+ *
+ * Returns: TRUE if settings for @controller should use the unified
+ * interface, else FALSE.
+ **/
+int
+cgroup_unified (const char *controller)
+{
 	nih_assert (controller);
 
-	cgroup = nih_new (parent, CGroup);
-	if (! cgroup)
-		return NULL;
+	if (! cgroup_fs_available ())
+		return FALSE;
 
-	nih_list_init (&cgroup->entry);
+	return cgroup_fs_controller_unified (controller);
+}
 
-	nih_alloc_set_destructor (cgroup, nih_list_destroy);
+/**
+ * cgroup_fs_detect:
+ *
+ * Look for the cgroup filesystem below cgroup_fs_root, preferring
+ * a unified hierarchy mounted there to per-controller hierarchies
+ * mounted in its sub-directories.
+ *
+ * Returns: TRUE for a unified hierarchy, FALSE for per-controller
+ * hierarchies or -1 if neither is mounted.
+ **/
+static int
+cgroup_fs_detect (void)
+{
+	nih_local char *path = NULL;
+	FILE           *file;
+	DIR            *dir;
+	struct dirent  *ent;
+	int             found = FALSE;
 
-	cgroup->controller = nih_strdup (cgroup, controller);
-	if (! cgroup->controller)
-		goto error;
+	path = NIH_MUST (nih_sprintf (NULL, "%s/cgroup.controllers",
+				      cgroup_fs_root));
 
-	nih_list_init (&cgroup->names);
+	file = fopen (path, "r");
+	if (file) {
+		char  line[LINE_MAX];
 
-	return cgroup;
+		/* Files in the cgroup filesystem have no size, so must be
+		 * read rather than mapped.
+		 */
+		if (! fgets (line, sizeof (line), file))
+			line[0] = '\0';
 
-error:
-	nih_free (cgroup);
-	return NULL;
+		fclose (file);
+
+		cgroup_fs_controllers = NIH_MUST (nih_strdup (NULL, line));
+
+		nih_debug ("Using unified cgroup hierarchy at %s",
+			   cgroup_fs_root);
+		return TRUE;
+	}
+
+	/* Each controller hierarchy has a cgroup.procs file at its root */
+	dir = opendir (cgroup_fs_root);
+	if (! dir)
+		return -1;
+
+	while (! found && (ent = readdir (dir)) != NULL) {
+		nih_local char *procs = NULL;
+
+		if (ent->d_name[0] == '.')
+			continue;
+
+		procs = NIH_MUST (nih_sprintf (NULL, "%s/%s/cgroup.procs",
+					       cgroup_fs_root, ent->d_name));
+
+		if (! access (procs, F_OK))
+			found = TRUE;
+	}
+
+	closedir (dir);
+
+	if (! found)
+		return -1;
+
+	nih_debug ("Using per-controller cgroup hierarchies below %s",
+		   cgroup_fs_root);
+
+	return FALSE;
 }
 
 /**
- * cgroup_serialise:
- * @cgroup: CGroup to serialise.
+ * cgroup_fs_controller_unified:
+ * @controller: cgroup controller.
  *
- * Convert @cgroup into a JSON representation for serialisation.
- * Caller must free returned value using json_object_put().
+ * Determine whether @controller is available in the unified hierarchy.
  *
- * Returns: JSON-serialised CGroup object, or NULL on error.
+ * Returns: TRUE if @controller is in the unified hierarchy, else FALSE.
  **/
-json_object *
-cgroup_serialise (CGroup *cgroup)
+static int
+cgroup_fs_controller_unified (const char *controller)
 {
-	json_object  *json;
-	json_object  *json_names;
+	size_t      len;
+	const char *p;
 
-	nih_assert (cgroup);
+	nih_assert (controller);
 
-	json = json_object_new_object ();
-	if (! json)
-		return NULL;
+	if (cgroup_fs_unified != TRUE || ! cgroup_fs_controllers)
+		return FALSE;
 
-	if (! state_set_json_string_var_from_obj (json, cgroup, controller))
-		goto error;
+	len = strlen (controller);
 
-	json_names = cgroup_name_serialise_all (&cgroup->names);
-	if (! json_names)
-		goto error;
+	for (p = cgroup_fs_controllers; *p; p += strcspn (p, " \n")) {
+		p += strspn (p, " \n");
 
-	json_object_object_add (json, "names", json_names);
+		if (! strncmp (p, controller, len)
+		    && (! p[len] || strchr (" \n", p[len])))
+			return TRUE;
+	}
 
-	return json;
+	return FALSE;
+}
 
-error:
-	json_object_put (json);
-	return NULL;
+/**
+ * cgroup_fs_bases_read:
+ *
+ * Read the cgroups of init in each hierarchy from cgroup_fs_self into
+ * cgroup_fs_bases, once, since the result can only change when we move
+ * ourselves; the path in the unified hierarchy is that of the session's
+ * cgroup, even after a re-exec from within CGROUP_FS_SCOPE.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+static int
+cgroup_fs_bases_read (void)
+{
+	FILE   *file;
+	char    line[PATH_MAX + 256];
+	char  **bases;
+	size_t  len = 0;
+
+	if (cgroup_fs_bases)
+		return TRUE;
+
+	file = fopen (cgroup_fs_self, "r");
+	if (! file)
+		nih_return_system_error (FALSE);
+
+	bases = nih_str_array_new (NULL);
+	if (! bases) {
+		fclose (file);
+		nih_return_no_memory_error (FALSE);
+	}
+
+	/* Lines are of the form "hierarchy-id:controller-list:path", the
+	 * unified hierarchy having id zero and no controllers listed.
+	 */
+	while (fgets (line, sizeof (line), file)) {
+		nih_local char *entry = NULL;
+		char           *controllers;
+		char           *path;
+
+		line[strcspn (line, "\n")] = '\0';
+
+		controllers = strchr (line, ':');
+		if (! controllers)
+			continue;
+		*controllers++ = '\0';
+
+		path = strchr (controllers, ':');
+		if (! path)
+			continue;
+		*path++ = '\0';
+
+		/* Only the unified hierarchy lists no controllers */
+		if ((! *controllers) && strcmp (line, "0"))
+			continue;
+
+		if (! *controllers) {
+			char *scope;
+
+			scope = strrchr (path, '/');
+			if (scope && (! strcmp (scope + 1, CGROUP_FS_SCOPE)))
+				*scope = '\0';
+		}
+
+		if (! strcmp (path, "/"))
+			path++;
+
+		entry = nih_sprintf (NULL, "%s:%s", controllers, path);
+		if ((! entry)
+		    || (! nih_str_array_add (&bases, NULL, &len, entry))) {
+			nih_free (bases);
+			fclose (file);
+			nih_return_no_memory_error (FALSE);
+		}
+	}
+
+	fclose (file);
+
+	cgroup_fs_bases = bases;
+
+	return TRUE;
 }
 
 /**
- * cgroup_serialise_all:
+ * cgroup_fs_base:
+ * @parent: parent of returned string,
+ * @controller: cgroup controller, or NULL for the unified hierarchy.
  *
- * @cgroups: list of CGroup objects.
+ * Determine the cgroup of the calling process within the hierarchy
+ * of @controller, below which the cgroups of jobs are created. This
+ * is the root cgroup unless running as a Session Init, in which case
+ * job cgroups are created below that of the session.
  *
- * Convert @cgroups to JSON representation.
+ * If @parent is not NULL, it should be a pointer to another allocated
+ * block which will be used as the parent for this block.  When @parent
+ * is freed, the returned string will be freed too.
  *
- * Returns: JSON object containing array of CGroup object in JSON form,
- * or NULL on error.
+ * Returns: newly allocated path, without a trailing slash, or NULL on
+ * raised error.
  **/
-json_object *
-cgroup_serialise_all (NihList *cgroups)
+static char *
+cgroup_fs_base (const void *parent, const char *controller)
 {
-	json_object  *json;
-	json_object  *json_cgroup;
+	char *base;
 
-	nih_assert (cgroups);
+	if (! user_mode)
+		return nih_strdup (parent, "");
 
-	json = json_object_new_array ();
-	if (! json)
+	if (! cgroup_fs_bases_read ())
 		return NULL;
 
-	NIH_LIST_FOREACH (cgroups, iter) {
-		CGroup *cgroup = (CGroup *)iter;
+	for (char **line = cgroup_fs_bases; *line; line++) {
+		const char *path;
+		size_t      len;
+		int         found = FALSE;
 
-		json_cgroup = cgroup_serialise (cgroup);
-		if (! json_cgroup)
-			goto error;
+		path = strchr (*line, ':');
+		nih_assert (path != NULL);
 
-		json_object_array_add (json, json_cgroup);
+		len = path - *line;
+		path++;
+
+		if (! controller) {
+			found = (len == 0);
+		} else {
+			const char *name = *line;
+
+			/* Search the comma-separated list of controllers */
+			while ((! found) && (name < *line + len)) {
+				size_t namelen;
+
+				namelen = strcspn (name, ",:");
+				if ((namelen == strlen (controller))
+				    && (! strncmp (name, controller, namelen)))
+					found = TRUE;
+
+				name += namelen + 1;
+			}
+		}
+
+		if (! found)
+			continue;
+
+		base = nih_strdup (parent, path);
+		if (! base)
+			nih_return_no_memory_error (NULL);
+
+		return base;
+	}
+
+	nih_return_error (NULL, CGROUP_ERROR,
+			  _("cgroup controller not available"));
+}
+
+/**
+ * cgroup_fs_path_valid:
+ * @path: relative cgroup path.
+ *
+ * Determine whether @path names a cgroup below the base cgroup; since it
+ * may be expanded from the environment of events emitted by any user,
+ * any path with an empty, "." or ".." component is refused lest we
+ * create or write to directories elsewhere.
+ *
+ * Returns: TRUE if @path is valid, else FALSE.
+ **/
+static int
+cgroup_fs_path_valid (const char *path)
+{
+	nih_assert (path);
+
+	for (;;) {
+		size_t len;
+
+		len = strcspn (path, "/");
+
+		if ((len == 0)
+		    || ((len == 1) && (path[0] == '.'))
+		    || ((len == 2) && (path[0] == '.') && (path[1] == '.')))
+			return FALSE;
+
+		if (! path[len])
+			break;
+
+		path += len + 1;
+	}
+
+	return TRUE;
+}
+
+/**
+ * cgroup_fs_dir:
+ * @parent: parent of returned string,
+ * @controller: cgroup controller,
+ * @path: relative cgroup path.
+ *
+ * Determine the directory of cgroup @path for @controller, using the
+ * unified hierarchy if the controller is available there, else the
+ * hierarchy mounted for that controller alone.  @path is refused if it
+ * would lead outside the base cgroup, see cgroup_fs_path_valid().
+ *
+ * If @parent is not NULL, it should be a pointer to another allocated
+ * block which will be used as the parent for this block.  When @parent
+ * is freed, the returned string will be freed too.
+ *
+ * Returns: newly allocated path or NULL on raised error.
+ **/
+static char *
+cgroup_fs_dir (const void  *parent,
+	       const char  *controller,
+	       const char  *path)
+{
+	nih_local char *base = NULL;
+	char           *dir;
+
+	nih_assert (controller);
+	nih_assert (path);
+	nih_assert (cgroup_fs_unified >= 0);
+
+	while (*path == '/')
+		path++;
+
+	if (! cgroup_fs_path_valid (path))
+		nih_return_error (NULL, CGROUP_ERROR,
+				  _("invalid cgroup path"));
+
+	if (cgroup_fs_controller_unified (controller)) {
+		base = cgroup_fs_base (NULL, NULL);
+		if (! base)
+			return NULL;
+
+		dir = nih_sprintf (parent, "%s%s/%s",
+				   cgroup_fs_root, base, path);
+	} else {
+		nih_local char *mount = NULL;
+		struct stat     statbuf;
+
+		mount = nih_sprintf (NULL, "%s/%s", cgroup_fs_root, controller);
+		if (! mount)
+			nih_return_no_memory_error (NULL);
+
+		if (stat (mount, &statbuf) < 0 || ! S_ISDIR (statbuf.st_mode))
+			nih_return_error (NULL, CGROUP_ERROR,
+					  _("cgroup controller not available"));
+
+		base = cgroup_fs_base (NULL, controller);
+		if (! base)
+			return NULL;
+
+		dir = nih_sprintf (parent, "%s%s/%s", mount, base, path);
 	}
 
-	return json;
+	if (! dir)
+		nih_return_no_memory_error (NULL);
+
+	return dir;
+}
+
+/**
+ * cgroup_fs_write:
+ * @dir: cgroup directory,
+ * @file: name of file within @dir,
+ * @value: value to write.
+ *
+ * Write @value to the cgroup file @file within @dir. The file is never
+ * created, since the kernel provides all valid files.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+static int
+cgroup_fs_write (const char  *dir,
+		 const char  *file,
+		 const char  *value)
+{
+	nih_local char *path = NULL;
+	size_t          len;
+	ssize_t         ret;
+	int             fd;
+
+	nih_assert (dir);
+	nih_assert (file);
+	nih_assert (value);
+
+	path = nih_sprintf (NULL, "%s/%s", dir, file);
+	if (! path)
+		nih_return_no_memory_error (FALSE);
+
+	fd = open (path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		nih_return_system_error (FALSE);
+
+	len = strlen (value);
+
+	/* The kernel takes each write as a whole value */
+	while ((ret = write (fd, value, len)) < 0 && errno == EINTR)
+		;
+
+	if (ret < 0) {
+		nih_error_raise_system ();
+		close (fd);
+		return FALSE;
+	}
+
+	if (close (fd) < 0)
+		nih_return_system_error (FALSE);
+
+	return TRUE;
+}
+
+/**
+ * cgroup_fs_read:
+ * @dir: cgroup directory,
+ * @file: name of file within @dir,
+ * @key: name of value to read, or NULL,
+ * @value: pointer to value to add to.
+ *
+ * Read a counter from the cgroup file @file within @dir and add it to
+ * @value.  If @key is NULL the file holds the counter alone; otherwise
+ * every value following a word matching @key is added, where a @key
+ * ending in '=' matches the start of a "key=value" word.  This covers
+ * both "key value" lines and per-device lines of either form.
+ *
+ * A file that does not exist is taken to hold zero, since which files
+ * are provided depends on the hierarchy and the controllers enabled.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+static int
+cgroup_fs_read (const char  *dir,
+		const char  *file,
+		const char  *key,
+		uint64_t    *value)
+{
+	nih_local char *path = NULL;
+	FILE           *stream;
+	char            line[4096];
+	size_t          keylen;
+	int             prefix;
+
+	nih_assert (dir);
+	nih_assert (file);
+	nih_assert (value);
+
+	path = nih_sprintf (NULL, "%s/%s", dir, file);
+	if (! path)
+		nih_return_no_memory_error (FALSE);
+
+	/* Files in the cgroup filesystem report a size of zero, so must
+	 * be read as a stream.
+	 */
+	stream = fopen (path, "r");
+	if (! stream) {
+		if (errno == ENOENT)
+			return TRUE;
+
+		nih_return_system_error (FALSE);
+	}
+
+	keylen = key ? strlen (key) : 0;
+	prefix = keylen && key[keylen - 1] == '=';
+
+	while (fgets (line, sizeof (line), stream)) {
+		char *saveptr = NULL;
+		char *word;
+		int   matched = FALSE;
+
+		for (word = strtok_r (line, " \t\n", &saveptr); word;
+		     word = strtok_r (NULL, " \t\n", &saveptr)) {
+			if (! key || matched) {
+				*value += strtoull (word, NULL, 10);
+				matched = FALSE;
+			} else if (prefix) {
+				if (! strncmp (word, key, keylen))
+					*value += strtoull (word + keylen,
+							    NULL, 10);
+			} else {
+				matched = ! strcmp (word, key);
+			}
+
+			if (! key)
+				break;
+		}
+
+		if (! key)
+			break;
+	}
+
+	fclose (stream);
+
+	return TRUE;
+}
+
+/**
+ * cgroup_fs_signal:
+ * @dir: cgroup directory,
+ * @signum: signal to send,
+ * @pgid: process group already signalled, or zero.
+ *
+ * Send @signum to each process listed in the cgroup.procs file of @dir
+ * and of every cgroup below it, other than those in process group @pgid
+ * which have already been sent it.  A cgroup that does not exist has
+ * no processes.
+ *
+ * Returns: number of processes signalled, or negative value on raised
+ * error.
+ **/
+static int
+cgroup_fs_signal (const char *dir,
+		  int         signum,
+		  pid_t       pgid)
+{
+	nih_local char *path = NULL;
+	FILE           *stream;
+	DIR            *subdirs;
+	struct dirent  *ent;
+	char            line[32];
+	int             count = 0;
+
+	nih_assert (dir);
+
+	path = nih_sprintf (NULL, "%s/cgroup.procs", dir);
+	if (! path)
+		nih_return_no_memory_error (-1);
+
+	stream = fopen (path, "r");
+	if (! stream) {
+		if (errno == ENOENT)
+			return 0;
+
+		nih_return_system_error (-1);
+	}
+
+	while (fgets (line, sizeof (line), stream)) {
+		pid_t pid;
+
+		pid = (pid_t)strtol (line, NULL, 10);
+		if (pid <= 0)
+			continue;
+
+		if (pgid > 0 && getpgid (pid) == pgid)
+			continue;
+
+		/* The process may already have exited */
+		if (kill (pid, signum) < 0 && errno != ESRCH) {
+			nih_error_raise_system ();
+			fclose (stream);
+			return -1;
+		}
+
+		count++;
+	}
+
+	fclose (stream);
+
+	/* Processes are not listed by the cgroups above their own */
+	subdirs = opendir (dir);
+	if (! subdirs)
+		return count;
+
+	while ((ent = readdir (subdirs)) != NULL) {
+		nih_local char *subdir = NULL;
+		int             ret;
+
+		if (ent->d_name[0] == '.' || ent->d_type != DT_DIR)
+			continue;
+
+		subdir = nih_sprintf (NULL, "%s/%s", dir, ent->d_name);
+		if (! subdir) {
+			closedir (subdirs);
+			nih_return_no_memory_error (-1);
+		}
+
+		ret = cgroup_fs_signal (subdir, signum, pgid);
+		if (ret < 0) {
+			closedir (subdirs);
+			return -1;
+		}
+
+		count += ret;
+	}
+
+	closedir (subdirs);
+
+	return count;
+}
+
+/**
+ * cgroup_fs_kill:
+ * @dir: cgroup directory,
+ * @signum: signal to send,
+ * @pgid: process group already signalled, or zero,
+ * @unified: TRUE if @dir is in the unified hierarchy.
+ *
+ * Send @signum to every process in the cgroup @dir and below it, other
+ * than those in process group @pgid.
+ *
+ * SIGKILL is sent by writing to the cgroup.kill file where the kernel
+ * provides one, which kills the whole tree at once including processes
+ * forked meanwhile.  Otherwise the processes are listed and signalled
+ * individually; for SIGKILL this is repeated until none remain, up to
+ * CGROUP_KILL_PASSES times, so that new children are caught too.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+static int
+cgroup_fs_kill (const char *dir,
+		int         signum,
+		pid_t       pgid,
+		int         unified)
+{
+	int pass;
+
+	nih_assert (dir);
+
+	if (signum == SIGKILL && unified) {
+		NihError *err;
+
+		if (cgroup_fs_write (dir, "cgroup.kill", "1"))
+			return TRUE;
+
+		/* Older kernels lack the file, as does a cgroup never
+		 * created; both are handled by listing the processes.
+		 */
+		err = nih_error_get ();
+		if (err->number != ENOENT) {
+			nih_error_raise_error (err);
+			return FALSE;
+		}
+		nih_free (err);
+	}
+
+	for (pass = 0; pass < CGROUP_KILL_PASSES; pass++) {
+		int ret;
+
+		ret = cgroup_fs_signal (dir, signum, pgid);
+		if (ret < 0)
+			return FALSE;
+
+		if (! ret || signum != SIGKILL)
+			break;
+	}
+
+	return TRUE;
+}
+
+/**
+ * cgroup_fs_contains:
+ * @dir: cgroup directory,
+ * @pid: process id to look for.
+ *
+ * Determine whether @pid is listed in the cgroup.procs file of @dir or
+ * of any cgroup below it.  A cgroup that does not exist has no
+ * processes.
+ *
+ * Returns: TRUE if @pid was found, FALSE if not, or negative value on
+ * raised error.
+ **/
+static int
+cgroup_fs_contains (const char *dir,
+		    pid_t       pid)
+{
+	nih_local char *path = NULL;
+	FILE           *stream;
+	DIR            *subdirs;
+	struct dirent  *ent;
+	char            line[32];
+	int             found = FALSE;
+
+	nih_assert (dir);
+	nih_assert (pid > 0);
+
+	path = nih_sprintf (NULL, "%s/cgroup.procs", dir);
+	if (! path)
+		nih_return_no_memory_error (-1);
+
+	stream = fopen (path, "r");
+	if (! stream) {
+		if (errno == ENOENT)
+			return FALSE;
+
+		nih_return_system_error (-1);
+	}
+
+	while (! found && fgets (line, sizeof (line), stream))
+		if ((pid_t)strtol (line, NULL, 10) == pid)
+			found = TRUE;
+
+	fclose (stream);
+
+	if (found)
+		return TRUE;
+
+	subdirs = opendir (dir);
+	if (! subdirs)
+		return FALSE;
+
+	while ((! found) && (ent = readdir (subdirs)) != NULL) {
+		nih_local char *subdir = NULL;
+
+		if (ent->d_name[0] == '.' || ent->d_type != DT_DIR)
+			continue;
+
+		subdir = nih_sprintf (NULL, "%s/%s", dir, ent->d_name);
+		if (! subdir) {
+			closedir (subdirs);
+			nih_return_no_memory_error (-1);
+		}
+
+		found = cgroup_fs_contains (subdir, pid);
+		if (found < 0) {
+			closedir (subdirs);
+			return -1;
+		}
+	}
+
+	closedir (subdirs);
+
+	return found;
+}
+
+/**
+ * cgroup_fs_parent:
+ * @parent: parent of returned string.
+ *
+ * Determine the directory of the cgroup below which job-unique cgroups
+ * are created in the unified hierarchy.
+ *
+ * If @parent is not NULL, it should be a pointer to another allocated
+ * block which will be used as the parent for this block.  When @parent
+ * is freed, the returned string will be freed too.
+ *
+ * Returns: newly allocated path or NULL on raised error.
+ **/
+static char *
+cgroup_fs_parent (const void *parent)
+{
+	nih_local char *base = NULL;
+	char           *dir;
+
+	if (! cgroup_fs_available () || cgroup_fs_unified != TRUE)
+		nih_return_error (NULL, CGROUP_ERROR,
+				  _("unified cgroup hierarchy not available"));
+
+	base = cgroup_fs_base (NULL, NULL);
+	if (! base)
+		return NULL;
+
+	dir = nih_sprintf (parent, "%s%s/%s", cgroup_fs_root, base,
+			   UPSTART_CGROUP_PARENT);
+	if (! dir)
+		nih_return_no_memory_error (NULL);
+
+	return dir;
+}
+
+/**
+ * cgroup_fs_create:
+ * @controller: cgroup controller,
+ * @path: relative cgroup path to create.
+ *
+ * Create the cgroup @path for @controller by making its directory, and
+ * those of any parent cgroups, in the cgroup filesystem.
+ *
+ * In the unified hierarchy a controller must also be enabled in each
+ * parent cgroup for its files to appear in the child, so @controller
+ * is enabled in the subtree of each cgroup between the base and @path;
+ * a Session Init must first have moved itself out of the base, see
+ * cgroup_scope().
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+static int
+cgroup_fs_create (const char *controller, const char *path)
+{
+	nih_local char *dir = NULL;
+	nih_local char *enable = NULL;
+	char           *p;
+	size_t          start;
+	int             unified;
+
+	nih_assert (controller);
+	nih_assert (path);
+
+	dir = cgroup_fs_dir (NULL, controller, path);
+	if (! dir)
+		return FALSE;
+
+	unified = cgroup_fs_controller_unified (controller);
+	if (unified) {
+		nih_local char *base = NULL;
+
+		base = cgroup_fs_base (NULL, NULL);
+		if (! base)
+			return FALSE;
+
+		enable = nih_sprintf (NULL, "+%s", controller);
+		if (! enable)
+			nih_return_no_memory_error (FALSE);
+
+		start = strlen (cgroup_fs_root) + strlen (base);
+	} else {
+		start = strlen (cgroup_fs_root) + 1 + strlen (controller);
+	}
+
+	/* Walk down from the base, creating each cgroup in turn; the
+	 * loop also visits the base itself so the controller is enabled
+	 * for its children.
+	 */
+	p = dir + start;
+	for (;;) {
+		char saved = *p;
+
+		*p = '\0';
+
+		if (p > dir + start && mkdir (dir, 0755) < 0 && errno != EEXIST)
+			nih_return_system_error (FALSE);
+
+		if (! saved)
+			break;
+
+		if (unified && ! cgroup_fs_write (dir, "cgroup.subtree_control",
+						  enable))
+			return FALSE;
+
+		*p = saved;
+
+		p = strchr (p + 1, '/');
+		if (! p)
+			p = dir + strlen (dir);
+	}
+
+	return TRUE;
+}
+
+/**
+ * cgroup_new:
+ * @parent: parent of new CGroup object,
+ * @controller: cgroup controller name.
+ *
+ * Allocates and returns a new CGroup object.
+ *
+ * If @parent is not NULL, it should be a pointer to another allocated
+ * block which will be used as the parent for this block.  When @parent
+ * is freed, the returned block will be freed too.
+ *
+ * Returns: newly allocated CGroup or NULL if insufficient memory.
+ **/
+CGroup *
+cgroup_new (void *parent, const char *controller)
+{
+	CGroup *cgroup;
+
+	nih_assert (controller);
+
+	cgroup = nih_new (parent, CGroup);
+	if (! cgroup)
+		return NULL;
+
+	nih_list_init (&cgroup->entry);
+
+	nih_alloc_set_destructor (cgroup, nih_list_destroy);
+
+	cgroup->controller = nih_strdup (cgroup, controller);
+	if (! cgroup->controller)
+		goto error;
+
+	nih_list_init (&cgroup->names);
+
+	return cgroup;
+
+error:
+	nih_free (cgroup);
+	return NULL;
+}
+
+/**
+ * cgroup_serialise:
+ * @cgroup: CGroup to serialise.
+ *
+ * Convert @cgroup into a JSON representation for serialisation.
+ * Caller must free returned value using json_object_put().
+ *
+ * Returns: JSON-serialised CGroup object, or NULL on error.
+ **/
+json_object *
+cgroup_serialise (CGroup *cgroup)
+{
+	json_object  *json;
+	json_object  *json_names;
+
+	nih_assert (cgroup);
+
+	json = json_object_new_object ();
+	if (! json)
+		return NULL;
+
+	if (! state_set_json_string_var_from_obj (json, cgroup, controller))
+		goto error;
+
+	json_names = cgroup_name_serialise_all (&cgroup->names);
+	if (! json_names)
+		goto error;
+
+	json_object_object_add (json, "names", json_names);
+
+	return json;
+
+error:
+	json_object_put (json);
+	return NULL;
+}
+
+/**
+ * cgroup_serialise_all:
+ *
+ * @cgroups: list of CGroup objects.
+ *
+ * Convert @cgroups to JSON representation.
+ *
+ * Returns: JSON object containing array of CGroup object in JSON form,
+ * or NULL on error.
+ **/
+json_object *
+cgroup_serialise_all (NihList *cgroups)
+{
+	json_object  *json;
+	json_object  *json_cgroup;
+
+	nih_assert (cgroups);
+
+	json = json_object_new_array ();
+	if (! json)
+		return NULL;
+
+	NIH_LIST_FOREACH (cgroups, iter) {
+		CGroup *cgroup = (CGroup *)iter;
+
+		json_cgroup = cgroup_serialise (cgroup);
+		if (! json_cgroup)
+			goto error;
+
+		json_object_array_add (json, json_cgroup);
+	}
+
+	return json;
+
+error:
+	json_object_put (json);
+	return NULL;
+}
+
+/**
+ * cgroup_deserialise:
+ * @parent: parent of new CGroup object,
+ * @json: JSON-serialised CGroup object to deserialise.
+ *
+ * Convert @json into a CGroup object.
+ *
+ * Returns: CGroup object, or NULL on error.
+ **/
+CGroup *
+cgroup_deserialise (void *parent, json_object *json)
+{
+	nih_local char  *controller = NULL;
+	CGroup          *cgroup;
+
+	nih_assert (json);
+
+	if (! state_check_json_type (json, object))
+		return NULL;
+
+	if (! state_get_json_string_var (json, "controller", NULL, controller))
+		return NULL;
+
+	cgroup = cgroup_new (parent, controller);
+	if (! cgroup)
+		return NULL;
+
+	if (cgroup_name_deserialise_all (cgroup, &cgroup->names, json) < 0)
+		goto error;
+
+	return cgroup;
+
+error:
+	nih_free (cgroup);
+	return NULL;
+}
+
+/**
+ * cgroup_deserialise_all:
+ *
+ * @parent: parent of new CGroup objects,
+ * @list: list to add new CGroup objects to,
+ * @json: root of JSON-serialised state.
+ *
+ * Convert JSON representation of CGroup objects back into
+ * CGroup objects.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+int
+cgroup_deserialise_all (void         *parent,
+			NihList      *list,
+			json_object  *json)
+{
+	json_object  *json_cgroups;
+
+	nih_assert (list);
+	nih_assert (json);
+
+	if (! json_object_object_get_ex (json, "cgroups", &json_cgroups))
+		goto error;
+
+	for (int i = 0; i < json_object_array_length (json_cgroups); i++) {
+		json_object  *json_cgroup;
+		CGroup       *cgroup;
+
+		json_cgroup = json_object_array_get_idx (json_cgroups, i);
+		if (! json_cgroup)
+			goto error;
+
+		if (! state_check_json_type (json_cgroup, object))
+			goto error;
+
+		cgroup = cgroup_deserialise (parent, json_cgroup);
+		if (! cgroup)
+			goto error;
+
+		nih_list_add (list, &cgroup->entry);
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+/**
+ * cgroup_clear:
+ *
+ * @cgroups: list of CGroup objects,
+ *
+ * Remove all cgroups associated with this job.
+ *
+ * Should be called by the _last_ job process to avoid racing with the
+ * cgroup manager which may remove an empty cgroup before the latest job
+ * process (which needs the cgroup) has been spawned.
+ *
+ * When the cgroup filesystem is driven directly there is nothing to
+ * arrange, the cgroups are left in place to be reused when the job is
+ * next started.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+int
+cgroup_clear (NihList *cgroups)
+{
+	nih_assert (cgroups);
+
+	if (! cgroup_support_enabled ())
+		return TRUE;
+
+	if (NIH_LIST_EMPTY (cgroups))
+		return TRUE;
+
+	if (cgroup_fs_available ())
+		return TRUE;
+
+	nih_assert (cgroup_manager);
+
+	NIH_LIST_FOREACH (cgroups, iter) {
+		CGroup *cgroup = (CGroup *)iter;
+
+		NIH_LIST_FOREACH (&cgroup->names, iter2) {
+			CGroupName   *cgname = (CGroupName *)iter2;
+			char         *cgpath;
+			int           ret;
+
+			cgpath = cgname->expanded ? cgname->expanded : cgname->name;
+
+			/* Get the cgroup manager to delete the cgroup once no more job
+			 * processes remain in it.
+			 */
+			ret = cgmanager_remove_on_empty_sync (NULL,
+					cgroup_manager,
+					cgroup->controller,
+					cgpath);
+
+			if (ret < 0) 
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * cgroup_environment:
+ * @parent: parent of returned environment table,
+ * @env: environment table.
+ *
+ * Construct the environment used to expand cgroup names, which is @env
+ * with the addition of $UPSTART_CGROUP.
+ *
+ * If @parent is not NULL, it should be a pointer to another allocated
+ * block which will be used as the parent for this block.  When @parent
+ * is freed, the returned block will be freed too.
+ *
+ * Returns: newly allocated environment table, or NULL on raised error.
+ **/
+static char **
+cgroup_environment (const void *parent, char * const *env)
+{
+	const char       *upstart_job = NULL;
+	const char       *upstart_instance = NULL;
+	nih_local char   *suffix = NULL;
+	char            **cgroup_env = NULL;
+	nih_local char   *envvar = NULL;
+	int               instance = FALSE;
+
+	/* Value of $UPSTART_CGROUP which takes the form:
+	 *
+	 *     upstart/${UPSTART_JOB}
+	 *
+	 * Or for instance jobs:
+	 *
+	 *     upstart/${UPSTART_JOB}-${UPSTART_INSTANCE}
+	 */
+	nih_local char   *upstart_cgroup = NULL;
+
+	nih_assert (env);
+
+	cgroup_env = nih_str_array_new (parent);
+	if (! cgroup_env)
+		nih_return_no_memory_error (NULL);
+
+	/* Copy the existing environment table */
+	if (! environ_append (&cgroup_env, parent, NULL, TRUE, env))
+		goto error;
+
+	upstart_job = environ_get (cgroup_env, "UPSTART_JOB");
+	nih_assert (upstart_job);
+
+	upstart_instance = environ_get (cgroup_env, "UPSTART_INSTANCE");
+	nih_assert (upstart_instance);
+
+	if (*upstart_instance)
+		instance = TRUE;
+
+	/* Construct the value of $UPSTART_CGROUP */
+	suffix = nih_sprintf (NULL, "%s%s%s",
+			upstart_job,
+			instance ? "-" : "",
+			instance ? upstart_instance : "");
+
+	if (! suffix)
+		goto error;
+
+	/* Remap the standard prefix to avoid creating sub-cgroups erroneously */
+	cgroup_name_remap (suffix);
+
+	upstart_cgroup = nih_sprintf (NULL, "%s/%s",
+				      UPSTART_CGROUP_PARENT, suffix);
+
+	if (! upstart_cgroup)
+		goto error;
+
+	envvar = nih_sprintf (NULL, "%s=%s",
+			UPSTART_CGROUP_ENVVAR,
+			upstart_cgroup);
+	if (! envvar)
+		goto error;
+
+	if (! environ_add (&cgroup_env, parent, NULL, TRUE, envvar))
+		goto error;
+
+	return cgroup_env;
+
+error:
+	nih_free (cgroup_env);
+	nih_return_no_memory_error (NULL);
+}
+
+/**
+ * cgroup_name_expand:
+ * @parent: parent of returned string,
+ * @cgname: CGroupName,
+ * @cgroup_env: environment table from cgroup_environment().
+ *
+ * Expand all variables in the name of @cgname, remapping slashes in
+ * the values of the variables to avoid unexpected sub-cgroup creation.
+ *
+ * If @parent is not NULL, it should be a pointer to another allocated
+ * block which will be used as the parent for this block.  When @parent
+ * is freed, the returned string will be freed too.
+ *
+ * Returns: newly allocated path, or NULL on raised error.
+ **/
+static char *
+cgroup_name_expand (const void        *parent,
+		    const CGroupName  *cgname,
+		    char * const      *cgroup_env)
+{
+	char    *expanded;
+	char    *p;
+
+	/* TRUE if the path *starts with* '$UPSTART_CGROUP' */
+	int      has_var = FALSE;
+	size_t   len;
+
+	nih_assert (cgname);
+	nih_assert (cgroup_env);
+
+	/* Note that we don't support "${UPSTART_CGROUP}" */
+	p = strstr (cgname->name, UPSTART_CGROUP_SHELL_ENVVAR);
+
+	/* cgroup specifies UPSTART_CGROUP initially */
+	if (p && p == cgname->name)
+		has_var = TRUE;
+
+	expanded = environ_expand (parent, cgname->name, cgroup_env);
+	if (! expanded)
+		return NULL;
+
+	len = strlen (expanded);
+
+	/* Remap slash to underscore to avoid unexpected
+	 * sub-cgroup creation.
+	 */
+	cgroup_name_remap (has_var && len > strlen (UPSTART_CGROUP_SHELL_ENVVAR)
+			? expanded + strlen (UPSTART_CGROUP_SHELL_ENVVAR)
+			: expanded);
+
+	return expanded;
+}
+
+/**
+ * cgroup_name_find_path:
+ * @cgname: CGroupName,
+ * @path: expanded path.
+ *
+ * Find the record of the cgroup @path having been created for @cgname.
+ *
+ * Returns: CGroupName recording @path, or NULL if not created.
+ **/
+static CGroupName *
+cgroup_name_find_path (CGroupName *cgname, const char *path)
+{
+	nih_assert (cgname);
+	nih_assert (path);
+
+	NIH_LIST_FOREACH (&cgname->paths, iter) {
+		CGroupName *record = (CGroupName *)iter;
+
+		if (! strcmp (record->name, path))
+			return record;
+	}
+
+	return NULL;
+}
+
+/**
+ * cgroup_settings_recorded:
+ * @record: CGroupName recording a created cgroup,
+ * @settings: list of CGroupSettings.
+ *
+ * Determine whether @settings were the last applied to the cgroup
+ * recorded by @record.
+ *
+ * Returns: TRUE if every setting is recorded with the same value,
+ * else FALSE.
+ **/
+static int
+cgroup_settings_recorded (CGroupName *record, NihList *settings)
+{
+	nih_assert (record);
+	nih_assert (settings);
+
+	NIH_LIST_FOREACH (settings, iter) {
+		CGroupSetting *setting = (CGroupSetting *)iter;
+		int            found = FALSE;
+
+		NIH_LIST_FOREACH (&record->settings, iter2) {
+			CGroupSetting *applied = (CGroupSetting *)iter2;
+
+			if (strcmp (applied->key, setting->key))
+				continue;
+
+			found = ! strcmp (applied->value ? applied->value : "",
+					  setting->value ? setting->value : "");
+			break;
+		}
+
+		if (! found)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * cgroup_record:
+ * @cgroups: list of CGroup objects,
+ * @env: environment table the job process was spawned with.
+ *
+ * Record that the cgroups of @cgroups, named by expanding their names
+ * using @env, have been created and configured by a successful spawn,
+ * so that later spawns need only place their process in them.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+int
+cgroup_record (NihList *cgroups, char * const *env)
+{
+	nih_local char **cgroup_env = NULL;
+
+	nih_assert (cgroups);
+	nih_assert (env);
+
+	if (NIH_LIST_EMPTY (cgroups))
+		return TRUE;
+
+	cgroup_env = cgroup_environment (NULL, env);
+	if (! cgroup_env)
+		return FALSE;
+
+	NIH_LIST_FOREACH (cgroups, iter) {
+		CGroup *cgroup = (CGroup *)iter;
+
+		NIH_LIST_FOREACH (&cgroup->names, iter2) {
+			CGroupName      *cgname = (CGroupName *)iter2;
+			CGroupName      *record;
+			nih_local char  *path = NULL;
+
+			path = cgroup_name_expand (NULL, cgname, cgroup_env);
+			if (! path)
+				return FALSE;
+
+			record = cgroup_name_find_path (cgname, path);
+			if (record && cgroup_settings_recorded (record,
+								&cgname->settings))
+				continue;
+
+			if (record)
+				nih_free (record);
+
+			record = cgroup_name_new (cgname, path);
+			if (! record)
+				nih_return_no_memory_error (FALSE);
+
+			NIH_LIST_FOREACH (&cgname->settings, iter3) {
+				CGroupSetting *setting = (CGroupSetting *)iter3;
+				CGroupSetting *applied;
+
+				applied = cgroup_setting_new (record,
+							      setting->key,
+							      setting->value);
+				if (! applied) {
+					nih_free (record);
+					nih_return_no_memory_error (FALSE);
+				}
+
+				nih_list_add (&record->settings, &applied->entry);
+			}
+
+			nih_list_add (&cgname->paths, &record->entry);
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * cgroup_forget:
+ * @cgroups: list of CGroup objects.
+ *
+ * Discard the records of all cgroups created for @cgroups, such that
+ * the next spawn creates and configures them again. This is done when
+ * the cgroups may have been removed, and when the configuration is
+ * reloaded.
+ **/
+void
+cgroup_forget (NihList *cgroups)
+{
+	nih_assert (cgroups);
+
+	NIH_LIST_FOREACH (cgroups, iter) {
+		CGroup *cgroup = (CGroup *)iter;
+
+		NIH_LIST_FOREACH (&cgroup->names, iter2) {
+			CGroupName *cgname = (CGroupName *)iter2;
+
+			NIH_LIST_FOREACH_SAFE (&cgname->paths, iter3) {
+				CGroupName *record = (CGroupName *)iter3;
+
+				nih_free (record);
+			}
+		}
+	}
+}
+
+/**
+ * cgroup_usage_read:
+ * @cgroups: list of CGroup objects,
+ * @env: environment table the job processes were spawned with,
+ * @cpu: pointer for CPU time consumed, in microseconds,
+ * @memory: pointer for memory in use, in bytes,
+ * @io_read: pointer for bytes read from block devices,
+ * @io_write: pointer for bytes written to block devices.
+ *
+ * Read the resource usage counters of the cgroups of @cgroups, named by
+ * expanding their names using @env, and sum them.  Each cgroup directory
+ * is only read once, so controllers sharing the unified hierarchy are
+ * not counted twice; counters of cgroups that do not exist are zero.
+ *
+ * In the unified hierarchy the counters are read from cpu.stat,
+ * memory.current and io.stat; in per-controller hierarchies from
+ * cpuacct.usage, memory.usage_in_bytes and
+ * blkio.throttle.io_service_bytes.
+ *
+ * The counters can only be read through the cgroup filesystem.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+int
+cgroup_usage_read (NihList        *cgroups,
+		   char * const   *env,
+		   uint64_t       *cpu,
+		   uint64_t       *memory,
+		   uint64_t       *io_read,
+		   uint64_t       *io_write)
+{
+	nih_local char **cgroup_env = NULL;
+	nih_local char **dirs = NULL;
+	size_t           dirc = 0;
+
+	nih_assert (cgroups);
+	nih_assert (env);
+	nih_assert (cpu);
+	nih_assert (memory);
+	nih_assert (io_read);
+	nih_assert (io_write);
+
+	*cpu = *memory = *io_read = *io_write = 0;
+
+	if (NIH_LIST_EMPTY (cgroups))
+		return TRUE;
+
+	if (! cgroup_fs_available ())
+		nih_return_error (FALSE, CGROUP_ERROR,
+				  _("cgroup filesystem not available"));
+
+	cgroup_env = cgroup_environment (NULL, env);
+	if (! cgroup_env)
+		return FALSE;
+
+	dirs = nih_str_array_new (NULL);
+	if (! dirs)
+		nih_return_no_memory_error (FALSE);
+
+	NIH_LIST_FOREACH (cgroups, iter) {
+		CGroup *cgroup = (CGroup *)iter;
+
+		NIH_LIST_FOREACH (&cgroup->names, iter2) {
+			CGroupName      *cgname = (CGroupName *)iter2;
+			nih_local char  *path = NULL;
+			nih_local char  *dir = NULL;
+			uint64_t         nsec = 0;
+			int              seen = FALSE;
+
+			path = cgroup_name_expand (NULL, cgname, cgroup_env);
+			if (! path)
+				return FALSE;
+
+			dir = cgroup_fs_dir (NULL, cgroup->controller, path);
+			if (! dir)
+				return FALSE;
+
+			for (char **d = dirs; *d; d++)
+				if (! strcmp (*d, dir))
+					seen = TRUE;
+
+			if (seen)
+				continue;
+
+			if (! nih_str_array_add (&dirs, NULL, &dirc, dir))
+				nih_return_no_memory_error (FALSE);
+
+			if (! cgroup_fs_read (dir, "cpu.stat", "usage_usec", cpu)
+			    || ! cgroup_fs_read (dir, "cpuacct.usage", NULL, &nsec)
+			    || ! cgroup_fs_read (dir, "memory.current", NULL, memory)
+			    || ! cgroup_fs_read (dir, "memory.usage_in_bytes",
+						 NULL, memory)
+			    || ! cgroup_fs_read (dir, "io.stat", "rbytes=", io_read)
+			    || ! cgroup_fs_read (dir, "io.stat", "wbytes=", io_write)
+			    || ! cgroup_fs_read (dir, "blkio.throttle.io_service_bytes",
+						 "Read", io_read)
+			    || ! cgroup_fs_read (dir, "blkio.throttle.io_service_bytes",
+						 "Write", io_write))
+				return FALSE;
+
+			*cpu += nsec / 1000;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * cgroup_kill:
+ * @cgroups: list of CGroup objects,
+ * @env: environment table the job processes were spawned with,
+ * @signum: signal to send,
+ * @pgid: process group already signalled, or zero.
+ *
+ * Send @signum to every process in the job-unique cgroups of @cgroups,
+ * named by expanding their names using @env, so that processes which
+ * have left the process group of the job, such as daemons that fork
+ * twice, are signalled too.  Processes in process group @pgid have
+ * already been sent the signal and are skipped.
+ *
+ * Only cgroups whose names begin with $UPSTART_CGROUP are job-unique;
+ * other cgroups may hold the processes of other jobs and are left
+ * alone.
+ *
+ * Processes can only be signalled through the cgroup filesystem, with
+ * the cgroup manager nothing is done.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+int
+cgroup_kill (NihList        *cgroups,
+	     char * const   *env,
+	     int             signum,
+	     pid_t           pgid)
+{
+	nih_local char **cgroup_env = NULL;
+	nih_local char **dirs = NULL;
+	size_t           dirc = 0;
+
+	nih_assert (cgroups);
+	nih_assert (env);
+
+	if (! cgroup_support_enabled ())
+		return TRUE;
+
+	if (NIH_LIST_EMPTY (cgroups))
+		return TRUE;
+
+	if (! cgroup_fs_available ())
+		return TRUE;
+
+	cgroup_env = cgroup_environment (NULL, env);
+	if (! cgroup_env)
+		return FALSE;
+
+	dirs = nih_str_array_new (NULL);
+	if (! dirs)
+		nih_return_no_memory_error (FALSE);
+
+	NIH_LIST_FOREACH (cgroups, iter) {
+		CGroup *cgroup = (CGroup *)iter;
+
+		NIH_LIST_FOREACH (&cgroup->names, iter2) {
+			CGroupName      *cgname = (CGroupName *)iter2;
+			nih_local char  *path = NULL;
+			nih_local char  *dir = NULL;
+			int              seen = FALSE;
+
+			if (strncmp (cgname->name, UPSTART_CGROUP_SHELL_ENVVAR,
+				     strlen (UPSTART_CGROUP_SHELL_ENVVAR)))
+				continue;
+
+			path = cgroup_name_expand (NULL, cgname, cgroup_env);
+			if (! path)
+				return FALSE;
+
+			dir = cgroup_fs_dir (NULL, cgroup->controller, path);
+			if (! dir)
+				return FALSE;
+
+			for (char **d = dirs; *d; d++)
+				if (! strcmp (*d, dir))
+					seen = TRUE;
+
+			if (seen)
+				continue;
+
+			if (! nih_str_array_add (&dirs, NULL, &dirc, dir))
+				nih_return_no_memory_error (FALSE);
+
+			if (! cgroup_fs_kill (dir, signum, pgid,
+					      cgroup_fs_controller_unified (
+						      cgroup->controller)))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * cgroup_kill_all:
+ *
+ * Kill every process remaining in the job-unique cgroups of all jobs,
+ * which once no job processes remain can only be those that escaped
+ * their jobs.
+ *
+ * This is only possible in the unified hierarchy, where those cgroups
+ * share a common parent.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+int
+cgroup_kill_all (void)
+{
+	nih_local char *dir = NULL;
+
+	dir = cgroup_fs_parent (NULL);
+	if (! dir)
+		return FALSE;
 
-error:
-	json_object_put (json);
-	return NULL;
+	return cgroup_fs_kill (dir, SIGKILL, 0, TRUE);
 }
 
 /**
- * cgroup_deserialise:
- * @parent: parent of new CGroup object,
- * @json: JSON-serialised CGroup object to deserialise.
+ * cgroup_scope:
  *
- * Convert @json into a CGroup object.
+ * Move a Session Init from the cgroup of the session into its
+ * CGROUP_FS_SCOPE leaf in the unified hierarchy; the kernel refuses to
+ * enable controllers for the children of a cgroup with processes of its
+ * own, which job cgroups created below the session's need.  This must be
+ * called by the init daemon before spawning a process that creates
+ * cgroups, so that the process starts out in the leaf too; it does
+ * nothing after the first time, or if not needed.
  *
- * Returns: CGroup object, or NULL on error.
+ * Returns: TRUE on success, FALSE on raised error.
  **/
-CGroup *
-cgroup_deserialise (void *parent, json_object *json)
+int
+cgroup_scope (void)
 {
-	nih_local char  *controller = NULL;
-	CGroup          *cgroup;
+	nih_local char *base = NULL;
+	nih_local char *dir = NULL;
+	char            value[32];
 
-	nih_assert (json);
+	if (cgroup_fs_scoped || (! user_mode))
+		return TRUE;
 
-	if (! state_check_json_type (json, object))
-		return NULL;
+	if ((! cgroup_fs_available ()) || (cgroup_fs_unified != TRUE))
+		return TRUE;
 
-	if (! state_get_json_string_var (json, "controller", NULL, controller))
-		return NULL;
+	base = cgroup_fs_base (NULL, NULL);
+	if (! base)
+		return FALSE;
 
-	cgroup = cgroup_new (parent, controller);
-	if (! cgroup)
-		return NULL;
+	/* The root cgroup may have processes of its own */
+	if (! *base)
+		return TRUE;
 
-	if (cgroup_name_deserialise_all (cgroup, &cgroup->names, json) < 0)
-		goto error;
+	dir = nih_sprintf (NULL, "%s%s/%s", cgroup_fs_root, base,
+			   CGROUP_FS_SCOPE);
+	if (! dir)
+		nih_return_no_memory_error (FALSE);
 
-	return cgroup;
+	if (mkdir (dir, 0755) < 0 && errno != EEXIST)
+		nih_return_system_error (FALSE);
 
-error:
-	nih_free (cgroup);
-	return NULL;
+	snprintf (value, sizeof (value), "%d", (int)getpid ());
+
+	if (! cgroup_fs_write (dir, "cgroup.procs", value))
+		return FALSE;
+
+	cgroup_fs_scoped = TRUE;
+
+	return TRUE;
 }
 
 /**
- * cgroup_deserialise_all:
+ * cgroup_contains:
+ * @cgroups: list of CGroup objects,
+ * @env: environment table the job processes were spawned with,
+ * @pid: process id to look for.
  *
- * @parent: parent of new CGroup objects,
- * @list: list to add new CGroup objects to,
- * @json: root of JSON-serialised state.
+ * Determine whether @pid is in one of the job-unique cgroups of
+ * @cgroups, named by expanding their names using @env, or below one;
+ * as for cgroup_kill() only cgroups whose names begin with
+ * $UPSTART_CGROUP are considered, since others may hold the processes
+ * of other jobs.
  *
- * Convert JSON representation of CGroup objects back into
- * CGroup objects.
+ * This can only be determined through the cgroup filesystem, with the
+ * cgroup manager @pid is never found.
  *
- * Returns: 0 on success, -1 on error.
+ * Returns: TRUE if @pid was found, FALSE if not, or negative value on
+ * raised error.
  **/
 int
-cgroup_deserialise_all (void         *parent,
-			NihList      *list,
-			json_object  *json)
+cgroup_contains (NihList      *cgroups,
+		 char * const *env,
+		 pid_t         pid)
 {
-	json_object  *json_cgroups;
+	nih_local char **cgroup_env = NULL;
 
-	nih_assert (list);
-	nih_assert (json);
+	nih_assert (cgroups);
+	nih_assert (env);
+	nih_assert (pid > 0);
 
-	if (! json_object_object_get_ex (json, "cgroups", &json_cgroups))
-		goto error;
+	if (! cgroup_support_enabled ())
+		return FALSE;
 
-	for (int i = 0; i < json_object_array_length (json_cgroups); i++) {
-		json_object  *json_cgroup;
-		CGroup       *cgroup;
+	if (NIH_LIST_EMPTY (cgroups))
+		return FALSE;
 
-		json_cgroup = json_object_array_get_idx (json_cgroups, i);
-		if (! json_cgroup)
-			goto error;
+	if (! cgroup_fs_available ())
+		return FALSE;
 
-		if (! state_check_json_type (json_cgroup, object))
-			goto error;
+	cgroup_env = cgroup_environment (NULL, env);
+	if (! cgroup_env)
+		return -1;
 
-		cgroup = cgroup_deserialise (parent, json_cgroup);
-		if (! cgroup)
-			goto error;
+	NIH_LIST_FOREACH (cgroups, iter) {
+		CGroup *cgroup = (CGroup *)iter;
 
-		nih_list_add (list, &cgroup->entry);
-	}
+		NIH_LIST_FOREACH (&cgroup->names, iter2) {
+			CGroupName      *cgname = (CGroupName *)iter2;
+			nih_local char  *path = NULL;
+			nih_local char  *dir = NULL;
+			int              ret;
 
-	return 0;
+			if (strncmp (cgname->name, UPSTART_CGROUP_SHELL_ENVVAR,
+				     strlen (UPSTART_CGROUP_SHELL_ENVVAR)))
+				continue;
 
-error:
-	return -1;
+			path = cgroup_name_expand (NULL, cgname, cgroup_env);
+			if (! path)
+				return -1;
+
+			dir = cgroup_fs_dir (NULL, cgroup->controller, path);
+			if (! dir)
+				return -1;
+
+			ret = cgroup_fs_contains (dir, pid);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return FALSE;
 }
 
 /**
- * cgroup_clear:
+ * cgroup_events_open:
  *
- * @cgroups: list of CGroup objects,
+ * Open the cgroup.events file of the cgroup below which job-unique
+ * cgroups are created in the unified hierarchy.  The kernel notifies
+ * a change in whether any processes remain in those cgroups as an
+ * exceptional condition on the returned descriptor, after which
+ * cgroup_events_populated() should be called to read the new state.
  *
- * Remove all cgroups associated with this job.
+ * Returns: open file descriptor, or negative value on raised error.
+ **/
+int
+cgroup_events_open (void)
+{
+	nih_local char *dir = NULL;
+	nih_local char *path = NULL;
+	int             fd;
+
+	dir = cgroup_fs_parent (NULL);
+	if (! dir)
+		return -1;
+
+	path = nih_sprintf (NULL, "%s/cgroup.events", dir);
+	if (! path)
+		nih_return_no_memory_error (-1);
+
+	fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		nih_return_system_error (-1);
+
+	return fd;
+}
+
+/**
+ * cgroup_events_populated:
+ * @fd: descriptor returned by cgroup_events_open().
  *
- * Should be called by the _last_ job process to avoid racing with the
- * cgroup manager which may remove an empty cgroup before the latest job
- * process (which needs the cgroup) has been spawned.
+ * Read whether any processes remain in the cgroups watched by @fd.
+ * Reading also acknowledges any notification, which would otherwise
+ * remain pending.
  *
- * Returns: TRUE on success, FALSE on raised error.
+ * Returns: TRUE if processes remain, FALSE if not, or negative value on
+ * raised error.
  **/
 int
-cgroup_clear (NihList *cgroups)
+cgroup_events_populated (int fd)
 {
-	nih_assert (cgroups);
-	nih_assert (cgroup_manager);
-
-	if (! cgroup_support_enabled ())
-		return TRUE;
+	char     buf[256];
+	ssize_t  len;
+	char    *p;
 
-	if (NIH_LIST_EMPTY (cgroups))
-		return TRUE;
+	nih_assert (fd >= 0);
 
-	NIH_LIST_FOREACH (cgroups, iter) {
-		CGroup *cgroup = (CGroup *)iter;
+	if (lseek (fd, 0, SEEK_SET) < 0)
+		nih_return_system_error (-1);
 
-		NIH_LIST_FOREACH (&cgroup->names, iter2) {
-			CGroupName   *cgname = (CGroupName *)iter2;
-			char         *cgpath;
-			int           ret;
+	while ((len = read (fd, buf, sizeof (buf) - 1)) < 0 && errno == EINTR)
+		;
 
-			cgpath = cgname->expanded ? cgname->expanded : cgname->name;
+	if (len < 0)
+		nih_return_system_error (-1);
 
-			/* Get the cgroup manager to delete the cgroup once no more job
-			 * processes remain in it.
-			 */
-			ret = cgmanager_remove_on_empty_sync (NULL,
-					cgroup_manager,
-					cgroup->controller,
-					cgpath);
+	buf[len] = '\0';
 
-			if (ret < 0) 
-				return FALSE;
-		}
+	/* Lines are of the form "key value" */
+	for (p = buf; *p; p += strcspn (p, "\n"), p += strspn (p, "\n")) {
+		if (! strncmp (p, "populated ", strlen ("populated ")))
+			return p[strlen ("populated ")] != '0';
 	}
 
-	return TRUE;
+	nih_return_error (-1, CGROUP_ERROR,
+			  _("cgroup.events has no populated key"));
 }
 
 /**
@@ -364,6 +2141,10 @@ cgroup_clear (NihList *cgroups)
  * in @cgroups, create the resulting cgroup paths, placing the caller
  * into each group and applying requested cgroup settings.
  *
+ * Cgroups recorded by cgroup_record() as created by an earlier spawn
+ * are not created again, and their settings are only applied if they
+ * have changed.
+ *
  * Returns: TRUE on success, FALSE on raised error.
  **/
 int
@@ -372,32 +2153,17 @@ cgroup_setup (NihList       *cgroups,
 	      uid_t          uid,
 	      gid_t          gid)
 {
-	const char       *upstart_job = NULL;
-	const char       *upstart_instance = NULL;
-	nih_local char   *suffix = NULL;
 	nih_local char  **cgroup_env = NULL;
-	nih_local char   *envvar = NULL;
-	int               instance = FALSE;
 	uid_t             current_uid;
 	gid_t             current_gid;
 
-	/* Value of $UPSTART_CGROUP which takes the form:
-	 *
-	 *     upstart/${UPSTART_JOB}
-	 *
-	 * Or for instance jobs:
-	 *
-	 *     upstart/${UPSTART_JOB}-${UPSTART_INSTANCE}
-	 */
-	nih_local char   *upstart_cgroup = NULL;
-
 	nih_assert (cgroups);
 	nih_assert (env);
 
 	if (! cgroup_support_enabled ())
 		return TRUE;
 
-	nih_assert (cgroup_manager_available ());
+	nih_assert (cgroup_available ());
 
 	if (NIH_LIST_EMPTY (cgroups))
 		return TRUE;
@@ -405,82 +2171,25 @@ cgroup_setup (NihList       *cgroups,
 	current_uid = geteuid ();
 	current_gid = getegid ();
 
-	cgroup_env = nih_str_array_new (NULL);
+	cgroup_env = cgroup_environment (NULL, env);
 	if (! cgroup_env)
-		nih_return_no_memory_error (FALSE);
-
-	/* Copy the existing environment table */
-	if (! environ_append (&cgroup_env, NULL, NULL, TRUE, env))
-		nih_return_no_memory_error (FALSE);
-
-	upstart_job = environ_get (cgroup_env, "UPSTART_JOB");
-	nih_assert (upstart_job);
-
-	upstart_instance = environ_get (cgroup_env, "UPSTART_INSTANCE");
-	nih_assert (upstart_instance);
-
-	if (*upstart_instance)
-		instance = TRUE;
-
-	/* Construct the value of $UPSTART_CGROUP */
-	suffix = nih_sprintf (NULL, "%s%s%s",
-			upstart_job,
-			instance ? "-" : "",
-			instance ? upstart_instance : "");
-
-	if (! suffix)
-		nih_return_no_memory_error (FALSE);
-
-	/* Remap the standard prefix to avoid creating sub-cgroups erroneously */
-	cgroup_name_remap (suffix);
-
-	upstart_cgroup = nih_sprintf (NULL, "upstart/%s", suffix);
-
-	if (! upstart_cgroup)
-		nih_return_no_memory_error (FALSE);
-
-	envvar = NIH_MUST (nih_sprintf (NULL, "%s=%s",
-				UPSTART_CGROUP_ENVVAR,
-				upstart_cgroup));
-
-	if (! environ_add (&cgroup_env, NULL, NULL, TRUE, envvar))
-		nih_return_no_memory_error (FALSE);
+		return FALSE;
 
 	NIH_LIST_FOREACH (cgroups, iter) {
 		CGroup *cgroup = (CGroup *)iter;
 
 		NIH_LIST_FOREACH (&cgroup->names, iter2) {
 			CGroupName   *cgname = (CGroupName *)iter2;
+			CGroupName   *record;
 			char         *cgpath;
-			char         *p;
-
-			/* TRUE if the path *starts with* '$UPSTART_CGROUP' */
-			int           has_var = FALSE;
-			size_t        len;
-
-			/* Note that we don't support "${UPSTART_CGROUP}" */
-			p = strstr (cgname->name, UPSTART_CGROUP_SHELL_ENVVAR);
 
-			/* cgroup specifies UPSTART_CGROUP initially */
-			if (p && p == cgname->name)
-				has_var = TRUE;
-
-			cgname->expanded = environ_expand (cgname,
-						cgname->name,
+			cgname->expanded = cgroup_name_expand (cgname,
+						cgname,
 						cgroup_env);
 
 			if (! cgname->expanded)
 				return FALSE;
 
-			len = strlen (cgname->expanded);
-
-			/* Remap slash to underscore to avoid unexpected
-			 * sub-cgroup creation.
-			 */
-			cgroup_name_remap (has_var && len > strlen (UPSTART_CGROUP_SHELL_ENVVAR)
-					? cgname->expanded + strlen (UPSTART_CGROUP_SHELL_ENVVAR)
-					: cgname->expanded);
-
 			if (! strcmp (cgname->name, cgname->expanded)) {
 				/* expanded value is the same as the
 				 * original, so don't bother storing the
@@ -492,7 +2201,16 @@ cgroup_setup (NihList       *cgroups,
 
 			cgpath = cgname->expanded ? cgname->expanded : cgname->name;
 
-			if (! cgroup_create (cgroup->controller, cgpath))
+			record = cgroup_name_find_path (cgname, cgpath);
+			if (record && cgroup_settings_recorded (record,
+								&cgname->settings)) {
+				/* Created, configured and owned by an
+				 * earlier spawn.
+				 */
+				continue;
+			}
+
+			if (! record && ! cgroup_create (cgroup->controller, cgpath))
 				return FALSE;
 
 			if (! cgroup_settings_apply (cgroup->controller,
@@ -500,6 +2218,11 @@ cgroup_setup (NihList       *cgroups,
 						&cgname->settings))
 				return FALSE;
 
+			if (record) {
+				/* Already owned */
+				continue;
+			}
+
 			if ((uid == current_uid) && (gid == current_gid)) {
 				/* No need to chown */
 				continue;
@@ -552,6 +2275,7 @@ cgroup_name_new (void *parent, const char *name)
 	cgroup->expanded = NULL;
 
 	nih_list_init (&cgroup->settings);
+	nih_list_init (&cgroup->paths);
 
 	return cgroup;
 
@@ -574,6 +2298,7 @@ cgroup_name_serialise (CGroupName *name)
 {
 	json_object  *json;
 	json_object  *json_settings;
+	json_object  *json_paths;
 
 	nih_assert (name);
 
@@ -593,6 +2318,12 @@ cgroup_name_serialise (CGroupName *name)
 
 	json_object_object_add (json, "settings", json_settings);
 
+	json_paths = cgroup_name_serialise_all (&name->paths);
+	if (! json_paths)
+		goto error;
+
+	json_object_object_add (json, "paths", json_paths);
+
 	return json;
 
 error:
@@ -654,6 +2385,7 @@ cgroup_name_deserialise (void *parent, json_object *json)
 {
 	nih_local char  *name = NULL;
 	CGroupName      *cgname;
+	json_object     *json_paths;
 
 	nih_assert (json);
 
@@ -673,6 +2405,27 @@ cgroup_name_deserialise (void *parent, json_object *json)
 	if (cgroup_setting_deserialise_all (cgname, &cgname->settings, json) < 0)
 		goto error;
 
+	/* Records of created cgroups are optional */
+	if (json_object_object_get_ex (json, "paths", &json_paths)) {
+		if (! state_check_json_type (json_paths, array))
+			goto error;
+
+		for (int i = 0; i < json_object_array_length (json_paths); i++) {
+			json_object  *json_path;
+			CGroupName   *record;
+
+			json_path = json_object_array_get_idx (json_paths, i);
+			if (! json_path)
+				goto error;
+
+			record = cgroup_name_deserialise (cgname, json_path);
+			if (! record)
+				goto error;
+
+			nih_list_add (&cgname->paths, &record->entry);
+		}
+	}
+
 	return cgname;
 
 error:
@@ -929,6 +2682,59 @@ error:
 	return -1;
 }
 
+/**
+ * cgroup_fs_chown:
+ * @controller: cgroup controller,
+ * @path: relative cgroup path,
+ * @uid: user id to change ownership to,
+ * @gid: group id to change ownership to.
+ *
+ * Change the ownership of the directory of cgroup @path for @controller,
+ * and of the files within it that allow processes and sub-cgroups to be
+ * managed, as the cgroup manager does.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+static int
+cgroup_fs_chown (const char  *controller,
+		 const char  *path,
+		 uid_t        uid,
+		 gid_t        gid)
+{
+	static const char * const  files[] = {
+		"cgroup.procs",
+		"cgroup.subtree_control",
+		"cgroup.threads",
+		"tasks",
+		NULL
+	};
+	nih_local char            *dir = NULL;
+
+	nih_assert (controller);
+	nih_assert (path);
+
+	dir = cgroup_fs_dir (NULL, controller, path);
+	if (! dir)
+		return FALSE;
+
+	if (chown (dir, uid, gid) < 0)
+		nih_return_system_error (FALSE);
+
+	for (const char * const *file = files; *file; file++) {
+		nih_local char *filename = NULL;
+
+		filename = nih_sprintf (NULL, "%s/%s", dir, *file);
+		if (! filename)
+			nih_return_no_memory_error (FALSE);
+
+		/* Which files exist depends on the hierarchy */
+		if (chown (filename, uid, gid) < 0 && errno != ENOENT)
+			nih_return_system_error (FALSE);
+	}
+
+	return TRUE;
+}
+
 /**
  * cgroup_manager_available:
  *
@@ -1096,8 +2902,8 @@ cgroup_manager_disconnected (DBusConnection *connection)
  *
  *   "upstart/$UPSTART_JOB-$UPSTART_INSTANCE/$requested_path".
  *
- * Note: No validation is done on @path: that is handled by the CGroup
- * manager.
+ * Note: @path is validated by the cgroup manager, or by
+ * cgroup_fs_path_valid() when the cgroup filesystem is driven directly.
  *
  * Returns: TRUE on success, FALSE on raised error.
  **/
@@ -1110,6 +2916,10 @@ cgroup_create (const char *controller, const char *path)
 
 	nih_assert (controller);
 	nih_assert (path);
+
+	if (cgroup_fs_available ())
+		return cgroup_fs_create (controller, path);
+
 	nih_assert (cgroup_manager);
 
 	if (! user_mode) {
@@ -1162,6 +2972,19 @@ cgroup_enter (const char *controller, const char *path, pid_t pid)
 	nih_assert (path);
 	nih_assert (pid > 0);
 
+	if (cgroup_fs_available ()) {
+		nih_local char *dir = NULL;
+		char            value[32];
+
+		dir = cgroup_fs_dir (NULL, controller, path);
+		if (! dir)
+			return FALSE;
+
+		snprintf (value, sizeof (value), "%d", (int)pid);
+
+		return cgroup_fs_write (dir, "cgroup.procs", value);
+	}
+
 	nih_assert (cgroup_manager);
 
 	/* Move the pid into the appropriate cgroup */
@@ -1351,12 +3174,23 @@ cgroup_settings_apply (const char  *controller,
 		       const char  *path,
 		       NihList     *settings)
 {
+	nih_local char   *dir = NULL;
 	int               ret;
 
 	nih_assert (controller);
 	nih_assert (path);
 	nih_assert (settings);
-	nih_assert (cgroup_manager);
+
+	if (NIH_LIST_EMPTY (settings))
+		return TRUE;
+
+	if (cgroup_fs_available ()) {
+		dir = cgroup_fs_dir (NULL, controller, path);
+		if (! dir)
+			return FALSE;
+	} else {
+		nih_assert (cgroup_manager);
+	}
 
 	NIH_LIST_FOREACH (settings, iter) {
 		nih_local char *setting_key = NULL;
@@ -1369,6 +3203,13 @@ cgroup_settings_apply (const char  *controller,
 		if (! setting_key)
 			nih_return_no_memory_error (FALSE);
 
+		if (dir) {
+			if (! cgroup_fs_write (dir, setting_key,
+					       setting->value ? setting->value : ""))
+				return FALSE;
+			continue;
+		}
+
 		ret = cgmanager_set_value_sync (NULL,
 				cgroup_manager,
 				controller,
@@ -1398,8 +3239,8 @@ cgroup_enter_groups (NihList  *cgroups)
 	pid_t   pid;
 
 	nih_assert (cgroups);
-	nih_assert (cgroup_manager_address);
-	
+	nih_assert (cgroup_available ());
+
 	pid = getpid ();
 
 	if (! cgroup_support_enabled ())
@@ -1448,6 +3289,10 @@ cgroup_chown (const char  *controller,
 
 	nih_assert (controller);
 	nih_assert (path);
+
+	if (cgroup_fs_available ())
+		return cgroup_fs_chown (controller, path, uid, gid);
+
 	nih_assert (cgroup_manager);
 
 	/* Ask cgmanager to chown the path */
@@ -22,6 +22,8 @@
 #ifndef INIT_CGROUP_H
 #define INIT_CGROUP_H
 
+#include <stdint.h>
+
 #include <nih/hash.h>
 #include <json.h>
 
@@ -41,6 +43,47 @@
  **/
 #define UPSTART_CGROUP_ROOT "/"
 
+/**
+ * CGROUP_FS_ROOT:
+ *
+ * Directory below which the cgroup hierarchies are mounted.
+ **/
+#define CGROUP_FS_ROOT "/sys/fs/cgroup"
+
+/**
+ * UPSTART_CGROUP_PARENT:
+ *
+ * Name of the cgroup below which the job-unique cgroups given by
+ * UPSTART_CGROUP_ENVVAR are created.
+ **/
+#define UPSTART_CGROUP_PARENT "upstart"
+
+/**
+ * CGROUP_FS_SELF:
+ *
+ * File listing the cgroups of the calling process in each hierarchy.
+ **/
+#define CGROUP_FS_SELF "/proc/self/cgroup"
+
+/**
+ * CGROUP_FS_SCOPE:
+ *
+ * Name of the leaf cgroup a Session Init moves itself into, in the
+ * unified hierarchy, so that controllers may be enabled for the cgroup
+ * of the session; the kernel refuses that while it has processes of its
+ * own.
+ **/
+#define CGROUP_FS_SCOPE "init.scope"
+
+/**
+ * CGROUP_KILL_PASSES:
+ *
+ * Maximum number of times the processes of a cgroup are listed and sent
+ * SIGKILL, to catch those forked while it was being done, when the
+ * kernel cannot kill the cgroup as a whole.
+ **/
+#define CGROUP_KILL_PASSES 8
+
 /**
  * UPSTART_CGROUP_ENVVAR:
  *
@@ -56,6 +99,20 @@
  **/
 #define UPSTART_CGROUP_SHELL_ENVVAR "$" UPSTART_CGROUP_ENVVAR
 
+/**
+ * CGroupBackend:
+ *
+ * Means by which cgroups are created and processes placed in them.
+ *
+ * CGROUP_BACKEND_AUTO drives the cgroup filesystem directly once it
+ * is mounted, falling back to the cgroup manager until then.
+ **/
+typedef enum cgroup_backend {
+	CGROUP_BACKEND_AUTO,
+	CGROUP_BACKEND_CGMANAGER,
+	CGROUP_BACKEND_CGROUPFS,
+} CGroupBackend;
+
 /**
  * CGroupSetting:
  *
@@ -85,7 +142,10 @@ typedef struct cgroup_setting {
  * @name: name of cgroup,
  * @expanded: value of @name where all variables have been expanded
  *  (or NULL if expanded value is the same as @name),
- * @settings: list of CGroupSettings.
+ * @settings: list of CGroupSettings,
+ * @paths: list of CGroupName objects recording each cgroup created for
+ *  @name by an earlier spawn, named by its expanded path and holding the
+ *  settings last applied to it.
  *
  * Representation of a control group name.
  *
@@ -98,6 +158,7 @@ typedef struct cgroup_name {
 	char           *name;
 	char           *expanded;
 	NihList         settings;
+	NihList         paths;
 } CGroupName;
 
 /**
@@ -120,11 +181,29 @@ typedef struct cgroup {
 
 NIH_BEGIN_EXTERN
 
+extern CGroupBackend  cgroup_backend;
+extern const char    *cgroup_fs_root;
+extern const char    *cgroup_fs_self;
+
 void cgroup_init (void);
 
 int cgroup_support_enabled (void)
 	__attribute__ ((warn_unused_result));
 
+int cgroup_available (void)
+	__attribute__ ((warn_unused_result));
+
+int cgroup_backend_from_name (const char *name)
+	__attribute__ ((warn_unused_result));
+
+int cgroup_fs_available (void)
+	__attribute__ ((warn_unused_result));
+
+void cgroup_fs_reset (void);
+
+int cgroup_unified (const char *controller)
+	__attribute__ ((warn_unused_result));
+
 CGroupName *cgroup_name_new (void *parent, const char *name)
 	__attribute__ ((warn_unused_result));
 
@@ -174,6 +253,35 @@ int cgroup_manager_available (void)
 
 int cgroup_clear (NihList *cgroups);
 
+int cgroup_record (NihList *cgroups, char * const *env)
+	__attribute__ ((warn_unused_result));
+
+void cgroup_forget (NihList *cgroups);
+
+int cgroup_usage_read (NihList *cgroups, char * const *env,
+		uint64_t *cpu, uint64_t *memory,
+		uint64_t *io_read, uint64_t *io_write)
+	__attribute__ ((warn_unused_result));
+
+int cgroup_kill (NihList *cgroups, char * const *env,
+		int signum, pid_t pgid)
+	__attribute__ ((warn_unused_result));
+
+int cgroup_kill_all (void)
+	__attribute__ ((warn_unused_result));
+
+int cgroup_scope (void)
+	__attribute__ ((warn_unused_result));
+
+int cgroup_contains (NihList *cgroups, char * const *env, pid_t pid)
+	__attribute__ ((warn_unused_result));
+
+int cgroup_events_open (void)
+	__attribute__ ((warn_unused_result));
+
+int cgroup_events_populated (int fd)
+	__attribute__ ((warn_unused_result));
+
 int cgroup_setup (NihList *cgroups, char * const *env,
 		uid_t uid, gid_t gid)
 	__attribute__ ((warn_unused_result));
@@ -50,6 +50,7 @@
 #include "errors.h"
 #include "paths.h"
 #include "environ.h"
+#include "credentials.h"
 
 /* Prototypes for static functions */
 static int  conf_source_reload_file    (ConfSource *source)
@@ -484,6 +485,8 @@ conf_file_new (ConfSource *source,
  * is called by job_change_state()) and replaced by the "best" (newest)
  * JobClass.
  *
+ * Cached job process credentials are discarded too.
+ *
  * Any errors are logged through the usual mechanism, and not returned,
  * since some configuration may have been parsed; and it's possible to
  * parse no configuration without error.
@@ -493,6 +496,16 @@ conf_reload (void)
 {
 	conf_init ();
 
+	/* Jobs may have been reconfigured to run as users and groups that
+	 * have only just been created, by means we wouldn't notice.
+	 */
+	credentials_flush ();
+
+#ifdef ENABLE_CGROUPS
+	/* Likewise cgroups may have been changed or removed. */
+	job_class_cgroups_flush ();
+#endif /* ENABLE_CGROUPS */
+
 	NIH_LIST_FOREACH (conf_sources, iter) {
 		ConfSource *source = (ConfSource *)iter;
 
@@ -1225,6 +1238,13 @@ conf_reload_path (ConfSource *source,
 		case PARSE_ILLEGAL_NICE:
 		case PARSE_ILLEGAL_OOM:
 		case PARSE_ILLEGAL_LIMIT:
+		case PARSE_ILLEGAL_BACKOFF:
+		case PARSE_ILLEGAL_CONCURRENCY:
+		case PARSE_ILLEGAL_PRIORITY:
+		case PARSE_ILLEGAL_WEIGHT:
+		case PARSE_ILLEGAL_QUOTA:
+		case PARSE_ILLEGAL_SIZE:
+		case PARSE_ILLEGAL_CPUSET:
 		case PARSE_EXPECTED_EVENT:
 		case PARSE_EXPECTED_OPERATOR:
 		case PARSE_EXPECTED_VARIABLE:
@@ -2015,7 +2035,7 @@ debug_show_job (const Job *job)
 		stop_env = state_collapse_env ((const char **)job->stop_env);
 
 	if (job->stop_on)
-		stop_on = event_operator_collapse (job->stop_on);
+		stop_on = event_expr_collapse (job->stop_on->expr);
 
 	nih_debug ("Job %p: name=%s, class=%p (%s), path=%s, env='%s'"
 			"start_env='%s', stop_env='%s', stop_on='%s', "
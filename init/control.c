@@ -57,9 +57,14 @@
 #include "errors.h"
 #include "state.h"
 #include "event.h"
+#include "event_operator.h"
 #include "events.h"
 #include "paths.h"
 #include "xdg.h"
+#include "trace.h"
+#include "job_queue.h"
+#include "pressure.h"
+#include "usage.h"
 
 #include "com.ubuntu.Upstart.h"
 #include "org.freedesktop.DBus.h"
@@ -80,6 +85,10 @@ static int   control_check_permission    (NihDBusMessage *message)
 	__attribute__ ((warn_unused_result));
 static void  control_session_file_create (void);
 static void  control_session_file_remove (void);
+static int   control_emit                (NihDBusMessage *message,
+					  const char *name, char * const *env,
+					  int wait, int file, int priority)
+	__attribute__ ((warn_unused_result));
 
 /**
  * use_session_bus:
@@ -615,7 +624,7 @@ control_emit_event (void            *data,
 		    char * const    *env,
 		    int              wait)
 {
-	return control_emit_event_with_file (data, message, name, env, wait, -1);
+	return control_emit (message, name, env, wait, -1, FALSE);
 }
 
 /**
@@ -627,8 +636,59 @@ control_emit_event (void            *data,
  * @wait: whether to wait for event completion before returning,
  * @file: file descriptor.
  *
- * Implements the top half of the EmitEvent method of the com.ubuntu.Upstart
- * interface, the bottom half may be found in event_finished().
+ * Implements the EmitEventWithFile method of the com.ubuntu.Upstart
+ * interface, see control_emit().
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_emit_event_with_file (void            *data,
+			      NihDBusMessage  *message,
+			      const char      *name,
+			      char * const    *env,
+			      int              wait,
+			      int              file)
+{
+	return control_emit (message, name, env, wait, file, FALSE);
+}
+
+/**
+ * control_emit_event_with_priority:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @name: name of event to emit,
+ * @env: environment of environment,
+ * @wait: whether to wait for event completion before returning,
+ * @priority: whether the event should be handled before bulk events.
+ *
+ * Implements the EmitEventWithPriority method of the com.ubuntu.Upstart
+ * interface, see control_emit().
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_emit_event_with_priority (void            *data,
+				  NihDBusMessage  *message,
+				  const char      *name,
+				  char * const    *env,
+				  int              wait,
+				  int              priority)
+{
+	return control_emit (message, name, env, wait, -1, priority);
+}
+
+/**
+ * control_emit:
+ * @message: D-Bus connection and message received,
+ * @name: name of event to emit,
+ * @env: environment of environment,
+ * @wait: whether to wait for event completion before returning,
+ * @file: file descriptor,
+ * @priority: whether the event should be handled before bulk events.
+ *
+ * Implements the top half of the EmitEvent methods of the
+ * com.ubuntu.Upstart interface, the bottom half may be found in
+ * event_finished().
  *
  * Called to emit an event with a given @name and @env, which will be
  * added to the event queue and processed asynchronously.  If @name or
@@ -637,6 +697,16 @@ control_emit_event (void            *data,
  * com.ubuntu.Upstart.Error.EventFailed D-Bus error will be returned when
  * the event finishes.
  *
+ * Events emitted this way wait in the bulk lane, behind those emitted by
+ * the init daemon itself, unless @priority is TRUE or the event is
+ * administrative, see event_administrative().
+ *
+ * Once max_pending_events events are pending, or session_event_limit of
+ * those emitted from the same chroot session, event_overflow_policy is
+ * applied: the event may be merged into an identical pending event or
+ * make room by dropping the oldest bulk event nobody waits for, otherwise
+ * the com.ubuntu.Upstart.Error.EventQueueFull D-Bus error is returned.
+ *
  * When @wait is TRUE the method call will not return until the event
  * has completed, which means that all jobs affected by the event have
  * finished starting (running for tasks) or stopping; when @wait is FALSE,
@@ -644,16 +714,18 @@ control_emit_event (void            *data,
  *
  * Returns: zero on success, negative value on raised error.
  **/
-int
-control_emit_event_with_file (void            *data,
-			      NihDBusMessage  *message,
-			      const char      *name,
-			      char * const    *env,
-			      int              wait,
-			      int              file)
+static int
+control_emit (NihDBusMessage  *message,
+	      const char      *name,
+	      char * const    *env,
+	      int              wait,
+	      int              file,
+	      int              priority)
 {
 	Event    *event;
+	Event    *existing;
 	Blocked  *blocked;
+	Session  *session;
 
 	nih_assert (message != NULL);
 	nih_assert (name != NULL);
@@ -682,6 +754,44 @@ control_emit_event_with_file (void            *data,
 		return -1;
 	}
 
+	/* Obtain the session, which may not flood the queue */
+	session = session_from_dbus (NULL, message);
+
+	if (event_queue_full (session)) {
+		if (event_overflow (name, env, file, session, &existing) < 0) {
+			if (session)
+				session->events_refused++;
+
+			nih_dbus_error_raise_printf (
+				DBUS_INTERFACE_UPSTART ".Error.EventQueueFull",
+				_("Too many events pending"));
+			close (file);
+			return -1;
+		}
+
+		/* Coalesced into an identical event already pending, which
+		 * never has a file descriptor of its own.
+		 */
+		if (existing) {
+			if (wait) {
+				blocked = blocked_new (existing,
+						       BLOCKED_EMIT_METHOD,
+						       message);
+				if (! blocked) {
+					nih_error_raise_system ();
+					return -1;
+				}
+
+				nih_list_add (&existing->blocking,
+					      &blocked->entry);
+			} else {
+				NIH_ZERO (control_emit_event_reply (message));
+			}
+
+			return 0;
+		}
+	}
+
 	/* Make the event and block the message on it */
 	event = event_new (NULL, name, (char **)env);
 	if (! event) {
@@ -690,6 +800,11 @@ control_emit_event_with_file (void            *data,
 		return -1;
 	}
 
+	if (! priority && ! event_administrative (name))
+		event_set_lane (event, EVENT_LANE_BULK);
+
+	event_set_session (event, session);
+
 	event->fd = file;
 	if (event->fd >= 0) {
 		long flags;
@@ -699,9 +814,6 @@ control_emit_event_with_file (void            *data,
 		fcntl (event->fd, F_SETFD, flags);
 	}
 
-	/* Obtain the session */
-	event->session = session_from_dbus (NULL, message);
-
 	if (wait) {
 		blocked = blocked_new (event, BLOCKED_EMIT_METHOD, message);
 		if (! blocked) {
@@ -860,6 +972,629 @@ control_set_log_priority (void *          data,
 	return 0;
 }
 
+/**
+ * control_get_trace_events:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @value: pointer for reply value.
+ *
+ * Implements the get method for the trace_events property of the
+ * com.ubuntu.Upstart interface.
+ *
+ * Called to obtain whether event lifecycle records are being collected,
+ * which will be stored in @value.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_trace_events (void *          data,
+			  NihDBusMessage *message,
+			  int *           value)
+{
+	nih_assert (message != NULL);
+	nih_assert (value != NULL);
+
+	*value = trace_events;
+
+	return 0;
+}
+
+/**
+ * control_set_trace_events:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @value: TRUE to collect event lifecycle records.
+ *
+ * Implements the set method for the trace_events property of the
+ * com.ubuntu.Upstart interface.
+ *
+ * Called to enable or disable collection of event lifecycle records.
+ * Enabling tracing discards any records previously collected.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_set_trace_events (void *          data,
+			  NihDBusMessage *message,
+			  int             value)
+{
+	nih_assert (message != NULL);
+
+	if (! control_check_permission (message)) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("You do not have permission to set event tracing"));
+		return -1;
+	}
+
+	if (value && ! trace_events)
+		trace_events_clear ();
+
+	trace_events_enable (value);
+
+	return 0;
+}
+
+/**
+ * control_get_event_trace:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @records: pointer for array of event records,
+ * @histograms: pointer for array of per-event histograms.
+ *
+ * Implements the GetEventTrace method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to obtain the event lifecycle records collected while the
+ * trace_events property was set, and the latency histograms derived from
+ * them; see trace_events_records() and trace_events_histograms() for the
+ * format of each element.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_event_trace (void           *data,
+			 NihDBusMessage  *message,
+			 char          ***records,
+			 char          ***histograms)
+{
+	nih_assert (message != NULL);
+	nih_assert (records != NULL);
+	nih_assert (histograms != NULL);
+
+	if (! control_check_permission (message)) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("You do not have permission to request event trace"));
+		return -1;
+	}
+
+	*records = trace_events_records (message);
+	if (! *records)
+		nih_return_no_memory_error (-1);
+
+	*histograms = trace_events_histograms (message);
+	if (! *histograms)
+		nih_return_no_memory_error (-1);
+
+	return 0;
+}
+
+/**
+ * control_get_blame:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @blame: pointer for array of jobs.
+ *
+ * Implements the GetBlame method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to obtain the jobs that have reached the running state ordered
+ * by the time they took to get there, slowest first; see
+ * job_class_blame() for the format of each element.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_blame (void            *data,
+		   NihDBusMessage  *message,
+		   char          ***blame)
+{
+	nih_assert (message != NULL);
+	nih_assert (blame != NULL);
+
+	*blame = job_class_blame (message);
+	if (! *blame)
+		nih_return_no_memory_error (-1);
+
+	return 0;
+}
+
+/**
+ * control_get_critical_chain:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @name: name of job,
+ * @chain: pointer for array of jobs.
+ *
+ * Implements the GetCriticalChain method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to obtain the chain of jobs whose events caused the job named
+ * @name to be started, see job_class_critical_chain() for the format of
+ * each element.  If no job class with that name exists, the
+ * com.ubuntu.Upstart.Error.UnknownJob D-Bus error will be raised.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_critical_chain (void            *data,
+			    NihDBusMessage  *message,
+			    const char      *name,
+			    char          ***chain)
+{
+	Session  *session;
+	JobClass *class;
+
+	nih_assert (message != NULL);
+	nih_assert (name != NULL);
+	nih_assert (chain != NULL);
+
+	if (! strlen (name)) {
+		nih_dbus_error_raise_printf (DBUS_ERROR_INVALID_ARGS,
+					     _("Name may not be empty string"));
+		return -1;
+	}
+
+	session = session_from_dbus (NULL, message);
+
+	class = job_class_get_registered (name, session);
+	if (! class && session && ! session->chroot)
+		class = job_class_get_registered (name, NULL);
+
+	if (! class) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.UnknownJob",
+			_("Unknown job: %s"), name);
+		return -1;
+	}
+
+	*chain = job_class_critical_chain (message, class);
+	if (! *chain)
+		nih_return_no_memory_error (-1);
+
+	return 0;
+}
+
+/**
+ * control_get_max_concurrent_spawns:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @value: pointer for reply value.
+ *
+ * Implements the get method for the max_concurrent_spawns property of
+ * the com.ubuntu.Upstart interface.
+ *
+ * Called to obtain the maximum number of jobs that may be starting at
+ * once, or zero if there is no limit, which will be stored in @value.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_max_concurrent_spawns (void           *data,
+				   NihDBusMessage *message,
+				   int32_t        *value)
+{
+	nih_assert (message != NULL);
+	nih_assert (value != NULL);
+
+	*value = max_concurrent_spawns;
+
+	return 0;
+}
+
+/**
+ * control_set_max_concurrent_spawns:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @value: new limit.
+ *
+ * Implements the set method for the max_concurrent_spawns property of
+ * the com.ubuntu.Upstart interface.
+ *
+ * Called to change the maximum number of jobs that may be starting at
+ * once; zero removes the limit.  Raising the limit starts queued jobs.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_set_max_concurrent_spawns (void           *data,
+				   NihDBusMessage *message,
+				   int32_t         value)
+{
+	nih_assert (message != NULL);
+
+	if (! control_check_permission (message)) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("You do not have permission to set the spawn limit"));
+		return -1;
+	}
+
+	if (value < 0) {
+		nih_dbus_error_raise_printf (DBUS_ERROR_INVALID_ARGS,
+					     _("Spawn limit may not be negative"));
+		return -1;
+	}
+
+	job_queue_set_limit (value);
+
+	return 0;
+}
+
+/**
+ * control_get_spawn_queue:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @jobs: pointer for array of queued jobs,
+ * @spawning: pointer for number of jobs starting,
+ * @longest_wait: pointer for longest wait.
+ *
+ * Implements the GetSpawnQueue method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to obtain the jobs waiting for a spawn slot, in the order they
+ * will be started, see job_queue_jobs() for the format of each element;
+ * the number of jobs that hold a spawn slot; and the longest time, in
+ * microseconds, that any job has waited.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_spawn_queue (void           *data,
+			 NihDBusMessage  *message,
+			 char          ***jobs,
+			 int32_t         *spawning,
+			 int64_t         *longest_wait)
+{
+	nih_assert (message != NULL);
+	nih_assert (jobs != NULL);
+	nih_assert (spawning != NULL);
+	nih_assert (longest_wait != NULL);
+
+	*jobs = job_queue_jobs (message);
+	if (! *jobs)
+		nih_return_no_memory_error (-1);
+
+	*spawning = job_queue_spawning ();
+	*longest_wait = (int64_t)job_queue_longest_wait ();
+
+	return 0;
+}
+
+/**
+ * control_get_event_queue:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @priority_depth: pointer for number of pending priority events,
+ * @bulk_depth: pointer for number of pending bulk events,
+ * @priority_peak: pointer for largest number of pending priority events,
+ * @bulk_peak: pointer for largest number of pending bulk events,
+ * @priority_handled: pointer for number of priority events handled,
+ * @bulk_handled: pointer for number of bulk events handled,
+ * @yielded: pointer for number of bulk events handled first.
+ *
+ * Implements the GetEventQueue method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to obtain the number of events pending in each lane of the
+ * event queue, the largest number that have been, the number handled
+ * from each, and the number of bulk events handled ahead of waiting
+ * priority events so that the bulk lane was not starved.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_event_queue (void           *data,
+			 NihDBusMessage *message,
+			 uint32_t       *priority_depth,
+			 uint32_t       *bulk_depth,
+			 uint32_t       *priority_peak,
+			 uint32_t       *bulk_peak,
+			 uint32_t       *priority_handled,
+			 uint32_t       *bulk_handled,
+			 uint32_t       *yielded)
+{
+	nih_assert (message != NULL);
+	nih_assert (priority_depth != NULL);
+	nih_assert (bulk_depth != NULL);
+	nih_assert (priority_peak != NULL);
+	nih_assert (bulk_peak != NULL);
+	nih_assert (priority_handled != NULL);
+	nih_assert (bulk_handled != NULL);
+	nih_assert (yielded != NULL);
+
+	*priority_depth = event_lane_depth[EVENT_LANE_PRIORITY];
+	*bulk_depth = event_lane_depth[EVENT_LANE_BULK];
+
+	*priority_peak = event_lane_peak[EVENT_LANE_PRIORITY];
+	*bulk_peak = event_lane_peak[EVENT_LANE_BULK];
+
+	*priority_handled = event_lane_handled[EVENT_LANE_PRIORITY];
+	*bulk_handled = event_lane_handled[EVENT_LANE_BULK];
+
+	*yielded = event_lane_yielded;
+
+	return 0;
+}
+
+/**
+ * control_get_event_overflow:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @limit: pointer for maximum number of pending events,
+ * @policy: pointer for reply string,
+ * @rejected: pointer for number of events refused,
+ * @dropped: pointer for number of pending events dropped,
+ * @coalesced: pointer for number of events coalesced.
+ *
+ * Implements the GetEventOverflow method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to obtain the number of pending events at which the event queue
+ * is full, what is done with events emitted while it is, and counts of
+ * the overflows so far.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_event_overflow (void           *data,
+			    NihDBusMessage *message,
+			    int32_t        *limit,
+			    char          **policy,
+			    uint32_t       *rejected,
+			    uint32_t       *dropped,
+			    uint32_t       *coalesced)
+{
+	nih_assert (message != NULL);
+	nih_assert (limit != NULL);
+	nih_assert (policy != NULL);
+	nih_assert (rejected != NULL);
+	nih_assert (dropped != NULL);
+	nih_assert (coalesced != NULL);
+
+	*policy = nih_strdup (message,
+			      event_overflow_name (event_overflow_policy));
+	if (! *policy)
+		nih_return_no_memory_error (-1);
+
+	*limit = max_pending_events;
+
+	*rejected = event_overflow_rejected;
+	*dropped = event_overflow_dropped;
+	*coalesced = event_overflow_coalesced;
+
+	return 0;
+}
+
+/**
+ * control_get_session_events:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @events: pointer for array of session event counts.
+ *
+ * Implements the GetSessionEvents method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to obtain, for each chroot session, the number of its events
+ * pending and handled and the number refused because the event queue
+ * was full, followed by the path of the chroot.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_session_events (void            *data,
+			    NihDBusMessage  *message,
+			    char          ***events)
+{
+	char   **list;
+	size_t   len = 0;
+
+	nih_assert (message != NULL);
+	nih_assert (events != NULL);
+
+	session_init ();
+
+	list = nih_str_array_new (message);
+	if (! list)
+		nih_return_no_memory_error (-1);
+
+	NIH_LIST_FOREACH (sessions, iter) {
+		Session *session = (Session *)iter;
+		char    *line;
+
+		line = nih_sprintf (NULL, "%u %u %u %s",
+				    session->events_pending,
+				    session->events_handled,
+				    session->events_refused,
+				    session->chroot);
+		if (! line)
+			goto error;
+
+		if (! nih_str_array_addp (&list, message, &len, line)) {
+			nih_free (line);
+			goto error;
+		}
+	}
+
+	*events = list;
+
+	return 0;
+
+error:
+	nih_free (list);
+	nih_return_no_memory_error (-1);
+}
+
+/**
+ * control_get_event_pools:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @pools: pointer for array of pool occupancy.
+ *
+ * Implements the GetEventPools method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to obtain, for each pool of structures made and released while
+ * handling events, the number in use, the largest number that have been,
+ * the number kept for reuse and the number reused rather than allocated,
+ * followed by the name of the pool.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_event_pools (void            *data,
+			 NihDBusMessage  *message,
+			 char          ***pools)
+{
+	const struct {
+		const char   *name;
+		unsigned int  in_use;
+		unsigned int  peak;
+		unsigned int  pooled;
+		unsigned int  reused;
+	} counts[] = {
+		{ "blocked", blocked_in_use, blocked_peak,
+		  blocked_pooled, blocked_reused },
+		{ "collapse", event_operator_scratch_in_use,
+		  event_operator_scratch_peak,
+		  event_operator_scratch_pooled,
+		  event_operator_scratch_reused },
+	};
+	char   **list;
+	size_t   len = 0;
+
+	nih_assert (message != NULL);
+	nih_assert (pools != NULL);
+
+	list = nih_str_array_new (message);
+	if (! list)
+		nih_return_no_memory_error (-1);
+
+	for (size_t i = 0; i < sizeof (counts) / sizeof (counts[0]); i++) {
+		char *line;
+
+		line = nih_sprintf (NULL, "%u %u %u %u %s",
+				    counts[i].in_use, counts[i].peak,
+				    counts[i].pooled, counts[i].reused,
+				    counts[i].name);
+		if (! line)
+			goto error;
+
+		if (! nih_str_array_addp (&list, message, &len, line)) {
+			nih_free (line);
+			goto error;
+		}
+	}
+
+	*pools = list;
+
+	return 0;
+
+error:
+	nih_free (list);
+	nih_return_no_memory_error (-1);
+}
+
+/**
+ * control_get_pressure:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @cpu: pointer for cpu pressure,
+ * @memory: pointer for memory pressure,
+ * @io: pointer for io pressure,
+ * @threshold: pointer for pressure threshold,
+ * @deferred: pointer for number of jobs deferred,
+ * @relieved: pointer for number admitted once pressure was relieved,
+ * @expired: pointer for number admitted once their delay expired.
+ *
+ * Implements the GetPressure method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to obtain the current ten second pressure average of each
+ * resource as a percentage, or a negative value where not known; the
+ * threshold above which jobs that defer under pressure are held back;
+ * and counts of the admission decisions made for such jobs.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_pressure (void           *data,
+		      NihDBusMessage *message,
+		      double         *cpu,
+		      double         *memory,
+		      double         *io,
+		      int32_t        *threshold,
+		      uint32_t       *deferred,
+		      uint32_t       *relieved,
+		      uint32_t       *expired)
+{
+	nih_assert (message != NULL);
+	nih_assert (cpu != NULL);
+	nih_assert (memory != NULL);
+	nih_assert (io != NULL);
+	nih_assert (threshold != NULL);
+	nih_assert (deferred != NULL);
+	nih_assert (relieved != NULL);
+	nih_assert (expired != NULL);
+
+	*cpu = pressure_level (PRESSURE_CPU);
+	*memory = pressure_level (PRESSURE_MEMORY);
+	*io = pressure_level (PRESSURE_IO);
+
+	*threshold = pressure_threshold;
+
+	*deferred = pressure_deferred;
+	*relieved = pressure_relieved;
+	*expired = pressure_expired;
+
+	return 0;
+}
+
+/**
+ * control_get_job_usage:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @usage: pointer for array of job usage,
+ * @window: pointer for shortest sampling window.
+ *
+ * Implements the GetJobUsage method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to obtain the resource usage of every running job that has
+ * cgroups, see usage_jobs() for the format of each element, and the
+ * shortest period, in microseconds, over which the rates given were
+ * computed.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_job_usage (void            *data,
+		       NihDBusMessage  *message,
+		       char          ***usage,
+		       int64_t         *window)
+{
+	nih_assert (message != NULL);
+	nih_assert (usage != NULL);
+	nih_assert (window != NULL);
+
+	*usage = usage_jobs (message, window);
+	if (! *usage)
+		nih_return_no_memory_error (-1);
+
+	return 0;
+}
+
 /**
  * control_get_bus_type:
  *
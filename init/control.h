@@ -22,6 +22,8 @@
 
 #include <dbus/dbus.h>
 
+#include <stdint.h>
+
 #include <nih/macros.h>
 #include <nih/list.h>
 
@@ -123,6 +125,10 @@ int  control_emit_event_with_file (void *data, NihDBusMessage *message,
 				   const char *name, char * const *env,
 				   int wait, int file)
 	__attribute__ ((warn_unused_result));
+int  control_emit_event_with_priority (void *data, NihDBusMessage *message,
+				       const char *name, char * const *env,
+				       int wait, int priority)
+	__attribute__ ((warn_unused_result));
 
 int  control_get_version          (void *data, NihDBusMessage *message,
 				   char **version)
@@ -135,6 +141,70 @@ int  control_set_log_priority     (void *data, NihDBusMessage *message,
 				   const char *log_priority)
 	__attribute__ ((warn_unused_result));
 
+int  control_get_trace_events     (void *data, NihDBusMessage *message,
+				   int *value)
+	__attribute__ ((warn_unused_result));
+int  control_set_trace_events     (void *data, NihDBusMessage *message,
+				   int value)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_event_trace      (void *data, NihDBusMessage *message,
+				   char ***records, char ***histograms)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_blame            (void *data, NihDBusMessage *message,
+				   char ***blame)
+	__attribute__ ((warn_unused_result));
+int  control_get_critical_chain   (void *data, NihDBusMessage *message,
+				   const char *name, char ***chain)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_max_concurrent_spawns (void *data, NihDBusMessage *message,
+					int32_t *value)
+	__attribute__ ((warn_unused_result));
+int  control_set_max_concurrent_spawns (void *data, NihDBusMessage *message,
+					int32_t value)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_spawn_queue      (void *data, NihDBusMessage *message,
+				   char ***jobs, int32_t *spawning,
+				   int64_t *longest_wait)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_event_queue      (void *data, NihDBusMessage *message,
+				   uint32_t *priority_depth,
+				   uint32_t *bulk_depth,
+				   uint32_t *priority_peak,
+				   uint32_t *bulk_peak,
+				   uint32_t *priority_handled,
+				   uint32_t *bulk_handled,
+				   uint32_t *yielded)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_event_overflow   (void *data, NihDBusMessage *message,
+				   int32_t *limit, char **policy,
+				   uint32_t *rejected, uint32_t *dropped,
+				   uint32_t *coalesced)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_session_events   (void *data, NihDBusMessage *message,
+				   char ***events)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_event_pools      (void *data, NihDBusMessage *message,
+				   char ***pools)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_pressure         (void *data, NihDBusMessage *message,
+				   double *cpu, double *memory, double *io,
+				   int32_t *threshold, uint32_t *deferred,
+				   uint32_t *relieved, uint32_t *expired)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_job_usage        (void *data, NihDBusMessage *message,
+				   char ***usage, int64_t *window)
+	__attribute__ ((warn_unused_result));
+
 DBusBusType control_get_bus_type (void)
 	__attribute__ ((warn_unused_result));
 
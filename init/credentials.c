@@ -0,0 +1,320 @@
+/* upstart
+ *
+ * credentials.c - cache of job process credentials
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <grp.h>
+#include <pwd.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/logging.h>
+
+#include "credentials.h"
+
+
+/* Prototypes for static functions */
+static int          credentials_changed (const char *path,
+					 struct stat *saved);
+static Credentials *credentials_resolve (const char *key, const char *user,
+					 const char *group)
+	__attribute__ ((warn_unused_result, malloc));
+
+
+/**
+ * credentials:
+ *
+ * Hash table of looked up credentials, indexed by user and group names.
+ **/
+static NihHash *credentials = NULL;
+
+/**
+ * credentials_passwd:
+ *
+ * Status of CREDENTIALS_PASSWD when credentials were last looked up.
+ **/
+static struct stat credentials_passwd;
+
+/**
+ * credentials_group:
+ *
+ * Status of CREDENTIALS_GROUP when credentials were last looked up.
+ **/
+static struct stat credentials_group;
+
+
+/**
+ * credentials_init:
+ *
+ * Initialise the credentials cache.
+ **/
+static void
+credentials_init (void)
+{
+	if (! credentials)
+		credentials = NIH_MUST (nih_hash_string_new (NULL, 0));
+}
+
+
+/**
+ * credentials_lookup:
+ * @user: name of user, or NULL,
+ * @group: name of group, or NULL.
+ *
+ * Look up the numeric credentials a job process with the setuid stanza
+ * @user and setgid stanza @group should run as, exactly as the process
+ * would itself: the user and group ids, and when we are running as root
+ * the supplementary groups that initgroups() would set.
+ *
+ * Credentials are cached for CREDENTIALS_TTL seconds, or until either of
+ * CREDENTIALS_PASSWD or CREDENTIALS_GROUP changes, so that spawning each
+ * process of a job doesn't cost a trip through NSS.
+ *
+ * The returned credentials belong to the cache and remain valid only
+ * until the next call to this function or to credentials_flush().
+ *
+ * Returns: credentials or NULL if any lookup failed or insufficient
+ * memory, in which case the caller should look up the credentials itself
+ * to report the error.
+ **/
+const Credentials *
+credentials_lookup (const char *user,
+		    const char *group)
+{
+	nih_local char  *key = NULL;
+	Credentials     *creds;
+	struct timespec  now;
+	int              changed;
+
+	credentials_init ();
+
+	changed = credentials_changed (CREDENTIALS_PASSWD,
+				       &credentials_passwd);
+	if (credentials_changed (CREDENTIALS_GROUP, &credentials_group))
+		changed = TRUE;
+
+	if (changed)
+		credentials_flush ();
+
+	key = nih_sprintf (NULL, "%s:%s", user ? user : "",
+			   group ? group : "");
+	if (! key)
+		return NULL;
+
+	if (clock_gettime (CLOCK_MONOTONIC, &now) < 0)
+		return NULL;
+
+	creds = (Credentials *)nih_hash_lookup (credentials, key);
+	if (creds) {
+		if (creds->expires > now.tv_sec)
+			return creds;
+
+		nih_free (creds);
+	}
+
+	creds = credentials_resolve (key, user, group);
+	if (! creds)
+		return NULL;
+
+	creds->expires = now.tv_sec + CREDENTIALS_TTL;
+	nih_hash_add (credentials, &creds->entry);
+
+	return creds;
+}
+
+/**
+ * credentials_flush:
+ *
+ * Discard all cached credentials, for example because the user or group
+ * databases have changed.
+ **/
+void
+credentials_flush (void)
+{
+	if (! credentials)
+		return;
+
+	NIH_HASH_FOREACH_SAFE (credentials, iter) {
+		Credentials *creds = (Credentials *)iter;
+
+		nih_free (creds);
+	}
+}
+
+
+/**
+ * credentials_changed:
+ * @path: file to check,
+ * @saved: status of @path when last checked.
+ *
+ * Check whether @path has been changed, or replaced, since its status was
+ * saved in @saved, and save its current status there.
+ *
+ * Returns: TRUE if @path has changed, FALSE otherwise.
+ **/
+static int
+credentials_changed (const char  *path,
+		     struct stat *saved)
+{
+	struct stat statbuf;
+
+	nih_assert (path != NULL);
+	nih_assert (saved != NULL);
+
+	if (stat (path, &statbuf) < 0)
+		memset (&statbuf, 0, sizeof (statbuf));
+
+	if ((statbuf.st_dev == saved->st_dev)
+	    && (statbuf.st_ino == saved->st_ino)
+	    && (statbuf.st_size == saved->st_size)
+	    && (statbuf.st_mtim.tv_sec == saved->st_mtim.tv_sec)
+	    && (statbuf.st_mtim.tv_nsec == saved->st_mtim.tv_nsec))
+		return FALSE;
+
+	*saved = statbuf;
+
+	return TRUE;
+}
+
+/**
+ * credentials_resolve:
+ * @key: cache key,
+ * @user: name of user, or NULL,
+ * @group: name of group, or NULL.
+ *
+ * Look up the credentials for @user and @group, see credentials_lookup().
+ *
+ * Returns: newly allocated credentials or NULL if any lookup failed or
+ * insufficient memory.
+ **/
+static Credentials *
+credentials_resolve (const char *key,
+		     const char *user,
+		     const char *group)
+{
+	Credentials   *creds;
+	struct passwd *pwd = NULL;
+	struct group  *grp = NULL;
+	int            ngroups = 32;
+
+	nih_assert (key != NULL);
+
+	creds = nih_new (NULL, Credentials);
+	if (! creds)
+		return NULL;
+
+	nih_list_init (&creds->entry);
+	nih_alloc_set_destructor (creds, nih_list_destroy);
+
+	creds->uid = (uid_t)-1;
+	creds->gid = (gid_t)-1;
+	creds->groups = NULL;
+	creds->ngroups = 0;
+
+	creds->key = nih_strdup (creds, key);
+	if (! creds->key)
+		goto error;
+
+	if (user) {
+		errno = 0;
+		pwd = getpwnam (user);
+		if (! pwd) {
+			nih_debug ("Unable to look up user %s: %s", user,
+				   errno ? strerror (errno) : "not found");
+			goto error;
+		}
+
+		creds->uid = pwd->pw_uid;
+		/* This will be overridden if group is also set: */
+		creds->gid = pwd->pw_gid;
+	}
+
+	if (group) {
+		errno = 0;
+		grp = getgrnam (group);
+		if (! grp) {
+			nih_debug ("Unable to look up group %s: %s", group,
+				   errno ? strerror (errno) : "not found");
+			goto error;
+		}
+
+		creds->gid = grp->gr_gid;
+	}
+
+	/* initgroups() only works as root; it's the same as setgroups()
+	 * on the list getgrouplist() returns.
+	 */
+	if (geteuid () != 0)
+		return creds;
+
+	if (! pwd) {
+		pwd = getpwuid (geteuid ());
+		if (! pwd)
+			goto error;
+	}
+
+	if (! grp) {
+		grp = getgrgid (getegid ());
+		if (! grp)
+			goto error;
+	}
+
+	for (;;) {
+		int n = ngroups;
+
+		creds->groups = nih_realloc (creds->groups, creds,
+					     sizeof (gid_t) * ngroups);
+		if (! creds->groups)
+			goto error;
+
+		if (getgrouplist (pwd->pw_name, grp->gr_gid,
+				  creds->groups, &n) >= 0) {
+			creds->ngroups = n;
+			break;
+		}
+
+		if (n <= ngroups)
+			goto error;
+
+		ngroups = n;
+	}
+
+	nih_debug ("Looked up credentials for %s: uid %d gid %d, %zu groups",
+		   key, (int)creds->uid, (int)creds->gid, creds->ngroups);
+
+	return creds;
+
+error:
+	nih_free (creds);
+	return NULL;
+}
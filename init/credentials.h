@@ -0,0 +1,87 @@
+/* upstart
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_CREDENTIALS_H
+#define INIT_CREDENTIALS_H
+
+#include <sys/types.h>
+
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/list.h>
+
+
+/**
+ * CREDENTIALS_TTL:
+ *
+ * Seconds for which looked up credentials are used before being looked
+ * up again, in case they come from a source other than the files whose
+ * changes we notice.
+ **/
+#define CREDENTIALS_TTL 60
+
+/**
+ * CREDENTIALS_PASSWD:
+ *
+ * File whose change invalidates all cached credentials.
+ **/
+#define CREDENTIALS_PASSWD "/etc/passwd"
+
+/**
+ * CREDENTIALS_GROUP:
+ *
+ * File whose change invalidates all cached credentials.
+ **/
+#define CREDENTIALS_GROUP "/etc/group"
+
+
+/**
+ * Credentials:
+ * @entry: list header,
+ * @key: user and group names @entry was looked up for,
+ * @expires: monotonic time after which @entry is looked up again,
+ * @uid: user to switch to or -1,
+ * @gid: group to switch to or -1,
+ * @groups: supplementary groups to set, or NULL if not running as root,
+ * @ngroups: number of entries in @groups.
+ *
+ * Numeric credentials for a job process, as looked up from the user and
+ * group names of its class.
+ **/
+typedef struct credentials {
+	NihList  entry;
+	char    *key;
+
+	time_t   expires;
+
+	uid_t    uid;
+	gid_t    gid;
+	gid_t   *groups;
+	size_t   ngroups;
+} Credentials;
+
+
+NIH_BEGIN_EXTERN
+
+const Credentials *credentials_lookup (const char *user, const char *group);
+void               credentials_flush  (void);
+
+NIH_END_EXTERN
+
+#endif /* INIT_CREDENTIALS_H */
@@ -47,6 +47,13 @@ enum {
 	PARSE_ILLEGAL_NICE,
 	PARSE_ILLEGAL_OOM,
 	PARSE_ILLEGAL_LIMIT,
+	PARSE_ILLEGAL_BACKOFF,
+	PARSE_ILLEGAL_CONCURRENCY,
+	PARSE_ILLEGAL_PRIORITY,
+	PARSE_ILLEGAL_WEIGHT,
+	PARSE_ILLEGAL_QUOTA,
+	PARSE_ILLEGAL_SIZE,
+	PARSE_ILLEGAL_CPUSET,
 	PARSE_EXPECTED_EVENT,
 	PARSE_EXPECTED_OPERATOR,
 	PARSE_EXPECTED_VARIABLE,
@@ -75,6 +82,13 @@ enum {
 #define PARSE_ILLEGAL_OOM_STR		N_("Illegal oom adjustment, expected -16 to 15 or 'never'")
 #define PARSE_ILLEGAL_OOM_SCORE_STR	N_("Illegal oom score adjustment, expected -999 to 1000 or 'never'")
 #define PARSE_ILLEGAL_LIMIT_STR		N_("Illegal limit, expected 'unlimited' or integer")
+#define PARSE_ILLEGAL_BACKOFF_STR	N_("Illegal backoff factor, expected positive integer")
+#define PARSE_ILLEGAL_CONCURRENCY_STR	N_("Illegal concurrency limit, expected positive integer")
+#define PARSE_ILLEGAL_PRIORITY_STR	N_("Illegal priority, expected integer")
+#define PARSE_ILLEGAL_WEIGHT_STR	N_("Illegal weight, expected 1 to 10000")
+#define PARSE_ILLEGAL_QUOTA_STR		N_("Illegal CPU quota, expected positive percentage")
+#define PARSE_ILLEGAL_SIZE_STR		N_("Illegal size, expected 'unlimited' or positive integer with optional K, M, G or T suffix")
+#define PARSE_ILLEGAL_CPUSET_STR	N_("Illegal list, expected numbers and ranges separated by commas")
 #define PARSE_EXPECTED_EVENT_STR	N_("Expected event")
 #define PARSE_EXPECTED_OPERATOR_STR	N_("Expected operator")
 #define PARSE_EXPECTED_VARIABLE_STR	N_("Expected variable name before value")
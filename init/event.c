@@ -40,11 +40,14 @@
 
 #include "environ.h"
 #include "event.h"
+#include "events.h"
+#include "intern.h"
 #include "job.h"
 #include "blocked.h"
 #include "control.h"
 #include "errors.h"
 #include "quiesce.h"
+#include "trace.h"
 
 #include "com.ubuntu.Upstart.h"
 
@@ -53,9 +56,26 @@
 #endif /* ENABLE_CGROUPS */
 
 /* Prototypes for static functions */
+static int  event_destroy              (Event *event);
+static void event_dequeue              (Event *event);
+static int  event_lane_wait            (Event *event)
+	__attribute__ ((warn_unused_result));
+static void event_lane_leave           (Event *event);
+static void event_session_credit       (void);
+static int  event_session_wait         (Event *event)
+	__attribute__ ((warn_unused_result));
 static void event_pending              (Event *event);
 static void event_pending_handle_jobs  (Event *event);
+static int  event_pending_handle_class (Event *event, JobClass *class,
+					NihList *starting, int *warn)
+	__attribute__ ((warn_unused_result));
 static void event_finished             (Event *event);
+static Event *event_overflow_duplicate (const char *name, char * const *env,
+					const Session *session)
+	__attribute__ ((warn_unused_result));
+static Event *event_overflow_victim    (const Session *session)
+	__attribute__ ((warn_unused_result));
+static void event_overflow_warn        (const char *action, const char *name);
 
 static const char * event_progress_enum_to_str (EventProgress progress)
 	__attribute__ ((warn_unused_result));
@@ -64,6 +84,13 @@ static EventProgress
 event_progress_str_to_enum (const char *name)
 	__attribute__ ((warn_unused_result));
 
+static const char * event_lane_enum_to_str (EventLane lane)
+	__attribute__ ((warn_unused_result));
+
+static EventLane
+event_lane_str_to_enum (const char *name)
+	__attribute__ ((warn_unused_result));
+
 extern json_object *json_events;
 
 /**
@@ -74,6 +101,92 @@ extern json_object *json_events;
  **/
 NihList *events = NULL;
 
+/**
+ * event_lane_depth:
+ *
+ * Number of pending events waiting in each lane.
+ **/
+unsigned int event_lane_depth[EVENT_LANE_LAST] = { 0 };
+
+/**
+ * event_lane_peak:
+ *
+ * Largest number of pending events that have waited in each lane at once.
+ **/
+unsigned int event_lane_peak[EVENT_LANE_LAST] = { 0 };
+
+/**
+ * event_lane_handled:
+ *
+ * Number of events from each lane that have been handled.
+ **/
+unsigned int event_lane_handled[EVENT_LANE_LAST] = { 0 };
+
+/**
+ * event_lane_yielded:
+ *
+ * Number of bulk events handled ahead of waiting priority events so that
+ * the bulk lane is not starved, see EVENT_PRIORITY_BURST.
+ **/
+unsigned int event_lane_yielded = 0;
+
+/**
+ * event_priority_run:
+ *
+ * Number of priority events handled in a row while bulk events waited.
+ **/
+static unsigned int event_priority_run = 0;
+
+/**
+ * max_pending_events:
+ *
+ * Maximum number of events that may be pending before further events
+ * emitted over D-Bus overflow the queue, or zero for no limit.
+ **/
+int max_pending_events = 0;
+
+/**
+ * event_overflow_policy:
+ *
+ * What is done with an event emitted while the queue is full.
+ **/
+EventOverflow event_overflow_policy = EVENT_OVERFLOW_REJECT;
+
+/**
+ * event_overflow_rejected:
+ *
+ * Number of events refused because the queue was full.
+ **/
+unsigned int event_overflow_rejected = 0;
+
+/**
+ * event_overflow_dropped:
+ *
+ * Number of pending events dropped to make room for newer ones.
+ **/
+unsigned int event_overflow_dropped = 0;
+
+/**
+ * event_overflow_coalesced:
+ *
+ * Number of events merged into an identical pending event.
+ **/
+unsigned int event_overflow_coalesced = 0;
+
+/**
+ * event_overflow_warned:
+ *
+ * Time, in microseconds, of the last warning that the queue overflowed.
+ **/
+static unsigned long long event_overflow_warned = 0;
+
+/**
+ * event_overflow_suppressed:
+ *
+ * Number of overflows since the last warning that were not warned of.
+ **/
+static unsigned int event_overflow_suppressed = 0;
+
 
 /**
  * event_init:
@@ -95,7 +208,8 @@ event_init (void)
  * @env: NULL-terminated array of environment variables for event.
  *
  * Allocates an Event structure for the event details given and
- * appends it to the queue of events.
+ * appends it to the queue of events, in the priority lane; events that
+ * may arrive in bulk should be moved with event_set_lane().
  *
  * @env is optional, and may be NULL; if given it should be a NULL-terminated
  * array of environment variables in KEY=VALUE form.  @env will be referenced
@@ -141,16 +255,25 @@ event_new (const void  *parent,
 	event->fd = -1;
 
 	event->progress = EVENT_PENDING;
+	event->lane = EVENT_LANE_PRIORITY;
 	event->failed = FALSE;
 
 	event->blockers = 0;
 	nih_list_init (&event->blocking);
 
-	nih_alloc_set_destructor (event, nih_list_destroy);
+	memset (&event->trace, 0, sizeof (event->trace));
+	if (trace_events)
+		event->trace.pending = trace_now ();
+
+	event_lane_depth[event->lane]++;
+	if (event_lane_depth[event->lane] > event_lane_peak[event->lane])
+		event_lane_peak[event->lane] = event_lane_depth[event->lane];
+
+	nih_alloc_set_destructor (event, event_destroy);
 
 
 	/* Fill in the event details */
-	event->name = nih_strdup (event, name);
+	event->name = intern_string (event, name);
 	if (! event->name) {
 		nih_free (event);
 		return NULL;
@@ -171,6 +294,413 @@ event_new (const void  *parent,
 }
 
 
+/**
+ * event_destroy:
+ * @event: event to be destroyed.
+ *
+ * Removes @event from the events list, and from the counts of its lane
+ * and session if it is still pending.
+ *
+ * Normally used or called from an nih_alloc() destructor so that the
+ * list item is automatically removed from its containing list when freed.
+ *
+ * Returns: zero.
+ **/
+static int
+event_destroy (Event *event)
+{
+	nih_assert (event != NULL);
+
+	if (event->progress == EVENT_PENDING)
+		event_dequeue (event);
+
+	nih_list_destroy (&event->entry);
+
+	return 0;
+}
+
+/**
+ * event_dequeue:
+ * @event: event no longer pending.
+ *
+ * Remove @event from the counts of pending events of its lane and its
+ * session.
+ **/
+static void
+event_dequeue (Event *event)
+{
+	nih_assert (event != NULL);
+
+	if (event_lane_depth[event->lane])
+		event_lane_depth[event->lane]--;
+
+	if (event->session && event->session->events_pending)
+		event->session->events_pending--;
+}
+
+/**
+ * event_set_lane:
+ * @event: pending event,
+ * @lane: lane to move it to.
+ *
+ * Move @event, which must still be pending, to wait in @lane.
+ **/
+void
+event_set_lane (Event     *event,
+		EventLane  lane)
+{
+	nih_assert (event != NULL);
+	nih_assert (event->progress == EVENT_PENDING);
+	nih_assert (lane < EVENT_LANE_LAST);
+
+	if (event->lane == lane)
+		return;
+
+	if (event_lane_depth[event->lane])
+		event_lane_depth[event->lane]--;
+
+	event->lane = lane;
+
+	event_lane_depth[lane]++;
+	if (event_lane_depth[lane] > event_lane_peak[lane])
+		event_lane_peak[lane] = event_lane_depth[lane];
+}
+
+/**
+ * event_set_session:
+ * @event: event,
+ * @session: session to attach it to.
+ *
+ * Attach @event to @session, or to no session if @session is NULL, so
+ * that only the jobs of that session are affected by it.
+ **/
+void
+event_set_session (Event   *event,
+		   Session *session)
+{
+	nih_assert (event != NULL);
+
+	if (event->session == session)
+		return;
+
+	if (event->progress == EVENT_PENDING) {
+		if (event->session && event->session->events_pending)
+			event->session->events_pending--;
+
+		if (session)
+			session->events_pending++;
+	}
+
+	event->session = session;
+}
+
+/**
+ * event_administrative:
+ * @name: name of event.
+ *
+ * Determine whether @name is that of an event with which an administrator
+ * or the system asks for a change of the system as a whole, and which
+ * must not wait behind events arriving in bulk.
+ *
+ * Returns: TRUE if @name is administrative, else FALSE.
+ **/
+int
+event_administrative (const char *name)
+{
+	static const char * const names[] = {
+		CTRLALTDEL_EVENT,
+		KBDREQUEST_EVENT,
+		PWRSTATUS_EVENT,
+		RUNLEVEL_EVENT,
+		SESSION_END_EVENT,
+		NULL
+	};
+
+	nih_assert (name != NULL);
+
+	for (const char * const *n = names; *n; n++)
+		if (! strcmp (name, *n))
+			return TRUE;
+
+	return FALSE;
+}
+
+
+/**
+ * event_queue_full:
+ * @session: session emitting an event.
+ *
+ * Determine whether the queue has room for an event emitted from
+ * @session, which may be NULL; it is full once max_pending_events events
+ * are pending, or once session_event_limit of those of @session are.
+ *
+ * Returns: TRUE if the queue is full, else FALSE.
+ **/
+int
+event_queue_full (const Session *session)
+{
+	unsigned int pending;
+
+	pending = (event_lane_depth[EVENT_LANE_PRIORITY]
+		   + event_lane_depth[EVENT_LANE_BULK]);
+
+	if ((max_pending_events > 0)
+	    && (pending >= (unsigned int)max_pending_events))
+		return TRUE;
+
+	if (session && (session_event_limit > 0)
+	    && (session->events_pending >= (unsigned int)session_event_limit))
+		return TRUE;
+
+	return FALSE;
+}
+
+/**
+ * event_overflow:
+ * @name: name of event emitted,
+ * @env: NULL-terminated array of environment variables of event,
+ * @fd: file descriptor associated with event, or -1,
+ * @session: session emitting event,
+ * @existing: pointer for identical pending event.
+ *
+ * Called when an event with @name and @env is emitted from @session
+ * while the queue is full, see event_queue_full(), to apply
+ * event_overflow_policy.
+ *
+ * With EVENT_OVERFLOW_COALESCE, an identical event that is still pending
+ * is stored in @existing and should be used instead of a new one; with
+ * EVENT_OVERFLOW_DROP_OLDEST, the oldest bulk event that nobody is
+ * waiting for is dropped to make room.  Events emitted by the init daemon
+ * itself are never dropped, and if neither is possible the event must be
+ * refused.  A warning is logged, at most once every
+ * EVENT_OVERFLOW_WARN_INTERVAL seconds.
+ *
+ * Returns: zero if the event may be queued or has been coalesced,
+ * negative value if it must be refused.
+ **/
+int
+event_overflow (const char    *name,
+		char * const  *env,
+		int            fd,
+		Session       *session,
+		Event        **existing)
+{
+	Event *event;
+
+	nih_assert (name != NULL);
+	nih_assert (env != NULL);
+	nih_assert (existing != NULL);
+
+	*existing = NULL;
+
+	switch (event_overflow_policy) {
+	case EVENT_OVERFLOW_COALESCE:
+		/* An event with a socket can't be merged with another */
+		if (fd >= 0)
+			break;
+
+		*existing = event_overflow_duplicate (name, env, session);
+		if (! *existing)
+			break;
+
+		event_overflow_coalesced++;
+		event_overflow_warn (_("coalesced"), name);
+
+		return 0;
+	case EVENT_OVERFLOW_DROP_OLDEST:
+		event = event_overflow_victim (session);
+		if (! event)
+			break;
+
+		event_overflow_dropped++;
+		event_overflow_warn (_("dropped"), event->name);
+
+		if (event->fd >= 0)
+			close (event->fd);
+
+		nih_free (event);
+
+		return 0;
+	default:
+		break;
+	}
+
+	event_overflow_rejected++;
+	event_overflow_warn (_("rejected"), name);
+
+	return -1;
+}
+
+/**
+ * event_overflow_duplicate:
+ * @name: name of event,
+ * @env: NULL-terminated array of environment variables of event,
+ * @session: session of event.
+ *
+ * Find a pending event of @session with the same @name and @env, in the
+ * same order, and without an associated socket.
+ *
+ * Returns: identical pending event or NULL if there is none.
+ **/
+static Event *
+event_overflow_duplicate (const char    *name,
+			  char * const  *env,
+			  const Session *session)
+{
+	nih_assert (name != NULL);
+	nih_assert (env != NULL);
+
+	NIH_LIST_FOREACH (events, iter) {
+		Event  *event = (Event *)iter;
+		size_t  i = 0;
+
+		if (event->progress != EVENT_PENDING)
+			continue;
+
+		if ((event->session != session) || (event->fd >= 0))
+			continue;
+
+		if (strcmp (event->name, name))
+			continue;
+
+		if (event->env)
+			for (; event->env[i] && env[i]; i++)
+				if (strcmp (event->env[i], env[i]))
+					break;
+
+		if ((! event->env || ! event->env[i]) && ! env[i])
+			return event;
+	}
+
+	return NULL;
+}
+
+/**
+ * event_overflow_victim:
+ * @session: session emitting an event.
+ *
+ * Find the oldest pending event in the bulk lane that nobody is waiting
+ * for; when @session has reached session_event_limit, only its own events
+ * are considered so that one session can't push out those of another.
+ *
+ * Returns: event to drop or NULL if there is none.
+ **/
+static Event *
+event_overflow_victim (const Session *session)
+{
+	int own = FALSE;
+
+	if (session && (session_event_limit > 0)
+	    && (session->events_pending >= (unsigned int)session_event_limit))
+		own = TRUE;
+
+	NIH_LIST_FOREACH (events, iter) {
+		Event *event = (Event *)iter;
+
+		if ((event->progress != EVENT_PENDING)
+		    || (event->lane != EVENT_LANE_BULK))
+			continue;
+
+		if (own && (event->session != session))
+			continue;
+
+		if (! NIH_LIST_EMPTY (&event->blocking))
+			continue;
+
+		return event;
+	}
+
+	return NULL;
+}
+
+/**
+ * event_overflow_warn:
+ * @action: what was done with the event,
+ * @name: name of event.
+ *
+ * Warn that @action was taken with the @name event because the queue was
+ * full, unless a warning was given less than EVENT_OVERFLOW_WARN_INTERVAL
+ * seconds ago; the number of overflows not warned of is given with the
+ * next warning.
+ **/
+static void
+event_overflow_warn (const char *action,
+		     const char *name)
+{
+	unsigned long long now;
+
+	nih_assert (action != NULL);
+	nih_assert (name != NULL);
+
+	now = trace_now ();
+
+	if (event_overflow_warned
+	    && (now - event_overflow_warned
+		< EVENT_OVERFLOW_WARN_INTERVAL * 1000000ULL)) {
+		event_overflow_suppressed++;
+		return;
+	}
+
+	if (event_overflow_suppressed) {
+		nih_warn (_("Event queue full, %s %s event "
+			    "(%u further overflows not reported)"),
+			  action, name, event_overflow_suppressed);
+	} else {
+		nih_warn (_("Event queue full, %s %s event"), action, name);
+	}
+
+	event_overflow_warned = now;
+	event_overflow_suppressed = 0;
+}
+
+/**
+ * event_overflow_from_name:
+ * @name: name of overflow policy.
+ *
+ * Convert @name into an EventOverflow.
+ *
+ * Returns: EventOverflow value or -1 if @name is not known.
+ **/
+int
+event_overflow_from_name (const char *name)
+{
+	nih_assert (name != NULL);
+
+	if (! strcmp (name, "reject")) {
+		return EVENT_OVERFLOW_REJECT;
+	} else if (! strcmp (name, "drop-oldest")) {
+		return EVENT_OVERFLOW_DROP_OLDEST;
+	} else if (! strcmp (name, "coalesce")) {
+		return EVENT_OVERFLOW_COALESCE;
+	}
+
+	return -1;
+}
+
+/**
+ * event_overflow_name:
+ * @policy: overflow policy.
+ *
+ * Convert @policy into the name accepted by event_overflow_from_name().
+ *
+ * Returns: static string or NULL if @policy is not known.
+ **/
+const char *
+event_overflow_name (EventOverflow policy)
+{
+	switch (policy) {
+	case EVENT_OVERFLOW_REJECT:
+		return "reject";
+	case EVENT_OVERFLOW_DROP_OLDEST:
+		return "drop-oldest";
+	case EVENT_OVERFLOW_COALESCE:
+		return "coalesce";
+	default:
+		return NULL;
+	}
+}
+
+
 /**
  * event_block:
  * @event: event to block.
@@ -216,6 +746,13 @@ event_unblock (Event *event)
  * in the finished state will have subscribers and jobs notified that the
  * event has completed.
  *
+ * Pending events in the priority lane are handled before those in the
+ * bulk lane, even those queued earlier; but should priority events keep
+ * arriving, one bulk event is handled after each EVENT_PRIORITY_BURST of
+ * them so that the bulk lane is never starved.  Each chroot session has
+ * at most EVENT_SESSION_QUANTUM of its events handled in each pass, so
+ * that sessions take turns rather than one flooding the queue.
+ *
  * Events remain in the handling state while they have blocking jobs.
  *
  * This function will only return once the events list is empty, or all
@@ -228,11 +765,16 @@ void
 event_poll (void)
 {
 	int poll_again;
+	int waited;
+	int stalled = FALSE;
 
 	event_init ();
 
 	do {
 		poll_again = FALSE;
+		waited = FALSE;
+
+		event_session_credit ();
 
 		NIH_LIST_FOREACH_SAFE (events, iter) {
 			Event *event = (Event *)iter;
@@ -248,6 +790,16 @@ event_poll (void)
 			 */
 			switch (event->progress) {
 			case EVENT_PENDING:
+				/* Leave it pending while the other lane is
+				 * handled first.
+				 */
+				if ((! stalled)
+				    && (event_lane_wait (event)
+					|| event_session_wait (event))) {
+					waited = TRUE;
+					break;
+				}
+
 				event_pending (event);
 				poll_again = TRUE;
 
@@ -266,9 +818,116 @@ event_poll (void)
 				nih_assert_not_reached ();
 			}
 		}
+
+		/* Should nothing else have been done, the events waited
+		 * for cannot be in the list; handle the others anyway.
+		 * Sessions waiting for their next turn always get it.
+		 */
+		stalled = (waited && ! poll_again);
+		if (stalled)
+			poll_again = TRUE;
 	} while (poll_again);
 }
 
+/**
+ * event_lane_wait:
+ * @event: pending event.
+ *
+ * Determine whether @event should be left pending while events in the
+ * other lane are handled: bulk events wait for priority events, unless
+ * EVENT_PRIORITY_BURST of those have been handled in a row, in which case
+ * priority events wait for one bulk event.
+ *
+ * Returns: TRUE if @event should wait, else FALSE.
+ **/
+static int
+event_lane_wait (Event *event)
+{
+	nih_assert (event != NULL);
+	nih_assert (event->progress == EVENT_PENDING);
+
+	if (event->lane == EVENT_LANE_BULK)
+		return (event_lane_depth[EVENT_LANE_PRIORITY]
+			&& (event_priority_run < EVENT_PRIORITY_BURST));
+
+	return (event_lane_depth[EVENT_LANE_BULK]
+		&& (event_priority_run >= EVENT_PRIORITY_BURST));
+}
+
+/**
+ * event_lane_leave:
+ * @event: event being handled.
+ *
+ * Remove @event from its lane and session as it is handled, and keep
+ * count of the priority events handled while bulk events wait and of the
+ * turn of its session.
+ **/
+static void
+event_lane_leave (Event *event)
+{
+	nih_assert (event != NULL);
+
+	event_dequeue (event);
+
+	event_lane_handled[event->lane]++;
+
+	if (event->session) {
+		event->session->events_handled++;
+
+		if (event->session->events_credit)
+			event->session->events_credit--;
+	}
+
+	if (event->lane == EVENT_LANE_PRIORITY) {
+		if (event_lane_depth[EVENT_LANE_BULK]) {
+			event_priority_run++;
+		} else {
+			event_priority_run = 0;
+		}
+	} else {
+		if (event_lane_depth[EVENT_LANE_PRIORITY])
+			event_lane_yielded++;
+
+		event_priority_run = 0;
+	}
+}
+
+
+/**
+ * event_session_credit:
+ *
+ * Give each chroot session its turn of EVENT_SESSION_QUANTUM events for
+ * the next pass of the event queue.
+ **/
+static void
+event_session_credit (void)
+{
+	session_init ();
+
+	NIH_LIST_FOREACH (sessions, iter) {
+		Session *session = (Session *)iter;
+
+		session->events_credit = EVENT_SESSION_QUANTUM;
+	}
+}
+
+/**
+ * event_session_wait:
+ * @event: pending event.
+ *
+ * Determine whether @event should be left pending until the next pass of
+ * the event queue because its session has had its turn in this one.
+ *
+ * Returns: TRUE if @event should wait, else FALSE.
+ **/
+static int
+event_session_wait (Event *event)
+{
+	nih_assert (event != NULL);
+
+	return (event->session && ! event->session->events_credit);
+}
+
 
 /**
  * event_pending:
@@ -288,9 +947,18 @@ event_pending (Event *event)
 	nih_assert (event->progress == EVENT_PENDING);
 
 	nih_info (_("Handling %s event"), event->name);
+	event_lane_leave (event);
 	event->progress = EVENT_HANDLING;
 
+	if (event->trace.pending)
+		event->trace.handling = trace_now ();
+
 	event_pending_handle_jobs (event);
+
+	if (event->trace.pending) {
+		event->trace.handled = trace_now ();
+		event->trace.blockers = event->blockers;
+	}
 }
 
 /**
@@ -298,126 +966,57 @@ event_pending (Event *event)
  * @event: event to be handled.
  *
  * This function is called whenever an event reaches the handling state.
- * It iterates the list of jobs and stops or starts any necessary.
+ * It iterates the list of jobs and stops or starts any necessary; new
+ * instances are started once all classes have been checked, in order of
+ * their class priority.
+ *
+ * Only the jobs within the same session as the event are affected, found
+ * through the index of the session, unless the event has no session in
+ * which case all jobs are.
  **/
 static void
 event_pending_handle_jobs (Event *event)
 {
-	int  empty = TRUE;
-
-#ifdef ENABLE_CGROUPS
-	int  warn = FALSE;
-#endif /* ENABLE_CGROUPS */
+	nih_local NihList *starting = NULL;
+	int                empty = TRUE;
+	int                warn = FALSE;
 
 	nih_assert (event != NULL);
 
 	job_class_init ();
 
-	NIH_HASH_FOREACH_SAFE (job_classes, iter) {
-		JobClass *class = (JobClass *)iter;
-
-		/* Only affect jobs within the same session as the event
-		 * unless the event has no session, in which case do them
-		 * all.
-		 */
-		if (event->session && (class->session != event->session))
-			continue;
-
-		/* We stop first so that if an event is listed both as a
-		 * stop and start event, it causes an active running process
-		 * to be killed, and then stop script then the start script
-		 * to be run. In any other state, it has no special effect.
-		 *
-		 * (The other way around would be just strange, it'd cause
-		 * a process's start and stop scripts to be run without the
-		 * actual process).
-		 */
-		NIH_HASH_FOREACH_SAFE (class->instances, job_iter) {
-			Job *job = (Job *)job_iter;
-
-			if (job->stop_on
-			    && event_operator_handle (job->stop_on, event,
-						      job->env)
-			    && job->stop_on->value) {
-				if (job->goal != JOB_STOP) {
-					size_t len = 0;
-
-					if (job->stop_env)
-						nih_unref (job->stop_env, job);
-					job->stop_env = NULL;
-
-					/* Collect environment that stopped
-					 * the job for the pre-stop script;
-					 * it can make a more informed
-					 * decision whether the stop is valid.
-					 * We don't add class environment
-					 * since this is appended to the
-					 * existing job environment.
-					 */
-					NIH_MUST (event_operator_environment (
-						job->stop_on, &job->stop_env,
-						job, &len, "UPSTART_STOP_EVENTS"));
-
-					job_finished (job, FALSE);
-
-					event_operator_events (
-						job->stop_on,
-						job, &job->blocking);
-
-					job_change_goal (job, JOB_STOP);
-				}
+	starting = NIH_MUST (nih_list_new (NULL));
 
-				event_operator_reset (job->stop_on);
-			}
+	if (event->session) {
+		NIH_LIST_FOREACH_SAFE (event->session->classes, iter) {
+			NihListEntry *entry = (NihListEntry *)iter;
 
+			if (! event_pending_handle_class (
+				    event, (JobClass *)entry->data,
+				    starting, &warn))
+				return;
 		}
+	} else {
+		NIH_HASH_FOREACH_SAFE (job_classes, iter) {
+			JobClass *class = (JobClass *)iter;
 
-		/* If the job has specified a cgroup stanza, do not
-		 * start it until the cgroup manager is available. Also,
-		 * block any events that the job requires such that when
-		 * the cgroup manager is available, the job may be
-		 * started.
-		 */
-
-#ifdef ENABLE_CGROUPS
-		if (class->start_on && job_class_cgroups (class)) {
-			if (cgroup_manager_available ()) {
-
-				if (class->cgmanager_wait) {
-					/* Unref the events that were ref'ed
-					 * whilst waiting for the cgroup manager
-					 * to become available.
-					 */
-					event_operator_reset (class->start_on);
-					class->cgmanager_wait = FALSE;
-				}
-			} else {
-				warn = TRUE;
-
-				/* Reference the event to stop it being destroyed since it will
-				 * be required by the job once the cgroup manager eventually
-				 * becomes available.
-				 */
-				if (! class->cgmanager_wait) {
-					if (event_operator_handle (class->start_on, event, NULL))
-						class->cgmanager_wait = TRUE;
-				}
-
-				continue;
-			}
+			if (! event_pending_handle_class (event, class,
+							  starting, &warn))
+				return;
 		}
-#endif /* ENABLE_CGROUPS */
+	}
 
-		/* Now we match the start events for the class to see
-		 * whether we need a new instance.
-		 */
-		if (class->start_on
-		    && event_operator_handle (class->start_on, event, NULL)
-		    && class->start_on->value) {
+	/* Hash order is arbitrary, so start the new instances in order of
+	 * priority; their starting events are then handled, and they are
+	 * queued for a spawn slot, ahead of those of a lower priority.
+	 */
+	NIH_LIST_FOREACH_SAFE (starting, iter) {
+		NihListEntry *entry = (NihListEntry *)iter;
 
-			if (! job_class_induct_job (class))
-				return;
-		}
+		if (! job_class_induct_job ((JobClass *)entry->data))
+			return;
+
+		nih_free (entry);
 	}
 
 #ifdef ENABLE_CGROUPS
@@ -447,6 +1046,147 @@ event_pending_handle_jobs (Event *event)
 }
 
 
+/**
+ * event_pending_handle_class:
+ * @event: event to be handled,
+ * @class: job class to handle it for,
+ * @starting: list of classes to start new instances of,
+ * @warn: set to TRUE if @class cannot be started until cgroups are
+ *        available.
+ *
+ * Stop any instances of @class whose stop condition @event completes,
+ * and add @class to @starting if @event completes its start condition.
+ *
+ * Returns: FALSE if event handling must stop, else TRUE.
+ **/
+static int
+event_pending_handle_class (Event    *event,
+			    JobClass *class,
+			    NihList  *starting,
+			    int      *warn)
+{
+	int matched = FALSE;
+
+	nih_assert (event != NULL);
+	nih_assert (class != NULL);
+	nih_assert (starting != NULL);
+	nih_assert (warn != NULL);
+
+	/* We stop first so that if an event is listed both as a
+	 * stop and start event, it causes an active running process
+	 * to be killed, and then stop script then the start script
+	 * to be run. In any other state, it has no special effect.
+	 *
+	 * (The other way around would be just strange, it'd cause
+	 * a process's start and stop scripts to be run without the
+	 * actual process).
+	 */
+	NIH_HASH_FOREACH_SAFE (class->instances, job_iter) {
+		Job *job = (Job *)job_iter;
+
+		if (! job->stop_on
+		    || ! event_expr_handle (job->stop_on, event,
+					    job->env))
+			continue;
+
+		matched = TRUE;
+
+		if (event_expr_value (job->stop_on)) {
+			if (job->goal != JOB_STOP) {
+				size_t len = 0;
+
+				if (job->stop_env)
+					nih_unref (job->stop_env, job);
+				job->stop_env = NULL;
+
+				/* Collect environment that stopped
+				 * the job for the pre-stop script;
+				 * it can make a more informed
+				 * decision whether the stop is valid.
+				 * We don't add class environment
+				 * since this is appended to the
+				 * existing job environment.
+				 */
+				NIH_MUST (event_expr_environment (
+					job->stop_on, &job->stop_env,
+					job, &len, "UPSTART_STOP_EVENTS"));
+
+				job_finished (job, FALSE);
+
+				event_expr_events (
+					job->stop_on,
+					job, &job->blocking);
+
+				job_change_goal (job, JOB_STOP);
+			}
+
+			event_expr_reset (job->stop_on);
+		}
+	}
+
+	if (matched)
+		event->trace.matched++;
+
+	/* If the job has specified a cgroup stanza, do not
+	 * start it until the cgroup manager is available, or the
+	 * cgroup filesystem is mounted. Also, block any events
+	 * that the job requires such that when cgroups are
+	 * available, the job may be started.
+	 */
+
+#ifdef ENABLE_CGROUPS
+	if (class->start_on && job_class_cgroups (class)) {
+		if (cgroup_available ()) {
+
+			if (class->cgmanager_wait) {
+				/* The cgroup filesystem has been
+				 * mounted since the job was blocked,
+				 * so start it now as the cgroup
+				 * manager would have been notified,
+				 * in order of priority with the rest.
+				 * Its start condition is still held
+				 * by the events it waited for, so
+				 * this event is not matched against
+				 * it too.
+				 */
+				class->cgmanager_wait = FALSE;
+				job_class_add_starting (starting, class);
+
+				return TRUE;
+			}
+		} else {
+			*warn = TRUE;
+
+			/* Reference the event to stop it being destroyed since it will
+			 * be required by the job once the cgroup manager eventually
+			 * becomes available.
+			 */
+			if (! class->cgmanager_wait) {
+				if (event_operator_handle (class->start_on, event, NULL))
+					class->cgmanager_wait = TRUE;
+			}
+
+			return TRUE;
+		}
+	}
+#endif /* ENABLE_CGROUPS */
+
+	/* Now we match the start events for the class to see
+	 * whether we need a new instance.
+	 */
+	if (class->start_on
+	    && event_operator_handle (class->start_on, event, NULL)) {
+		if (! matched)
+			event->trace.matched++;
+
+		if (class->start_on->value)
+			job_class_add_starting (starting, class);
+	}
+
+	return TRUE;
+}
+
+
 /**
  * event_finished:
  * @event: finished event.
@@ -464,6 +1204,11 @@ event_finished (Event *event)
 
 	nih_debug ("Finished %s event", event->name);
 
+	if (event->trace.pending) {
+		event->trace.finished = trace_now ();
+		trace_event_record (event->name, &event->trace);
+	}
+
 	NIH_LIST_FOREACH_SAFE (&event->blocking, iter) {
 		Blocked *blocked = (Blocked *)iter;
 
@@ -496,7 +1241,7 @@ event_finished (Event *event)
 			nih_assert_not_reached ();
 		}
 
-		nih_free  (blocked);
+		blocked_release (blocked, event);
 	}
 
 	close (event->fd);
@@ -512,7 +1257,7 @@ event_finished (Event *event)
 			failed = NIH_MUST (nih_sprintf (NULL, "%s/failed",
 							event->name));
 			new_event = NIH_MUST (event_new (NULL, failed, NULL));
-			new_event->session = event->session;
+			event_set_session (new_event, event->session);
 
 			if (event->env)
 				new_event->env = NIH_MUST (nih_str_array_copy (
@@ -576,6 +1321,11 @@ event_serialise (const Event *event)
 				"progress", event->progress))
 		goto error;
 
+	if (! state_set_json_enum_var (json,
+				event_lane_enum_to_str,
+				"lane", event->lane))
+		goto error;
+
 	if (! state_set_json_int_var_from_obj (json, event, failed))
 		goto error;
 
@@ -652,6 +1402,8 @@ event_deserialise (json_object *json)
 	nih_local char     *name = NULL;
         nih_local char    **env = NULL;
 	int                 session_index = -1;
+	EventProgress       progress;
+	EventLane           lane;
 
 	nih_assert (json);
 
@@ -680,13 +1432,28 @@ event_deserialise (json_object *json)
 		goto error;
 
 	/* can't check return value here (as all values are legitimate) */
-	event->session = session_from_index (session_index);
+	event_set_session (event, session_from_index (session_index));
+
+	if (json_object_object_get_ex (json, "lane", NULL)) {
+		if (! state_get_json_enum_var (json,
+					event_lane_str_to_enum,
+					"lane", lane))
+			goto error;
+
+		event_set_lane (event, lane);
+	}
 
 	if (! state_get_json_enum_var (json,
 				event_progress_str_to_enum,
-				"progress", event->progress))
+				"progress", progress))
 		goto error;
 
+	/* Only pending events wait in a lane */
+	if (progress != EVENT_PENDING)
+		event_dequeue (event);
+
+	event->progress = progress;
+
 	if (! state_get_json_int_var_to_obj (json, event, failed))
 		goto error;
 
@@ -793,6 +1560,43 @@ event_progress_str_to_enum (const char *progress)
 	return -1;
 }
 
+/**
+ * event_lane_enum_to_str:
+ *
+ * @lane: event lane.
+ *
+ * Convert EventLane to a string representation.
+ *
+ * Returns: string representation of @lane, or NULL if not known.
+ **/
+static const char *
+event_lane_enum_to_str (EventLane lane)
+{
+	state_enum_to_str (EVENT_LANE_PRIORITY, lane);
+	state_enum_to_str (EVENT_LANE_BULK, lane);
+
+	return NULL;
+}
+
+/**
+ * event_lane_str_to_enum:
+ *
+ * @lane: name of EventLane value.
+ *
+ * Convert string representation of EventLane into a
+ * real EventLane value.
+ *
+ * Returns: EventLane representing @lane, or -1 if not known.
+ **/
+static EventLane
+event_lane_str_to_enum (const char *lane)
+{
+	state_str_to_enum (EVENT_LANE_PRIORITY, lane);
+	state_str_to_enum (EVENT_LANE_BULK, lane);
+
+	return -1;
+}
+
 /**
  * event_to_index:
  *
@@ -25,6 +25,7 @@
 
 #include "session.h"
 #include "state.h"
+#include "trace.h"
 
 #include <json.h>
 
@@ -41,18 +42,69 @@ typedef enum event_progress {
 	EVENT_FINISHED
 } EventProgress;
 
+/**
+ * EventLane:
+ *
+ * Pending events wait in one of these lanes; those in the priority lane
+ * are handled before those in the bulk lane, see event_poll().
+ **/
+typedef enum event_lane {
+	EVENT_LANE_PRIORITY,
+	EVENT_LANE_BULK,
+	EVENT_LANE_LAST
+} EventLane;
+
+/**
+ * EVENT_PRIORITY_BURST:
+ *
+ * Number of priority events that may be handled in a row while bulk
+ * events are waiting, before one bulk event is handled.
+ **/
+#define EVENT_PRIORITY_BURST 32
+
+/**
+ * EVENT_SESSION_QUANTUM:
+ *
+ * Number of pending events of each chroot session handled in each pass of
+ * the event queue, so that one session cannot hold back the others; events
+ * emitted outside any session are never held back.
+ **/
+#define EVENT_SESSION_QUANTUM 8
+
+/**
+ * EVENT_OVERFLOW_WARN_INTERVAL:
+ *
+ * Minimum number of seconds between warnings that the event queue has
+ * overflowed.
+ **/
+#define EVENT_OVERFLOW_WARN_INTERVAL 10
+
+/**
+ * EventOverflow:
+ *
+ * What is done with an event emitted while the event queue is full, see
+ * event_overflow().
+ **/
+typedef enum event_overflow {
+	EVENT_OVERFLOW_REJECT,
+	EVENT_OVERFLOW_DROP_OLDEST,
+	EVENT_OVERFLOW_COALESCE
+} EventOverflow;
+
 /**
  * Event:
  * @entry: list header,
  * @session: session the event is attached to,
- * @name: string name of the event,
+ * @name: string name of the event (interned, see intern_string()),
  * @env: NULL-terminated array of environment variables,
  * @fd: open file descriptor associated with a particular
  *      socket-bridge socket (see socket-event(8)),
  * @progress: progress of event,
+ * @lane: lane the event waits in while pending,
  * @failed: whether this event has failed,
  * @blockers: number of blockers for finishing,
- * @blocking: messages and jobs we're blocking.
+ * @blocking: messages and jobs we're blocking,
+ * @trace: lifecycle timestamps and counters, see trace_event_record().
  *
  * Events are one of the core concepts of upstart; they occur whenever
  * something, somewhere changes state.  They are idenitied by a unique
@@ -74,10 +126,13 @@ typedef struct event {
 	int              fd;
 
 	EventProgress    progress;
+	EventLane        lane;
 	int              failed;
 
 	unsigned int     blockers;
 	NihList          blocking;
+
+	EventTrace       trace;
 } Event;
 
 
@@ -86,11 +141,39 @@ NIH_BEGIN_EXTERN
 extern int      paused;
 extern NihList *events;
 
+extern unsigned int event_lane_depth[EVENT_LANE_LAST];
+extern unsigned int event_lane_peak[EVENT_LANE_LAST];
+extern unsigned int event_lane_handled[EVENT_LANE_LAST];
+extern unsigned int event_lane_yielded;
+
+extern int           max_pending_events;
+extern EventOverflow event_overflow_policy;
+
+extern unsigned int event_overflow_rejected;
+extern unsigned int event_overflow_dropped;
+extern unsigned int event_overflow_coalesced;
+
 
 void   event_init    (void);
 
 Event *event_new     (const void *parent, const char *name, char **env);
 
+void   event_set_lane (Event *event, EventLane lane);
+void   event_set_session (Event *event, Session *session);
+int    event_administrative (const char *name)
+	__attribute__ ((warn_unused_result));
+
+int    event_queue_full (const Session *session)
+	__attribute__ ((warn_unused_result));
+int    event_overflow (const char *name, char * const *env, int fd,
+		       Session *session, Event **existing)
+	__attribute__ ((warn_unused_result));
+
+int    event_overflow_from_name (const char *name)
+	__attribute__ ((warn_unused_result));
+const char *event_overflow_name (EventOverflow policy)
+	__attribute__ ((warn_unused_result));
+
 void   event_block   (Event *event);
 void   event_unblock (Event *event);
 
@@ -40,10 +40,66 @@
 #include "environ.h"
 #include "event.h"
 #include "event_operator.h"
+#include "intern.h"
 #include "blocked.h"
 #include "errors.h"
 
 
+/* Prototypes for static functions */
+static int event_operator_match_env (char * const *oenv, Event *event,
+				     char * const *env);
+
+static NihListEntry *event_operator_scratch_get (void)
+	__attribute__ ((warn_unused_result));
+static void          event_operator_scratch_put (NihListEntry *entry);
+
+
+/**
+ * event_operator_scratch_max:
+ *
+ * Largest number of stack entries kept in event_operator_scratch for
+ * reuse; zero disables the pool.
+ **/
+unsigned int event_operator_scratch_max = EVENT_OPERATOR_SCRATCH_MAX;
+
+/**
+ * event_operator_scratch_pooled:
+ *
+ * Number of entries kept in event_operator_scratch.
+ **/
+unsigned int event_operator_scratch_pooled = 0;
+
+/**
+ * event_operator_scratch_in_use:
+ *
+ * Number of entries on the stack of event_operator_collapse().
+ **/
+unsigned int event_operator_scratch_in_use = 0;
+
+/**
+ * event_operator_scratch_peak:
+ *
+ * Largest number of entries that have been on the stack at once.
+ **/
+unsigned int event_operator_scratch_peak = 0;
+
+/**
+ * event_operator_scratch_reused:
+ *
+ * Number of entries taken from the pool rather than allocated.
+ **/
+unsigned int event_operator_scratch_reused = 0;
+
+/**
+ * event_operator_scratch:
+ *
+ * Stack entries of event_operator_collapse() kept for reuse, since every
+ * job class with a start on or stop on condition needs one for each
+ * operator each time it is serialised.
+ **/
+static NihList *event_operator_scratch = NULL;
+
+
 /**
  * event_operator_new:
  * @parent: parent object for new operator,
@@ -55,6 +111,9 @@
  * if @type is EVENT_MATCH then the operator will be used to match an event
  * with the given @name and @arguments using event_match().
  *
+ * @name is interned with intern_string(), so operators and events with
+ * the same name share a single copy of it.
+ *
  * @env is optional, and may be NULL; if given it should be a NULL-terminated
  * array of environment variables in KEY=VALUE form.  @env will be referenced
  * by the new event.  After calling this function, you should never use
@@ -91,7 +150,7 @@ event_operator_new (const void         *parent,
 	oper->value = FALSE;
 
 	if (oper->type == EVENT_MATCH) {
-		oper->name = nih_strdup (oper, name);
+		oper->name = intern_string (oper, name);
 		if (! oper->name) {
 			nih_free (oper);
 			return NULL;
@@ -275,24 +334,46 @@ event_operator_match (EventOperator *oper,
 		      Event         *event,
 		      char * const  *env)
 {
-	char * const *oenv;
-	char * const *eenv;
-
 	nih_assert (oper != NULL);
 	nih_assert (oper->type == EVENT_MATCH);
 	nih_assert (oper->node.left == NULL);
 	nih_assert (oper->node.right == NULL);
 	nih_assert (event != NULL);
 
-	/* Names must match */
-	if (strcmp (oper->name, event->name))
+	/* Names must match; both are interned so comparing the pointers
+	 * is sufficient.
+	 */
+	if (oper->name != event->name)
 		return FALSE;
 
+	return event_operator_match_env (oper->env, event, env);
+}
+
+/**
+ * event_operator_match_env:
+ * @oenv: NULL-terminated array of environment variables to match,
+ * @event: event to match,
+ * @env: NULL-terminated array of environment variables for expansion.
+ *
+ * Checks whether @event contains a superset of the environment variables
+ * given in @oenv, as described for event_operator_match().  Shared by
+ * EventOperator trees and compiled EventExpr expressions.
+ *
+ * Returns: TRUE if the environment matches, FALSE otherwise.
+ **/
+static int
+event_operator_match_env (char * const *oenv,
+			  Event         *event,
+			  char * const  *env)
+{
+	char * const *eenv;
+
+	nih_assert (event != NULL);
+
 	/* Match operator environment variables against those from the event,
 	 * starting both from the beginning.
 	 */
-	for (oenv = oper->env, eenv = event->env; oenv && *oenv;
-	     oenv++, eenv++) {
+	for (eenv = event->env; oenv && *oenv; oenv++, eenv++) {
 		nih_local char *expoval = NULL;
 		char           *oval, *eval;
 		int             negate = FALSE;
@@ -338,20 +419,27 @@ event_operator_match (EventOperator *oper,
 
 		/* Expand operator value against given environment before
 		 * matching; silently discard errors, since otherwise we'd
-		 * be excessively noisy on every event.
+		 * be excessively noisy on every event.  Most values contain
+		 * no variable references at all, in which case expansion
+		 * would only return a copy, so match those directly rather
+		 * than allocating for every comparison.
 		 */
-		while (! (expoval = environ_expand (NULL, oval, env))) {
-			NihError *err;
-
-			err = nih_error_get ();
-			if (err->number != ENOMEM) {
+		if (strchr (oval, '$')) {
+			while (! (expoval = environ_expand (NULL, oval, env))) {
+				NihError *err;
+
+				err = nih_error_get ();
+				if (err->number != ENOMEM) {
+					nih_free (err);
+					return FALSE;
+				}
 				nih_free (err);
-				return FALSE;
 			}
-			nih_free (err);
-		}
 
-		ret = fnmatch (expoval, eval, 0);
+			ret = fnmatch (expoval, eval, 0);
+		} else {
+			ret = fnmatch (oval, eval, 0);
+		}
 
 		if (negate ? (! ret) : ret)
 			return FALSE;
@@ -741,15 +829,16 @@ event_operator_reset (EventOperator *root)
 char *
 event_operator_collapse (EventOperator *condition)
 {
-	nih_local NihList       *stack = NULL;
+	NihList                  stack;
 	NihListEntry            *latest = NULL;
 	NihTree                 *root;
+	char                    *collapsed;
 
 	nih_assert (condition);
 
 	root = &condition->node;
 
-	stack = NIH_MUST (nih_list_new (NULL));
+	nih_list_init (&stack);
 
 	NIH_TREE_FOREACH_POST (root, iter) {
 		EventOperator   *oper = (EventOperator *)iter;
@@ -775,12 +864,12 @@ event_operator_collapse (EventOperator *condition)
 				if (oper->env)
 					env = NIH_MUST (state_collapse_env ((const char **)oper->env));
 
-				expr = NIH_MUST (nih_list_entry_new (stack));
+				expr = event_operator_scratch_get ();
 				expr->str = NIH_MUST (nih_sprintf (expr, "%s%s%s",
 							oper->name,
 							env ? " " : "",
 							env ? env : ""));
-				nih_list_add_after (stack, &expr->entry);
+				nih_list_add_after (&stack, &expr->entry);
 				break;
 			} else {
 				/* We build the expression from visiting the logical
@@ -794,7 +883,7 @@ event_operator_collapse (EventOperator *condition)
 		nih_assert (left);
 		nih_assert (right);
 
-		expr = NIH_MUST (nih_list_entry_new (stack));
+		expr = event_operator_scratch_get ();
 
 		/* If a child is an EVENT_MATCH, expand its event
 		 * details and push onto the stack.
@@ -814,10 +903,11 @@ event_operator_collapse (EventOperator *condition)
 		 * expression will look rather different.
 		 */
 		if (right->type != EVENT_MATCH) {
-			nih_assert (! NIH_LIST_EMPTY (stack));
+			nih_assert (! NIH_LIST_EMPTY (&stack));
 
-			latest = (NihListEntry *)nih_list_remove (stack->next);
+			latest = (NihListEntry *)nih_list_remove (stack.next);
 			right_expr = NIH_MUST (nih_strdup (NULL, latest->str));
+			event_operator_scratch_put (latest);
 		} else {
 			nih_local char *env = NULL;
 
@@ -831,10 +921,11 @@ event_operator_collapse (EventOperator *condition)
 		}
 
 		if (left->type != EVENT_MATCH) {
-			nih_assert (! NIH_LIST_EMPTY (stack));
+			nih_assert (! NIH_LIST_EMPTY (&stack));
 
-			latest = (NihListEntry *)nih_list_remove (stack->next);
+			latest = (NihListEntry *)nih_list_remove (stack.next);
 			left_expr = NIH_MUST (nih_strdup (NULL, latest->str));
+			event_operator_scratch_put (latest);
 		} else {
 			nih_local char *env = NULL;
 
@@ -852,16 +943,81 @@ event_operator_collapse (EventOperator *condition)
 					oper->type == EVENT_OR ? "or" : "and",
 					right_expr));
 
-		nih_list_add_after (stack, &expr->entry);
+		nih_list_add_after (&stack, &expr->entry);
 	}
 
-	nih_assert (! NIH_LIST_EMPTY (stack));
+	nih_assert (! NIH_LIST_EMPTY (&stack));
 
-	latest = (NihListEntry *)nih_list_remove (stack->next);
+	latest = (NihListEntry *)nih_list_remove (stack.next);
 
-	nih_assert (NIH_LIST_EMPTY (stack));
+	nih_assert (NIH_LIST_EMPTY (&stack));
 
-	return NIH_MUST (nih_strdup (NULL, latest->str));
+	collapsed = NIH_MUST (nih_strdup (NULL, latest->str));
+	event_operator_scratch_put (latest);
+
+	return collapsed;
+}
+
+/**
+ * event_operator_scratch_get:
+ *
+ * Takes an entry for the stack of event_operator_collapse() from the
+ * pool, or allocates one if the pool is empty.
+ *
+ * Returns: list entry without a parent and with no string.
+ **/
+static NihListEntry *
+event_operator_scratch_get (void)
+{
+	NihListEntry *entry;
+
+	if (event_operator_scratch
+	    && (! NIH_LIST_EMPTY (event_operator_scratch))) {
+		entry = (NihListEntry *)nih_list_remove (
+			event_operator_scratch->next);
+
+		event_operator_scratch_pooled--;
+		event_operator_scratch_reused++;
+	} else {
+		entry = NIH_MUST (nih_list_entry_new (NULL));
+	}
+
+	if (++event_operator_scratch_in_use > event_operator_scratch_peak)
+		event_operator_scratch_peak = event_operator_scratch_in_use;
+
+	return entry;
+}
+
+/**
+ * event_operator_scratch_put:
+ * @entry: entry taken with event_operator_scratch_get().
+ *
+ * Frees the string of @entry and removes it from the stack, keeping it
+ * for reuse unless event_operator_scratch_max entries are already kept.
+ **/
+static void
+event_operator_scratch_put (NihListEntry *entry)
+{
+	nih_assert (entry != NULL);
+
+	if (entry->str) {
+		nih_free (entry->str);
+		entry->str = NULL;
+	}
+
+	event_operator_scratch_in_use--;
+
+	if (event_operator_scratch_pooled >= event_operator_scratch_max) {
+		nih_free (entry);
+		return;
+	}
+
+	if (! event_operator_scratch)
+		event_operator_scratch = NIH_MUST (nih_list_new (NULL));
+
+	nih_list_add (event_operator_scratch, &entry->entry);
+
+	event_operator_scratch_pooled++;
 }
 
 /**
@@ -1172,3 +1328,675 @@ error:
 
 	return NULL;
 }
+
+
+/**
+ * event_expr_new:
+ * @parent: parent object for new expression,
+ * @root: operator tree to compile.
+ *
+ * Compiles the EventOperator tree rooted at @root into an immutable
+ * EventExpr, a single allocation holding every node of the tree in
+ * post-order so that evaluation only has to walk linear memory.  Names
+ * are interned and environment copied; the matching state of @root is
+ * ignored.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned expression.  When all parents
+ * of the returned expression are freed, the returned expression will also
+ * be freed.
+ *
+ * Returns: newly allocated EventExpr structure, or NULL if insufficient
+ * memory.
+ **/
+EventExpr *
+event_expr_new (const void    *parent,
+		EventOperator *root)
+{
+	EventExpr     *expr;
+	nih_local int *stack = NULL;
+	size_t         len = 0;
+	size_t         top = 0;
+	int            i = 0;
+
+	nih_assert (root != NULL);
+
+	NIH_TREE_FOREACH_POST (&root->node, iter)
+		len++;
+
+	expr = nih_alloc (parent, sizeof (EventExpr)
+			  + sizeof (EventExprNode) * len);
+	if (! expr)
+		return NULL;
+
+	expr->len = len;
+	expr->nodes = (EventExprNode *)(expr + 1);
+
+	/* Indices of the nodes whose parent has not yet been visited */
+	stack = nih_alloc (NULL, sizeof (int) * len);
+	if (! stack)
+		goto error;
+
+	NIH_TREE_FOREACH_POST (&root->node, iter) {
+		EventOperator *oper = (EventOperator *)iter;
+		EventExprNode *node = &expr->nodes[i];
+
+		node->type = oper->type;
+		node->parent = -1;
+		node->name = NULL;
+		node->env = NULL;
+
+		switch (oper->type) {
+		case EVENT_OR:
+		case EVENT_AND:
+			nih_assert (top >= 2);
+
+			node->right = stack[--top];
+			node->left = stack[--top];
+
+			expr->nodes[node->left].parent = i;
+			expr->nodes[node->right].parent = i;
+			break;
+		case EVENT_MATCH:
+			node->left = -1;
+			node->right = -1;
+
+			node->name = intern_string (expr, oper->name);
+			if (! node->name)
+				goto error;
+
+			if (oper->env) {
+				node->env = nih_str_array_copy (expr, NULL,
+								oper->env);
+				if (! node->env)
+					goto error;
+			}
+			break;
+		default:
+			nih_assert_not_reached ();
+		}
+
+		stack[top++] = i++;
+	}
+
+	nih_assert (top == 1);
+
+	return expr;
+
+error:
+	nih_free (expr);
+	return NULL;
+}
+
+/**
+ * event_expr_state_new:
+ * @parent: parent object for new state,
+ * @expr: compiled expression.
+ *
+ * Allocates and returns a new EventExprState structure for @expr with
+ * every node FALSE and no events matched; @expr is referenced by the new
+ * state.  The values and events are held in the same allocation as the
+ * structure itself.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned state.  When all parents
+ * of the returned state are freed, the returned state will also be
+ * freed.
+ *
+ * Returns: newly allocated EventExprState structure, or NULL if
+ * insufficient memory.
+ **/
+EventExprState *
+event_expr_state_new (const void *parent,
+		      EventExpr  *expr)
+{
+	EventExprState *state;
+
+	nih_assert (expr != NULL);
+
+	state = nih_alloc (parent, sizeof (EventExprState)
+			   + (sizeof (Event *) + sizeof (int)) * expr->len);
+	if (! state)
+		return NULL;
+
+	state->expr = expr;
+	nih_ref (state->expr, state);
+
+	state->event = (Event **)(state + 1);
+	state->value = (int *)(state->event + expr->len);
+
+	for (size_t i = 0; i < expr->len; i++) {
+		state->event[i] = NULL;
+		state->value[i] = FALSE;
+	}
+
+	nih_alloc_set_destructor (state, event_expr_state_destroy);
+
+	return state;
+}
+
+/**
+ * event_expr_state_destroy:
+ * @state: state to be destroyed.
+ *
+ * Unblocks any events referenced by @state.
+ *
+ * Normally used or called from an nih_alloc() destructor.
+ *
+ * Returns: zero.
+ **/
+int
+event_expr_state_destroy (EventExprState *state)
+{
+	nih_assert (state != NULL);
+
+	for (size_t i = 0; i < state->expr->len; i++) {
+		if (state->event[i])
+			event_unblock (state->event[i]);
+	}
+
+	return 0;
+}
+
+/**
+ * event_expr_value:
+ * @state: expression state.
+ *
+ * Returns: value of the expression as a whole.
+ **/
+int
+event_expr_value (const EventExprState *state)
+{
+	nih_assert (state != NULL);
+	nih_assert (state->expr->len > 0);
+
+	return state->value[state->expr->len - 1];
+}
+
+/**
+ * event_expr_active:
+ * @state: expression state,
+ * @i: index of node.
+ *
+ * Determines whether the node at @i played an active role in making the
+ * expression TRUE; this is the case when it and all of its ancestors are
+ * TRUE, and is the flat equivalent of filtering a tree with
+ * event_operator_filter().
+ *
+ * Returns: TRUE if node is active, FALSE otherwise.
+ **/
+static int
+event_expr_active (const EventExprState *state,
+		   int                   i)
+{
+	for (; i >= 0; i = state->expr->nodes[i].parent)
+		if (state->value[i] != TRUE)
+			return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * event_expr_handle:
+ * @state: expression state to update,
+ * @event: event to match against,
+ * @env: NULL-terminated array of environment variables for expansion.
+ *
+ * Handles the emission of @event, matching it against EVENT_MATCH nodes of
+ * the expression and updating the values of other nodes to match; this is
+ * the equivalent of event_operator_handle().
+ *
+ * Returns: TRUE if @event matched a node of the expression, FALSE
+ * otherwise.
+ **/
+int
+event_expr_handle (EventExprState *state,
+		   Event          *event,
+		   char * const   *env)
+{
+	EventExpr *expr;
+	int        ret = FALSE;
+
+	nih_assert (state != NULL);
+	nih_assert (event != NULL);
+
+	expr = state->expr;
+
+	/* Nodes are in post-order so children are always updated before
+	 * their parent.
+	 */
+	for (size_t i = 0; i < expr->len; i++) {
+		EventExprNode *node = &expr->nodes[i];
+
+		switch (node->type) {
+		case EVENT_OR:
+			state->value[i] = (state->value[node->left]
+					   || state->value[node->right]);
+			break;
+		case EVENT_AND:
+			state->value[i] = (state->value[node->left]
+					   && state->value[node->right]);
+			break;
+		case EVENT_MATCH:
+			if ((! state->value[i])
+			    && (node->name == event->name)
+			    && event_operator_match_env (node->env, event, env)) {
+				state->value[i] = TRUE;
+
+				state->event[i] = event;
+				event_block (state->event[i]);
+
+				ret = TRUE;
+			}
+			break;
+		default:
+			nih_assert_not_reached ();
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * event_expr_environment:
+ * @state: expression state to collect from,
+ * @env: NULL-terminated array of environment variables to add to,
+ * @parent: parent object for new array,
+ * @len: length of @env,
+ * @key: key of variable to contain event names.
+ *
+ * Collects environment from the events that made the expression TRUE,
+ * as event_operator_environment() does for an EventOperator tree.
+ *
+ * Returns: pointer to new array on success, NULL on insufficient memory.
+ **/
+char **
+event_expr_environment (EventExprState   *state,
+			char           ***env,
+			const void       *parent,
+			size_t           *len,
+			const char       *key)
+{
+	nih_local char *evlist = NULL;
+
+	nih_assert (state != NULL);
+	nih_assert (env != NULL);
+	nih_assert (len != NULL);
+
+	if (key) {
+		evlist = nih_sprintf (NULL, "%s=", key);
+		if (! evlist)
+			return NULL;
+	}
+
+	if (! *env) {
+		*env = nih_str_array_new (parent);
+		if (! *env)
+			return NULL;
+	}
+
+	/* Post-order visits the leaves left to right, which is the same
+	 * order the tree form collects them in.
+	 */
+	for (size_t i = 0; i < state->expr->len; i++) {
+		Event *event = state->event[i];
+
+		if (state->expr->nodes[i].type != EVENT_MATCH)
+			continue;
+
+		if (! event_expr_active (state, i))
+			continue;
+
+		nih_assert (event != NULL);
+
+		if (! environ_append (env, parent, len, TRUE, event->env))
+			return NULL;
+
+		if (evlist) {
+			if (evlist[strlen (evlist) - 1] != '=') {
+				if (! nih_strcat_sprintf (&evlist, NULL, " %s",
+							  event->name))
+					return NULL;
+			} else {
+				if (! nih_strcat (&evlist, NULL, event->name))
+					return NULL;
+			}
+		}
+	}
+
+	if (evlist)
+		if (! environ_add (env, parent, len, TRUE, evlist))
+			return NULL;
+
+	return *env;
+}
+
+/**
+ * event_expr_events:
+ * @state: expression state to collect from,
+ * @parent: parent object for blocked structures,
+ * @list: list to add events to.
+ *
+ * Collects the events that made the expression TRUE, blocking each and
+ * appending a Blocked structure for it to @list, as event_operator_events()
+ * does for an EventOperator tree.
+ **/
+void
+event_expr_events (EventExprState *state,
+		   const void     *parent,
+		   NihList        *list)
+{
+	nih_assert (state != NULL);
+	nih_assert (list != NULL);
+
+	for (size_t i = 0; i < state->expr->len; i++) {
+		Blocked *blocked;
+
+		if (state->expr->nodes[i].type != EVENT_MATCH)
+			continue;
+
+		if (! event_expr_active (state, i))
+			continue;
+
+		nih_assert (state->event[i] != NULL);
+
+		blocked = NIH_MUST (blocked_new (parent, BLOCKED_EVENT,
+						 state->event[i]));
+		nih_list_add (list, &blocked->entry);
+
+		event_block (blocked->event);
+	}
+}
+
+/**
+ * event_expr_reset:
+ * @state: expression state to reset.
+ *
+ * Resets @state, unblocking any events that were matched and clearing
+ * the value of every node.
+ **/
+void
+event_expr_reset (EventExprState *state)
+{
+	nih_assert (state != NULL);
+
+	for (size_t i = 0; i < state->expr->len; i++) {
+		state->value[i] = FALSE;
+
+		if (state->event[i]) {
+			event_unblock (state->event[i]);
+			state->event[i] = NULL;
+		}
+	}
+}
+
+/**
+ * event_expr_collapse_node:
+ * @expr: compiled expression,
+ * @i: index of node to collapse.
+ *
+ * Returns: newly-allocated string representing the sub-expression at @i,
+ * bracketed unless it is a lone EVENT_MATCH.
+ **/
+static char *
+event_expr_collapse_node (const EventExpr *expr,
+			  int              i)
+{
+	const EventExprNode *node = &expr->nodes[i];
+	nih_local char      *left_expr = NULL;
+	nih_local char      *right_expr = NULL;
+
+	if (node->type == EVENT_MATCH) {
+		nih_local char *env = NULL;
+
+		if (node->env)
+			env = NIH_MUST (state_collapse_env ((const char **)node->env));
+
+		return NIH_MUST (nih_sprintf (NULL, "%s%s%s",
+					      node->name,
+					      env ? " " : "",
+					      env ? env : ""));
+	}
+
+	left_expr = event_expr_collapse_node (expr, node->left);
+	right_expr = event_expr_collapse_node (expr, node->right);
+
+	return NIH_MUST (nih_sprintf (NULL, "(%s %s %s)",
+				      left_expr,
+				      node->type == EVENT_OR ? "or" : "and",
+				      right_expr));
+}
+
+/**
+ * event_expr_collapse:
+ * @expr: compiled expression.
+ *
+ * Reconstructs the condition @expr was compiled from, exactly as
+ * event_operator_collapse() does for the original tree.
+ *
+ * Returns: newly-allocated flattened string representing @expr.
+ **/
+char *
+event_expr_collapse (const EventExpr *expr)
+{
+	nih_assert (expr != NULL);
+	nih_assert (expr->len > 0);
+
+	return event_expr_collapse_node (expr, expr->len - 1);
+}
+
+/**
+ * event_expr_state_serialise:
+ * @state: expression state to serialise.
+ *
+ * Convert @state into a JSON representation for serialisation; this is
+ * identical to that produced by event_operator_serialise_all() for the
+ * equivalent tree, so either may be used to deserialise it.
+ *
+ * Returns: JSON object containing array of nodes in post-order,
+ * or NULL on error.
+ **/
+json_object *
+event_expr_state_serialise (const EventExprState *state)
+{
+	json_object *json;
+
+	nih_assert (state != NULL);
+
+	json = json_object_new_array ();
+	if (! json)
+		return NULL;
+
+	for (size_t i = 0; i < state->expr->len; i++) {
+		const EventExprNode *node = &state->expr->nodes[i];
+		json_object         *json_node;
+		int                  value = state->value[i];
+
+		json_node = json_object_new_object ();
+		if (! json_node)
+			goto error;
+
+		if (json_object_array_add (json, json_node) < 0) {
+			json_object_put (json_node);
+			goto error;
+		}
+
+		if (! state_set_json_enum_var (json_node,
+					event_operator_type_enum_to_str,
+					"type", node->type))
+			goto error;
+
+		if (! state_set_json_int_var (json_node, "value", value))
+			goto error;
+
+		if (node->name) {
+			if (! state_set_json_string_var (json_node, "name",
+							 node->name))
+				goto error;
+		}
+
+		if (node->env) {
+			if (! state_set_json_str_array_from_obj (json_node,
+								 node, env))
+				goto error;
+		}
+
+		if (state->event[i]) {
+			int event_index;
+
+			event_index = event_to_index (state->event[i]);
+			if (event_index < 0)
+				goto error;
+
+			if (! state_set_json_int_var (json_node, "event",
+						      event_index))
+				goto error;
+		}
+	}
+
+	return json;
+
+error:
+	json_object_put (json);
+	return NULL;
+}
+
+/**
+ * event_expr_equal:
+ * @expr: compiled expression,
+ * @root: operator tree.
+ *
+ * Returns: TRUE if @expr has the same shape, names and environment as
+ * the tree rooted at @root, FALSE otherwise.
+ **/
+static int
+event_expr_equal (const EventExpr *expr,
+		  EventOperator   *root)
+{
+	size_t i = 0;
+
+	nih_assert (expr != NULL);
+	nih_assert (root != NULL);
+
+	NIH_TREE_FOREACH_POST (&root->node, iter) {
+		EventOperator       *oper = (EventOperator *)iter;
+		const EventExprNode *node;
+		char * const        *a;
+		char * const        *b;
+
+		if (i >= expr->len)
+			return FALSE;
+
+		node = &expr->nodes[i++];
+
+		if (node->type != oper->type)
+			return FALSE;
+
+		if (node->type != EVENT_MATCH)
+			continue;
+
+		if (node->name != oper->name)
+			return FALSE;
+
+		for (a = node->env, b = oper->env;
+		     a && *a && b && *b; a++, b++)
+			if (strcmp (*a, *b))
+				return FALSE;
+
+		if ((a && *a) || (b && *b))
+			return FALSE;
+	}
+
+	return i == expr->len;
+}
+
+/**
+ * event_expr_state_from_operator:
+ * @parent: parent object for new state,
+ * @expr: compiled expression to use if possible,
+ * @root: operator tree holding the state.
+ *
+ * Creates an EventExprState holding the values and matched events of the
+ * tree rooted at @root; used when restoring state serialised in the tree
+ * format.  @expr is shared if it matches @root, otherwise a new
+ * expression is compiled from @root.
+ *
+ * The matched events are moved from @root to the new state without
+ * changing their blockers count, so @root may then be freed without
+ * unblocking them.
+ *
+ * Returns: newly allocated EventExprState structure, or NULL if
+ * insufficient memory.
+ **/
+EventExprState *
+event_expr_state_from_operator (const void    *parent,
+				EventExpr     *expr,
+				EventOperator *root)
+{
+	nih_local EventExpr *new_expr = NULL;
+	EventExprState      *state;
+	size_t               i = 0;
+
+	nih_assert (root != NULL);
+
+	if (! (expr && event_expr_equal (expr, root))) {
+		new_expr = event_expr_new (NULL, root);
+		if (! new_expr)
+			return NULL;
+
+		expr = new_expr;
+	}
+
+	state = event_expr_state_new (parent, expr);
+	if (! state)
+		return NULL;
+
+	NIH_TREE_FOREACH_POST (&root->node, iter) {
+		EventOperator *oper = (EventOperator *)iter;
+
+		state->value[i] = oper->value;
+		state->event[i] = oper->event;
+		oper->event = NULL;
+
+		i++;
+	}
+
+	return state;
+}
+
+/**
+ * event_expr_state_deserialise:
+ * @parent: parent object for new state,
+ * @expr: compiled expression to use if possible,
+ * @json: JSON-serialised array of nodes in post-order.
+ *
+ * Convert @json, as produced by event_expr_state_serialise() or
+ * event_operator_serialise_all(), back into an EventExprState.  @expr is
+ * shared if it matches the serialised expression, otherwise a new
+ * expression is compiled.
+ *
+ * Returns: EventExprState structure, or NULL on error.
+ **/
+EventExprState *
+event_expr_state_deserialise (const void  *parent,
+			      EventExpr   *expr,
+			      json_object *json)
+{
+	nih_local char *scratch = NULL;
+	EventOperator  *root;
+
+	nih_assert (json != NULL);
+
+	/* Every node of the deserialised tree is a child of @scratch so
+	 * the whole tree is freed along with it.
+	 */
+	scratch = nih_strdup (NULL, "");
+	if (! scratch)
+		return NULL;
+
+	root = event_operator_deserialise_all (scratch, json);
+	if (! root)
+		return NULL;
+
+	return event_expr_state_from_operator (parent, expr, root);
+}
@@ -43,7 +43,7 @@ typedef enum event_operator_type {
  * @node: tree node,
  * @type: operator type,
  * @value: operator value,
- * @name: name of event to match (EVENT_MATCH only),
+ * @name: interned name of event to match (EVENT_MATCH only),
  * @env: environment variables of event to match (EVENT_MATCH only),
  * @event: event matched (EVENT_MATCH only).
  *
@@ -72,9 +72,82 @@ typedef struct event_operator {
 	Event              *event;
 } EventOperator;
 
+/**
+ * EventExprNode:
+ * @type: operator type,
+ * @parent: index of parent node, or -1 for the root,
+ * @left: index of left child (EVENT_OR and EVENT_AND only),
+ * @right: index of right child (EVENT_OR and EVENT_AND only),
+ * @name: interned name of event to match (EVENT_MATCH only),
+ * @env: environment variables of event to match (EVENT_MATCH only).
+ *
+ * A single node of an EventExpr.  Nodes are stored in post-order so a
+ * node's children always precede it; @left and @right are -1 for
+ * EVENT_MATCH nodes.
+ **/
+typedef struct event_expr_node {
+	EventOperatorType   type;
+	int                 parent;
+	int                 left;
+	int                 right;
+
+	char               *name;
+	char              **env;
+} EventExprNode;
+
+/**
+ * EVENT_OPERATOR_SCRATCH_MAX:
+ *
+ * Default largest number of stack entries kept for reuse by
+ * event_operator_collapse().
+ **/
+#define EVENT_OPERATOR_SCRATCH_MAX 32
+
+
+/**
+ * EventExpr:
+ * @len: number of nodes,
+ * @nodes: array of @len nodes in post-order.
+ *
+ * Immutable, contiguous form of an EventOperator tree, compiled once by
+ * event_expr_new() and shared by everything that needs to match against
+ * the same expression (for example, every instance of a job class).
+ * The root of the expression is always the last node.
+ *
+ * Matching state is held separately in an EventExprState.
+ **/
+typedef struct event_expr {
+	size_t          len;
+	EventExprNode  *nodes;
+} EventExpr;
+
+/**
+ * EventExprState:
+ * @expr: expression (referenced),
+ * @event: array of events matched, indexed as @expr's nodes,
+ * @value: array of operator values, indexed as @expr's nodes.
+ *
+ * Matching state of an EventExpr; @event and @value have the same meaning
+ * as the equivalent EventOperator members.  Both arrays are held in the
+ * same allocation as the structure so a new state costs a single small
+ * allocation.
+ **/
+typedef struct event_expr_state {
+	EventExpr      *expr;
+	Event         **event;
+	int            *value;
+} EventExprState;
+
 
 NIH_BEGIN_EXTERN
 
+extern unsigned int event_operator_scratch_max;
+extern unsigned int event_operator_scratch_pooled;
+extern unsigned int event_operator_scratch_in_use;
+extern unsigned int event_operator_scratch_peak;
+extern unsigned int event_operator_scratch_reused;
+
+
 EventOperator *event_operator_new         (const void *parent,
 					   EventOperatorType type,
 					   const char *name, char **env)
@@ -136,6 +209,45 @@ event_operator_deserialise_all (void *parent, json_object *json)
 char *event_operator_collapse (EventOperator *condition)
 	__attribute__ ((warn_unused_result, unused));
 
+EventExpr *    event_expr_new            (const void *parent,
+					  EventOperator *root)
+	__attribute__ ((warn_unused_result, malloc));
+
+EventExprState *event_expr_state_new     (const void *parent,
+					  EventExpr *expr)
+	__attribute__ ((warn_unused_result, malloc));
+EventExprState *event_expr_state_from_operator (const void *parent,
+						EventExpr *expr,
+						EventOperator *root)
+	__attribute__ ((warn_unused_result, malloc));
+
+int            event_expr_state_destroy  (EventExprState *state);
+
+int            event_expr_value          (const EventExprState *state)
+	__attribute__ ((warn_unused_result));
+
+int            event_expr_handle         (EventExprState *state,
+					  Event *event, char * const *env);
+
+char **        event_expr_environment    (EventExprState *state,
+					  char ***env, const void *parent,
+					  size_t *len, const char *key);
+void           event_expr_events         (EventExprState *state,
+					  const void *parent, NihList *list);
+
+void           event_expr_reset          (EventExprState *state);
+
+char *         event_expr_collapse       (const EventExpr *expr)
+	__attribute__ ((warn_unused_result));
+
+json_object *  event_expr_state_serialise (const EventExprState *state)
+	__attribute__ ((warn_unused_result));
+
+EventExprState *event_expr_state_deserialise (const void *parent,
+					      EventExpr *expr,
+					      json_object *json)
+	__attribute__ ((warn_unused_result));
+
 NIH_END_EXTERN
 
 #endif /* INIT_EVENT_OPERATOR_H */
@@ -63,6 +63,14 @@
  **/
 #define PWRSTATUS_EVENT "power-status-changed"
 
+/**
+ * RUNLEVEL_EVENT:
+ *
+ * Name of the event that telinit and shutdown emit to change the system
+ * runlevel.
+ **/
+#define RUNLEVEL_EVENT "runlevel"
+
 
 /**
  * JOB_STARTING_EVENT:
@@ -100,5 +108,21 @@
  **/
 #define JOB_STOPPED_EVENT "stopped"
 
+/**
+ * JOB_DEFERRED_EVENT:
+ *
+ * Name of the event we generate when a job that defers under pressure is
+ * held in the queue because a resource is under pressure.
+ **/
+#define JOB_DEFERRED_EVENT "deferred"
+
+/**
+ * JOB_ADMITTED_EVENT:
+ *
+ * Name of the event we generate when a deferred job is allowed to start,
+ * either because pressure was relieved or its maximum delay expired.
+ **/
+#define JOB_ADMITTED_EVENT "admitted"
+
 
 #endif /* INIT_EVENTS_H */
@@ -0,0 +1,160 @@
+/* upstart
+ *
+ * intern.c - shared, reference-counted strings
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/logging.h>
+
+#include "intern.h"
+
+
+/* Prototypes for static functions */
+static int intern_entry_destroy (NihListEntry *entry);
+
+
+/**
+ * intern_strings:
+ *
+ * This hash table holds the list of interned strings, indexed by the
+ * string itself; each item is an NihListEntry structure whose @str
+ * member is the shared string.
+ **/
+NihHash *intern_strings = NULL;
+
+/**
+ * intern_strings_count:
+ *
+ * Number of entries currently held in intern_strings.
+ **/
+static size_t intern_strings_count = 0;
+
+
+/**
+ * intern_init:
+ *
+ * Initialise the intern table.
+ **/
+void
+intern_init (void)
+{
+	if (! intern_strings)
+		intern_strings = NIH_MUST (nih_hash_string_new (NULL, 0));
+}
+
+
+/**
+ * intern_string:
+ * @parent: parent object for string,
+ * @str: string to intern.
+ *
+ * Returns the single shared copy of @str, allocating it and adding it to
+ * the intern table if this is the first time it has been seen.  Strings
+ * returned by this function for equal @str are always the same pointer,
+ * so they may be compared with == rather than strcmp().
+ *
+ * The returned string is referenced by @parent, which must not be NULL
+ * since the string is shared between all of its holders.  The string is
+ * removed from the table and freed once all of its parents have been
+ * freed or have dropped their reference with nih_unref(); it must never
+ * be freed with nih_free() or modified.
+ *
+ * Returns: shared string or NULL if insufficient memory.
+ **/
+char *
+intern_string (const void *parent,
+	       const char *str)
+{
+	NihListEntry *entry;
+	char         *interned;
+
+	nih_assert (parent != NULL);
+	nih_assert (str != NULL);
+
+	intern_init ();
+
+	entry = (NihListEntry *)nih_hash_lookup (intern_strings, str);
+	if (entry) {
+		nih_ref (entry->str, parent);
+		return entry->str;
+	}
+
+	interned = nih_strdup (parent, str);
+	if (! interned)
+		return NULL;
+
+	/* The hash entry is a child of the string, so it's removed from
+	 * the table when the last reference to the string goes.
+	 */
+	entry = nih_list_entry_new (interned);
+	if (! entry) {
+		nih_free (interned);
+		return NULL;
+	}
+
+	entry->str = interned;
+	nih_alloc_set_destructor (entry, intern_entry_destroy);
+
+	nih_hash_add (intern_strings, &entry->entry);
+	intern_strings_count++;
+
+	nih_debug ("Interned %s (%zu strings)", interned,
+		   intern_strings_count);
+
+	return interned;
+}
+
+/**
+ * intern_entry_destroy:
+ * @entry: intern table entry being freed.
+ *
+ * Removes @entry from the intern table and updates the count of entries.
+ *
+ * Returns: zero.
+ **/
+static int
+intern_entry_destroy (NihListEntry *entry)
+{
+	nih_assert (entry != NULL);
+	nih_assert (intern_strings_count > 0);
+
+	intern_strings_count--;
+
+	return nih_list_destroy (&entry->entry);
+}
+
+
+/**
+ * intern_count:
+ *
+ * Returns: number of distinct strings currently interned.
+ **/
+size_t
+intern_count (void)
+{
+	return intern_strings_count;
+}
@@ -0,0 +1,43 @@
+/* upstart
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_INTERN_H
+#define INIT_INTERN_H
+
+#include <stddef.h>
+
+#include <nih/macros.h>
+#include <nih/hash.h>
+
+
+NIH_BEGIN_EXTERN
+
+extern NihHash *intern_strings;
+
+
+void   intern_init   (void);
+
+char * intern_string (const void *parent, const char *str)
+	__attribute__ ((warn_unused_result));
+
+size_t intern_count  (void)
+	__attribute__ ((warn_unused_result));
+
+NIH_END_EXTERN
+
+#endif /* INIT_INTERN_H */
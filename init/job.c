@@ -27,6 +27,7 @@
 
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
@@ -54,9 +55,14 @@
 #include "event_operator.h"
 #include "blocked.h"
 #include "control.h"
+#include "quiesce.h"
 #include "parse_job.h"
 #include "state.h"
 #include "apparmor.h"
+#include "intern.h"
+#include "trace.h"
+#include "job_queue.h"
+#include "usage.h"
 
 #ifdef ENABLE_CGROUPS
 #include "cgroup.h"
@@ -82,16 +88,20 @@ job_trace_state_str_to_enum (const char *state)
 	__attribute__ ((warn_unused_result));
 
 static json_object *
-job_serialise_kill_timer (NihTimer *timer)
+job_serialise_timer (WheelTimer *timer)
 	__attribute__ ((warn_unused_result));
 
-static NihTimer *
-job_deserialise_kill_timer (json_object *json)
+static WheelTimer *
+job_deserialise_timer (json_object *json)
 	__attribute__ ((warn_unused_result));
 
 static int 
 job_destroy (Job *job);
 
+static void job_timing_enter   (Job *job);
+static void job_timing_release (Event *event, Job *blocker);
+static void job_timing_retire  (Job *job);
+
 /**
  * job_destroy:
  *
@@ -120,6 +130,16 @@ job_destroy (Job *job)
 			}
 		}
 	}
+
+	/* Processes of a job being freed are no longer counted */
+	if (job->pid) {
+		for (i = 0; i < PROCESS_LAST; i++)
+			job_process_set_pid (job, i, 0);
+	}
+
+	/* Give up our place in the queue or our spawn slot */
+	job_queue_leave (job);
+
 	nih_list_destroy (&job->entry);
 
 	return 0;
@@ -159,7 +179,11 @@ job_new (JobClass   *class,
 	nih_list_init (&job->entry);
 
 	/* Ensure unset before destructor could possibly be called */
+	job->pid = NULL;
 	job->process_data = NULL;
+	job->queued = NULL;
+	job->spawn_slot = FALSE;
+	job->deferred = FALSE;
 
 	nih_alloc_set_destructor (job, job_destroy);
 
@@ -189,8 +213,18 @@ job_new (JobClass   *class,
 
 	job->stop_on = NULL;
 
+	/* The class's stop_on expression is compiled once, on first use;
+	 * each instance only needs its own small matching state.
+	 */
 	if (class->stop_on) {
-		job->stop_on = event_operator_copy (job, class->stop_on);
+		if (! class->stop_on_expr) {
+			class->stop_on_expr = event_expr_new (class,
+							      class->stop_on);
+			if (! class->stop_on_expr)
+				goto error;
+		}
+
+		job->stop_on = event_expr_state_new (job, class->stop_on_expr);
 		if (! job->stop_on)
 			goto error;
 	}
@@ -230,6 +264,9 @@ job_new (JobClass   *class,
 
 	job->respawn_time = 0;
 	job->respawn_count = 0;
+	job->respawn_delay = 0;
+	job->respawn_due = 0;
+	job->respawn_timer = NULL;
 
 	job->trace_forks = 0;
 	job->trace_state = TRACE_NONE;
@@ -261,6 +298,12 @@ job_new (JobClass   *class,
 	for (i = 0; i < PROCESS_LAST; i++)
 		job->process_data[i] = NULL;
 
+	job->timing = job_timing_new (job);
+	if (! job->timing)
+		goto error;
+
+	job->usage = NULL;
+
 	return job;
 
 error:
@@ -318,6 +361,9 @@ job_register (Job            *job,
  * begin to be stopped and will either block in the PRE-STOP state for
  * the pre-stop script or the STOPPING state for an event to finish.
  *
+ * If the job is waiting to be respawned and @goal is STOP, the respawn is
+ * cancelled and the job will be stopped.
+ *
  * Thus in all circumstances, @job is safe to use once this function
  * returns.  Though further calls to job_change_state may change that as
  * noted.
@@ -360,7 +406,19 @@ job_change_goal (Job     *job,
 
 		break;
 	case JOB_STOP:
-		if (job->state == JOB_RUNNING)
+		if (job->respawn_timer) {
+			nih_unref (job->respawn_timer, job);
+			job->respawn_timer = NULL;
+
+			if ((job->state == JOB_POST_STOP)
+			    && (job->pid[PROCESS_POST_STOP] <= 0)) {
+				job_change_state (job, job_next_state (job));
+				break;
+			}
+		}
+
+		if ((job->state == JOB_RUNNING)
+		    || (job->state == JOB_QUEUED))
 			job_change_state (job, job_next_state (job));
 
 		break;
@@ -406,12 +464,22 @@ job_change_state (Job      *job,
 		if (job->blocker)
 		    return;
 
+		/* Hold a respawning job until its respawn delay has
+		 * passed, the respawn timer will move it on.
+		 */
+		if (job->respawn_timer && (job->state == JOB_POST_STOP)
+		    && (state == JOB_STARTING))
+			return;
+
 		nih_info (_("%s state changed from %s to %s"), job_name (job),
 			  job_state_name (job->state), job_state_name (state));
 
 		old_state = job->state;
 		job->state = state;
 
+		job_timing_enter (job);
+		quiesce_job_changed (job);
+
 		NIH_LIST_FOREACH (control_conns, iter) {
 			NihListEntry   *entry = (NihListEntry *)iter;
 			DBusConnection *conn = (DBusConnection *)entry->data;
@@ -475,10 +543,21 @@ job_change_state (Job      *job,
 				state = job_next_state (job);
 			}
 			break;
-		case JOB_PRE_STARTING:
+		case JOB_QUEUED:
 			nih_assert (job->goal == JOB_START);
 			nih_assert (old_state == JOB_SECURITY);
 
+			/* Wait here for a spawn slot if too many jobs are
+			 * already starting, job_queue_poll() will move us
+			 * on once there is one.
+			 */
+			if (job_queue_enter (job))
+				state = job_next_state (job);
+			break;
+		case JOB_PRE_STARTING:
+			nih_assert (job->goal == JOB_START);
+			nih_assert (old_state == JOB_QUEUED);
+
 			/* spawn pre-start asynchronously, child
 			 * watcher asynchronously will change goal to
 			 * stop if spawning fails.
@@ -538,6 +617,9 @@ job_change_state (Job      *job,
 			nih_assert ((old_state == JOB_POST_START)
 				    || (old_state == JOB_PRE_STOP));
 
+			/* Finished starting, let the next job go */
+			job_queue_leave (job);
+
 			if (old_state == JOB_PRE_STOP) {
 				/* Throw away the stop environment */
 				if (job->stop_env) {
@@ -580,11 +662,14 @@ job_change_state (Job      *job,
 				    || (old_state == JOB_PRE_STARTING)
 				    || (old_state == JOB_PRE_START)
 				    || (old_state == JOB_SECURITY)
+				    || (old_state == JOB_QUEUED)
 				    || (old_state == JOB_SPAWNED)
 				    || (old_state == JOB_POST_START)
 				    || (old_state == JOB_RUNNING)
 				    || (old_state == JOB_PRE_STOP));
 
+			job_queue_leave (job);
+
 			job->blocker = job_emit_event (job);
 
 			break;
@@ -653,7 +738,10 @@ job_change_state (Job      *job,
 							  job->path));
 				}
 
-				/* Destroy the instance */
+				/* Destroy the instance, keeping its timing
+				 * with the class.
+				 */
+				job_timing_retire (job);
 				nih_free (job);
 			}
 
@@ -714,6 +802,15 @@ job_next_state (Job *job)
 			nih_assert_not_reached ();
 		}
 	case JOB_SECURITY:
+		switch (job->goal) {
+		case JOB_STOP:
+			return JOB_STOPPING;
+		case JOB_START:
+			return JOB_QUEUED;
+		default:
+			nih_assert_not_reached ();
+		}
+	case JOB_QUEUED:
 		switch (job->goal) {
 		case JOB_STOP:
 			return JOB_STOPPING;
@@ -925,6 +1022,9 @@ job_finished (Job *job,
 
 			event_unblock (blocked->event);
 
+			if (! blocked->event->blockers)
+				job_timing_release (blocked->event, job);
+
 			break;
 		case BLOCKED_JOB_START_METHOD:
 			if (failed) {
@@ -1001,10 +1101,324 @@ job_finished (Job *job,
 			nih_assert_not_reached ();
 		}
 
-		nih_free (blocked);
+		blocked_release (blocked, job);
+	}
+}
+
+
+/**
+ * job_timing_new:
+ * @parent: parent object for new structure.
+ *
+ * Allocates and returns a new, empty, JobTiming structure.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned structure.  When all parents
+ * of the returned structure are freed, the returned structure will also
+ * be freed.
+ *
+ * Returns: newly allocated JobTiming structure or NULL if insufficient
+ * memory.
+ **/
+JobTiming *
+job_timing_new (const void *parent)
+{
+	JobTiming *timing;
+
+	timing = nih_new (parent, JobTiming);
+	if (! timing)
+		return NULL;
+
+	memset (timing->entered, 0, sizeof (timing->entered));
+
+	timing->cause = NULL;
+	timing->cause_job = NULL;
+	timing->cause_instance = NULL;
+
+	timing->start_blocker = NULL;
+	timing->stop_blocker = NULL;
+
+	return timing;
+}
+
+/**
+ * job_timing_replace:
+ * @timing: timing structure,
+ * @field: pointer to string member of @timing,
+ * @value: new value, may be NULL.
+ *
+ * Replace the string in @field with a copy of @value owned by @timing.
+ **/
+static void
+job_timing_replace (JobTiming   *timing,
+		    char       **field,
+		    const char  *value)
+{
+	nih_assert (timing != NULL);
+	nih_assert (field != NULL);
+
+	if (*field)
+		nih_free (*field);
+
+	*field = value ? NIH_MUST (nih_strdup (timing, value)) : NULL;
+}
+
+/**
+ * job_timing_enter:
+ * @job: job that has changed state.
+ *
+ * Record the time that @job entered its current state.  Entering the
+ * starting state begins a new run, so everything recorded for the
+ * previous run is discarded first.
+ **/
+static void
+job_timing_enter (Job *job)
+{
+	JobTiming *timing;
+
+	nih_assert (job != NULL);
+	nih_assert (job->timing != NULL);
+
+	timing = job->timing;
+
+	if (job->state == JOB_STARTING) {
+		memset (timing->entered, 0, sizeof (timing->entered));
+
+		job_timing_replace (timing, &timing->cause, NULL);
+		job_timing_replace (timing, &timing->cause_job, NULL);
+		job_timing_replace (timing, &timing->cause_instance, NULL);
+		job_timing_replace (timing, &timing->start_blocker, NULL);
+		job_timing_replace (timing, &timing->stop_blocker, NULL);
+	}
+
+	timing->entered[job->state] = trace_now ();
+}
+
+/**
+ * job_timing_set_cause:
+ * @job: job being started,
+ * @start_on: start condition that became true.
+ *
+ * Record which event caused @job to be started; of the events matched
+ * in @start_on this is the one emitted most recently, since that is the
+ * one that completed the condition.  If the event was emitted by another
+ * job, that job is recorded too so the chain of causes may be followed.
+ *
+ * Must be called after the job has entered the starting state, and before
+ * @start_on is reset; if the job is still stopping from a previous run,
+ * nothing is recorded since that would be discarded on entering starting.
+ **/
+void
+job_timing_set_cause (Job           *job,
+		      EventOperator *start_on)
+{
+	Event *cause = NULL;
+	int    cause_index = -1;
+
+	nih_assert (job != NULL);
+	nih_assert (job->timing != NULL);
+	nih_assert (start_on != NULL);
+
+	if (job->state != JOB_STARTING)
+		return;
+
+	/* Events are queued in the order they are emitted, so the most
+	 * recent is the one latest in the list.
+	 */
+	NIH_TREE_FOREACH_POST (&start_on->node, iter) {
+		EventOperator *oper = (EventOperator *)iter;
+		int            event_index;
+
+		if ((oper->type != EVENT_MATCH) || (! oper->event))
+			continue;
+
+		event_index = event_to_index (oper->event);
+		if (event_index > cause_index) {
+			cause = oper->event;
+			cause_index = event_index;
+		}
+	}
+
+	if (! cause)
+		return;
+
+	job_timing_replace (job->timing, &job->timing->cause, cause->name);
+	job_timing_replace (job->timing, &job->timing->cause_job,
+			    environ_get (cause->env, "JOB"));
+	job_timing_replace (job->timing, &job->timing->cause_instance,
+			    environ_get (cause->env, "INSTANCE"));
+}
+
+/**
+ * job_timing_release:
+ * @event: event no longer blocked,
+ * @blocker: job that held the last block on @event.
+ *
+ * Called when @blocker has released the last block on @event, records
+ * @blocker against any job waiting in the starting or stopping state for
+ * @event to finish.
+ **/
+static void
+job_timing_release (Event *event,
+		    Job   *blocker)
+{
+	nih_assert (event != NULL);
+	nih_assert (blocker != NULL);
+
+	NIH_LIST_FOREACH (&event->blocking, iter) {
+		Blocked   *blocked = (Blocked *)iter;
+		JobTiming *timing;
+
+		if (blocked->type != BLOCKED_JOB)
+			continue;
+
+		timing = blocked->job->timing;
+
+		switch (blocked->job->state) {
+		case JOB_STARTING:
+			job_timing_replace (timing, &timing->start_blocker,
+					    job_name (blocker));
+			break;
+		case JOB_STOPPING:
+			job_timing_replace (timing, &timing->stop_blocker,
+					    job_name (blocker));
+			break;
+		default:
+			break;
+		}
 	}
 }
 
+/**
+ * job_timing_retire:
+ * @job: job about to be destroyed.
+ *
+ * Hand the timing of @job to its class, replacing that of any instance
+ * destroyed before it, so that it is still available once @job is freed.
+ **/
+static void
+job_timing_retire (Job *job)
+{
+	nih_assert (job != NULL);
+	nih_assert (job->timing != NULL);
+
+	if (job->class->timing)
+		nih_unref (job->class->timing, job->class);
+
+	job->class->timing = job->timing;
+	nih_ref (job->class->timing, job->class);
+}
+
+/**
+ * job_timing_serialise:
+ * @timing: timing structure to serialise.
+ *
+ * Convert @timing into a JSON representation for serialisation.
+ * Caller must free returned value using json_object_put().
+ *
+ * Returns: JSON-serialised JobTiming object, or NULL on error.
+ **/
+json_object *
+job_timing_serialise (const JobTiming *timing)
+{
+	json_object *json;
+	json_object *json_entered;
+
+	nih_assert (timing != NULL);
+
+	json = json_object_new_object ();
+	if (! json)
+		return NULL;
+
+	json_entered = state_serialise_int64_array (
+		(int64_t *)timing->entered, JOB_TIMING_STATES);
+	if (! json_entered)
+		goto error;
+
+	json_object_object_add (json, "entered", json_entered);
+
+	if (! state_set_json_string_var_from_obj (json, timing, cause))
+		goto error;
+
+	if (! state_set_json_string_var_from_obj (json, timing, cause_job))
+		goto error;
+
+	if (! state_set_json_string_var_from_obj (json, timing, cause_instance))
+		goto error;
+
+	if (! state_set_json_string_var_from_obj (json, timing, start_blocker))
+		goto error;
+
+	if (! state_set_json_string_var_from_obj (json, timing, stop_blocker))
+		goto error;
+
+	return json;
+
+error:
+	json_object_put (json);
+	return NULL;
+}
+
+/**
+ * job_timing_deserialise:
+ * @parent: parent object for new structure,
+ * @json: JSON-serialised JobTiming object to deserialise.
+ *
+ * Convert @json back into a JobTiming structure.  Entries for states not
+ * known to this version are ignored, and those missing left as zero.
+ *
+ * Returns: JobTiming object, or NULL on error.
+ **/
+JobTiming *
+job_timing_deserialise (const void  *parent,
+			json_object *json)
+{
+	JobTiming          *timing;
+	json_object        *json_entered;
+	nih_local int64_t  *entered = NULL;
+	size_t              len = 0;
+
+	nih_assert (json != NULL);
+
+	if (! state_check_json_type (json, object))
+		return NULL;
+
+	timing = job_timing_new (parent);
+	if (! timing)
+		return NULL;
+
+	if (! json_object_object_get_ex (json, "entered", &json_entered))
+		goto error;
+
+	if (state_deserialise_int64_array (NULL, json_entered,
+					   &entered, &len) < 0)
+		goto error;
+
+	for (size_t i = 0; (i < len) && (i < JOB_TIMING_STATES); i++)
+		timing->entered[i] = entered[i];
+
+	if (! state_get_json_string_var_to_obj (json, timing, cause))
+		goto error;
+
+	if (! state_get_json_string_var_to_obj (json, timing, cause_job))
+		goto error;
+
+	if (! state_get_json_string_var_to_obj (json, timing, cause_instance))
+		goto error;
+
+	if (! state_get_json_string_var_to_obj (json, timing, start_blocker))
+		goto error;
+
+	if (! state_get_json_string_var_to_obj (json, timing, stop_blocker))
+		goto error;
+
+	return timing;
+
+error:
+	nih_free (timing);
+	return NULL;
+}
+
 
 /**
  * job_emit_event:
@@ -1127,7 +1541,7 @@ job_emit_event (Job *job)
 	}
 
 	event = NIH_MUST (event_new (NULL, name, env));
-	event->session = job->class->session;
+	event_set_session (event, job->class->session);
 
 	if (block) {
 		Blocked *blocked;
@@ -1241,6 +1655,8 @@ job_state_name (JobState state)
 		return N_("security-spawning");
 	case JOB_SECURITY:
 		return N_("security");
+	case JOB_QUEUED:
+		return N_("queued");
 	case JOB_PRE_STARTING:
 		return N_("pre-starting");
 	case JOB_PRE_START:
@@ -1293,6 +1709,8 @@ job_state_from_name (const char *state)
 		return JOB_SECURITY_SPAWNING;
 	} else if (! strcmp (state, "security")) {
 		return JOB_SECURITY;
+	} else if (! strcmp (state, "queued")) {
+		return JOB_QUEUED;
 	} else if (! strcmp (state, "pre-starting")) {
 		return JOB_PRE_STARTING;
 	} else if (! strcmp (state, "pre-start")) {
@@ -1381,7 +1799,7 @@ job_start (Job             *job,
 	/* Job has specified a cgroup stanza but since the cgroup
 	 * manager has not yet been contacted, the job cannot be started.
 	 */
-	if (job_class_cgroups (job->class) && ! cgroup_manager_available ()) {
+	if (job_class_cgroups (job->class) && ! cgroup_available ()) {
 		nih_dbus_error_raise_printf (
 			DBUS_INTERFACE_UPSTART ".Error.CGroupManagerNotAvailable",
 			_("Job cannot be started as cgroup manager not available: %s"),
@@ -1780,6 +2198,196 @@ job_get_processes (Job *                  job,
 	return 0;
 }
 
+/**
+ * job_get_next_respawn:
+ * @job: job to obtain next respawn time from,
+ * @message: D-Bus connection and message received,
+ * @next_respawn: pointer for reply value.
+ *
+ * Implements the get method for the next_respawn property of the
+ * com.ubuntu.Upstart.Instance interface.
+ *
+ * Called to obtain the time, in seconds since the epoch, at which the
+ * given @job will next be respawned if it is waiting for its respawn
+ * delay to pass, or zero if it isn't; this will be stored in
+ * @next_respawn.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+job_get_next_respawn (Job            *job,
+		      NihDBusMessage *message,
+		      int64_t        *next_respawn)
+{
+	struct timespec now;
+
+	nih_assert (job != NULL);
+	nih_assert (message != NULL);
+	nih_assert (next_respawn != NULL);
+
+	*next_respawn = 0;
+
+	if (! job->respawn_timer)
+		return 0;
+
+	/* The timer runs on the monotonic clock */
+	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
+
+	*next_respawn = time (NULL) + (job->respawn_timer->due - now.tv_sec);
+
+	return 0;
+}
+
+/**
+ * job_usage_current:
+ * @job: job to read,
+ * @usage: structure to fill in.
+ *
+ * Read the current resource usage counters of @job into @usage, leaving
+ * them zero if they cannot be read since not every job has cgroups.
+ **/
+static void
+job_usage_current (Job      *job,
+		   JobUsage *usage)
+{
+	nih_assert (job != NULL);
+	nih_assert (usage != NULL);
+
+	if (usage_read (job, usage) < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_debug ("%s: %s", job_name (job), err->message);
+		nih_free (err);
+
+		memset (usage, 0, sizeof (JobUsage));
+	}
+}
+
+/**
+ * job_get_cpu_time:
+ * @job: job to obtain usage from,
+ * @message: D-Bus connection and message received,
+ * @cpu_time: pointer for reply value.
+ *
+ * Implements the get method for the cpu_time property of the
+ * com.ubuntu.Upstart.Instance interface.
+ *
+ * Called to obtain the CPU time, in microseconds, consumed by the
+ * cgroups of the given @job, which will be stored in @cpu_time.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+job_get_cpu_time (Job            *job,
+		  NihDBusMessage *message,
+		  uint64_t       *cpu_time)
+{
+	JobUsage usage;
+
+	nih_assert (job != NULL);
+	nih_assert (message != NULL);
+	nih_assert (cpu_time != NULL);
+
+	job_usage_current (job, &usage);
+	*cpu_time = usage.cpu;
+
+	return 0;
+}
+
+/**
+ * job_get_memory_usage:
+ * @job: job to obtain usage from,
+ * @message: D-Bus connection and message received,
+ * @memory_usage: pointer for reply value.
+ *
+ * Implements the get method for the memory_usage property of the
+ * com.ubuntu.Upstart.Instance interface.
+ *
+ * Called to obtain the memory, in bytes, in use by the cgroups of the
+ * given @job, which will be stored in @memory_usage.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+job_get_memory_usage (Job            *job,
+		      NihDBusMessage *message,
+		      uint64_t       *memory_usage)
+{
+	JobUsage usage;
+
+	nih_assert (job != NULL);
+	nih_assert (message != NULL);
+	nih_assert (memory_usage != NULL);
+
+	job_usage_current (job, &usage);
+	*memory_usage = usage.memory;
+
+	return 0;
+}
+
+/**
+ * job_get_io_read_bytes:
+ * @job: job to obtain usage from,
+ * @message: D-Bus connection and message received,
+ * @io_read_bytes: pointer for reply value.
+ *
+ * Implements the get method for the io_read_bytes property of the
+ * com.ubuntu.Upstart.Instance interface.
+ *
+ * Called to obtain the number of bytes read from block devices by the
+ * cgroups of the given @job, which will be stored in @io_read_bytes.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+job_get_io_read_bytes (Job            *job,
+		       NihDBusMessage *message,
+		       uint64_t       *io_read_bytes)
+{
+	JobUsage usage;
+
+	nih_assert (job != NULL);
+	nih_assert (message != NULL);
+	nih_assert (io_read_bytes != NULL);
+
+	job_usage_current (job, &usage);
+	*io_read_bytes = usage.io_read;
+
+	return 0;
+}
+
+/**
+ * job_get_io_write_bytes:
+ * @job: job to obtain usage from,
+ * @message: D-Bus connection and message received,
+ * @io_write_bytes: pointer for reply value.
+ *
+ * Implements the get method for the io_write_bytes property of the
+ * com.ubuntu.Upstart.Instance interface.
+ *
+ * Called to obtain the number of bytes written to block devices by the
+ * cgroups of the given @job, which will be stored in @io_write_bytes.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+job_get_io_write_bytes (Job            *job,
+			NihDBusMessage *message,
+			uint64_t       *io_write_bytes)
+{
+	JobUsage usage;
+
+	nih_assert (job != NULL);
+	nih_assert (message != NULL);
+	nih_assert (io_write_bytes != NULL);
+
+	job_usage_current (job, &usage);
+	*io_write_bytes = usage.io_write;
+
+	return 0;
+}
+
 /**
  * job_serialise:
  * @job: job serialise.
@@ -1801,6 +2409,7 @@ job_serialise (const Job *job)
 	json_object      *json_fds;
 	json_object      *json_logs;
 	json_object      *json_handler_data;
+	json_object      *json_timing;
 
 	nih_assert (job);
 
@@ -1836,7 +2445,7 @@ job_serialise (const Job *job)
 	if (job->stop_on) {
 		json_object *json_stop_on;
 
-		json_stop_on = event_operator_serialise_all (job->stop_on);
+		json_stop_on = event_expr_state_serialise (job->stop_on);
 		if (! json_stop_on)
 			goto error;
 
@@ -1890,7 +2499,7 @@ job_serialise (const Job *job)
 	if (job->kill_timer) {
 		json_object *kill_timer;
 
-		kill_timer = job_serialise_kill_timer (job->kill_timer);
+		kill_timer = job_serialise_timer (job->kill_timer);
 
 		if (! kill_timer)
 			goto error;
@@ -1920,6 +2529,30 @@ job_serialise (const Job *job)
 	if (! state_set_json_int_var_from_obj (json, job, respawn_count))
 		goto error;
 
+	if (! state_set_json_int_var_from_obj (json, job, respawn_delay))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, job, respawn_due))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, job, spawn_slot))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, job, deferred))
+		goto error;
+
+	/* conditionally encode respawn timer */
+	if (job->respawn_timer) {
+		json_object *respawn_timer;
+
+		respawn_timer = job_serialise_timer (job->respawn_timer);
+
+		if (! respawn_timer)
+			goto error;
+
+		json_object_object_add (json, "respawn_timer", respawn_timer);
+	}
+
 	if (! state_set_json_int_var_from_obj (json, job, trace_forks))
 		goto error;
 
@@ -1973,6 +2606,12 @@ job_serialise (const Job *job)
 
 	json_object_object_add (json, "process_data", json_handler_data);
 
+	json_timing = job_timing_serialise (job->timing);
+	if (! json_timing)
+		goto error;
+
+	json_object_object_add (json, "timing", json_timing);
+
 	return json;
 
 error:
@@ -2031,13 +2670,16 @@ Job *
 job_deserialise (JobClass *parent, json_object *json)
 {
 	nih_local char *name = NULL;
+	pid_t          *pids = NULL;
 	Job            *job = NULL;
 	json_object    *json_kill_timer;
+	json_object    *json_respawn_timer;
 	json_object    *json_fds;
 	json_object    *json_pid;
 	json_object    *json_logs;
 	json_object    *json_process_data;
 	json_object    *json_stop_on = NULL;
+	json_object    *json_timing;
 	size_t          len;
 	int             ret;
 
@@ -2080,8 +2722,11 @@ job_deserialise (JobClass *parent, json_object *json)
 	if (json_object_object_get_ex (json, "stop_on", &json_stop_on)) {
 
 		if (state_check_json_type (json_stop_on, array)) {
+			if (job->stop_on)
+				nih_free (job->stop_on);
 
-			job->stop_on = event_operator_deserialise_all (job, json_stop_on);
+			job->stop_on = event_expr_state_deserialise (job,
+					parent->stop_on_expr, json_stop_on);
 			if (! job->stop_on)
 				goto error;
 		} else {
@@ -2119,8 +2764,11 @@ job_deserialise (JobClass *parent, json_object *json)
 					goto error;
 				}
 
-				nih_free (job->stop_on);
-				job->stop_on = event_operator_copy (job, tmp->stop_on);
+				if (job->stop_on)
+					nih_free (job->stop_on);
+
+				job->stop_on = event_expr_state_from_operator (job,
+						parent->stop_on_expr, tmp->stop_on);
 				if (! job->stop_on)
 					goto error;
 			}
@@ -2169,7 +2817,7 @@ job_deserialise (JobClass *parent, json_object *json)
 		 *   to give their processes the full amount of time to
 		 *   end.
 		 */
-		nih_local NihTimer *kill_timer = job_deserialise_kill_timer (json_kill_timer);
+		nih_local WheelTimer *kill_timer = job_deserialise_timer (json_kill_timer);
 		if (! kill_timer)
 			goto error;
 
@@ -2196,6 +2844,26 @@ job_deserialise (JobClass *parent, json_object *json)
 	if (! state_get_json_int_var_to_obj (json, job, respawn_count))
 		goto error;
 
+	/* Respawn delays are new, older versions always respawned
+	 * immediately.
+	 */
+	if (json_object_object_get_ex (json, "respawn_delay", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, job, respawn_delay))
+			goto error;
+
+		if (! state_get_json_int_var_to_obj (json, job, respawn_due))
+			goto error;
+	}
+
+	if (json_object_object_get_ex (json, "respawn_timer", &json_respawn_timer)) {
+		nih_local WheelTimer *respawn_timer = job_deserialise_timer (json_respawn_timer);
+		if (! respawn_timer)
+			goto error;
+
+		job_process_set_respawn_timer (job, respawn_timer->timeout);
+		job_process_adj_respawn_timer (job, respawn_timer->due);
+	}
+
 	if (! json_object_object_get_ex (json, "fds", &json_fds))
 		goto error;
 
@@ -2207,27 +2875,34 @@ job_deserialise (JobClass *parent, json_object *json)
 	if (! json_object_object_get_ex (json, "pid", &json_pid))
 		goto error;
 
+	/* Read into a separate array so that the process ids of the job
+	 * are only ever set through job_process_set_pid().
+	 */
 	ret = state_deserialise_int_array (job, json_pid,
-			pid_t, &job->pid, &len);
+			pid_t, &pids, &len);
 	if (ret < 0)
 		goto error;
 
 	/* If we are missing one, we're probably importing from a
-	 * previous version that didn't include PROCESS_SECURITY.
-	 * Simply add the missing one.
+	 * previous version that didn't include PROCESS_SECURITY,
+	 * which is simply left unset.
 	 */
-	if (len == PROCESS_LAST - 1) {
-		job->pid = nih_realloc (job->pid, job, sizeof (pid_t) * PROCESS_LAST);
-
-		if (! job->pid)
-			goto error;
+	if (len != PROCESS_LAST && len != PROCESS_LAST - 1)
+		goto error;
 
-		job->pid[PROCESS_LAST - 1] = 0;
+	/* Process file descriptors don't survive the re-exec, nor does
+	 * the count of running processes.
+	 */
+	for (size_t i = 0; i < len; i++) {
+		if (pids[i] <= 0)
+			continue;
 
-	} else if (len != PROCESS_LAST) {
-		goto error;
+		job_process_set_pid (job, i, pids[i]);
+		job_process_watch_add (job, i);
 	}
 
+	nih_free (pids);
+
 	if (! state_get_json_int_var_to_obj (json, job, trace_forks))
 			goto error;
 
@@ -2296,6 +2971,33 @@ job_deserialise (JobClass *parent, json_object *json)
 		}
 	}
 
+	/* Older versions did not record timing */
+	if (json_object_object_get_ex (json, "timing", &json_timing)) {
+		JobTiming *timing;
+
+		timing = job_timing_deserialise (job, json_timing);
+		if (! timing)
+			goto error;
+
+		nih_free (job->timing);
+		job->timing = timing;
+	}
+
+	/* Older versions had no spawn queue; this is read last since the
+	 * job's spawn slot is released if it is freed.
+	 */
+	if (json_object_object_get_ex (json, "spawn_slot", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, job, spawn_slot))
+			goto error;
+	}
+
+	if (json_object_object_get_ex (json, "deferred", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, job, deferred))
+			goto error;
+	}
+
+	job_queue_restore (job);
+
 	return job;
 
 error:
@@ -2417,6 +3119,7 @@ job_state_enum_to_str (JobState state)
 	state_enum_to_str (JOB_KILLED, state);
 	state_enum_to_str (JOB_POST_STOPPING, state);
 	state_enum_to_str (JOB_POST_STOP, state);
+	state_enum_to_str (JOB_QUEUED, state);
 
 	return NULL;
 }
@@ -2450,6 +3153,7 @@ job_state_str_to_enum (const char *state)
 	state_str_to_enum (JOB_KILLED, state);
 	state_str_to_enum (JOB_POST_STOPPING, state);
 	state_str_to_enum (JOB_POST_STOP, state);
+	state_str_to_enum (JOB_QUEUED, state);
 
 	return -1;
 }
@@ -2495,16 +3199,16 @@ job_trace_state_str_to_enum (const char *state)
 }
 
 /**
- * job_serialise_kill_timer:
+ * job_serialise_timer:
  *
- * @timer: NihTimer to serialise.
+ * @timer: WheelTimer to serialise.
  *
  * Serialise @timer into JSON.
  *
- * Returns: JSON-serialised NihTimer object, or NULL on error.
+ * Returns: JSON-serialised WheelTimer object, or NULL on error.
  **/
 static json_object *
-job_serialise_kill_timer (NihTimer *timer)
+job_serialise_timer (WheelTimer *timer)
 {
 	json_object  *json;
 
@@ -2528,26 +3232,27 @@ error:
 }
 
 /**
- * job_deserialise_kill_timer:
+ * job_deserialise_timer:
  *
- * @json: JSON representation of NihTimer.
+ * @json: JSON representation of WheelTimer.
  *
- * Deserialise @json back into an NihTimer.
+ * Deserialise @json back into a WheelTimer; the result is not added to
+ * the timer wheel, only its timeout and due time are meaningful.
  *
- * Returns: NihTimer on NULL on error.
+ * Returns: WheelTimer on NULL on error.
  **/
-static NihTimer *
-job_deserialise_kill_timer (json_object *json)
+static WheelTimer *
+job_deserialise_timer (json_object *json)
 {
-	NihTimer *timer;
+	WheelTimer *timer;
 
 	nih_assert (json);
 
-	timer = nih_new (NULL, NihTimer);
+	timer = nih_new (NULL, WheelTimer);
 	if (! timer)
 		return NULL;
 
-	memset (timer, '\0', sizeof (NihTimer));
+	memset (timer, '\0', sizeof (WheelTimer));
 
 	if (! state_get_json_int_var_to_obj (json, timer, due))
 			goto error;
@@ -2645,7 +3350,7 @@ job_child_error_handler (Job *job, ProcessType process)
 	nih_assert (process > PROCESS_INVALID);
 	nih_assert (process < PROCESS_LAST);
 
-	job->pid[process] = 0;
+	job_process_set_pid (job, process, 0);
 
 	switch (process) {
 	case PROCESS_SECURITY:
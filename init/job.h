@@ -24,6 +24,7 @@
 
 #include <sys/types.h>
 
+#include <stdint.h>
 #include <time.h>
 
 #include <nih/macros.h>
@@ -35,6 +36,7 @@
 #include "job_class.h"
 #include "event_operator.h"
 #include "log.h"
+#include "wheel.h"
 
 #include "com.ubuntu.Upstart.Instance.h"
 
@@ -62,6 +64,10 @@ typedef enum job_goal {
  * This is combined with the job's goal decide what to do with the
  * processes and which states to move into when changes in process state
  * (pid obtained or death) occur.
+ *
+ * JOB_QUEUED comes between JOB_SECURITY and JOB_PRE_STARTING, but is
+ * last so that the other states keep their places in JobTiming's
+ * @entered array, which is serialised by position.
  **/
 typedef enum job_state {
 	JOB_WAITING,
@@ -80,7 +86,8 @@ typedef enum job_state {
 	JOB_STOPPING,
 	JOB_KILLED,
 	JOB_POST_STOPPING,
-	JOB_POST_STOP
+	JOB_POST_STOP,
+	JOB_QUEUED
 } JobState;
 
 /**
@@ -99,6 +106,63 @@ typedef enum trace_state {
 
 typedef struct job_process_data JobProcessData;
 
+/**
+ * JOB_TIMING_STATES:
+ *
+ * Number of job states, and so of entries in JobTiming's @entered array.
+ **/
+#define JOB_TIMING_STATES (JOB_QUEUED + 1)
+
+/**
+ * JobTiming:
+ * @entered: monotonic time in microseconds at which the job last entered
+ *           each state (see trace_now()), zero if it has not since it
+ *           was last started,
+ * @cause: name of event that caused the job to be started, or NULL if it
+ *         was started by request,
+ * @cause_job: class name of job that emitted @cause, or NULL,
+ * @cause_instance: instance name of job that emitted @cause, or NULL,
+ * @start_blocker: name of the job which last blocked the starting event,
+ * @stop_blocker: name of the job which last blocked the stopping event.
+ *
+ * This structure records when a job instance moved through its states
+ * and what held it up, so that the jobs that delayed others can be found
+ * after the fact.  It is reset each time the job is started, and kept by
+ * the job's class once the instance is destroyed.
+ **/
+typedef struct job_timing {
+	int64_t  entered[JOB_TIMING_STATES];
+
+	char    *cause;
+	char    *cause_job;
+	char    *cause_instance;
+
+	char    *start_blocker;
+	char    *stop_blocker;
+} JobTiming;
+
+/**
+ * JobUsage:
+ * @time: monotonic time in microseconds at which the counters were read
+ *        (see trace_now()),
+ * @cpu: CPU time consumed, in microseconds,
+ * @memory: memory in use, in bytes,
+ * @io_read: bytes read from block devices,
+ * @io_write: bytes written to block devices.
+ *
+ * This structure holds the resource usage counters of the cgroups of a
+ * job instance at one point in time; rates are computed from the
+ * difference between two of them.
+ **/
+typedef struct job_usage {
+	int64_t   time;
+
+	uint64_t  cpu;
+	uint64_t  memory;
+	uint64_t  io_read;
+	uint64_t  io_write;
+} JobUsage;
+
 /**
  * Job:
  * @entry: list header,
@@ -110,7 +174,7 @@ typedef struct job_process_data JobProcessData;
  * @env: NULL-terminated list of environment variables,
  * @start_env: environment to use next time the job is started,
  * @stop_env: environment to add for the next pre-stop script,
- * @stop_on: event operator expression that can stop this job.
+ * @stop_on: matching state of the class's stop_on expression for this job,
  * @fds: array of file descriptors associated with events in parent
  *       JobClasses @start_on condition,
  * @num_fds: number of elements in @fds,
@@ -124,10 +188,18 @@ typedef struct job_process_data JobProcessData;
  * @exit_status: exit status of the last failed process,
  * @respawn_time: time job was first respawned,
  * @respawn_count: number of respawns since @respawn_time,
+ * @respawn_delay: delay before the last or pending respawn, before jitter,
+ * @respawn_due: time of the last or pending respawn,
+ * @respawn_timer: timer holding a pending respawn,
+ * @queued: entry in job_queue while waiting for a spawn slot,
+ * @spawn_slot: TRUE while the job holds a spawn slot,
+ * @deferred: TRUE while the job is held in the queue by resource pressure,
  * @trace_forks: number of forks traced,
  * @trace_state: state of trace,
  * @log: pointer to array of log objects for handling job output,
- * @process_data: transitory async job process metadata.
+ * @process_data: transitory async job process metadata,
+ * @timing: state transition timing of the current or last start,
+ * @usage: resource usage that rates are computed from, or NULL.
  *
  * This structure holds the state of an active job instance being tracked
  * by the init daemon, the configuration details of the job are available
@@ -146,7 +218,7 @@ typedef struct job {
 
 	char           **start_env;
 	char           **stop_env;
-	EventOperator   *stop_on;
+	EventExprState  *stop_on;
 
 	int             *fds;
 	size_t           num_fds;
@@ -155,7 +227,7 @@ typedef struct job {
 	Event           *blocker;
 	NihList          blocking;
 
-	NihTimer        *kill_timer;
+	WheelTimer      *kill_timer;
 	ProcessType      kill_process;
 
 	int              failed;
@@ -164,12 +236,21 @@ typedef struct job {
 
 	time_t           respawn_time;
 	int              respawn_count;
+	time_t           respawn_delay;
+	time_t           respawn_due;
+	WheelTimer      *respawn_timer;
+
+	NihListEntry    *queued;
+	int              spawn_slot;
+	int              deferred;
 
 	int              trace_forks;
 	TraceState       trace_state;
 	Log            **log;
 	JobProcessData **process_data;
 
+	JobTiming       *timing;
+	JobUsage        *usage;
 } Job;
 
 /**
@@ -271,6 +352,30 @@ int         job_get_state       (Job *job, NihDBusMessage *message,
 int         job_get_processes   (Job *job, NihDBusMessage *message,
 				 JobProcessesElement ***processes)
 	__attribute__ ((warn_unused_result));
+int         job_get_next_respawn (Job *job, NihDBusMessage *message,
+				  int64_t *next_respawn)
+	__attribute__ ((warn_unused_result));
+int         job_get_cpu_time     (Job *job, NihDBusMessage *message,
+				  uint64_t *cpu_time)
+	__attribute__ ((warn_unused_result));
+int         job_get_memory_usage (Job *job, NihDBusMessage *message,
+				  uint64_t *memory_usage)
+	__attribute__ ((warn_unused_result));
+int         job_get_io_read_bytes (Job *job, NihDBusMessage *message,
+				   uint64_t *io_read_bytes)
+	__attribute__ ((warn_unused_result));
+int         job_get_io_write_bytes (Job *job, NihDBusMessage *message,
+				    uint64_t *io_write_bytes)
+	__attribute__ ((warn_unused_result));
+
+JobTiming * job_timing_new      (const void *parent)
+	__attribute__ ((warn_unused_result));
+void        job_timing_set_cause (Job *job, EventOperator *start_on);
+
+json_object *job_timing_serialise (const JobTiming *timing)
+	__attribute__ ((warn_unused_result));
+JobTiming * job_timing_deserialise (const void *parent, json_object *json)
+	__attribute__ ((warn_unused_result));
 
 json_object *job_serialise (const Job *job);
 Job *job_deserialise (JobClass *parent, json_object *json);
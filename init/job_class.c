@@ -25,6 +25,9 @@
 
 
 #include <errno.h>
+#include <fnmatch.h>
+#include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <sys/time.h>
@@ -51,6 +54,7 @@
 #include "job_class.h"
 #include "job.h"
 #include "event_operator.h"
+#include "events.h"
 #include "blocked.h"
 #include "conf.h"
 #include "control.h"
@@ -72,8 +76,21 @@ extern char **environ;
 
 /* Prototypes for static functions */
 static void  job_class_add (JobClass *class);
+static int   job_class_operator_names (EventOperator *root,
+				       const char *event, const char *name)
+	__attribute__ ((warn_unused_result));
 static int   job_class_remove (JobClass *class, const Session *session);
 
+#ifdef ENABLE_CGROUPS
+static int   job_class_resource_add (JobClass *class, const char *controller,
+				     const char *key, const char *format, ...)
+	__attribute__ ((warn_unused_result, format (printf, 4, 5)));
+static int   job_class_resource_memory (JobClass *class, const char *key,
+					const char *legacy_key,
+					unsigned long long size)
+	__attribute__ ((warn_unused_result));
+#endif /* ENABLE_CGROUPS */
+
 /**
  * default_console:
  *
@@ -348,6 +365,7 @@ job_class_new (const void *parent,
 
 	class->start_on = NULL;
 	class->stop_on = NULL;
+	class->stop_on_expr = NULL;
 	class->emits = NULL;
 
 	class->process = nih_alloc (class, sizeof (Process *) * PROCESS_LAST);
@@ -368,6 +386,9 @@ job_class_new (const void *parent,
 	class->respawn = FALSE;
 	class->respawn_limit = JOB_DEFAULT_RESPAWN_LIMIT;
 	class->respawn_interval = JOB_DEFAULT_RESPAWN_INTERVAL;
+	class->respawn_delay = 0;
+	class->respawn_backoff = 0;
+	class->respawn_delay_max = 0;
 
 	class->normalexit = NULL;
 	class->normalexit_len = 0;
@@ -398,6 +419,22 @@ job_class_new (const void *parent,
 
 	nih_list_init (&class->cgroups);
 
+	class->concurrency = 0;
+	class->spawning = 0;
+	class->stop_layer = -1;
+	class->priority = 0;
+	class->defer_under_pressure = 0;
+
+	class->cpu_weight = 0;
+	class->cpu_quota = 0;
+	class->memory_max = 0;
+	class->memory_high = 0;
+	class->io_weight = 0;
+	class->cpuset_cpus = NULL;
+	class->cpuset_mems = NULL;
+
+	class->timing = NULL;
+
 	return class;
 
 error:
@@ -600,8 +637,9 @@ job_class_event_block (void *parent, JobClass *old, JobClass *new)
  * job_class_add:
  * @class: new class to select.
  *
- * Adds @class to the hash table and registers it with all current D-Bus
- * connections.  @class may be NULL.
+ * Adds @class to the hash table, and the index of its session if it has
+ * one, and registers it with all current D-Bus connections.  @class may
+ * be NULL.
  **/
 static void
 job_class_add (JobClass *class)
@@ -613,6 +651,16 @@ job_class_add (JobClass *class)
 
 	nih_hash_add (job_classes, &class->entry);
 
+	/* The index entry is freed along with the class */
+	if (class->session) {
+		NihListEntry *entry;
+
+		entry = NIH_MUST (nih_list_entry_new (class));
+		entry->data = class;
+
+		nih_list_add (class->session->classes, &entry->entry);
+	}
+
 	NIH_LIST_FOREACH (control_conns, iter) {
 		NihListEntry   *entry = (NihListEntry *)iter;
 		DBusConnection *conn = (DBusConnection *)entry->data;
@@ -651,8 +699,8 @@ job_class_add_safe (JobClass *class)
  * @class: class to remove,
  * @session: Session of @class.
  *
- * Removes @class from the hash table and unregisters it from all current
- * D-Bus connections.
+ * Removes @class from the hash table, and the index of its session, and
+ * unregisters it from all current D-Bus connections.
  *
  * Returns: TRUE if class could be unregistered, FALSE if there are
  * active instances that prevent unregistration, or if @session
@@ -674,6 +722,15 @@ job_class_remove (JobClass *class, const Session *session)
 
 	nih_list_remove (&class->entry);
 
+	if (class->session) {
+		NIH_LIST_FOREACH_SAFE (class->session->classes, iter) {
+			NihListEntry *entry = (NihListEntry *)iter;
+
+			if (entry->data == class)
+				nih_free (entry);
+		}
+	}
+
 	NIH_LIST_FOREACH (control_conns, iter) {
 		NihListEntry   *entry = (NihListEntry *)iter;
 		DBusConnection *conn = (DBusConnection *)entry->data;
@@ -1051,7 +1108,7 @@ job_class_start (JobClass        *class,
 	/* Job has specified a cgroup stanza but since the cgroup
 	 * manager has not yet been contacted, the job cannot be started.
 	 */
-	if (job_class_cgroups (class) && ! cgroup_manager_available ()) {
+	if (job_class_cgroups (class) && ! cgroup_available ()) {
 		nih_dbus_error_raise_printf (
 			DBUS_INTERFACE_UPSTART ".Error.CGroupManagerNotAvailable",
 			_("Job cannot be started as cgroup manager not available: %s"),
@@ -2027,6 +2084,45 @@ job_class_serialise (JobClass *class)
 	if (! state_set_json_int_var_from_obj (json, class, respawn_interval))
 		goto error;
 
+	if (! state_set_json_int_var_from_obj (json, class, respawn_delay))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, class, respawn_backoff))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, class, respawn_delay_max))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, class, concurrency))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, class, priority))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, class, defer_under_pressure))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, class, cpu_weight))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, class, cpu_quota))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, class, memory_max))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, class, memory_high))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, class, io_weight))
+		goto error;
+
+	if (! state_set_json_string_var_from_obj (json, class, cpuset_cpus))
+		goto error;
+
+	if (! state_set_json_string_var_from_obj (json, class, cpuset_mems))
+		goto error;
+
 	json_normalexit = state_serialise_int_array (int, class->normalexit,
 					     class->normalexit_len);
 	if (! json_normalexit)
@@ -2080,6 +2176,16 @@ job_class_serialise (JobClass *class)
 	if (! state_set_json_int_var_from_obj (json, class, cgmanager_wait))
 		goto error;
 
+	if (class->timing) {
+		json_object *json_timing;
+
+		json_timing = job_timing_serialise (class->timing);
+		if (! json_timing)
+			goto error;
+
+		json_object_object_add (json, "timing", json_timing);
+	}
+
 #ifdef ENABLE_CGROUPS
 	json_cgroups = cgroup_serialise_all (&class->cgroups);
 	if (! json_cgroups)
@@ -2168,6 +2274,7 @@ job_class_deserialise (json_object *json)
 	nih_local char *path = NULL;
 	json_object    *json_start_on = NULL;
 	json_object    *json_stop_on = NULL;
+	json_object    *json_timing;
 
 	nih_assert (json);
 	nih_assert (job_classes);
@@ -2344,6 +2451,58 @@ job_class_deserialise (json_object *json)
 	if (! state_get_json_int_var_to_obj (json, class, respawn_interval))
 		goto error;
 
+	/* Respawn delays are new, older versions always respawned
+	 * immediately.
+	 */
+	if (json_object_object_get_ex (json, "respawn_delay", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, class, respawn_delay))
+			goto error;
+
+		if (! state_get_json_int_var_to_obj (json, class, respawn_backoff))
+			goto error;
+
+		if (! state_get_json_int_var_to_obj (json, class, respawn_delay_max))
+			goto error;
+	}
+
+	if (json_object_object_get_ex (json, "concurrency", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, class, concurrency))
+			goto error;
+	}
+
+	if (json_object_object_get_ex (json, "priority", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, class, priority))
+			goto error;
+	}
+
+	if (json_object_object_get_ex (json, "defer_under_pressure", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, class, defer_under_pressure))
+			goto error;
+	}
+
+	if (json_object_object_get_ex (json, "cpu_weight", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, class, cpu_weight))
+			goto error;
+
+		if (! state_get_json_int_var_to_obj (json, class, cpu_quota))
+			goto error;
+
+		if (! state_get_json_int_var_to_obj (json, class, memory_max))
+			goto error;
+
+		if (! state_get_json_int_var_to_obj (json, class, memory_high))
+			goto error;
+
+		if (! state_get_json_int_var_to_obj (json, class, io_weight))
+			goto error;
+
+		if (! state_get_json_string_var_to_obj (json, class, cpuset_cpus))
+			goto error;
+
+		if (! state_get_json_string_var_to_obj (json, class, cpuset_mems))
+			goto error;
+	}
+
 	if (! state_get_json_enum_var (json,
 				job_class_console_type_str_to_enum,
 				"console", class->console))
@@ -2420,6 +2579,12 @@ job_class_deserialise (json_object *json)
 	if (job_deserialise_all (class, json) < 0)
 		goto error;
 
+	if (json_object_object_get_ex (json, "timing", &json_timing)) {
+		class->timing = job_timing_deserialise (class, json_timing);
+		if (! class->timing)
+			goto error;
+	}
+
 #ifdef ENABLE_CGROUPS
 	if (json_object_object_get_ex (json, "cgmanager_wait", NULL)) {
 
@@ -2524,6 +2689,7 @@ job_class_expect_type_enum_to_str (ExpectType expect)
 	state_enum_to_str (EXPECT_STOP, expect);
 	state_enum_to_str (EXPECT_DAEMON, expect);
 	state_enum_to_str (EXPECT_FORK, expect);
+	state_enum_to_str (EXPECT_NOTIFY, expect);
 
 	return NULL;
 }
@@ -2546,6 +2712,7 @@ job_class_expect_type_str_to_enum (const char *expect)
 	state_str_to_enum (EXPECT_STOP, expect);
 	state_str_to_enum (EXPECT_DAEMON, expect);
 	state_str_to_enum (EXPECT_FORK, expect);
+	state_str_to_enum (EXPECT_NOTIFY, expect);
 
 	return -1;
 }
@@ -2680,6 +2847,90 @@ job_class_max_kill_timeout (void)
 	return kill_timeout;
 }
 
+/**
+ * job_class_operator_names:
+ * @root: event expression,
+ * @event: name of job event,
+ * @name: name of job class.
+ *
+ * Determine whether @root contains a match for @event emitted by the job
+ * @name, that is one whose JOB variable, given either by name or as the
+ * first positional argument, matches @name.  Matches whose value refers
+ * to other variables or is negated are never considered to name it.
+ *
+ * Returns: TRUE if @name is named, else FALSE.
+ **/
+static int
+job_class_operator_names (EventOperator *root,
+			  const char    *event,
+			  const char    *name)
+{
+	nih_assert (event != NULL);
+	nih_assert (name != NULL);
+
+	if (! root)
+		return FALSE;
+
+	NIH_TREE_FOREACH_POST (&root->node, iter) {
+		EventOperator  *oper = (EventOperator *)iter;
+		const char     *value = NULL;
+
+		if (oper->type != EVENT_MATCH)
+			continue;
+
+		if (strcmp (oper->name, event) || ! oper->env)
+			continue;
+
+		for (char **e = oper->env; *e; e++) {
+			if (! strncmp (*e, "JOB=", 4)) {
+				value = *e + 4;
+				break;
+			}
+
+			if ((e == oper->env) && ! strchr (*e, '=')) {
+				value = *e;
+				break;
+			}
+		}
+
+		if (! value || strchr (value, '$'))
+			continue;
+
+		if (! fnmatch (value, name, 0))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * job_class_stop_depends:
+ * @class: job class,
+ * @other: job class that may be depended on.
+ *
+ * Determine whether @class depends on @other, in that it starts once
+ * @other has started ("start on started OTHER") or stops as @other
+ * begins to stop ("stop on stopping OTHER").  Instances of @class
+ * should then be stopped before those of @other when shutting down.
+ *
+ * Returns: TRUE if @class depends on @other, else FALSE.
+ **/
+int
+job_class_stop_depends (JobClass *class,
+			JobClass *other)
+{
+	nih_assert (class != NULL);
+	nih_assert (other != NULL);
+
+	if (class == other)
+		return FALSE;
+
+	return (job_class_operator_names (class->start_on, JOB_STARTED_EVENT,
+					  other->name)
+		|| job_class_operator_names (class->stop_on, JOB_STOPPING_EVENT,
+					     other->name));
+}
+
 /**
  * job_class_get_index:
  * @class: JobClass to search for.
@@ -2778,6 +3029,8 @@ job_class_induct_job (JobClass *class)
 				job, &job->blocking);
 
 		job_change_goal (job, JOB_START);
+
+		job_timing_set_cause (job, class->start_on);
 	}
 
 	event_operator_reset (class->start_on);
@@ -2785,24 +3038,340 @@ job_class_induct_job (JobClass *class)
 	return TRUE;
 }
 
+/**
+ * job_class_add_starting:
+ * @starting: list of classes to start,
+ * @class: class to add.
+ *
+ * Add @class to the @starting list behind any classes of the same or a
+ * higher priority, so that job_class_induct_job() may be called for
+ * each in the order they should be started.
+ **/
+void
+job_class_add_starting (NihList  *starting,
+			JobClass *class)
+{
+	NihListEntry *entry;
+	NihList      *iter;
+
+	nih_assert (starting != NULL);
+	nih_assert (class != NULL);
+
+	entry = NIH_MUST (nih_list_entry_new (starting));
+	entry->data = class;
+
+	for (iter = starting->next; iter != starting; iter = iter->next) {
+		JobClass *other = (JobClass *)((NihListEntry *)iter)->data;
+
+		if (other->priority < class->priority)
+			break;
+	}
+
+	nih_list_add (iter, &entry->entry);
+}
+
+
+/**
+ * job_class_timing:
+ * @class: job class,
+ * @instance: instance name, or NULL for any.
+ *
+ * Find the most relevant timing for @class: that of the named @instance
+ * (or any instance, if @instance is NULL) if it has been started, and
+ * otherwise that of the last instance destroyed.
+ *
+ * Returns: timing or NULL if the class has never been started.
+ **/
+static JobTiming *
+job_class_timing (JobClass   *class,
+		  const char *instance)
+{
+	nih_assert (class != NULL);
+
+	NIH_HASH_FOREACH (class->instances, iter) {
+		Job *job = (Job *)iter;
+
+		if (instance && strcmp (job->name, instance))
+			continue;
+
+		if (job->timing->entered[JOB_STARTING])
+			return job->timing;
+	}
+
+	if (class->timing && class->timing->entered[JOB_STARTING])
+		return class->timing;
+
+	return NULL;
+}
+
+/**
+ * JobClassBlame:
+ * @duration: microseconds from starting to running,
+ * @line: formatted entry.
+ *
+ * Entry collected by job_class_blame() for sorting.
+ **/
+typedef struct job_class_blame {
+	int64_t  duration;
+	char    *line;
+} JobClassBlame;
+
+/**
+ * job_class_blame_cmp:
+ * @a: first entry,
+ * @b: second entry.
+ *
+ * qsort() comparison function ordering entries slowest first, then by
+ * name.
+ *
+ * Returns: less than, equal to or greater than zero.
+ **/
+static int
+job_class_blame_cmp (const void *a,
+		     const void *b)
+{
+	const JobClassBlame *blame_a = a;
+	const JobClassBlame *blame_b = b;
+
+	if (blame_a->duration > blame_b->duration)
+		return -1;
+	if (blame_a->duration < blame_b->duration)
+		return 1;
+
+	return strcmp (blame_a->line, blame_b->line);
+}
+
+/**
+ * job_class_blame_add:
+ * @blame: pointer to array of entries,
+ * @len: number of entries in @blame,
+ * @timing: timing to add,
+ * @name: name of job.
+ *
+ * Append an entry to @blame for @timing if the job it belongs to reached
+ * the running state.
+ *
+ * Returns: zero on success, negative value on insufficient memory.
+ **/
+static int
+job_class_blame_add (JobClassBlame  **blame,
+		     size_t          *len,
+		     const JobTiming *timing,
+		     const char      *name)
+{
+	JobClassBlame *new_blame;
+	int64_t        duration;
+
+	nih_assert (blame != NULL);
+	nih_assert (len != NULL);
+	nih_assert (timing != NULL);
+	nih_assert (name != NULL);
+
+	if ((! timing->entered[JOB_STARTING])
+	    || (timing->entered[JOB_RUNNING] < timing->entered[JOB_STARTING]))
+		return 0;
+
+	duration = timing->entered[JOB_RUNNING] - timing->entered[JOB_STARTING];
+
+	new_blame = nih_realloc (*blame, NULL,
+				 sizeof (JobClassBlame) * (*len + 1));
+	if (! new_blame)
+		return -1;
+
+	*blame = new_blame;
+
+	(*blame)[*len].duration = duration;
+	(*blame)[*len].line = nih_sprintf (*blame, "%lld %s",
+					   (long long)duration, name);
+	if (! (*blame)[*len].line)
+		return -1;
+
+	(*len)++;
+
+	return 0;
+}
+
+/**
+ * job_class_blame:
+ * @parent: parent object for new array.
+ *
+ * Builds a list of every job that has reached the running state, slowest
+ * first, where each entry is the number of microseconds the job took from
+ * entering the starting state to entering the running state, followed by
+ * a space and the job name.
+ *
+ * Jobs with no instances are listed using the timing of their most
+ * recently destroyed instance, so tasks that have completed are included.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned array.  When all parents
+ * of the returned array are freed, the returned array will also be
+ * freed.
+ *
+ * Returns: newly allocated NULL-terminated array or NULL if insufficient
+ * memory.
+ **/
+char **
+job_class_blame (const void *parent)
+{
+	nih_local JobClassBlame  *blame = NULL;
+	size_t                    blame_len = 0;
+	char                    **lines;
+	size_t                    len = 0;
+
+	job_class_init ();
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+		int       instances = FALSE;
+
+		NIH_HASH_FOREACH (class->instances, job_iter) {
+			Job *job = (Job *)job_iter;
+
+			instances = TRUE;
+
+			if (job_class_blame_add (&blame, &blame_len,
+						 job->timing,
+						 job_name (job)) < 0)
+				return NULL;
+		}
+
+		if ((! instances) && class->timing) {
+			if (job_class_blame_add (&blame, &blame_len,
+						 class->timing,
+						 class->name) < 0)
+				return NULL;
+		}
+	}
+
+	if (blame_len)
+		qsort (blame, blame_len, sizeof (JobClassBlame),
+		       job_class_blame_cmp);
+
+	lines = nih_str_array_new (parent);
+	if (! lines)
+		return NULL;
+
+	for (size_t i = 0; i < blame_len; i++) {
+		if (! nih_str_array_add (&lines, parent, &len,
+					 blame[i].line)) {
+			nih_free (lines);
+			return NULL;
+		}
+	}
+
+	return lines;
+}
+
+/**
+ * job_class_critical_chain:
+ * @parent: parent object for new array,
+ * @class: job class to start from.
+ *
+ * Follows the recorded causes of @class being started back through the
+ * jobs that emitted them, until reaching an event not emitted by a job
+ * (such as startup) or a job that has no recorded timing.
+ *
+ * Each entry, starting with @class, consists of the time the job entered
+ * the starting state and the time it entered the running state (in
+ * microseconds of the monotonic clock, zero if not reached), the name of
+ * the event that caused it to start (or "-" if it was started by request)
+ * and the job name, separated by spaces.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned array.  When all parents
+ * of the returned array are freed, the returned array will also be
+ * freed.
+ *
+ * Returns: newly allocated NULL-terminated array or NULL if insufficient
+ * memory.
+ **/
+char **
+job_class_critical_chain (const void *parent,
+			  JobClass   *class)
+{
+	char       **chain;
+	size_t       len = 0;
+	size_t       max_len = 1;
+	const char  *instance = NULL;
+
+	nih_assert (class != NULL);
+
+	job_class_init ();
+
+	chain = nih_str_array_new (parent);
+	if (! chain)
+		return NULL;
+
+	/* A job can't appear in its own chain more than once, but the
+	 * recorded causes may be from different boots of a job so guard
+	 * against loops by bounding the length.
+	 */
+	NIH_HASH_FOREACH (job_classes, iter)
+		max_len++;
+
+	while (class && (len < max_len)) {
+		JobTiming      *timing;
+		nih_local char *line = NULL;
+
+		timing = job_class_timing (class, instance);
+		if (! timing)
+			break;
+
+		if (instance && *instance) {
+			line = nih_sprintf (NULL, "%lld %lld %s %s (%s)",
+					    (long long)timing->entered[JOB_STARTING],
+					    (long long)timing->entered[JOB_RUNNING],
+					    timing->cause ? timing->cause : "-",
+					    class->name, instance);
+		} else {
+			line = nih_sprintf (NULL, "%lld %lld %s %s",
+					    (long long)timing->entered[JOB_STARTING],
+					    (long long)timing->entered[JOB_RUNNING],
+					    timing->cause ? timing->cause : "-",
+					    class->name);
+		}
+		if (! line)
+			goto error;
+
+		if (! nih_str_array_addp (&chain, parent, &len, line))
+			goto error;
+
+		if (! timing->cause_job)
+			break;
+
+		class = job_class_get_registered (timing->cause_job,
+						  class->session);
+		instance = timing->cause_instance;
+	}
+
+	return chain;
+
+error:
+	nih_free (chain);
+	return NULL;
+}
 
 #ifdef ENABLE_CGROUPS
 
 /**
  * job_class_induct_jobs:
  *
- * Start all jobs waiting on a cgmanager.
+ * Start all jobs waiting on a cgmanager, in order of priority.
  *
  * Returns: TRUE on success, if induction of any job fails returns FALSE.
  **/
 int
 job_class_induct_jobs (void)
 {
-	nih_assert (cgroup_manager_available ());
+	nih_local NihList *starting = NULL;
+	int                success = TRUE;
+
+	nih_assert (cgroup_available ());
 
 	job_class_init ();
 
-	int success = TRUE;
+	starting = NIH_MUST (nih_list_new (NULL));
 
 	NIH_HASH_FOREACH_SAFE (job_classes, iter) {
 		JobClass *class = (JobClass *)iter;
@@ -2815,15 +3384,20 @@ job_class_induct_jobs (void)
 
 		nih_assert (class->start_on->value);
 
-		if (! job_class_induct_job (class))
+		class->cgmanager_wait = FALSE;
+		job_class_add_starting (starting, class);
+	}
+
+	/* Inducting a job also unrefs the events that were ref'ed
+	 * whilst waiting for the cgroup manager to become available.
+	 */
+	NIH_LIST_FOREACH_SAFE (starting, iter) {
+		NihListEntry *entry = (NihListEntry *)iter;
+
+		if (! job_class_induct_job ((JobClass *)entry->data))
 			success = FALSE;
 
-		/* Unref the events that were ref'ed
-		 * whilst waiting for the cgroup manager
-		 * to become available.
-		 */
-		event_operator_reset (class->start_on);
-		class->cgmanager_wait = FALSE;
+		nih_free (entry);
 	}
 
 	return success;
@@ -2844,6 +3418,11 @@ job_class_cgroups (JobClass *class)
 {
 	nih_assert (class);
 
+	if (class->cpu_weight || class->cpu_quota
+	    || class->memory_max || class->memory_high
+	    || class->io_weight || class->cpuset_cpus)
+		return TRUE;
+
 	if (NIH_LIST_EMPTY (&class->cgroups))
 		return FALSE;
 
@@ -2851,4 +3430,211 @@ job_class_cgroups (JobClass *class)
 
 }
 
+/**
+ * job_class_resource_add:
+ * @class: job class,
+ * @controller: cgroup controller,
+ * @key: name of setting,
+ * @format: format string for value.
+ *
+ * Add a setting of @key to @format for @controller to the default cgroup
+ * of @class, as though given by a cgroup stanza, replacing any earlier
+ * value.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+static int
+job_class_resource_add (JobClass   *class,
+			const char *controller,
+			const char *key,
+			const char *format,
+			...)
+{
+	nih_local char *value = NULL;
+	va_list         args;
+
+	nih_assert (class);
+	nih_assert (controller);
+	nih_assert (key);
+	nih_assert (format);
+
+	va_start (args, format);
+	value = nih_vsprintf (NULL, format, args);
+	va_end (args);
+
+	if (! value)
+		nih_return_no_memory_error (FALSE);
+
+	if (! cgroup_add (class, &class->cgroups, controller, NULL, key, value))
+		nih_return_no_memory_error (FALSE);
+
+	return TRUE;
+}
+
+/**
+ * job_class_resource_memory:
+ * @class: job class,
+ * @key: name of setting in the unified hierarchy,
+ * @legacy_key: name of setting in per-controller hierarchies,
+ * @size: memory size, or JOB_MEMORY_UNLIMITED.
+ *
+ * Add a setting of @size to the @key or @legacy_key setting of the memory
+ * controller for the default cgroup of @class, depending on the
+ * hierarchy.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+static int
+job_class_resource_memory (JobClass           *class,
+			   const char         *key,
+			   const char         *legacy_key,
+			   unsigned long long  size)
+{
+	int unified;
+
+	nih_assert (class);
+	nih_assert (key);
+	nih_assert (legacy_key);
+
+	unified = cgroup_unified ("memory");
+
+	if (size == JOB_MEMORY_UNLIMITED)
+		return job_class_resource_add (class, "memory",
+					       unified ? key : legacy_key,
+					       "%s", unified ? "max" : "-1");
+
+	return job_class_resource_add (class, "memory",
+				       unified ? key : legacy_key,
+				       "%llu", size);
+}
+
+/**
+ * job_class_resources:
+ * @class: job class.
+ *
+ * Turn the resource-control stanzas of @class into settings of its
+ * default cgroup, expressed for the hierarchy in use:
+ *
+ *   cpu-weight   cpu.weight        / cpu.shares (scaled)
+ *   cpu-quota    cpu.max           / cpu.cfs_period_us + cpu.cfs_quota_us
+ *   memory-max   memory.max        / memory.limit_in_bytes
+ *   memory-high  memory.high       / memory.soft_limit_in_bytes
+ *   io-weight    io.weight         / blkio.weight (scaled, clamped)
+ *   cpuset       cpuset.cpus/mems  / same, with mems defaulting to 0
+ *
+ * This is called before each spawn of a process that needs cgroups,
+ * rather than when the job is parsed, since the hierarchy is only known
+ * once the cgroup filesystem is mounted; the cgroup manager only
+ * supports the per-controller settings.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+int
+job_class_resources (JobClass *class)
+{
+	nih_assert (class);
+
+	if (class->cpu_weight) {
+		if (cgroup_unified ("cpu")) {
+			if (! job_class_resource_add (class, "cpu", "weight", "%lu",
+						      class->cpu_weight))
+				return FALSE;
+		} else {
+			if (! job_class_resource_add (class, "cpu", "shares", "%lu",
+						      class->cpu_weight * 1024 / 100))
+				return FALSE;
+		}
+	}
+
+	if (class->cpu_quota) {
+		unsigned long quota;
+
+		quota = class->cpu_quota * (JOB_CPU_PERIOD / 100);
+
+		if (cgroup_unified ("cpu")) {
+			if (! job_class_resource_add (class, "cpu", "max", "%lu %d",
+						      quota, JOB_CPU_PERIOD))
+				return FALSE;
+		} else {
+			if ((! job_class_resource_add (class, "cpu", "cfs_period_us",
+						       "%d", JOB_CPU_PERIOD))
+			    || (! job_class_resource_add (class, "cpu", "cfs_quota_us",
+							  "%lu", quota)))
+				return FALSE;
+		}
+	}
+
+	if (class->memory_max
+	    && (! job_class_resource_memory (class, "max", "limit_in_bytes",
+					     class->memory_max)))
+		return FALSE;
+
+	if (class->memory_high
+	    && (! job_class_resource_memory (class, "high",
+					     "soft_limit_in_bytes",
+					     class->memory_high)))
+		return FALSE;
+
+	if (class->io_weight) {
+		if (cgroup_unified ("io")) {
+			if (! job_class_resource_add (class, "io", "weight",
+						      "default %lu",
+						      class->io_weight))
+				return FALSE;
+		} else {
+			unsigned long weight;
+
+			weight = class->io_weight * 5;
+			if (weight < 10)
+				weight = 10;
+			if (weight > 1000)
+				weight = 1000;
+
+			if (! job_class_resource_add (class, "blkio", "weight",
+						      "%lu", weight))
+				return FALSE;
+		}
+	}
+
+	/* Per-controller hierarchies require both to be set before a
+	 * process can join the cgroup, so the memory nodes default to the
+	 * first there.
+	 */
+	if (class->cpuset_cpus) {
+		if (! job_class_resource_add (class, "cpuset", "cpus", "%s",
+					      class->cpuset_cpus))
+			return FALSE;
+
+		if (class->cpuset_mems) {
+			if (! job_class_resource_add (class, "cpuset", "mems", "%s",
+						      class->cpuset_mems))
+				return FALSE;
+		} else if (! cgroup_unified ("cpuset")) {
+			if (! job_class_resource_add (class, "cpuset", "mems", "0"))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * job_class_cgroups_flush:
+ *
+ * Discard the records of the cgroups created for all registered job
+ * classes, such that each is created and configured again when a job
+ * process is next spawned.
+ **/
+void
+job_class_cgroups_flush (void)
+{
+	job_class_init ();
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		cgroup_forget (&class->cgroups);
+	}
+}
+
 #endif /* ENABLE_CGROUPS */
@@ -44,12 +44,15 @@
  * This is used to determine what to expect to happen before moving the job
  * from the spawned state.  EXPECT_NONE means that we don't expect anything
  * so the job will move directly out of the spawned state without waiting.
+ * EXPECT_NOTIFY means that we wait for the main process to send READY=1
+ * to the notification socket.
  **/
 typedef enum expect_type {
 	EXPECT_NONE,
 	EXPECT_STOP,
 	EXPECT_DAEMON,
-	EXPECT_FORK
+	EXPECT_FORK,
+	EXPECT_NOTIFY
 } ExpectType;
 
 /**
@@ -94,6 +97,14 @@ typedef enum console_type {
  **/
 #define JOB_DEFAULT_RESPAWN_INTERVAL 5
 
+/**
+ * JOB_RESPAWN_JITTER:
+ *
+ * Percentage by which a respawn delay may be randomly shortened, so that
+ * instances that failed together don't all respawn together.
+ **/
+#define JOB_RESPAWN_JITTER 25
+
 /**
  * JOB_DEFAULT_UMASK:
  *
@@ -115,6 +126,22 @@ typedef enum console_type {
  **/
 #define JOB_DEFAULT_OOM_SCORE_ADJ 0
 
+/**
+ * JOB_CPU_PERIOD:
+ *
+ * Period, in microseconds, over which the CPU time allowed by the
+ * cpu-quota stanza is enforced.
+ **/
+#define JOB_CPU_PERIOD 100000
+
+/**
+ * JOB_MEMORY_UNLIMITED:
+ *
+ * Memory limit of the memory-max and memory-high stanzas meaning that
+ * no limit is imposed.
+ **/
+#define JOB_MEMORY_UNLIMITED ((unsigned long long)-1)
+
 /**
  * JOB_DEFAULT_ENVIRONMENT:
  *
@@ -127,6 +154,8 @@ typedef enum console_type {
 	"TERM"
 
 
+typedef struct job_timing JobTiming;
+
 /**
  * JobClass:
  * @entry: list header,
@@ -142,6 +171,7 @@ typedef enum console_type {
  * @export: NULL-terminated array of environment exported to events,
  * @start_on: event operator expression that can start an instance,
  * @stop_on: event operator expression that stops instances,
+ * @stop_on_expr: compiled form of @stop_on shared by instances,
  * @emits: NULL-terminated array of events that may be emitted by instances,
  * @process: processes to be run,
  * @expect: what to expect before entering the next state after spawned,
@@ -152,6 +182,10 @@ typedef enum console_type {
  * @respawn: instances should be restarted if main process fails,
  * @respawn_limit: number of respawns in @respawn_interval that we permit,
  * @respawn_interval: barrier for @respawn_limit,
+ * @respawn_delay: time to wait before respawning,
+ * @respawn_backoff: factor to multiply @respawn_delay by on each
+ *  consecutive respawn,
+ * @respawn_delay_max: ceiling for @respawn_delay,
  * @normalexit: array of exit codes that prevent a respawn,
  * @normalexit_len: length of @normalexit array,
  * @console: how to arrange processes' stdin/out/err file descriptors,
@@ -169,12 +203,36 @@ typedef enum console_type {
  * @cgroups: list of CGroup objects representing the cgroups the
  *  job is required to run in,
  * @cgmanager_wait: TRUE if job waiting for cgroup manager to be
- * available.
+ * available,
+ * @concurrency: maximum number of instances that may be starting at once,
+ *  or zero for no limit,
+ * @spawning: number of instances holding a spawn slot,
+ * @stop_layer: order in which instances are stopped during shutdown,
+ *  or -1 if not yet known, see quiesce(),
+ * @priority: start priority, instances of classes with a higher priority
+ *  are started and given spawn slots ahead of those with a lower one,
+ * @defer_under_pressure: maximum number of seconds instances are held in
+ *  the queue while resources are under pressure, or zero to never hold
+ *  them,
+ * @cpu_weight: share of CPU time relative to other jobs, from 1 to 10000,
+ * @cpu_quota: percentage of one CPU that may be used at most,
+ * @memory_max: memory in bytes that may be used at most,
+ *  or JOB_MEMORY_UNLIMITED,
+ * @memory_high: memory in bytes above which processes are throttled,
+ *  or JOB_MEMORY_UNLIMITED,
+ * @io_weight: share of block I/O relative to other jobs, from 1 to 10000,
+ * @cpuset_cpus: list of CPUs processes may run on,
+ * @cpuset_mems: list of memory nodes processes may allocate from,
+ * @timing: state timing of the most recently destroyed instance.
  *
  * This structure holds the configuration of a known task or service that
  * should be tracked by the init daemon; as tasks and services are
  * fundamentally identical except for when they "finish", they are both
  * collated together and only differ in the value of @task.
+ *
+ * The resource-control members are zero or NULL when not set; they are
+ * only turned into settings of the job's cgroups by job_class_resources()
+ * when a process is spawned, since that depends on the cgroup hierarchy.
  **/
 typedef struct job_class {
 	NihList         entry;
@@ -195,6 +253,7 @@ typedef struct job_class {
 
 	EventOperator  *start_on;
 	EventOperator  *stop_on;
+	EventExpr      *stop_on_expr;
 	char          **emits;
 
 	Process       **process;
@@ -209,6 +268,9 @@ typedef struct job_class {
 	int             respawn;
 	int             respawn_limit;
 	time_t          respawn_interval;
+	time_t          respawn_delay;
+	int             respawn_backoff;
+	time_t          respawn_delay_max;
 
 	int            *normalexit;
 	size_t          normalexit_len;
@@ -232,6 +294,22 @@ typedef struct job_class {
 	char	       *apparmor_switch;
 	NihList         cgroups;
 	int             cgmanager_wait;
+
+	int             concurrency;
+	int             spawning;
+	int             stop_layer;
+	int             priority;
+	int             defer_under_pressure;
+
+	unsigned long       cpu_weight;
+	unsigned long       cpu_quota;
+	unsigned long long  memory_max;
+	unsigned long long  memory_high;
+	unsigned long       io_weight;
+	char               *cpuset_cpus;
+	char               *cpuset_mems;
+
+	JobTiming      *timing;
 } JobClass;
 
 
@@ -379,6 +457,9 @@ void job_class_prepare_reexec (void);
 time_t     job_class_max_kill_timeout (void)
 	__attribute__ ((warn_unused_result));
 
+int        job_class_stop_depends (JobClass *class, JobClass *other)
+	__attribute__ ((warn_unused_result));
+
 JobClass  *job_class_get_registered (const char *name, const Session *session)
 	__attribute__ ((warn_unused_result));
 
@@ -391,6 +472,14 @@ job_class_get_index (const JobClass *class)
 int job_class_induct_job (JobClass *class)
 	__attribute__ ((warn_unused_result));
 
+void job_class_add_starting (NihList *starting, JobClass *class);
+
+char **job_class_blame (const void *parent)
+	__attribute__ ((warn_unused_result));
+
+char **job_class_critical_chain (const void *parent, JobClass *class)
+	__attribute__ ((warn_unused_result));
+
 #ifdef ENABLE_CGROUPS
 
 int job_class_induct_jobs (void)
@@ -399,6 +488,11 @@ int job_class_induct_jobs (void)
 int job_class_cgroups (JobClass *class)
 	__attribute__ ((warn_unused_result));
 
+int job_class_resources (JobClass *class)
+	__attribute__ ((warn_unused_result));
+
+void job_class_cgroups_flush (void);
+
 #endif /* ENABLE_CGROUPS */
 
 NIH_END_EXTERN
@@ -32,8 +32,11 @@
 #include <sys/ptrace.h>
 #include <sys/resource.h>
 #include <sys/ioctl.h>
+#include <sys/wait.h>
 
 #include <time.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <errno.h>
 #include <stdio.h>
 #include <limits.h>
@@ -51,7 +54,10 @@
 #include <nih/macros.h>
 #include <nih/alloc.h>
 #include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
 #include <nih/signal.h>
+#include <nih/child.h>
 #include <nih/io.h>
 #include <nih/logging.h>
 #include <nih/error.h>
@@ -68,6 +74,10 @@
 #include "control.h"
 #include "xdg.h"
 #include "apparmor.h"
+#include "spawner.h"
+#include "notify.h"
+#include "credentials.h"
+#include "wheel.h"
 
 #ifdef ENABLE_CGROUPS
 #include "cgroup.h"
@@ -81,6 +91,23 @@
  **/
 #define SHELL_CHARS "~`!$^&*()=|\\{}[];\"'<>?"
 
+/**
+ * JOB_PROCESS_SPAWN_STACK_SIZE:
+ *
+ * Size of the stack the child runs on between clone() and exec(); the
+ * child only makes system calls and searches the PATH so needs very
+ * little.
+ **/
+#define JOB_PROCESS_SPAWN_STACK_SIZE 65536
+
+/**
+ * JOB_PROCESS_DEFAULT_PATH:
+ *
+ * Search path used for a binary without a slash when the job environment
+ * has no PATH, matching execvp().
+ **/
+#define JOB_PROCESS_DEFAULT_PATH "/bin:/usr/bin"
+
 
 /**
  * JobProcessWireError:
@@ -95,6 +122,104 @@ typedef struct job_process_wire_error {
 	int                 errnum;
 } JobProcessWireError;
 
+/**
+ * JobProcessSpawn:
+ * @process: job process being spawned,
+ * @trace: TRUE if the process should be traced,
+ * @console_log: TRUE if output should be sent to the log pty,
+ * @argv: arguments of process,
+ * @argc: number of entries in @argv,
+ * @env: environment of process,
+ * @envc: number of entries in @env,
+ * @path: search path for @argv[0] if it contains no slash,
+ * @chdir: working directory or NULL,
+ * @sh_argv: arguments to run a file without a recognised format with the
+ * shell, @sh_argv[1] is filled in by the child,
+ * @error_rd: reading end of the error pipe or -1,
+ * @error_fd: writing end of the error pipe,
+ * @script_fd: descriptor to be moved to JOB_PROCESS_SCRIPT_FD or -1,
+ * @pty_master: master side of the log pty or -1,
+ * @pty_slave: slave side of the log pty or -1,
+ * @has_limit: TRUE for each resource limit to be set,
+ * @limits: resource limits,
+ * @umask: file mode creation mask,
+ * @nice: process priority or JOB_NICE_INVALID,
+ * @oom_score_adj: value to write to /proc/self/oom_score_adj or "",
+ * @oom_adj: value to write to /proc/self/oom_adj if that file is missing,
+ * @uid: user to switch to or -1,
+ * @gid: group to switch to or -1,
+ * @groups: supplementary groups to set or NULL,
+ * @ngroups: number of entries in @groups,
+ * @orig_set: signal mask to restore before exec.
+ *
+ * Everything the child of a clone() spawn needs, prepared by the parent
+ * so that the child, which shares our memory until it calls exec(), makes
+ * only async-signal-safe calls and never allocates.
+ *
+ * The details are complete without the job class so that they may also
+ * be sent to the spawn helper, see job_process_spawn_encode().
+ **/
+typedef struct job_process_spawn {
+	ProcessType    process;
+	int            trace;
+	int            console_log;
+
+	char * const  *argv;
+	size_t         argc;
+	char * const  *env;
+	size_t         envc;
+	const char    *path;
+	const char    *chdir;
+	char         **sh_argv;
+
+	int            error_rd;
+	int            error_fd;
+	int            script_fd;
+	int            pty_master;
+	int            pty_slave;
+
+	int            has_limit[RLIMIT_NLIMITS];
+	struct rlimit  limits[RLIMIT_NLIMITS];
+	mode_t         umask;
+	int            nice;
+
+	char           oom_score_adj[16];
+	char           oom_adj[16];
+
+	uid_t          uid;
+	gid_t          gid;
+	gid_t         *groups;
+	size_t         ngroups;
+
+	sigset_t       orig_set;
+} JobProcessSpawn;
+
+/**
+ * JobProcessWatch:
+ * @entry: list header,
+ * @pid: process id,
+ * @fd: process file descriptor referring to @pid,
+ * @job: job @pid was started for,
+ * @process: which of @job's processes @pid is,
+ * @io_watch: watch on @fd, or NULL once @pid has been reaped,
+ * @event: child event once @pid has been reaped,
+ * @status: exit status or signal once @pid has been reaped.
+ *
+ * Process file descriptor held for a job process, indexed by @pid in the
+ * job_process_watches hash table.  It is a child of @job so is freed with
+ * it, and otherwise once the exit of @pid has been handled.
+ **/
+typedef struct job_process_watch {
+	NihList         entry;
+	pid_t           pid;
+	int             fd;
+	Job            *job;
+	ProcessType     process;
+	NihIoWatch     *io_watch;
+	NihChildEvents  event;
+	int             status;
+} JobProcessWatch;
+
 /**
  * log_dir:
  *
@@ -112,6 +237,14 @@ int disable_respawn = FALSE;
 
 /* Prototypes for static functions */
 static void job_process_remap_fd        (int *fd, int reserved_fd, int error_fd);
+static JobProcessWatch *job_process_watch_find (pid_t pid);
+static int  job_process_watch_destroy   (JobProcessWatch *watch);
+static void job_process_watch_reader    (JobProcessWatch *watch,
+					 NihIoWatch *io_watch,
+					 NihIoEvents events);
+static int  job_process_signal          (Job *job, ProcessType process,
+					 int signal)
+	__attribute__ ((warn_unused_result));
 
 /**
  * disable_job_logging:
@@ -129,11 +262,91 @@ int disable_job_logging = 0;
  **/
 int no_inherit_env = FALSE;
 
+/**
+ * disable_clone_spawn:
+ *
+ * If TRUE, always spawn job processes with fork() rather than with
+ * clone() sharing our memory until the child calls exec().
+ **/
+int disable_clone_spawn = FALSE;
+
+/**
+ * use_pidfd:
+ *
+ * If TRUE, supervise job processes with process file descriptors as well
+ * as SIGCHLD; set by init on startup and cleared once we find the kernel
+ * doesn't support them.
+ **/
+int use_pidfd = FALSE;
+
+/**
+ * job_process_watches:
+ *
+ * Hash table of process file descriptors held for job processes, indexed
+ * by process id.
+ **/
+static NihHash *job_process_watches = NULL;
+
+/**
+ * job_process_running:
+ *
+ * Number of job processes running, that is the number of non-zero
+ * process ids of all jobs, kept by job_process_set_pid().
+ **/
+static int job_process_running = 0;
+
+/**
+ * job_process_exits:
+ *
+ * List of job processes reaped through their process file descriptor
+ * whose exit has yet to be handled, see job_process_watch_poll().
+ **/
+static NihList *job_process_exits = NULL;
+
+/**
+ * job_process_spawn_stack:
+ *
+ * Stack for the child of a clone() spawn; the parent is suspended until
+ * the child calls exec() or exits so only one child uses it at a time.
+ **/
+static char job_process_spawn_stack[JOB_PROCESS_SPAWN_STACK_SIZE]
+	__attribute__ ((aligned (16)));
+
 /* Prototypes for static functions */
-static void job_process_kill_timer      (Job *job, NihTimer *timer);
+static void job_process_error_write     (int fd, JobProcessErrorType type,
+					 int arg, int errnum);
+static JobProcessSpawn *job_process_spawn_prepare (Job *job,
+						   char * const argv[],
+						   char * const *env,
+						   int trace, int script_fd,
+						   ProcessType process,
+						   int fds[2], int pty_master,
+						   const sigset_t *orig_set);
+static int  job_process_spawn_credentials (JobProcessSpawn *spawn,
+					   JobClass *class);
+static pid_t job_process_spawn_remote   (JobProcessSpawn *spawn);
+static char *job_process_spawn_encode   (const void *parent,
+					 const JobProcessSpawn *spawn,
+					 size_t *len, int *fds, size_t *nfds)
+	__attribute__ ((warn_unused_result));
+static JobProcessSpawn *job_process_spawn_decode (const void *parent,
+						  const char *buf,
+						  size_t len,
+						  const int *fds,
+						  size_t nfds)
+	__attribute__ ((warn_unused_result));
+static int  job_process_spawn_child     (void *data);
+static void job_process_spawn_abort     (int fd, JobProcessErrorType type,
+					 int arg)
+	__attribute__ ((noreturn));
+static void job_process_spawn_remap_fd  (int *fd, int error_fd);
+static void job_process_spawn_exec      (JobProcessSpawn *spawn);
+static void job_process_kill_timer      (Job *job, WheelTimer *timer);
 static void job_process_terminated      (Job *job, ProcessType process,
 					 int status, int state_only);
 static int  job_process_catch_runaway   (Job *job);
+static time_t job_process_respawn_delay (Job *job);
+static void job_process_respawn_timer   (Job *job, WheelTimer *timer);
 static void job_process_stopped         (Job *job, ProcessType process);
 static void job_process_trace_new       (Job *job, ProcessType process);
 static void job_process_trace_new_child (Job *job, ProcessType process);
@@ -141,6 +354,11 @@ static void job_process_trace_signal    (Job *job, ProcessType process,
 					 int signum);
 static void job_process_trace_fork      (Job *job, ProcessType process);
 static void job_process_trace_exec      (Job *job, ProcessType process);
+#ifdef ENABLE_CGROUPS
+static void job_process_cgroups_record  (Job *job, ProcessType process);
+static void job_process_cgroups_kill    (Job *job, ProcessType process,
+					 int signal);
+#endif /* ENABLE_CGROUPS */
 
 extern char         *control_server_address;
 extern int           user_mode;
@@ -148,6 +366,63 @@ extern int           session_end;
 extern time_t        quiesce_phase_time;
 
 
+/**
+ * job_process_environment:
+ * @parent: parent object for new array,
+ * @job: job context for process to be run in,
+ * @process: job process to be run,
+ * @envc: pointer to variable to store number of elements.
+ *
+ * Build the environment that @process of @job is run with.
+ *
+ * We provide the standard job environment to all of its processes,
+ * except for pre-stop and post-stop which also have the stop event
+ * environment, adding special variables that indicate which job it
+ * was -- mostly so that initctl can have clever behaviour when called
+ * within them.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned array.  When all parents
+ * of the returned array are freed, the returned array will also be
+ * freed.
+ *
+ * Returns: newly allocated environment array.
+ **/
+char **
+job_process_environment (const void   *parent,
+			 Job          *job,
+			 ProcessType   process,
+			 size_t       *envc)
+{
+	char **env;
+	char **e;
+
+	nih_assert (job != NULL);
+	nih_assert (envc != NULL);
+
+	*envc = 0;
+	env = NIH_MUST (nih_str_array_new (parent));
+
+	if (job->env)
+		NIH_MUST (environ_append (&env, parent, envc, TRUE, job->env));
+
+	if (job->stop_env
+	    && ((process == PROCESS_PRE_STOP)
+		|| (process == PROCESS_POST_STOP)))
+		for (e = job->stop_env; *e; e++)
+			NIH_MUST (environ_set (&env, parent, envc, TRUE, *e));
+
+	NIH_MUST (environ_set (&env, parent, envc, TRUE,
+			       "UPSTART_JOB=%s", job->class->name));
+	NIH_MUST (environ_set (&env, parent, envc, TRUE,
+			       "UPSTART_INSTANCE=%s", job->name));
+	if (user_mode)
+		NIH_MUST (environ_set (&env, parent, envc, TRUE,
+			       "UPSTART_SESSION=%s", control_server_address));
+
+	return env;
+}
+
 /**
  * job_process_start:
  *
@@ -191,12 +466,12 @@ job_process_start (Job                    *job,
 	nih_local char    **argv = NULL;
 	nih_local char    **env = NULL;
 	nih_local char     *script = NULL;
-	char              **e;
 	size_t              argc, envc;
 	int                 fds[2] = { -1, -1 };
 	int                 trace = FALSE, shell = FALSE;
 	int                 job_process_fd = -1;
 	JobProcessData     *process_data = NULL;
+	pid_t               pid;
 
 	nih_assert (job);
 	nih_assert (process > PROCESS_INVALID);
@@ -275,30 +550,27 @@ job_process_start (Job                    *job,
 						" \t\r\n", TRUE));
 	}
 
-	/* We provide the standard job environment to all of its processes,
-	 * except for pre-stop which also has the stop event environment,
-	 * adding special variables that indicate which job it was -- mostly
-	 * so that initctl can have clever behaviour when called within them.
-	 */
-	envc = 0;
-	env = NIH_MUST (nih_str_array_new (NULL));
-
-	if (job->env)
-		NIH_MUST (environ_append (&env, NULL, &envc, TRUE, job->env));
+	env = job_process_environment (NULL, job, process, &envc);
 
-	if (job->stop_env
-	    && ((process == PROCESS_PRE_STOP)
-		|| (process == PROCESS_POST_STOP)))
-		for (e = job->stop_env; *e; e++)
-			NIH_MUST (environ_set (&env, NULL, &envc, TRUE, *e));
+	/* If we're about to spawn the main job and we expect it to notify
+	 * us when it's ready, tell it where to send the notification.
+	 */
+	if ((process == PROCESS_MAIN)
+	    && (job->class->expect == EXPECT_NOTIFY)) {
+		if (notify_init () < 0) {
+			NihError *err;
 
-	NIH_MUST (environ_set (&env, NULL, &envc, TRUE,
-			       "UPSTART_JOB=%s", job->class->name));
-	NIH_MUST (environ_set (&env, NULL, &envc, TRUE,
-			       "UPSTART_INSTANCE=%s", job->name));
-	if (user_mode)
-		NIH_MUST (environ_set (&env, NULL, &envc, TRUE,
-			       "UPSTART_SESSION=%s", control_server_address));
+			err = nih_error_get ();
+			nih_warn ("%s: %s",
+				  _("Unable to create notification socket"),
+				  err->message);
+			nih_free (err);
+		} else {
+			NIH_MUST (environ_set (&env, NULL, &envc, TRUE,
+					       "%s=%s", NOTIFY_SOCKET_ENV,
+					       notify_socket_name ()));
+		}
+	}
 
 	/* If we're about to spawn the main job and we expect it to become
 	 * a daemon or fork before we can move out of spawned, we need to
@@ -310,7 +582,7 @@ job_process_start (Job                    *job,
 		trace = TRUE;
 
 	/* Spawn the process, repeat until fork() works */
-	while ((job->pid[process] = job_process_spawn_with_fd (job, argv, env,
+	while ((pid = job_process_spawn_with_fd (job, argv, env,
 					trace, fds[0], process, &job_process_fd)) < 0) {
 		NihError *err;
 
@@ -320,9 +592,13 @@ job_process_start (Job                    *job,
 		nih_free (err);
 	}
 
+	job_process_set_pid (job, process, pid);
+
 	nih_info (_("%s %s process (%d)"),
 		  job_name (job), process_name (process), job->pid[process]);
 
+	job_process_watch_add (job, process);
+
 	job->trace_forks = 0;
 	job->trace_state = trace ? TRACE_NEW : TRACE_NONE;
 
@@ -397,8 +673,14 @@ job_process_start (Job                    *job,
  * closed setup was successful and the caller can then mark the job
  * process as started.
  *
+ * The process is spawned with clone() sharing our memory until it calls
+ * exec() when the job needs no setup beyond plain system calls, unless
+ * disable_clone_spawn is TRUE; otherwise it is spawned with fork().  If the
+ * spawn helper is running, such processes are spawned by it instead but
+ * remain our children.
+ *
  * Spawning a process may fail for temporary reasons, usually due to a failure
- * of the fork() syscall.
+ * of the fork() or clone() syscall.
  *
  * Returns: process id of new process on success, -1 on raised error
  **/
@@ -425,6 +707,8 @@ job_process_spawn_with_fd (Job          *job,
 	gid_t           job_setgid = -1;
 	struct passwd   *pwd = NULL;
 	struct group    *grp = NULL;
+	const Credentials *creds = NULL;
+	nih_local JobProcessSpawn *spawn = NULL;
 
 #ifdef ENABLE_CGROUPS
 	int              cgroups_needed = FALSE;
@@ -448,8 +732,18 @@ job_process_spawn_with_fd (Job          *job,
 			nih_return_error (-1, CGROUP_ERROR, _("cgroup support not available"));
 
 		/* Should never happen */
-		if (! cgroup_manager_available ())
+		if (! cgroup_available ())
 			nih_return_error (-1, CGROUP_ERROR, _("cgroup manager not available"));
+
+		/* The child can't enable controllers for the session's
+		 * cgroup while we, and so it, are still in there.
+		 */
+		if (! cgroup_scope ())
+			return -1;
+
+		/* Only now is the hierarchy settled */
+		if (! job_class_resources (class))
+			return -1;
 	}
 
 #endif /* ENABLE_CGROUPS */
@@ -531,10 +825,41 @@ job_process_spawn_with_fd (Job          *job,
 	 */
 	fflush (NULL);
 
-	/* Fork the child process, handling success and failure by resetting
+	/* Spawn the child process, handling success and failure by resetting
 	 * the signal mask and returning the new process id or a raised error.
+	 *
+	 * Where the child can be set up entirely with system calls it is
+	 * cloned sharing our memory, which avoids copying the page tables
+	 * of a large init; we are suspended until it calls exec() or exits,
+	 * after which any error is waiting in the pipe exactly as if the
+	 * child had been forked.  If the spawn helper is running, it does
+	 * this for us instead.  Anything else is forked.
 	 */
-	pid = fork ();
+	spawn = job_process_spawn_prepare (job, argv, env, trace, script_fd,
+					   process, fds, pty_master, &orig_set);
+	if (spawn) {
+		pid = job_process_spawn_remote (spawn);
+		if (! pid)
+			pid = clone (job_process_spawn_child,
+				     (job_process_spawn_stack
+				      + sizeof (job_process_spawn_stack)),
+				     CLONE_VM | CLONE_VFORK | SIGCHLD, spawn);
+
+		if (spawn->pty_slave != -1)
+			close (spawn->pty_slave);
+	} else {
+		/* Look up the credentials here, where they're cached,
+		 * unless they must be looked up inside a chroot; if that
+		 * fails the child looks them up itself to report why.
+		 */
+		if ((process != PROCESS_SECURITY) && (! class->chroot)
+		    && (! (class->session && class->session->chroot)))
+			creds = credentials_lookup (class->setuid,
+						    class->setgid);
+
+		pid = fork ();
+	}
+
 	if (pid > 0) {
 		if (class->debug) {
 			nih_info (_("Pausing %s (%d) [pre-exec] for debug"),
@@ -802,9 +1127,15 @@ job_process_spawn_with_fd (Job          *job,
 		/* Change the user and group of the process to the one
 		 * configured in the job. We must wait until now to lookup the
 		 * UID and GID from the names to accommodate both chroot
-		 * session jobs and jobs with a chroot stanza.
+		 * session jobs and jobs with a chroot stanza; otherwise
+		 * they were looked up before we were forked.
 		 */
-		if (class->setuid) {
+		if (creds) {
+			job_setuid = creds->uid;
+			job_setgid = creds->gid;
+		}
+
+		if (class->setuid && (! creds)) {
 			/* Without resetting errno, it's impossible to
 			 * distinguish between a non-existent user and and
 			 * error during lookup */
@@ -826,7 +1157,7 @@ job_process_spawn_with_fd (Job          *job,
 			job_setgid = pwd->pw_gid;
 		}
 
-		if (class->setgid) {
+		if (class->setgid && (! creds)) {
 			errno = 0;
 			grp = getgrnam (class->setgid);
 			if (! grp) {
@@ -853,7 +1184,12 @@ job_process_spawn_with_fd (Job          *job,
 		/* Make sure we always have the needed pwd and grp structs.
 		 * Then pass those to initgroups() to setup the user's group list.
 		 * Only do that if we're root as initgroups() won't work when non-root. */
-		if (geteuid () == 0) {
+		if ((geteuid () == 0) && creds) {
+			if (setgroups (creds->ngroups, creds->groups) < 0) {
+				nih_error_raise_system ();
+				job_process_error_abort (fds[1], JOB_PROCESS_ERROR_INITGROUPS, 0);
+			}
+		} else if (geteuid () == 0) {
 			if (! pwd) {
 				pwd = getpwuid (geteuid ());
 				if (! pwd) {
@@ -880,7 +1216,7 @@ job_process_spawn_with_fd (Job          *job,
 
 #ifdef ENABLE_CGROUPS
 		if (cgroups_needed) {
-			if (cgroup_manager_connect () < 0)
+			if (! cgroup_fs_available () && cgroup_manager_connect () < 0)
 				job_process_error_abort (fds[1], JOB_PROCESS_ERROR_CGROUP_MGR_CONNECT, 0);
 
 			if (! cgroup_setup (&job->class->cgroups,
@@ -900,6 +1236,14 @@ job_process_spawn_with_fd (Job          *job,
 					job_process_error_abort (fds[1], JOB_PROCESS_ERROR_CGROUP_CLEAR, 0);
 				}
 			}
+
+			/* Moving a process between cgroups by writing to the
+			 * cgroup filesystem needs the privileges we are about
+			 * to drop, so do so now.
+			 */
+			if (cgroup_fs_available ()
+			    && cgroup_enter_groups (&job->class->cgroups) != TRUE)
+				job_process_error_abort (fds[1], JOB_PROCESS_ERROR_CGROUP_ENTER, 0);
 		}
 #endif /* ENABLE_CGROUPS */
 
@@ -954,7 +1298,8 @@ job_process_spawn_with_fd (Job          *job,
 	 * the process is running with the correct group and user
 	 * ownership.
 	 */
-	if (cgroups_needed && cgroup_enter_groups (&job->class->cgroups) != TRUE)
+	if (cgroups_needed && ! cgroup_fs_available ()
+	    && cgroup_enter_groups (&job->class->cgroups) != TRUE)
 		job_process_error_abort (fds[1], JOB_PROCESS_ERROR_CGROUP_ENTER, 0);
 
 #endif /* ENABLE_CGROUPS */
@@ -995,26 +1340,940 @@ job_process_error_abort (int                 fd,
 			 JobProcessErrorType type,
 			 int                 arg)
 {
-	NihError            *err;
-	JobProcessWireError  wire_err;
+	NihError *err;
 
 	/* Get the currently raised system error */
 	err = nih_error_get ();
 
+	job_process_error_write (fd, type, arg, err->number);
+
+	nih_free (err);
+
+	exit (255);
+}
+
+/**
+ * job_process_error_write:
+ * @fd: writing end of pipe,
+ * @type: step that failed,
+ * @arg: argument to @type,
+ * @errnum: error number.
+ *
+ * Write the error details in @type, @arg and @errnum to the writing end
+ * of the pipe specified by @fd, to be read by job_process_error_handler().
+ *
+ * This function is async-signal-safe.
+ **/
+static void
+job_process_error_write (int                 fd,
+			 JobProcessErrorType type,
+			 int                 arg,
+			 int                 errnum)
+{
+	JobProcessWireError wire_err;
+
 	/* Fill in the structure we send over the pipe */
 	wire_err.type = type;
 	wire_err.arg = arg;
-	wire_err.errnum = err->number;
+	wire_err.errnum = errnum;
 
 	/* Write structure to the pipe; in theory this should never fail, but
 	 * if it does, we abort anyway.
 	 */
 	while (write (fd, &wire_err, sizeof (wire_err)) < 0)
 		;
+}
 
-	nih_free (err);
 
-	exit (255);
+/**
+ * job_process_spawn_prepare:
+ * @job: job of process to be spawned,
+ * @argv: NULL-terminated list of arguments for the process,
+ * @env: NULL-terminated list of environment variables for the process,
+ * @trace: whether to trace this process,
+ * @script_fd: script file descriptor,
+ * @process: job process being spawned,
+ * @fds: error pipe,
+ * @pty_master: master side of the log pty or -1,
+ * @orig_set: signal mask to restore in the child.
+ *
+ * Decide whether @process of @job can be spawned with clone() and, if so,
+ * do all of the work that cannot be done safely in a child sharing our
+ * memory: looking up the user and groups, opening the slave side of the
+ * log pty and formatting values.
+ *
+ * Jobs that need anything more (a console device, an AppArmor profile, a
+ * chroot, cgroups or the debug stanza), or for which any of this fails, are
+ * left to be forked so that their setup, and any error, is exactly as it
+ * always was.
+ *
+ * Must be called with all signals blocked.
+ *
+ * Returns: newly allocated spawn details or NULL if the process should
+ * be forked.
+ **/
+static JobProcessSpawn *
+job_process_spawn_prepare (Job            *job,
+			   char * const    argv[],
+			   char * const   *env,
+			   int             trace,
+			   int             script_fd,
+			   ProcessType     process,
+			   int             fds[2],
+			   int             pty_master,
+			   const sigset_t *orig_set)
+{
+	JobProcessSpawn *spawn;
+	JobClass        *class;
+	char             pts_name[PATH_MAX];
+
+	nih_assert (job != NULL);
+	nih_assert (argv != NULL);
+	nih_assert (argv[0] != NULL);
+	nih_assert (fds != NULL);
+	nih_assert (orig_set != NULL);
+
+	class = job->class;
+
+	if (disable_clone_spawn)
+		return NULL;
+
+	if ((class->console != CONSOLE_NONE)
+	    && (class->console != CONSOLE_LOG))
+		return NULL;
+
+	if (class->debug)
+		return NULL;
+
+	if (class->apparmor_switch && (process == PROCESS_MAIN))
+		return NULL;
+
+	/* User and group lookups must happen inside the chroot */
+	if (class->chroot || (class->session && class->session->chroot))
+		return NULL;
+
+#ifdef ENABLE_CGROUPS
+	if (job_needs_cgroups (job))
+		return NULL;
+#endif /* ENABLE_CGROUPS */
+
+	spawn = nih_new (NULL, JobProcessSpawn);
+	if (! spawn)
+		return NULL;
+
+	memset (spawn, 0, sizeof (JobProcessSpawn));
+
+	spawn->process = process;
+	spawn->trace = trace;
+	spawn->console_log = (class->console == CONSOLE_LOG);
+	spawn->argv = argv;
+	spawn->env = env;
+	spawn->error_rd = fds[0];
+	spawn->error_fd = fds[1];
+	spawn->script_fd = script_fd;
+	spawn->pty_master = pty_master;
+	spawn->pty_slave = -1;
+	spawn->uid = (uid_t)-1;
+	spawn->gid = (gid_t)-1;
+	spawn->orig_set = *orig_set;
+
+	/* The forked child sets environ to the job environment before
+	 * calling execvp(), so it is that PATH we search.
+	 */
+	spawn->path = environ_get (env, "PATH");
+	if (! spawn->path)
+		spawn->path = JOB_PROCESS_DEFAULT_PATH;
+
+	while (argv[spawn->argc])
+		spawn->argc++;
+
+	while (env && env[spawn->envc])
+		spawn->envc++;
+
+	spawn->sh_argv = nih_alloc (spawn, (sizeof (char *)
+					    * (spawn->argc + 2)));
+	if (! spawn->sh_argv)
+		goto error;
+
+	spawn->sh_argv[0] = "/bin/sh";
+	spawn->sh_argv[1] = NULL;
+	for (size_t i = 1; i <= spawn->argc; i++)
+		spawn->sh_argv[i + 1] = argv[i];
+
+	if (process != PROCESS_SECURITY) {
+		for (int i = 0; i < RLIMIT_NLIMITS; i++) {
+			if (! class->limits[i])
+				continue;
+
+			spawn->has_limit[i] = TRUE;
+			spawn->limits[i] = *class->limits[i];
+		}
+
+		spawn->umask = class->umask;
+		spawn->nice = class->nice;
+
+		if (class->chdir || user_mode == FALSE)
+			spawn->chdir = class->chdir ? class->chdir : "/";
+
+		if (class->oom_score_adj != JOB_DEFAULT_OOM_SCORE_ADJ) {
+			snprintf (spawn->oom_score_adj,
+				  sizeof (spawn->oom_score_adj),
+				  "%d\n", class->oom_score_adj);
+			snprintf (spawn->oom_adj, sizeof (spawn->oom_adj),
+				  "%d\n",
+				  (class->oom_score_adj
+				   * ((class->oom_score_adj < 0) ? 17 : 15)) / 1000);
+		}
+
+		if (job_process_spawn_credentials (spawn, class) < 0)
+			goto error;
+	}
+
+	/* grantpt() may run a helper which it reaps itself; that's safe
+	 * here since all signals are blocked so our own SIGCHLD handler
+	 * can't run until it is done.
+	 */
+	if (class->console == CONSOLE_LOG) {
+		if ((grantpt (pty_master) < 0)
+		    || (unlockpt (pty_master) < 0)
+		    || (ptsname_r (pty_master, pts_name, sizeof (pts_name))))
+			goto error;
+
+		spawn->pty_slave = open (pts_name,
+					 O_RDWR | O_NOCTTY | O_CLOEXEC);
+		if (spawn->pty_slave < 0)
+			goto error;
+	}
+
+	return spawn;
+
+error:
+	nih_free (spawn);
+	return NULL;
+}
+
+/**
+ * job_process_spawn_credentials:
+ * @spawn: spawn details,
+ * @class: job class of process.
+ *
+ * Look up the user, group and supplementary groups the job process
+ * described by @spawn should run as, exactly as the forked child would.
+ * The groups belong to the credentials cache, which is left alone until
+ * @spawn has been used.
+ *
+ * Returns: zero on success, negative value if any lookup failed and the
+ * process should be forked to report it.
+ **/
+static int
+job_process_spawn_credentials (JobProcessSpawn *spawn,
+			       JobClass        *class)
+{
+	const Credentials *creds;
+
+	nih_assert (spawn != NULL);
+	nih_assert (class != NULL);
+
+	creds = credentials_lookup (class->setuid, class->setgid);
+	if (! creds)
+		return -1;
+
+	spawn->uid = creds->uid;
+	spawn->gid = creds->gid;
+	spawn->groups = creds->groups;
+	spawn->ngroups = creds->ngroups;
+
+	return 0;
+}
+
+/**
+ * job_process_spawn_child:
+ * @data: spawn details.
+ *
+ * Child of a clone() spawn, running on job_process_spawn_stack in our
+ * memory while we are suspended.  Sets up the process in the same order
+ * as the forked child and ends by executing the new binary.
+ *
+ * Only async-signal-safe calls are made, and nothing in our memory other
+ * than the stack is modified; failures are written to the error pipe with
+ * job_process_error_write() exactly as job_process_error_abort() would.
+ *
+ * Returns: never.
+ **/
+static int
+job_process_spawn_child (void *data)
+{
+	JobProcessSpawn *spawn = data;
+	int              error_fd;
+	int              script_fd;
+	int              pty_master;
+	int              pty_slave;
+	int              fd;
+
+	nih_assert (spawn != NULL);
+
+	error_fd = spawn->error_fd;
+	script_fd = spawn->script_fd;
+	pty_master = spawn->pty_master;
+	pty_slave = spawn->pty_slave;
+
+	if (spawn->error_rd != -1)
+		close (spawn->error_rd);
+
+	job_process_spawn_remap_fd (&error_fd, error_fd);
+	if (fcntl (error_fd, F_SETFD, FD_CLOEXEC) < 0)
+		job_process_spawn_abort (error_fd, JOB_PROCESS_ERROR_DUP, 0);
+
+	if (spawn->console_log) {
+		job_process_spawn_remap_fd (&pty_master, error_fd);
+		if (fcntl (pty_master, F_SETFD, FD_CLOEXEC) < 0)
+			job_process_spawn_abort (error_fd,
+						 JOB_PROCESS_ERROR_DUP, 0);
+
+		job_process_spawn_remap_fd (&pty_slave, error_fd);
+	}
+
+	if ((script_fd != -1) && (script_fd != JOB_PROCESS_SCRIPT_FD)) {
+		if (dup2 (script_fd, JOB_PROCESS_SCRIPT_FD) < 0)
+			job_process_spawn_abort (error_fd,
+						 JOB_PROCESS_ERROR_DUP, 0);
+
+		close (script_fd);
+		script_fd = JOB_PROCESS_SCRIPT_FD;
+	}
+
+	setsid ();
+
+	/* No console really means /dev/null, as does a logged one until
+	 * the output is redirected below.
+	 */
+	for (fd = 0; fd < 3; fd++)
+		close (fd);
+
+	fd = open (DEV_NULL, O_RDWR | O_NOCTTY);
+	if (fd < 0)
+		job_process_spawn_abort (error_fd, JOB_PROCESS_ERROR_CONSOLE, 0);
+
+	while (fd < 2) {
+		fd = dup (fd);
+		if (fd < 0)
+			job_process_spawn_abort (error_fd,
+						 JOB_PROCESS_ERROR_CONSOLE, 0);
+	}
+
+	if (spawn->console_log) {
+		if ((dup2 (pty_slave, STDOUT_FILENO) < 0)
+		    || (dup2 (pty_slave, STDERR_FILENO) < 0))
+			job_process_spawn_abort (error_fd,
+						 JOB_PROCESS_ERROR_DUP, 0);
+
+		close (pty_slave);
+	}
+
+	if (spawn->process != PROCESS_SECURITY) {
+		for (int i = 0; i < RLIMIT_NLIMITS; i++) {
+			if (! spawn->has_limit[i])
+				continue;
+
+			if (setrlimit (i, &spawn->limits[i]) < 0)
+				job_process_spawn_abort (error_fd,
+							 JOB_PROCESS_ERROR_RLIMIT,
+							 i);
+		}
+
+		umask (spawn->umask);
+
+		if (spawn->nice != JOB_NICE_INVALID &&
+		    setpriority (PRIO_PROCESS, 0, spawn->nice) < 0)
+			job_process_spawn_abort (error_fd,
+						 JOB_PROCESS_ERROR_PRIORITY, 0);
+
+		if (spawn->oom_score_adj[0]) {
+			const char *value = spawn->oom_score_adj;
+
+			fd = open ("/proc/self/oom_score_adj", O_WRONLY);
+			if ((fd < 0) && (errno == ENOENT)) {
+				value = spawn->oom_adj;
+				fd = open ("/proc/self/oom_adj", O_WRONLY);
+			}
+
+			if ((fd < 0)
+			    || (write (fd, value, strlen (value)) < 0)
+			    || (close (fd) < 0))
+				job_process_spawn_abort (error_fd,
+							 JOB_PROCESS_ERROR_OOM_ADJ, 0);
+		}
+
+		if (spawn->chdir && (chdir (spawn->chdir) < 0))
+			job_process_spawn_abort (error_fd,
+						 JOB_PROCESS_ERROR_CHDIR, 0);
+
+		if (script_fd != -1 &&
+		    (spawn->uid != (uid_t) -1 || spawn->gid != (gid_t) -1) &&
+		    fchown (script_fd, spawn->uid, spawn->gid) < 0)
+			job_process_spawn_abort (error_fd,
+						 JOB_PROCESS_ERROR_CHOWN, 0);
+
+		if (spawn->groups &&
+		    setgroups (spawn->ngroups, spawn->groups) < 0)
+			job_process_spawn_abort (error_fd,
+						 JOB_PROCESS_ERROR_INITGROUPS, 0);
+
+		if (spawn->gid != (gid_t) -1 && setgid (spawn->gid) < 0)
+			job_process_spawn_abort (error_fd,
+						 JOB_PROCESS_ERROR_SETGID, 0);
+
+		if (spawn->uid != (uid_t) -1 && setuid (spawn->uid) < 0)
+			job_process_spawn_abort (error_fd,
+						 JOB_PROCESS_ERROR_SETUID, 0);
+	}
+
+	/* Reset all the signal handlers back to their default handling;
+	 * without CLONE_SIGHAND this only affects the child.
+	 */
+	for (int signum = 1; signum < _NSIG; signum++) {
+		struct sigaction act;
+
+		if ((signum == SIGKILL) || (signum == SIGSTOP))
+			continue;
+
+		act.sa_handler = SIG_DFL;
+		act.sa_flags = 0;
+		sigemptyset (&act.sa_mask);
+
+		sigaction (signum, &act, NULL);
+	}
+
+	sigprocmask (SIG_SETMASK, &spawn->orig_set, NULL);
+
+	if (spawn->trace) {
+		if (ptrace (PTRACE_TRACEME, 0, NULL, 0) < 0)
+			job_process_spawn_abort (error_fd,
+						 JOB_PROCESS_ERROR_PTRACE, 0);
+	}
+
+	job_process_spawn_exec (spawn);
+
+	job_process_spawn_abort (error_fd, JOB_PROCESS_ERROR_EXEC, 0);
+}
+
+/**
+ * job_process_spawn_abort:
+ * @fd: writing end of pipe,
+ * @type: step that failed,
+ * @arg: argument to @type.
+ *
+ * Abort the child of a clone() spawn, first writing the error details in
+ * @type, @arg and errno to the writing end of the pipe specified by @fd.
+ *
+ * This function calls the _exit() system call, so never returns.
+ **/
+static void
+job_process_spawn_abort (int                 fd,
+			 JobProcessErrorType type,
+			 int                 arg)
+{
+	job_process_error_write (fd, type, arg, errno);
+
+	_exit (255);
+}
+
+/**
+ * job_process_spawn_remap_fd:
+ * @fd: file descriptor to remap,
+ * @error_fd: writing end of error pipe.
+ *
+ * Async-signal-safe equivalent of job_process_remap_fd() for the child
+ * of a clone() spawn, remapping @fd if it is JOB_PROCESS_SCRIPT_FD.
+ **/
+static void
+job_process_spawn_remap_fd (int *fd,
+			    int  error_fd)
+{
+	int new;
+
+	nih_assert (fd != NULL);
+
+	if (*fd != JOB_PROCESS_SCRIPT_FD)
+		return;
+
+	new = dup (*fd);
+	if (new < 0)
+		job_process_spawn_abort (error_fd, JOB_PROCESS_ERROR_DUP, 0);
+
+	close (*fd);
+	*fd = new;
+}
+
+/**
+ * job_process_spawn_exec:
+ * @spawn: spawn details.
+ *
+ * Execute the process described by @spawn with its environment, searching
+ * its PATH for the binary if the name contains no slash and running files
+ * without a recognised format with the shell, as execvp() does but without
+ * touching environ or allocating memory.
+ *
+ * Only returns on failure, with errno set.
+ **/
+static void
+job_process_spawn_exec (JobProcessSpawn *spawn)
+{
+	static char * const  no_env[] = { NULL };
+	char * const        *env;
+	const char          *file;
+	const char          *path;
+	size_t               file_len;
+	int                  eacces = FALSE;
+	char                 buf[PATH_MAX];
+
+	nih_assert (spawn != NULL);
+
+	env = spawn->env ? spawn->env : no_env;
+	file = spawn->argv[0];
+
+	if (strchr (file, '/')) {
+		execve (file, spawn->argv, env);
+		if (errno == ENOEXEC) {
+			spawn->sh_argv[1] = (char *)file;
+			execve (spawn->sh_argv[0], spawn->sh_argv, env);
+		}
+		return;
+	}
+
+	file_len = strlen (file);
+	path = spawn->path;
+
+	for (;;) {
+		const char *end = strchrnul (path, ':');
+		size_t      dir_len = end - path;
+
+		if (dir_len + file_len + 2 <= sizeof (buf)) {
+			/* An empty element means the current directory */
+			if (dir_len) {
+				memcpy (buf, path, dir_len);
+				buf[dir_len++] = '/';
+			}
+			memcpy (buf + dir_len, file, file_len + 1);
+
+			execve (buf, spawn->argv, env);
+
+			if (errno == ENOEXEC) {
+				spawn->sh_argv[1] = buf;
+				execve (spawn->sh_argv[0], spawn->sh_argv, env);
+				return;
+			}
+
+			switch (errno) {
+			case EACCES:
+				eacces = TRUE;
+				break;
+			case ENOENT:
+			case ENOTDIR:
+			case ESTALE:
+			case ENODEV:
+			case ETIMEDOUT:
+				break;
+			default:
+				return;
+			}
+		}
+
+		if (! *end)
+			break;
+
+		path = end + 1;
+	}
+
+	errno = eacces ? EACCES : ENOENT;
+}
+
+
+/**
+ * job_process_spawn_remote:
+ * @spawn: spawn details.
+ *
+ * Ask the spawn helper to spawn the process described by @spawn.  The
+ * helper clones the process with CLONE_PARENT so that it is our child,
+ * reaped and traced by us exactly as if we had spawned it ourselves.
+ *
+ * Returns: process id of new process on success, negative value with
+ * errno set if the helper failed to spawn it, or zero if the helper is
+ * not available and we should spawn the process ourselves.
+ **/
+static pid_t
+job_process_spawn_remote (JobProcessSpawn *spawn)
+{
+	nih_local char *buf = NULL;
+	size_t          len;
+	int             fds[SPAWNER_FDS_MAX];
+	size_t          nfds;
+	pid_t           pid;
+
+	nih_assert (spawn != NULL);
+
+	if (! spawner_available ())
+		return 0;
+
+	buf = job_process_spawn_encode (NULL, spawn, &len, fds, &nfds);
+	if (! buf)
+		return 0;
+
+	pid = spawner_request (buf, len, fds, nfds);
+	if ((pid < 0) && (! spawner_available ())) {
+		nih_warn (_("Spawn helper failed, spawning directly: %s"),
+			  strerror (errno));
+		return 0;
+	}
+
+	return pid;
+}
+
+/**
+ * job_process_spawn_append:
+ * @buf: pointer to buffer,
+ * @len: length of @buf,
+ * @data: data to append,
+ * @size: length of @data.
+ *
+ * Append @size bytes of @data to the buffer @buf, which must not grow
+ * beyond SPAWNER_MESSAGE_MAX.
+ *
+ * Returns: zero on success, negative value if the buffer is full or
+ * insufficient memory.
+ **/
+static int
+job_process_spawn_append (char       **buf,
+			  size_t      *len,
+			  const void  *data,
+			  size_t       size)
+{
+	char *new_buf;
+
+	nih_assert (buf != NULL);
+	nih_assert (len != NULL);
+
+	if (size > SPAWNER_MESSAGE_MAX - *len)
+		return -1;
+
+	new_buf = nih_realloc (*buf, NULL, *len + size);
+	if (! new_buf)
+		return -1;
+
+	*buf = new_buf;
+
+	memcpy (*buf + *len, data, size);
+	*len += size;
+
+	return 0;
+}
+
+/**
+ * job_process_spawn_encode:
+ * @parent: parent object for new buffer,
+ * @spawn: spawn details,
+ * @len: pointer to store length of buffer,
+ * @fds: array of SPAWNER_FDS_MAX entries to store descriptors to send,
+ * @nfds: pointer to store number of entries in @fds.
+ *
+ * Encode @spawn as a request for the spawn helper: the details themselves,
+ * followed by the supplementary groups and then the path, working
+ * directory, arguments and environment as nul-terminated strings.  The
+ * pointers in the copied details are meaningless to the helper, other than
+ * a non-NULL working directory marking it as present.
+ *
+ * The error pipe, script, and log pty descriptors in use are stored in
+ * @fds in that order, to be sent with the request.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned buffer.  When all parents
+ * of the returned buffer are freed, the returned buffer will also be
+ * freed.
+ *
+ * Returns: newly allocated buffer or NULL if insufficient memory or the
+ * request would be too large.
+ **/
+static char *
+job_process_spawn_encode (const void            *parent,
+			  const JobProcessSpawn *spawn,
+			  size_t                *len,
+			  int                   *fds,
+			  size_t                *nfds)
+{
+	char *buf;
+
+	nih_assert (spawn != NULL);
+	nih_assert (len != NULL);
+	nih_assert (fds != NULL);
+	nih_assert (nfds != NULL);
+
+	buf = nih_alloc (parent, sizeof (JobProcessSpawn));
+	if (! buf)
+		return NULL;
+
+	memcpy (buf, spawn, sizeof (JobProcessSpawn));
+	*len = sizeof (JobProcessSpawn);
+
+	if (spawn->ngroups
+	    && (job_process_spawn_append (&buf, len, spawn->groups,
+					  (sizeof (gid_t)
+					   * spawn->ngroups)) < 0))
+		goto error;
+
+	if (job_process_spawn_append (&buf, len, spawn->path,
+				      strlen (spawn->path) + 1) < 0)
+		goto error;
+
+	if (spawn->chdir
+	    && (job_process_spawn_append (&buf, len, spawn->chdir,
+					  strlen (spawn->chdir) + 1) < 0))
+		goto error;
+
+	for (size_t i = 0; i < spawn->argc; i++)
+		if (job_process_spawn_append (&buf, len, spawn->argv[i],
+					      strlen (spawn->argv[i]) + 1) < 0)
+			goto error;
+
+	for (size_t i = 0; i < spawn->envc; i++)
+		if (job_process_spawn_append (&buf, len, spawn->env[i],
+					      strlen (spawn->env[i]) + 1) < 0)
+			goto error;
+
+	*nfds = 0;
+	fds[(*nfds)++] = spawn->error_fd;
+	if (spawn->script_fd != -1)
+		fds[(*nfds)++] = spawn->script_fd;
+	if (spawn->pty_master != -1)
+		fds[(*nfds)++] = spawn->pty_master;
+	if (spawn->pty_slave != -1)
+		fds[(*nfds)++] = spawn->pty_slave;
+
+	return buf;
+
+error:
+	nih_free (buf);
+	return NULL;
+}
+
+/**
+ * job_process_spawn_string:
+ * @ptr: pointer to position in buffer,
+ * @end: end of buffer.
+ *
+ * Take the nul-terminated string at @ptr, advancing @ptr past it.
+ *
+ * Returns: string or NULL if there is no terminated string before @end.
+ **/
+static const char *
+job_process_spawn_string (const char **ptr,
+			  const char  *end)
+{
+	const char *str;
+	const char *nul;
+
+	nih_assert (ptr != NULL);
+	nih_assert (end != NULL);
+
+	str = *ptr;
+
+	nul = memchr (str, '\0', end - str);
+	if (! nul)
+		return NULL;
+
+	*ptr = nul + 1;
+
+	return str;
+}
+
+/**
+ * job_process_spawn_decode:
+ * @parent: parent object for new details,
+ * @buf: request from job_process_spawn_encode(),
+ * @len: length of @buf,
+ * @fds: descriptors received with request,
+ * @nfds: number of entries in @fds.
+ *
+ * Decode the spawn details sent in @buf, pointing their strings into
+ * @buf and their descriptors at those received.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned details.  When all parents
+ * of the returned details are freed, the returned details will also be
+ * freed.
+ *
+ * Returns: newly allocated details or NULL with errno set if the request
+ * is invalid or insufficient memory.
+ **/
+static JobProcessSpawn *
+job_process_spawn_decode (const void *parent,
+			  const char *buf,
+			  size_t      len,
+			  const int  *fds,
+			  size_t      nfds)
+{
+	JobProcessSpawn *spawn;
+	const char      *ptr;
+	const char      *end;
+	char           **argv;
+	char           **env;
+	size_t           fd_index = 0;
+
+	nih_assert (buf != NULL);
+	nih_assert ((fds != NULL) || (nfds == 0));
+
+	if (len < sizeof (JobProcessSpawn)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	spawn = nih_new (parent, JobProcessSpawn);
+	if (! spawn) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	memcpy (spawn, buf, sizeof (JobProcessSpawn));
+
+	ptr = buf + sizeof (JobProcessSpawn);
+	end = buf + len;
+
+	spawn->groups = NULL;
+	if (spawn->ngroups) {
+		if (spawn->ngroups > (size_t)(end - ptr) / sizeof (gid_t))
+			goto invalid;
+
+		spawn->groups = nih_alloc (spawn, (sizeof (gid_t)
+						   * spawn->ngroups));
+		if (! spawn->groups)
+			goto no_memory;
+
+		memcpy (spawn->groups, ptr, sizeof (gid_t) * spawn->ngroups);
+		ptr += sizeof (gid_t) * spawn->ngroups;
+	}
+
+	spawn->path = job_process_spawn_string (&ptr, end);
+	if (! spawn->path)
+		goto invalid;
+
+	if (spawn->chdir) {
+		spawn->chdir = job_process_spawn_string (&ptr, end);
+		if (! spawn->chdir)
+			goto invalid;
+	}
+
+	if ((! spawn->argc)
+	    || (spawn->argc > (size_t)(end - ptr))
+	    || (spawn->envc > (size_t)(end - ptr)))
+		goto invalid;
+
+	argv = nih_alloc (spawn, sizeof (char *) * (spawn->argc + 1));
+	env = nih_alloc (spawn, sizeof (char *) * (spawn->envc + 1));
+	spawn->sh_argv = nih_alloc (spawn, (sizeof (char *)
+					    * (spawn->argc + 2)));
+	if ((! argv) || (! env) || (! spawn->sh_argv))
+		goto no_memory;
+
+	for (size_t i = 0; i < spawn->argc; i++) {
+		argv[i] = (char *)job_process_spawn_string (&ptr, end);
+		if (! argv[i])
+			goto invalid;
+	}
+	argv[spawn->argc] = NULL;
+
+	for (size_t i = 0; i < spawn->envc; i++) {
+		env[i] = (char *)job_process_spawn_string (&ptr, end);
+		if (! env[i])
+			goto invalid;
+	}
+	env[spawn->envc] = NULL;
+
+	spawn->argv = argv;
+	spawn->env = env;
+
+	spawn->sh_argv[0] = "/bin/sh";
+	spawn->sh_argv[1] = NULL;
+	for (size_t i = 1; i <= spawn->argc; i++)
+		spawn->sh_argv[i + 1] = argv[i];
+
+	spawn->error_rd = -1;
+
+	if (fd_index >= nfds)
+		goto invalid;
+	spawn->error_fd = fds[fd_index++];
+
+	if (spawn->script_fd != -1) {
+		if (fd_index >= nfds)
+			goto invalid;
+		spawn->script_fd = fds[fd_index++];
+	}
+
+	if (spawn->pty_master != -1) {
+		if (fd_index >= nfds)
+			goto invalid;
+		spawn->pty_master = fds[fd_index++];
+	}
+
+	if (spawn->pty_slave != -1) {
+		if (fd_index >= nfds)
+			goto invalid;
+		spawn->pty_slave = fds[fd_index++];
+	}
+
+	if (fd_index != nfds)
+		goto invalid;
+
+	return spawn;
+
+invalid:
+	nih_free (spawn);
+	errno = EINVAL;
+	return NULL;
+
+no_memory:
+	nih_free (spawn);
+	errno = ENOMEM;
+	return NULL;
+}
+
+/**
+ * job_process_spawn_helper:
+ * @buf: request,
+ * @len: length of @buf,
+ * @fds: descriptors received with request,
+ * @nfds: number of entries in @fds.
+ *
+ * Handler for requests made of the spawn helper, see spawner_start().
+ * Clones the process described by the request as job_process_spawn_with_fd()
+ * would, except as a child of init rather than of the helper.
+ *
+ * Returns: process id of new process or negative value with errno set.
+ **/
+pid_t
+job_process_spawn_helper (const char *buf,
+			  size_t      len,
+			  int        *fds,
+			  size_t      nfds)
+{
+	JobProcessSpawn *spawn;
+	pid_t            pid;
+	int              saved_errno;
+
+	nih_assert (buf != NULL);
+
+	spawn = job_process_spawn_decode (NULL, buf, len, fds, nfds);
+	if (! spawn)
+		return -1;
+
+	pid = clone (job_process_spawn_child,
+		     (job_process_spawn_stack
+		      + sizeof (job_process_spawn_stack)),
+		     CLONE_VM | CLONE_VFORK | CLONE_PARENT | SIGCHLD, spawn);
+	saved_errno = errno;
+
+	nih_free (spawn);
+
+	errno = saved_errno;
+	return pid;
 }
 
 
@@ -1281,6 +2540,9 @@ job_process_error_handler (const char *buf, size_t len)
  * @process the "kill signal" defined signal (TERM by default), and maybe
  * later the KILL signal.  The actual state changes are performed by
  * job_child_reaper when the process has actually terminated.
+ *
+ * The signals are also sent to any other processes in the job's own
+ * cgroups, which catches daemons that have left its process group.
  **/
 void
 job_process_kill (Job         *job,
@@ -1295,7 +2557,7 @@ job_process_kill (Job         *job,
 		  nih_signal_to_name (job->class->kill_signal),
 		  job_name (job), process_name (process), job->pid[process]);
 
-	if (system_kill (job->pid[process], job->class->kill_signal) < 0) {
+	if (job_process_signal (job, process, job->class->kill_signal) < 0) {
 		NihError *err;
 
 		err = nih_error_get ();
@@ -1309,9 +2571,41 @@ job_process_kill (Job         *job,
 		return;
 	}
 
+#ifdef ENABLE_CGROUPS
+	job_process_cgroups_kill (job, process, job->class->kill_signal);
+#endif /* ENABLE_CGROUPS */
+
 	job_process_set_kill_timer (job, process, job->class->kill_timeout);
 }
 
+/**
+ * job_process_set_pid:
+ * @job: job,
+ * @process: process,
+ * @pid: process id, or zero once the process has ended.
+ *
+ * Set the process id of @process of @job, counting the job processes
+ * running so that job_process_jobs_running() need not look at every
+ * job.  All changes to the process ids of jobs must be made this way.
+ **/
+void
+job_process_set_pid (Job         *job,
+		     ProcessType  process,
+		     pid_t        pid)
+{
+	nih_assert (job != NULL);
+	nih_assert (process > PROCESS_INVALID);
+	nih_assert (process < PROCESS_LAST);
+
+	if (job->pid[process] > 0)
+		job_process_running--;
+
+	job->pid[process] = pid;
+
+	if (pid > 0)
+		job_process_running++;
+}
+
 /**
  * job_process_jobs_running:
  *
@@ -1324,23 +2618,7 @@ job_process_kill (Job         *job,
 int
 job_process_jobs_running (void)
 {
-	job_class_init ();
-
-	NIH_HASH_FOREACH (job_classes, iter) {
-		JobClass *class = (JobClass *)iter;
-
-		NIH_HASH_FOREACH (class->instances, job_iter) {
-			Job *job = (Job *)job_iter;
-			int i;
-
-			for (i = 0; i < PROCESS_LAST; i++) {
-				if (job->pid[i])
-					return TRUE;
-			}
-		}
-	}
-
-	return FALSE;
+	return job_process_running > 0;
 }
 
 
@@ -1368,44 +2646,110 @@ job_process_stop_all (void)
 }
 
 /**
- * job_process_set_kill_timer:
- * @job: job to set kill timer for,
- * @process: process to be killed,
- * @timeout: timeout to apply for timer.
+ * job_process_set_kill_timer:
+ * @job: job to set kill timer for,
+ * @process: process to be killed,
+ * @timeout: timeout to apply for timer.
+ *
+ * Set kill timer for specified @job @process with timeout @timeout.
+ **/
+void
+job_process_set_kill_timer (Job          *job,
+		  	    ProcessType   process,
+			    time_t        timeout)
+{
+	nih_assert (job);
+	nih_assert (timeout);
+	nih_assert (job->kill_timer == NULL);
+
+	job->kill_process = process;
+	job->kill_timer = NIH_MUST (wheel_timer_add_timeout (
+			  job, timeout,
+			  (WheelTimerCb)job_process_kill_timer, job));
+}
+
+/**
+ * job_process_adj_kill_timer:
+ *
+ * @job: job whose kill timer is to be modified,
+ * @due: new due time to set for job kill timer.
+ *
+ * Adjust due time for @job's kill timer to @due.
+ **/
+void
+job_process_adj_kill_timer (Job *job, time_t due)
+{
+	nih_assert (job);
+	nih_assert (job->kill_timer);
+	nih_assert (due);
+
+	wheel_timer_set_due (job->kill_timer, due);
+}
+
+/**
+ * job_process_set_respawn_timer:
+ * @job: job to set respawn timer for,
+ * @timeout: seconds to wait before respawning.
  *
- * Set kill timer for specified @job @process with timeout @timeout.
+ * Set a timer to hold @job in the post-stop state for @timeout seconds
+ * before it is respawned.
  **/
 void
-job_process_set_kill_timer (Job          *job,
-		  	    ProcessType   process,
-			    time_t        timeout)
+job_process_set_respawn_timer (Job    *job,
+			       time_t  timeout)
 {
 	nih_assert (job);
 	nih_assert (timeout);
-	nih_assert (job->kill_timer == NULL);
+	nih_assert (job->respawn_timer == NULL);
 
-	job->kill_process = process;
-	job->kill_timer = NIH_MUST (nih_timer_add_timeout (
+	job->respawn_timer = NIH_MUST (wheel_timer_add_timeout (
 			  job, timeout,
-			  (NihTimerCb)job_process_kill_timer, job));
+			  (WheelTimerCb)job_process_respawn_timer, job));
 }
 
 /**
- * job_process_adj_kill_timer:
+ * job_process_adj_respawn_timer:
  *
- * @job: job whose kill timer is to be modified,
- * @due: new due time to set for job kill timer.
+ * @job: job whose respawn timer is to be modified,
+ * @due: new due time to set for job respawn timer.
  *
- * Adjust due time for @job's kill timer to @due.
+ * Adjust due time for @job's respawn timer to @due.
  **/
 void
-job_process_adj_kill_timer (Job *job, time_t due)
+job_process_adj_respawn_timer (Job *job, time_t due)
 {
 	nih_assert (job);
-	nih_assert (job->kill_timer);
+	nih_assert (job->respawn_timer);
 	nih_assert (due);
 
-	job->kill_timer->due = due;
+	wheel_timer_set_due (job->respawn_timer, due);
+}
+
+/**
+ * job_process_respawn_timer:
+ * @job: job to respawn,
+ * @timer: timer that caused us to be called.
+ *
+ * This callback is called once a job's respawn delay has passed.  If the
+ * job has finished stopping, and so is being held in the post-stop state,
+ * it is started again; otherwise it will be started once it has.
+ **/
+static void
+job_process_respawn_timer (Job        *job,
+			   WheelTimer *timer)
+{
+	nih_assert (job != NULL);
+	nih_assert (timer != NULL);
+	nih_assert (job->respawn_timer == timer);
+
+	job->respawn_timer = NULL;
+
+	if ((job->state == JOB_POST_STOP)
+	    && (job->pid[PROCESS_POST_STOP] <= 0)) {
+		nih_info (_("Respawning %s"), job_name (job));
+
+		job_change_state (job, job_next_state (job));
+	}
 }
 
 /**
@@ -1418,8 +2762,8 @@ job_process_adj_kill_timer (Job *job, time_t due)
  * more forcibly by sending the KILL signal.
  **/
 static void
-job_process_kill_timer (Job      *job,
-			NihTimer *timer)
+job_process_kill_timer (Job        *job,
+			WheelTimer *timer)
 {
 	ProcessType process;
 
@@ -1438,7 +2782,7 @@ job_process_kill_timer (Job      *job,
 		  "KILL",
 		  job_name (job), process_name (process), job->pid[process]);
 
-	if (system_kill (job->pid[process], SIGKILL) < 0) {
+	if (job_process_signal (job, process, SIGKILL) < 0) {
 		NihError *err;
 
 		err = nih_error_get ();
@@ -1449,6 +2793,10 @@ job_process_kill_timer (Job      *job,
 				  job->pid[process], err->message);
 		nih_free (err);
 	}
+
+#ifdef ENABLE_CGROUPS
+	job_process_cgroups_kill (job, process, SIGKILL);
+#endif /* ENABLE_CGROUPS */
 }
 
 
@@ -1484,6 +2832,19 @@ job_process_handler (void           *data,
 	 * ignore the event.
 	 */
 	job = job_process_find (pid, &process);
+
+	/* Once the process has been reaped its process file descriptor is
+	 * of no further use, whether or not it still belongs to a job.
+	 */
+	if ((event == NIH_CHILD_EXITED) || (event == NIH_CHILD_KILLED)
+	    || (event == NIH_CHILD_DUMPED)) {
+		JobProcessWatch *watch;
+
+		watch = job_process_watch_find (pid);
+		if (watch)
+			nih_free (watch);
+	}
+
 	if (! job)
 		return;
 
@@ -1737,9 +3098,25 @@ job_process_terminated (Job         *job,
 					failed = FALSE;
 					job_failed (job, PROCESS_INVALID, 0);
 				} else {
-					nih_warn (_("%s %s process ended, respawning"),
-						  job_name (job),
-						  process_name (process));
+					time_t delay;
+
+					delay = job_process_respawn_delay (job);
+					if (delay) {
+						nih_warn (_("%s %s process ended, respawning in %ld seconds"),
+							  job_name (job),
+							  process_name (process),
+							  (long)delay);
+
+						/* The job stops as normal but
+						 * waits in the post-stop state
+						 * until the timer fires.
+						 */
+						job_process_set_respawn_timer (job, delay);
+					} else {
+						nih_warn (_("%s %s process ended, respawning"),
+							  job_name (job),
+							  process_name (process));
+					}
 					failed = FALSE;
 
 					/* If we're not going to change the
@@ -1886,7 +3263,7 @@ job_process_terminated (Job         *job,
 		endutxent();
 
 		/* Clear the process pid field */
-		job->pid[process] = 0;
+		job_process_set_pid (job, process, 0);
 	}
 
 	/* Mark the job as failed */
@@ -1957,6 +3334,68 @@ job_process_catch_runaway (Job *job)
 	return FALSE;
 }
 
+/**
+ * job_process_respawn_delay:
+ * @job: job being respawned.
+ *
+ * Work out how long @job should wait before being respawned.  The first
+ * respawn waits for the respawn delay of the job's class, each consecutive
+ * respawn waits for the previous delay multiplied by the class's backoff
+ * factor, up to its maximum.  Once the job has stayed up for longer than
+ * the maximum since it was last respawned, the delay returns to its
+ * initial value.
+ *
+ * Each delay is shortened at random by up to JOB_RESPAWN_JITTER percent
+ * so that instances that fail together don't respawn together.
+ *
+ * Returns: seconds to wait before respawning, or zero to respawn
+ * immediately.
+ **/
+static time_t
+job_process_respawn_delay (Job *job)
+{
+	JobClass        *class;
+	struct timespec  now;
+	time_t           max;
+	time_t           delay;
+	time_t           jitter;
+
+	nih_assert (job != NULL);
+
+	class = job->class;
+
+	if (! class->respawn_delay)
+		return 0;
+
+	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
+
+	max = class->respawn_delay_max;
+	if (max < class->respawn_delay)
+		max = class->respawn_delay;
+
+	if (job->respawn_delay && (now.tv_sec - job->respawn_due < max)) {
+		delay = job->respawn_delay;
+		if (class->respawn_backoff > 1)
+			delay = ((delay > max / class->respawn_backoff)
+				 ? max : delay * class->respawn_backoff);
+	} else {
+		delay = class->respawn_delay;
+	}
+
+	if (delay > max)
+		delay = max;
+
+	job->respawn_delay = delay;
+
+	jitter = delay * JOB_RESPAWN_JITTER / 100;
+	if (jitter)
+		delay -= random () % (jitter + 1);
+
+	job->respawn_due = now.tv_sec + delay;
+
+	return delay;
+}
+
 
 /**
  * job_process_stopped:
@@ -2176,9 +3615,11 @@ job_process_trace_fork (Job         *job,
 	/* Update the process we're supervising which is about to get SIGSTOP
 	 * so set the trace options to capture it.
 	 */
-	job->pid[process] = (pid_t)data;
+	job_process_set_pid (job, process, (pid_t)data);
 	job->trace_state = TRACE_NEW_CHILD;
 
+	job_process_watch_add (job, process);
+
 	/* We may have already had the wait notification for the new child
 	 * waiting at SIGSTOP, in which case a ptrace() call will succeed
 	 * for it.
@@ -2255,8 +3696,21 @@ Job *
 job_process_find (pid_t        pid,
 		  ProcessType *process)
 {
+	JobProcessWatch *watch;
+
 	nih_assert (pid > 0);
 
+	/* Processes we hold a process file descriptor for are indexed,
+	 * which saves searching every instance of every job; the entry
+	 * may be stale if the job has since moved on to another process.
+	 */
+	watch = job_process_watch_find (pid);
+	if (watch && (watch->job->pid[watch->process] == pid)) {
+		if (process)
+			*process = watch->process;
+		return watch->job;
+	}
+
 	job_class_init ();
 
 	NIH_HASH_FOREACH (job_classes, iter) {
@@ -2279,6 +3733,309 @@ job_process_find (pid_t        pid,
 	return NULL;
 }
 
+/**
+ * job_process_watch_key:
+ * @entry: watch.
+ *
+ * Returns: pointer to the process id of @entry, the key of
+ * job_process_watches.
+ **/
+static const void *
+job_process_watch_key (NihList *entry)
+{
+	nih_assert (entry != NULL);
+
+	return &((JobProcessWatch *)entry)->pid;
+}
+
+/**
+ * job_process_watch_hash:
+ * @key: pointer to process id.
+ *
+ * Returns: hash of the process id pointed to by @key.
+ **/
+static uint32_t
+job_process_watch_hash (const void *key)
+{
+	nih_assert (key != NULL);
+
+	return (uint32_t)*(const pid_t *)key;
+}
+
+/**
+ * job_process_watch_cmp:
+ * @key1: pointer to process id,
+ * @key2: pointer to process id.
+ *
+ * Returns: zero if @key1 and @key2 point to the same process id.
+ **/
+static int
+job_process_watch_cmp (const void *key1,
+		       const void *key2)
+{
+	nih_assert (key1 != NULL);
+	nih_assert (key2 != NULL);
+
+	return *(const pid_t *)key1 != *(const pid_t *)key2;
+}
+
+/**
+ * job_process_watch_init:
+ *
+ * Initialise the table of process file descriptors and the list of
+ * exits to be handled.
+ **/
+static void
+job_process_watch_init (void)
+{
+	if (! job_process_watches)
+		job_process_watches = NIH_MUST (nih_hash_new (
+				NULL, 0, job_process_watch_key,
+				job_process_watch_hash, job_process_watch_cmp));
+
+	if (! job_process_exits)
+		job_process_exits = NIH_MUST (nih_list_new (NULL));
+}
+
+/**
+ * job_process_watch_find:
+ * @pid: process id to find.
+ *
+ * Returns: process file descriptor watch held for @pid or NULL.
+ **/
+static JobProcessWatch *
+job_process_watch_find (pid_t pid)
+{
+	if (! job_process_watches)
+		return NULL;
+
+	return (JobProcessWatch *)nih_hash_lookup (job_process_watches, &pid);
+}
+
+/**
+ * job_process_watch_add:
+ * @job: job to watch process of,
+ * @process: process to be watched.
+ *
+ * Obtain a process file descriptor for @process of @job, which must have
+ * just been spawned or otherwise be known to be our child or tracee, and
+ * watch it in the main loop so that the process is reaped as soon as it
+ * exits; the exit is handled by job_process_watch_poll().  Signals sent
+ * to the process by job_process_kill() are also sent through it, so they
+ * can never reach an unrelated process that has reused its process id.
+ *
+ * The SIGCHLD handler remains in place regardless, since it's needed
+ * for ptrace events and for processes we could not obtain a descriptor
+ * for; whichever sees the exit first reaps the process.
+ *
+ * Failure is not fatal, the process is then supervised with SIGCHLD
+ * alone.  If the kernel does not support process file descriptors,
+ * use_pidfd is cleared so we don't try again.
+ **/
+void
+job_process_watch_add (Job         *job,
+		       ProcessType  process)
+{
+	JobProcessWatch *watch;
+	pid_t            pid;
+	int              fd;
+
+	nih_assert (job != NULL);
+	nih_assert (job->pid[process] > 0);
+
+	if (! use_pidfd)
+		return;
+
+	job_process_watch_init ();
+
+	pid = job->pid[process];
+
+	/* Any existing entry must be left over from an earlier process
+	 * with the same id, which we can't still be waiting for.
+	 */
+	watch = job_process_watch_find (pid);
+	if (watch)
+		nih_free (watch);
+
+	fd = system_pidfd_open (pid);
+	if (fd < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		if (err->number == ENOSYS) {
+			nih_debug ("Process file descriptors not supported, "
+				   "supervising with SIGCHLD only");
+			use_pidfd = FALSE;
+		} else {
+			nih_debug ("Failed to open %s %s process (%d): %s",
+				   job_name (job), process_name (process),
+				   pid, err->message);
+		}
+		nih_free (err);
+
+		return;
+	}
+
+	watch = nih_new (job, JobProcessWatch);
+	if (! watch) {
+		close (fd);
+		return;
+	}
+
+	nih_list_init (&watch->entry);
+
+	watch->pid = pid;
+	watch->fd = fd;
+	watch->job = job;
+	watch->process = process;
+	watch->event = 0;
+	watch->status = 0;
+
+	nih_alloc_set_destructor (watch, job_process_watch_destroy);
+
+	watch->io_watch = nih_io_add_watch (watch, fd, NIH_IO_READ,
+			(NihIoWatcher)job_process_watch_reader, watch);
+	if (! watch->io_watch) {
+		nih_free (watch);
+		return;
+	}
+
+	nih_hash_add (job_process_watches, &watch->entry);
+}
+
+/**
+ * job_process_watch_destroy:
+ * @watch: watch being freed.
+ *
+ * Removes @watch from the table and closes its process file descriptor.
+ *
+ * Returns: zero.
+ **/
+static int
+job_process_watch_destroy (JobProcessWatch *watch)
+{
+	nih_assert (watch != NULL);
+
+	nih_list_destroy (&watch->entry);
+	close (watch->fd);
+
+	return 0;
+}
+
+/**
+ * job_process_watch_reader:
+ * @watch: watch for process,
+ * @io_watch: NihIoWatch for process file descriptor,
+ * @events: events that occurred.
+ *
+ * Called when the process file descriptor of @watch becomes readable,
+ * which happens once the process has exited.  The process is reaped and
+ * its exit queued to be handled along with any others by
+ * job_process_watch_poll().
+ *
+ * If the process has already been reaped, or is not our child to reap,
+ * the watch is freed and the exit left to the SIGCHLD handler.
+ **/
+static void
+job_process_watch_reader (JobProcessWatch *watch,
+			  NihIoWatch      *io_watch,
+			  NihIoEvents      events)
+{
+	NihListEntry *entry;
+	siginfo_t     info;
+
+	nih_assert (watch != NULL);
+	nih_assert (io_watch != NULL);
+	nih_assert (watch->io_watch == io_watch);
+
+	info.si_pid = 0;
+	if ((waitid (P_PID, watch->pid, &info, WEXITED | WNOHANG) < 0)
+	    || (info.si_pid != watch->pid)) {
+		nih_free (watch);
+		return;
+	}
+
+	switch (info.si_code) {
+	case CLD_EXITED:
+		watch->event = NIH_CHILD_EXITED;
+		break;
+	case CLD_KILLED:
+		watch->event = NIH_CHILD_KILLED;
+		break;
+	case CLD_DUMPED:
+		watch->event = NIH_CHILD_DUMPED;
+		break;
+	default:
+		nih_assert_not_reached ();
+	}
+
+	watch->status = info.si_status;
+
+	/* The descriptor stays open until the exit is handled so that the
+	 * process id can't be signalled in the meantime.
+	 */
+	nih_free (watch->io_watch);
+	watch->io_watch = NULL;
+
+	entry = NIH_MUST (nih_list_entry_new (watch));
+	entry->data = watch;
+
+	nih_list_add (job_process_exits, &entry->entry);
+}
+
+/**
+ * job_process_watch_poll:
+ *
+ * Handle the exits of all job processes reaped through their process
+ * file descriptor since we were last called.  This should be called
+ * once each time through the main loop, before the event queue is
+ * processed, so that the exits are handled in a single batch and the
+ * events they cause are handled in the same iteration.
+ **/
+void
+job_process_watch_poll (void)
+{
+	if (! job_process_exits)
+		return;
+
+	NIH_LIST_FOREACH_SAFE (job_process_exits, iter) {
+		NihListEntry    *entry = (NihListEntry *)iter;
+		JobProcessWatch *watch = (JobProcessWatch *)entry->data;
+
+		/* Frees the watch, and so the entry */
+		job_process_handler (NULL, watch->pid, watch->event,
+				     watch->status);
+	}
+}
+
+/**
+ * job_process_signal:
+ * @job: job to signal process of,
+ * @process: process to be signalled,
+ * @signal: signal to send.
+ *
+ * Send @signal to @process of @job and the rest of its process group,
+ * through its process file descriptor if we hold one.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+job_process_signal (Job         *job,
+		    ProcessType  process,
+		    int          signal)
+{
+	JobProcessWatch *watch;
+
+	nih_assert (job != NULL);
+	nih_assert (job->pid[process] > 0);
+
+	watch = job_process_watch_find (job->pid[process]);
+	if (watch && (watch->job == job) && (watch->process == process))
+		return system_kill_pidfd (watch->fd, job->pid[process], signal);
+
+	return system_kill (job->pid[process], signal);
+}
+
 /**
  * job_process_log_path:
  *
@@ -2484,6 +4241,12 @@ job_process_child_reader (JobProcessData  *process_data,
 			err->message);
 	nih_free (err);
 
+#ifdef ENABLE_CGROUPS
+	/* The cgroups may not be as recorded, so set them up again */
+	if (job && job_needs_cgroups (job))
+		cgroup_forget (&job->class->cgroups);
+#endif /* ENABLE_CGROUPS */
+
 	/* Non-temporary error condition, we're not going
 	 * to be able to spawn this job.
 	 */
@@ -2556,15 +4319,23 @@ job_process_close_handler (JobProcessData  *process_data,
 	process_data->job_process_fd = -1;
 	process_data->valid = FALSE;
 
+#ifdef ENABLE_CGROUPS
+	if (job && job_needs_cgroups (job))
+		job_process_cgroups_record (job, process);
+#endif /* ENABLE_CGROUPS */
+
 	job_process_run_bottom (process_data);
 
 	if (job && job->state == JOB_SPAWNED) {
-		if (job->class->expect == EXPECT_NONE) {
+		if ((job->class->expect == EXPECT_NONE)
+		    || ((job->class->expect == EXPECT_NOTIFY)
+			&& (! notify_available ()))) {
 			if (process == PROCESS_MAIN) {
 				/* Job has not specified expect stanza so will
 				 * not have its state automatically progressed
 				 * by the ptrace handlers, hence bump it
-				 * manually.
+				 * manually; likewise if it can't be told
+				 * where to send its notification.
 				 */
 				job_change_state (job, job_next_state (job));
 			}
@@ -2592,6 +4363,89 @@ job_process_close_handler (JobProcessData  *process_data,
 }
 
 
+#ifdef ENABLE_CGROUPS
+/**
+ * job_process_cgroups_record:
+ * @job: job,
+ * @process: process that was spawned successfully.
+ *
+ * Record that the cgroups of @job were set up by the spawn of @process
+ * so that later spawns need only enter them.
+ *
+ * The cgroup manager is asked to remove the cgroups once empty when the
+ * last process of the job is spawned, after which they can no longer
+ * be assumed to exist.
+ **/
+static void
+job_process_cgroups_record (Job         *job,
+			    ProcessType  process)
+{
+	nih_local char **env = NULL;
+	size_t           envc;
+
+	nih_assert (job != NULL);
+
+	if (! cgroup_fs_available () && job_last_process (job, process)) {
+		cgroup_forget (&job->class->cgroups);
+		return;
+	}
+
+	/* Names are expanded using the environment the process was given */
+	env = job_process_environment (NULL, job, process, &envc);
+
+	if (! cgroup_record (&job->class->cgroups, env)) {
+		NihError *err;
+
+		/* Not fatal, the next spawn sets them up again */
+		err = nih_error_get ();
+		nih_debug ("%s: %s", job_name (job), err->message);
+		nih_free (err);
+	}
+}
+
+/**
+ * job_process_cgroups_kill:
+ * @job: job,
+ * @process: process that has been signalled,
+ * @signal: signal to send.
+ *
+ * Send @signal to the processes in the job-unique cgroups of @job,
+ * other than those in the process group of @process which has already
+ * been sent it.
+ **/
+static void
+job_process_cgroups_kill (Job         *job,
+			  ProcessType  process,
+			  int          signal)
+{
+	nih_local char **env = NULL;
+	size_t           envc;
+	pid_t            pgid;
+
+	nih_assert (job != NULL);
+
+	if (NIH_LIST_EMPTY (&job->class->cgroups))
+		return;
+
+	pgid = getpgid (job->pid[process]);
+	if (pgid < 0)
+		pgid = 0;
+
+	/* Names are expanded using the environment the process was given */
+	env = job_process_environment (NULL, job, process, &envc);
+
+	if (! cgroup_kill (&job->class->cgroups, env, signal, pgid)) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_warn (_("Failed to send %s signal to %s cgroups: %s"),
+			  nih_signal_to_name (signal), job_name (job),
+			  err->message);
+		nih_free (err);
+	}
+}
+#endif /* ENABLE_CGROUPS */
+
 /**
  * job_process_run_bottom:
  *
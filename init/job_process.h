@@ -142,6 +142,10 @@ typedef void (*JobProcessErrorHandler) (Job *job, JobState state, ProcessType pr
 
 NIH_BEGIN_EXTERN
 
+char **job_process_environment (const void *parent, Job *job,
+				ProcessType process, size_t *envc)
+	__attribute__ ((warn_unused_result, malloc));
+
 void   job_process_start      (Job *job, ProcessType process);
 void   job_process_run_bottom (JobProcessData *handler_data);
 
@@ -168,6 +172,9 @@ void   job_process_handler (void *ptr, pid_t pid,
 
 Job   *job_process_find     (pid_t pid, ProcessType *process);
 
+void   job_process_watch_add  (Job *job, ProcessType process);
+void   job_process_watch_poll (void);
+
 char  *job_process_log_path (Job *job, int user_job)
 	__attribute__ ((warn_unused_result));
 
@@ -177,7 +184,13 @@ void   job_process_set_kill_timer (Job          *job,
 
 void   job_process_adj_kill_timer  (Job *job, time_t due);
 
-int    job_process_jobs_running (void);
+void   job_process_set_respawn_timer (Job *job, time_t timeout);
+void   job_process_adj_respawn_timer (Job *job, time_t due);
+
+void   job_process_set_pid (Job *job, ProcessType process, pid_t pid);
+
+int    job_process_jobs_running (void)
+	__attribute__ ((warn_unused_result));
 
 void   job_process_stop_all (void);
 
@@ -199,6 +212,9 @@ void job_process_error_abort     (int fd, JobProcessErrorType type,
 					 int arg)
 	__attribute__ ((noreturn));
 
+pid_t job_process_spawn_helper   (const char *buf, size_t len,
+				  int *fds, size_t nfds);
+
 NIH_END_EXTERN
 
 #endif /* INIT_JOB_PROCESS_H */
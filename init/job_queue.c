@@ -0,0 +1,517 @@
+/* upstart
+ *
+ * job_queue.c - limits on the number of jobs starting at once
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/main.h>
+#include <nih/logging.h>
+
+#include "job_class.h"
+#include "job.h"
+#include "trace.h"
+#include "pressure.h"
+#include "job_queue.h"
+
+
+/* Prototypes for static functions */
+static int  job_queue_admit   (Job *job);
+static void job_queue_acquire (Job *job);
+static void job_queue_reserve (void);
+static void job_queue_insert  (Job *job);
+static unsigned long long job_queue_wait (Job *job);
+
+
+/**
+ * max_concurrent_spawns:
+ *
+ * Maximum number of jobs that may be starting at once, or zero for no
+ * limit.  Set with the --max-concurrent-spawns option or the
+ * max_concurrent_spawns D-Bus property.
+ **/
+int max_concurrent_spawns = 0;
+
+/**
+ * job_queue:
+ *
+ * List of jobs waiting in the queued state for a spawn slot, highest
+ * priority first and then oldest first; each entry is an NihListEntry whose data member points to the
+ * job, and which is a child of that job.
+ **/
+NihList *job_queue = NULL;
+
+/**
+ * job_queue_ready:
+ *
+ * List of jobs that have been given a spawn slot but not yet moved out
+ * of the queued state, which job_queue_poll() does; entries are as for
+ * job_queue.
+ **/
+static NihList *job_queue_ready = NULL;
+
+/**
+ * job_queue_slots:
+ *
+ * Number of spawn slots currently held.
+ **/
+static int job_queue_slots = 0;
+
+/**
+ * job_queue_max_wait:
+ *
+ * Longest time, in microseconds, that any job has waited in the queue.
+ **/
+static unsigned long long job_queue_max_wait = 0;
+
+
+/**
+ * job_queue_init:
+ *
+ * Initialise the spawn queue.
+ **/
+void
+job_queue_init (void)
+{
+	if (! job_queue)
+		job_queue = NIH_MUST (nih_list_new (NULL));
+
+	if (! job_queue_ready)
+		job_queue_ready = NIH_MUST (nih_list_new (NULL));
+}
+
+
+/**
+ * job_queue_enter:
+ * @job: job entering the queued state.
+ *
+ * Called as @job enters the queued state on its way to running its
+ * pre-start process.  If neither the max_concurrent_spawns limit nor the
+ * concurrency limit of @job's class has been reached, @job is given a
+ * spawn slot and may continue immediately; otherwise it is added to the
+ * queue behind any jobs of the same or higher priority, and will be moved
+ * on by job_queue_poll() once a slot is free.
+ *
+ * Returns: TRUE if @job may continue, FALSE if it has been queued.
+ **/
+int
+job_queue_enter (Job *job)
+{
+	nih_assert (job != NULL);
+	nih_assert (job->state == JOB_QUEUED);
+	nih_assert (job->queued == NULL);
+	nih_assert (! job->spawn_slot);
+
+	job_queue_init ();
+
+	if (job_queue_admit (job)) {
+		job_queue_acquire (job);
+		return TRUE;
+	}
+
+	job_queue_insert (job);
+
+	nih_debug ("Queued %s, %zu waiting", job_name (job),
+		   job_queue_depth ());
+
+	return FALSE;
+}
+
+/**
+ * job_queue_leave:
+ * @job: job that has finished starting.
+ *
+ * Called once @job has finished starting, either because it is running
+ * or because it is being stopped; removes @job from the queue if it is
+ * waiting there, and releases its spawn slot if it holds one so that the
+ * next queued job may be started.
+ **/
+void
+job_queue_leave (Job *job)
+{
+	nih_assert (job != NULL);
+
+	if (job->queued) {
+		nih_free (job->queued);
+		job->queued = NULL;
+	}
+
+	job->deferred = FALSE;
+
+	if (! job->spawn_slot)
+		return;
+
+	job->spawn_slot = FALSE;
+	job->class->spawning--;
+	job_queue_slots--;
+
+	job_queue_reserve ();
+}
+
+/**
+ * job_queue_restore:
+ * @job: deserialised job.
+ *
+ * Account for @job after a stateful re-exec; if it held a spawn slot that
+ * slot is taken again, and if it was waiting in the queue it is put back
+ * in the order it was queued.
+ **/
+void
+job_queue_restore (Job *job)
+{
+	nih_assert (job != NULL);
+	nih_assert (job->queued == NULL);
+
+	job_queue_init ();
+
+	if (job->spawn_slot) {
+		job->class->spawning++;
+		job_queue_slots++;
+
+		if (job->state != JOB_QUEUED)
+			return;
+
+		job->queued = NIH_MUST (nih_list_entry_new (job));
+		job->queued->data = job;
+		nih_list_add (job_queue_ready, &job->queued->entry);
+
+		nih_main_loop_interrupt ();
+		return;
+	}
+
+	if (job->state != JOB_QUEUED)
+		return;
+
+	job_queue_insert (job);
+
+	if (job->deferred)
+		pressure_arm ();
+}
+
+/**
+ * job_queue_set_limit:
+ * @limit: new value for max_concurrent_spawns.
+ *
+ * Change the number of jobs that may be starting at once; if this is an
+ * increase, queued jobs are given the newly free slots.
+ **/
+void
+job_queue_set_limit (int limit)
+{
+	nih_assert (limit >= 0);
+
+	max_concurrent_spawns = limit;
+
+	job_queue_init ();
+	job_queue_reserve ();
+}
+
+/**
+ * job_queue_recheck:
+ *
+ * Consider queued jobs for any free spawn slots again; called when the
+ * conditions checked by pressure_admit() may have changed.
+ **/
+void
+job_queue_recheck (void)
+{
+	job_queue_init ();
+	job_queue_reserve ();
+}
+
+
+/**
+ * job_queue_poll:
+ *
+ * Move on each queued job that has been given a spawn slot.  This is
+ * called from the main loop, rather than as slots are released, since
+ * slots are released from within job_change_state() for another job.
+ **/
+void
+job_queue_poll (void)
+{
+	job_queue_init ();
+
+	while (! NIH_LIST_EMPTY (job_queue_ready)) {
+		NihListEntry *entry = (NihListEntry *)job_queue_ready->next;
+		Job          *job = (Job *)entry->data;
+
+		nih_assert (job->state == JOB_QUEUED);
+		nih_assert (job->spawn_slot);
+
+		nih_free (job->queued);
+		job->queued = NULL;
+
+		job_change_state (job, job_next_state (job));
+	}
+}
+
+
+/**
+ * job_queue_spawning:
+ *
+ * Returns: number of jobs currently holding a spawn slot.
+ **/
+int
+job_queue_spawning (void)
+{
+	return job_queue_slots;
+}
+
+/**
+ * job_queue_depth:
+ *
+ * Returns: number of jobs waiting in the queue for a spawn slot.
+ **/
+size_t
+job_queue_depth (void)
+{
+	size_t depth = 0;
+
+	job_queue_init ();
+
+	NIH_LIST_FOREACH (job_queue, iter)
+		depth++;
+
+	return depth;
+}
+
+/**
+ * job_queue_longest_wait:
+ *
+ * Returns: longest time, in microseconds, that any job has waited in the
+ * queue, including those still waiting.
+ **/
+unsigned long long
+job_queue_longest_wait (void)
+{
+	unsigned long long longest = job_queue_max_wait;
+
+	job_queue_init ();
+
+	NIH_LIST_FOREACH (job_queue, iter) {
+		NihListEntry       *entry = (NihListEntry *)iter;
+		unsigned long long  wait;
+
+		wait = job_queue_wait ((Job *)entry->data);
+		if (wait > longest)
+			longest = wait;
+	}
+
+	return longest;
+}
+
+/**
+ * job_queue_jobs:
+ * @parent: parent object for new array.
+ *
+ * Describe the jobs waiting in the queue, in the order they will be
+ * started; each element is of the form "WAIT NAME" where WAIT is the
+ * number of microseconds the job has waited so far and NAME the name of
+ * the job as returned by job_name().
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned array.  When all parents
+ * of the returned array are freed, the returned array will also be
+ * freed.
+ *
+ * Returns: newly allocated NULL-terminated array or NULL if insufficient
+ * memory.
+ **/
+char **
+job_queue_jobs (const void *parent)
+{
+	char   **jobs;
+	size_t   len = 0;
+
+	job_queue_init ();
+
+	jobs = nih_str_array_new (parent);
+	if (! jobs)
+		return NULL;
+
+	NIH_LIST_FOREACH (job_queue, iter) {
+		NihListEntry *entry = (NihListEntry *)iter;
+		Job          *job = (Job *)entry->data;
+		char         *line;
+
+		line = nih_sprintf (NULL, "%llu %s", job_queue_wait (job),
+				    job_name (job));
+		if (! line)
+			goto error;
+
+		if (! nih_str_array_addp (&jobs, parent, &len, line)) {
+			nih_free (line);
+			goto error;
+		}
+	}
+
+	return jobs;
+
+error:
+	nih_free (jobs);
+	return NULL;
+}
+
+
+/**
+ * job_queue_admit:
+ * @job: job to check.
+ *
+ * Returns: TRUE if @job may be given a spawn slot without exceeding
+ * either limit, and pressure_admit() allows it, FALSE otherwise.
+ **/
+static int
+job_queue_admit (Job *job)
+{
+	nih_assert (job != NULL);
+
+	if ((max_concurrent_spawns > 0)
+	    && (job_queue_slots >= max_concurrent_spawns))
+		return FALSE;
+
+	if ((job->class->concurrency > 0)
+	    && (job->class->spawning >= job->class->concurrency))
+		return FALSE;
+
+	return pressure_admit (job);
+}
+
+/**
+ * job_queue_acquire:
+ * @job: job to give a spawn slot to.
+ *
+ * Give @job a spawn slot.
+ **/
+static void
+job_queue_acquire (Job *job)
+{
+	nih_assert (job != NULL);
+	nih_assert (! job->spawn_slot);
+
+	job->spawn_slot = TRUE;
+	job->class->spawning++;
+	job_queue_slots++;
+}
+
+/**
+ * job_queue_reserve:
+ *
+ * Give as many free spawn slots as possible to queued jobs in queue order,
+ * skipping those whose class is at its own limit, and hand them to
+ * job_queue_poll() to be moved on.  Slots are taken here, rather than by
+ * job_queue_poll(), so that jobs entering the queued state in the mean
+ * time cannot take them first.
+ **/
+static void
+job_queue_reserve (void)
+{
+	int reserved = FALSE;
+
+	NIH_LIST_FOREACH_SAFE (job_queue, iter) {
+		NihListEntry       *entry = (NihListEntry *)iter;
+		Job                *job = (Job *)entry->data;
+		unsigned long long  wait;
+
+		if ((max_concurrent_spawns > 0)
+		    && (job_queue_slots >= max_concurrent_spawns))
+			break;
+
+		if (! job_queue_admit (job))
+			continue;
+
+		job_queue_acquire (job);
+
+		wait = job_queue_wait (job);
+		if (wait > job_queue_max_wait)
+			job_queue_max_wait = wait;
+
+		nih_debug ("Releasing %s after %lluus in queue",
+			   job_name (job), wait);
+
+		nih_list_add (job_queue_ready, &entry->entry);
+		reserved = TRUE;
+	}
+
+	if (reserved)
+		nih_main_loop_interrupt ();
+}
+
+/**
+ * job_queue_insert:
+ * @job: job to queue.
+ *
+ * Add @job to the queue ahead of any jobs of a lower priority, and of
+ * any jobs of the same priority that entered the queued state after it.
+ **/
+static void
+job_queue_insert (Job *job)
+{
+	NihList *iter;
+
+	nih_assert (job != NULL);
+	nih_assert (job->queued == NULL);
+
+	job->queued = NIH_MUST (nih_list_entry_new (job));
+	job->queued->data = job;
+
+	for (iter = job_queue->next; iter != job_queue; iter = iter->next) {
+		Job *queued = (Job *)((NihListEntry *)iter)->data;
+
+		if (queued->class->priority < job->class->priority)
+			break;
+
+		if ((queued->class->priority == job->class->priority)
+		    && (queued->timing->entered[JOB_QUEUED]
+			> job->timing->entered[JOB_QUEUED]))
+			break;
+	}
+
+	/* Adding to the entry we stopped at, or to the list head if we
+	 * reached the end, places the job in front of it.
+	 */
+	nih_list_add (iter, &job->queued->entry);
+}
+
+/**
+ * job_queue_wait:
+ * @job: queued job.
+ *
+ * Returns: microseconds @job has spent in the queued state.
+ **/
+static unsigned long long
+job_queue_wait (Job *job)
+{
+	unsigned long long now;
+	unsigned long long entered;
+
+	nih_assert (job != NULL);
+	nih_assert (job->timing != NULL);
+
+	now = trace_now ();
+	entered = job->timing->entered[JOB_QUEUED];
+
+	return (now > entered) ? now - entered : 0;
+}
@@ -0,0 +1,55 @@
+/* upstart
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_JOB_QUEUE_H
+#define INIT_JOB_QUEUE_H
+
+#include <nih/macros.h>
+#include <nih/list.h>
+
+#include "job.h"
+
+
+NIH_BEGIN_EXTERN
+
+extern int      max_concurrent_spawns;
+extern NihList *job_queue;
+
+void   job_queue_init      (void);
+
+int    job_queue_enter     (Job *job);
+void   job_queue_leave     (Job *job);
+void   job_queue_restore   (Job *job);
+void   job_queue_set_limit (int limit);
+void   job_queue_recheck   (void);
+
+void   job_queue_poll      (void);
+
+int    job_queue_spawning  (void)
+	__attribute__ ((warn_unused_result));
+size_t job_queue_depth     (void)
+	__attribute__ ((warn_unused_result));
+unsigned long long job_queue_longest_wait (void)
+	__attribute__ ((warn_unused_result));
+
+char **job_queue_jobs      (const void *parent)
+	__attribute__ ((warn_unused_result, malloc));
+
+NIH_END_EXTERN
+
+#endif /* INIT_JOB_QUEUE_H */
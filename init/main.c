@@ -69,6 +69,14 @@
 #include "control.h"
 #include "state.h"
 #include "xdg.h"
+#include "spawner.h"
+#include "notify.h"
+#include "job_queue.h"
+#include "pressure.h"
+
+#ifdef ENABLE_CGROUPS
+#include "cgroup.h"
+#endif /* ENABLE_CGROUPS */
 
 
 /* Prototypes for static functions */
@@ -91,6 +99,10 @@ static int  console_type_setter     (NihOption *option, const char *arg);
 static int  conf_dir_setter         (NihOption *option, const char *arg);
 static int  prepend_conf_dir_setter (NihOption *option, const char *arg);
 static int  append_conf_dir_setter  (NihOption *option, const char *arg);
+static int  event_overflow_setter   (NihOption *option, const char *arg);
+#ifdef ENABLE_CGROUPS
+static int  cgroup_backend_setter   (NihOption *option, const char *arg);
+#endif /* ENABLE_CGROUPS */
 
 
 /**
@@ -146,10 +158,26 @@ static int disable_startup_event = FALSE;
  **/
 static int disable_dbus = FALSE;
 
+/**
+ * use_spawn_helper:
+ *
+ * If TRUE, start a helper process to spawn job processes.
+ **/
+static int use_spawn_helper = FALSE;
+
+/**
+ * disable_pidfd:
+ *
+ * If TRUE, supervise job processes with SIGCHLD alone.
+ **/
+static int disable_pidfd = FALSE;
+
 extern int          no_inherit_env;
 extern int          user_mode;
 extern int          chroot_sessions;
 extern int          disable_job_logging;
+extern int          disable_clone_spawn;
+extern int          use_pidfd;
 extern int          use_session_bus;
 extern int          default_console;
 extern int          write_state_file;
@@ -171,6 +199,11 @@ static NihOption options[] = {
 	{ 0, "append-confdir", N_("specify additional directory to load configuration files from"),
 		NULL, "DIR", NULL, append_conf_dir_setter },
 
+#ifdef ENABLE_CGROUPS
+	{ 0, "cgroup-backend", N_("specify how cgroups are managed (auto, cgmanager or cgroupfs)"),
+		NULL, "NAME", NULL, cgroup_backend_setter },
+#endif /* ENABLE_CGROUPS */
+
 	{ 0, "chroot-sessions", N_("enable chroot sessions"),
 		NULL, NULL, &chroot_sessions, NULL },
 
@@ -180,14 +213,26 @@ static NihOption options[] = {
 	{ 0, "default-console", N_("default value for console stanza"),
 		NULL, "VALUE", NULL, console_type_setter },
 
+	{ 0, "event-overflow", N_("handle events emitted while the queue is full (reject, drop-oldest or coalesce)"),
+		NULL, "POLICY", NULL, event_overflow_setter },
+
 	{ 0, "logdir", N_("specify alternative directory to store job output logs in"),
 		NULL, "DIR", &log_dir, NULL },
 
+	{ 0, "max-concurrent-spawns", N_("limit the number of jobs starting at once"),
+		NULL, "NUMBER", &max_concurrent_spawns, nih_option_int },
+
+	{ 0, "max-pending-events", N_("limit the number of events pending at once"),
+		NULL, "NUMBER", &max_pending_events, nih_option_int },
+
 #ifdef ENABLE_CGROUPS
 	{ 0, "no-cgroups", N_("do not support cgroups"),
 		NULL, NULL, &disable_cgroups, NULL },
 #endif /* ENABLE_CGROUPS */
 
+	{ 0, "no-clone-spawn", N_("always spawn job processes with fork()"),
+		NULL, NULL, &disable_clone_spawn, NULL },
+
 	{ 0, "no-dbus", N_("do not connect to a D-Bus bus"),
 		NULL, NULL, &disable_dbus, NULL },
 
@@ -197,12 +242,18 @@ static NihOption options[] = {
 	{ 0, "no-log", N_("disable job logging"),
 		NULL, NULL, &disable_job_logging, NULL },
 
+	{ 0, "no-pidfd", N_("supervise job processes with SIGCHLD only"),
+		NULL, NULL, &disable_pidfd, NULL },
+
 	{ 0, "no-startup-event", N_("do not emit any startup event (for testing)"),
 		NULL, NULL, &disable_startup_event, NULL },
 
 	{ 0, "prepend-confdir", N_("specify additional initial directory to load configuration files from"),
 		NULL, "DIR", NULL, prepend_conf_dir_setter },
 
+	{ 0, "pressure-threshold", N_("percentage of time stalled on a resource before deferring jobs"),
+		NULL, "PERCENT", &pressure_threshold, nih_option_int },
+
 	/* Must be specified for both stateful and stateless re-exec */
 	{ 0, "restart", N_("flag a re-exec has occurred"),
 		NULL, NULL, &restart, NULL },
@@ -214,6 +265,12 @@ static NihOption options[] = {
 	{ 0, "session", N_("use D-Bus session bus rather than system bus (for testing)"),
 		NULL, NULL, &use_session_bus, NULL },
 
+	{ 0, "session-event-limit", N_("limit the number of events pending from each chroot session"),
+		NULL, "NUMBER", &session_event_limit, nih_option_int },
+
+	{ 0, "spawn-helper", N_("spawn job processes from a helper process"),
+		NULL, NULL, &use_spawn_helper, NULL },
+
 	{ 0, "startup-event", N_("specify an alternative initial event (for testing)"),
 		NULL, "NAME", &initial_event, NULL },
 
@@ -264,6 +321,12 @@ main (int   argc,
 	if (disable_job_logging)
 		nih_debug ("Job logging disabled");
 
+	if ((pressure_threshold < 1) || (pressure_threshold > 100)) {
+		nih_warn (_("Pressure threshold must be between 1 and 100, using %d"),
+			  PRESSURE_DEFAULT_THRESHOLD);
+		pressure_threshold = PRESSURE_DEFAULT_THRESHOLD;
+	}
+
 	if (getenv (USE_SESSION_BUS_ENV))
 		use_session_bus = TRUE;
 
@@ -523,10 +586,25 @@ main (int   argc,
 	NIH_MUST (nih_child_add_watch (NULL, -1, NIH_CHILD_ALL,
 				       job_process_handler, NULL));
 
+	/* Handle the exits of processes reaped through their process file
+	 * descriptors each time through the main loop, before the event
+	 * queue so that events they cause are handled in the same pass.
+	 */
+	NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)job_process_watch_poll,
+					  NULL));
+
 	/* Process the event queue each time through the main loop */
 	NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)event_poll,
 					  NULL));
 
+	/* Start queued jobs as spawn slots become free */
+	NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)job_queue_poll,
+					  NULL));
+
+	/* Finish each phase of shutdown once all job processes have ended */
+	NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)quiesce_poll,
+					  NULL));
+
 
 	/* Adjust our OOM priority to the default, which will be inherited
 	 * by all jobs.
@@ -560,6 +638,43 @@ main (int   argc,
 	}
 
 
+	/* Supervise job processes with process file descriptors, including
+	 * those read from the state on re-exec, unless told not to.
+	 */
+	use_pidfd = ! disable_pidfd;
+
+	/* Start the spawn helper while our heap is still small, and before
+	 * any state is read on re-exec; any helper from before the re-exec
+	 * exits since its socket was closed when we exec'd.
+	 */
+	if (use_spawn_helper && (spawner_start (job_process_spawn_helper) < 0)) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_warn ("%s: %s", _("Unable to start spawn helper"),
+			  err->message);
+		nih_free (err);
+	}
+
+	/* Bind the notification socket before any state is read on
+	 * re-exec, so that jobs still starting can reach us again under the
+	 * same name; the previous socket was closed when we exec'd.
+	 */
+	if (notify_init () < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_warn ("%s: %s", _("Unable to create notification socket"),
+			  err->message);
+		nih_free (err);
+	}
+
+	/* Watch for resource pressure, so that jobs may be deferred while
+	 * the system is under it.
+	 */
+	pressure_init ();
+
+
 	if (restart) {
 		if (state_fd == -1) {
 			nih_warn ("%s",
@@ -1139,6 +1254,57 @@ console_type_setter (NihOption *option, const char *arg)
 	 return 0;
 }
 
+/**
+ * NihOption setter function to handle selection of the event queue
+ * overflow policy.
+ *
+ * Returns: 0 on success, -1 on invalid policy.
+ **/
+static int
+event_overflow_setter (NihOption *option, const char *arg)
+{
+	int policy;
+
+	nih_assert (option);
+
+	policy = event_overflow_from_name (arg);
+
+	if (policy == -1) {
+		nih_fatal ("%s: %s", _("invalid event overflow policy specified"), arg);
+		return -1;
+	}
+
+	event_overflow_policy = (EventOverflow)policy;
+
+	return 0;
+}
+
+#ifdef ENABLE_CGROUPS
+/**
+ * NihOption setter function to handle selection of the cgroup backend.
+ *
+ * Returns: 0 on success, -1 on invalid backend.
+ **/
+static int
+cgroup_backend_setter (NihOption *option, const char *arg)
+{
+	int backend;
+
+	nih_assert (option);
+
+	backend = cgroup_backend_from_name (arg);
+
+	if (backend == -1) {
+		nih_fatal ("%s: %s", _("invalid cgroup backend specified"), arg);
+		return -1;
+	}
+
+	cgroup_backend = (CGroupBackend)backend;
+
+	return 0;
+}
+#endif /* ENABLE_CGROUPS */
+
 /**  
  * NihOption setter function to handle selection of configuration file
  * directories.
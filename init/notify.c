@@ -0,0 +1,386 @@
+/* upstart
+ *
+ * notify.c - readiness notification from job processes
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/io.h>
+#include <nih/logging.h>
+#include <nih/error.h>
+
+#include "system.h"
+#include "job_class.h"
+#include "job_process.h"
+#include "job.h"
+#include "notify.h"
+
+#ifdef ENABLE_CGROUPS
+#include "cgroup.h"
+#endif /* ENABLE_CGROUPS */
+
+
+/* Prototypes for static functions */
+static void notify_reader   (void *data, NihIoWatch *watch,
+			     NihIoEvents events);
+static int  notify_main_pid (Job *job, pid_t pid)
+	__attribute__ ((warn_unused_result));
+
+
+/**
+ * notify_fd:
+ *
+ * Notification socket, or -1 if not yet created.
+ **/
+static int notify_fd = -1;
+
+/**
+ * notify_watch:
+ *
+ * Main loop watch on notify_fd.
+ **/
+static NihIoWatch *notify_watch = NULL;
+
+/**
+ * notify_name:
+ *
+ * Address of notify_fd in the form given to jobs, with a leading '@'
+ * for the abstract namespace.
+ **/
+static char notify_name[sizeof (((struct sockaddr_un *)0)->sun_path)];
+
+
+/**
+ * notify_init:
+ *
+ * Create the notification socket, if not already created, and watch it
+ * in the main loop.  A single datagram socket is shared by all jobs, the
+ * sender of each message being identified by its credentials.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+notify_init (void)
+{
+	struct sockaddr_un addr;
+	socklen_t          addrlen;
+	size_t             len;
+	int                fd;
+	int                opt = 1;
+
+	if (notify_fd >= 0)
+		return 0;
+
+	snprintf (notify_name, sizeof (notify_name), "@%s/%d",
+		  NOTIFY_SOCKET_PATH, getpid ());
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+
+	len = strlen (notify_name);
+	memcpy (addr.sun_path, notify_name, len);
+	addr.sun_path[0] = '\0';
+
+	addrlen = offsetof (struct sockaddr_un, sun_path) + len;
+
+	fd = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		nih_return_system_error (-1);
+
+	if ((setsockopt (fd, SOL_SOCKET, SO_PASSCRED, &opt, sizeof (opt)) < 0)
+	    || (bind (fd, (struct sockaddr *)&addr, addrlen) < 0)) {
+		nih_error_raise_system ();
+		close (fd);
+		return -1;
+	}
+
+	notify_watch = NIH_MUST (nih_io_add_watch (NULL, fd, NIH_IO_READ,
+						   notify_reader, NULL));
+	notify_fd = fd;
+
+	nih_debug ("Receiving notifications on %s", notify_name);
+
+	return 0;
+}
+
+/**
+ * notify_available:
+ *
+ * Returns: TRUE if the notification socket has been created.
+ **/
+int
+notify_available (void)
+{
+	return notify_fd >= 0;
+}
+
+/**
+ * notify_socket_name:
+ *
+ * Returns: address of the notification socket to be given to jobs in
+ * NOTIFY_SOCKET_ENV.
+ **/
+const char *
+notify_socket_name (void)
+{
+	nih_assert (notify_available ());
+
+	return notify_name;
+}
+
+
+/**
+ * notify_reader:
+ * @data: unused,
+ * @watch: NihIoWatch for notification socket,
+ * @events: events that occurred.
+ *
+ * Called when the notification socket is readable; receives up to
+ * NOTIFY_BATCH messages with a single system call and handles each with
+ * notify_message().  Any further messages are left for the next time
+ * through the main loop so that a chatty job can't hold us up.
+ **/
+static void
+notify_reader (void        *data,
+	       NihIoWatch  *watch,
+	       NihIoEvents  events)
+{
+	static char     bufs[NOTIFY_BATCH][NOTIFY_MESSAGE_MAX];
+	static char     controls[NOTIFY_BATCH][CMSG_SPACE (sizeof (struct ucred))];
+	struct mmsghdr  msgs[NOTIFY_BATCH];
+	struct iovec    iovs[NOTIFY_BATCH];
+	int             count;
+
+	nih_assert (watch != NULL);
+
+	memset (msgs, 0, sizeof (msgs));
+
+	for (int i = 0; i < NOTIFY_BATCH; i++) {
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = sizeof (bufs[i]);
+
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = controls[i];
+		msgs[i].msg_hdr.msg_controllen = sizeof (controls[i]);
+	}
+
+	count = recvmmsg (notify_fd, msgs, NOTIFY_BATCH, MSG_DONTWAIT, NULL);
+	if (count < 0) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK)
+		    && (errno != EINTR))
+			nih_warn ("%s: %s", _("Unable to receive notifications"),
+				  strerror (errno));
+		return;
+	}
+
+	for (int i = 0; i < count; i++) {
+		struct msghdr  *msg = &msgs[i].msg_hdr;
+		struct cmsghdr *cmsg;
+		struct ucred   *cred = NULL;
+
+		for (cmsg = CMSG_FIRSTHDR (msg); cmsg;
+		     cmsg = CMSG_NXTHDR (msg, cmsg)) {
+			if ((cmsg->cmsg_level == SOL_SOCKET)
+			    && (cmsg->cmsg_type == SCM_CREDENTIALS)
+			    && (cmsg->cmsg_len == CMSG_LEN (sizeof (struct ucred))))
+				cred = (struct ucred *)CMSG_DATA (cmsg);
+		}
+
+		if ((! cred) || (msg->msg_flags & MSG_TRUNC))
+			continue;
+
+		notify_message (cred->pid, bufs[i], msgs[i].msg_len);
+	}
+}
+
+/**
+ * notify_message:
+ * @pid: process that sent message,
+ * @buf: message,
+ * @len: length of @buf.
+ *
+ * Handle the notification message in @buf, sent by @pid.  The message
+ * consists of newline-separated assignments, of which we understand:
+ *
+ * READY=1: the job's main process has finished starting up, so the job
+ * is moved out of the spawned state;
+ *
+ * MAINPID=PID: the job's main process is now @PID, for example because
+ * it has forked; @PID must belong to the job, see notify_main_pid();
+ *
+ * STATUS=TEXT: free-form status of the job, which is logged.
+ *
+ * Messages are only accepted from the main process of jobs that expect
+ * to be notified; others are ignored.
+ **/
+void
+notify_message (pid_t       pid,
+		const char *buf,
+		size_t      len)
+{
+	Job         *job;
+	ProcessType  process;
+	pid_t        main_pid = 0;
+	int          ready = FALSE;
+	const char  *line;
+	const char  *end;
+
+	nih_assert (pid > 0);
+	nih_assert (buf != NULL);
+
+	job = job_process_find (pid, &process);
+	if ((! job) || (process != PROCESS_MAIN)
+	    || (job->class->expect != EXPECT_NOTIFY)) {
+		nih_debug ("Ignored notification from process (%d)", pid);
+		return;
+	}
+
+	for (line = buf; line < buf + len; line = end + 1) {
+		nih_local char *value = NULL;
+		size_t          linelen;
+
+		end = memchr (line, '\n', buf + len - line);
+		if (! end)
+			end = buf + len;
+
+		linelen = end - line;
+
+		if ((linelen == 7) && (! strncmp (line, "READY=1", 7))) {
+			ready = TRUE;
+
+		} else if ((linelen > 8) && (! strncmp (line, "MAINPID=", 8))) {
+			char *endptr;
+			long  val;
+
+			value = NIH_MUST (nih_strndup (NULL, line + 8,
+						       linelen - 8));
+
+			errno = 0;
+			val = strtol (value, &endptr, 10);
+			if (errno || *endptr || (val <= 0) || ((pid_t)val != val)) {
+				nih_warn (_("%s main process (%d) sent invalid "
+					    "main process: %s"),
+					  job_name (job), pid, value);
+			} else {
+				main_pid = (pid_t)val;
+			}
+
+		} else if ((linelen > 7) && (! strncmp (line, "STATUS=", 7))) {
+			value = NIH_MUST (nih_strndup (NULL, line + 7,
+						       linelen - 7));
+
+			nih_info (_("%s main process (%d) status: %s"),
+				  job_name (job), pid, value);
+		}
+	}
+
+	if (main_pid && (main_pid != job->pid[PROCESS_MAIN])
+	    && (! notify_main_pid (job, main_pid))) {
+		nih_warn (_("%s main process (%d) sent main process (%d) "
+			    "not belonging to job"),
+			  job_name (job), pid, main_pid);
+
+	} else if (main_pid && (main_pid != job->pid[PROCESS_MAIN])) {
+		nih_info (_("%s main process (%d) became new process (%d)"),
+			  job_name (job), job->pid[PROCESS_MAIN], main_pid);
+
+		job_process_set_pid (job, PROCESS_MAIN, main_pid);
+		job_process_watch_add (job, PROCESS_MAIN);
+	}
+
+	if (ready && (job->state == JOB_SPAWNED)) {
+		nih_info (_("%s main process (%d) is ready"),
+			  job_name (job), job->pid[PROCESS_MAIN]);
+
+		job_change_state (job, job_next_state (job));
+	}
+}
+
+/**
+ * notify_main_pid:
+ * @job: job notifying,
+ * @pid: new main process given.
+ *
+ * Determine whether @pid may become the main process of @job, which is
+ * only the case for a descendant of its current main process or for a
+ * process in one of its job-unique cgroups; we would otherwise supervise,
+ * and in time kill, a process of another job or of nobody's.
+ *
+ * Returns: TRUE if @pid belongs to @job, else FALSE.
+ **/
+static int
+notify_main_pid (Job   *job,
+		 pid_t  pid)
+{
+#ifdef ENABLE_CGROUPS
+	nih_local char **env = NULL;
+	size_t           envc;
+	int              ret;
+#endif /* ENABLE_CGROUPS */
+
+	nih_assert (job != NULL);
+	nih_assert (pid > 0);
+
+	if (system_descendant (pid, job->pid[PROCESS_MAIN]))
+		return TRUE;
+
+#ifdef ENABLE_CGROUPS
+	if (NIH_LIST_EMPTY (&job->class->cgroups))
+		return FALSE;
+
+	/* Names are expanded using the environment the process was given */
+	env = job_process_environment (NULL, job, PROCESS_MAIN, &envc);
+	if (! env)
+		return FALSE;
+
+	ret = cgroup_contains (&job->class->cgroups, env, pid);
+	if (ret < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_debug ("Failed to find process (%d) in %s cgroups: %s",
+			   pid, job_name (job), err->message);
+		nih_free (err);
+
+		return FALSE;
+	}
+
+	return ret;
+#else /* ENABLE_CGROUPS */
+	return FALSE;
+#endif /* ENABLE_CGROUPS */
+}
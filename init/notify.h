@@ -0,0 +1,70 @@
+/* upstart
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_NOTIFY_H
+#define INIT_NOTIFY_H
+
+#include <sys/types.h>
+
+#include <nih/macros.h>
+
+
+/**
+ * NOTIFY_SOCKET_ENV:
+ *
+ * Environment variable giving jobs the address of the notification
+ * socket, compatible with sd_notify(3).
+ **/
+#define NOTIFY_SOCKET_ENV "NOTIFY_SOCKET"
+
+/**
+ * NOTIFY_SOCKET_PATH:
+ *
+ * Abstract socket name on which notifications are received; the process
+ * id of init is appended so that Session Inits each have their own.
+ **/
+#define NOTIFY_SOCKET_PATH "/com/ubuntu/upstart-notify"
+
+/**
+ * NOTIFY_MESSAGE_MAX:
+ *
+ * Largest notification message accepted; longer messages are discarded.
+ **/
+#define NOTIFY_MESSAGE_MAX 4096
+
+/**
+ * NOTIFY_BATCH:
+ *
+ * Maximum number of messages read from the socket each time through the
+ * main loop.
+ **/
+#define NOTIFY_BATCH 16
+
+
+NIH_BEGIN_EXTERN
+
+int         notify_init        (void)
+	__attribute__ ((warn_unused_result));
+int         notify_available   (void);
+const char *notify_socket_name (void);
+
+void        notify_message     (pid_t pid, const char *buf, size_t len);
+
+NIH_END_EXTERN
+
+#endif /* INIT_NOTIFY_H */
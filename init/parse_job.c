@@ -27,6 +27,7 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#include <ctype.h>
 #include <errno.h>
 #include <limits.h>
 #include <stdlib.h>
@@ -46,6 +47,7 @@
 #include "parse_job.h"
 #include "errors.h"
 #include "apparmor.h"
+#include "pressure.h"
 
 #ifdef ENABLE_CGROUPS
 #include "cgroup.h"
@@ -242,6 +244,19 @@ static int stanza_usage       (JobClass *class, NihConfigStanza *stanza,
 			       const char *file, size_t len,
 			       size_t *pos, size_t *lineno)
 	__attribute__ ((warn_unused_result));
+static int stanza_concurrency (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_priority    (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_defer_under_pressure (JobClass *class,
+					NihConfigStanza *stanza,
+					const char *file, size_t len,
+					size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
 
 static int stanza_cgroup      (JobClass *class, NihConfigStanza *stanza,
 			       const char *file, size_t len,
@@ -255,6 +270,43 @@ static int parse_cgroup       (JobClass        *class,
 			       size_t          *lineno)
 	__attribute__ ((warn_unused_result));
 
+static int stanza_cpu_weight  (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_cpu_quota   (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_memory_max  (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_memory_high (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_io_weight   (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_cpuset      (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+
+static int parse_resource_weight  (const char *arg, unsigned long *weight)
+	__attribute__ ((warn_unused_result));
+static int parse_resource_size    (const char *arg,
+				   unsigned long long *size)
+	__attribute__ ((warn_unused_result));
+static int parse_resource_list    (const char *arg)
+	__attribute__ ((warn_unused_result));
+static int parse_memory_limit     (const char *file, size_t len,
+				   size_t *pos, size_t *lineno,
+				   unsigned long long *limit)
+	__attribute__ ((warn_unused_result));
+
 /**
  * debug_stanza_enabled:
  *
@@ -304,6 +356,16 @@ static NihConfigStanza stanzas[] = {
 	{ "usage",       (NihConfigHandler)stanza_usage       },
 	{ "apparmor",    (NihConfigHandler)stanza_apparmor    },
 	{ "cgroup",      (NihConfigHandler)stanza_cgroup      },
+	{ "concurrency", (NihConfigHandler)stanza_concurrency },
+	{ "priority",    (NihConfigHandler)stanza_priority    },
+	{ "defer-under-pressure",
+	  (NihConfigHandler)stanza_defer_under_pressure },
+	{ "cpu-weight",  (NihConfigHandler)stanza_cpu_weight  },
+	{ "cpu-quota",   (NihConfigHandler)stanza_cpu_quota   },
+	{ "memory-max",  (NihConfigHandler)stanza_memory_max  },
+	{ "memory-high", (NihConfigHandler)stanza_memory_high },
+	{ "io-weight",   (NihConfigHandler)stanza_io_weight   },
+	{ "cpuset",      (NihConfigHandler)stanza_cpuset      },
 
 	NIH_CONFIG_LAST
 };
@@ -1911,6 +1973,8 @@ stanza_expect (JobClass        *class,
 		class->expect = EXPECT_DAEMON;
 	} else if (! strcmp (arg, "fork")) {
 		class->expect = EXPECT_FORK;
+	} else if (! strcmp (arg, "notify")) {
+		class->expect = EXPECT_NOTIFY;
 	} else if (! strcmp (arg, "none")) {
 		class->expect = EXPECT_NONE;
 	} else {
@@ -2263,7 +2327,9 @@ finish:
  *
  * Parse a daemon stanza from @file.  This either has no arguments, in
  * which case it sets the respawn flag for the job, or it has the "limit"
- * argument and sets the respawn rate limit.
+ * argument and sets the respawn rate limit, the "delay" argument and sets
+ * the time to wait before respawning, or the "backoff" argument and sets
+ * how that time grows with each consecutive respawn.
  *
  * Returns: zero on success, negative value on error.
  **/
@@ -2348,6 +2414,70 @@ stanza_respawn (JobClass        *class,
 
 		ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
 
+	} else if (! strcmp (arg, "delay")) {
+		nih_local char *delayarg = NULL;
+		char           *endptr;
+
+		/* Update error position to the delay value */
+		*pos = a_pos;
+		if (lineno)
+			*lineno = a_lineno;
+
+		/* Parse the delay value */
+		delayarg = nih_config_next_arg (NULL, file, len,
+						&a_pos, &a_lineno);
+		if (! delayarg)
+			goto finish;
+
+		errno = 0;
+		class->respawn_delay = strtol (delayarg, &endptr, 10);
+		if (errno || *endptr || (class->respawn_delay < 0))
+			nih_return_error (-1, PARSE_ILLEGAL_INTERVAL,
+					  _(PARSE_ILLEGAL_INTERVAL_STR));
+
+		ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+	} else if (! strcmp (arg, "backoff")) {
+		nih_local char *factorarg = NULL;
+		nih_local char *maxarg = NULL;
+		char           *endptr;
+
+		/* Update error position to the factor value */
+		*pos = a_pos;
+		if (lineno)
+			*lineno = a_lineno;
+
+		/* Parse the factor value */
+		factorarg = nih_config_next_arg (NULL, file, len,
+						 &a_pos, &a_lineno);
+		if (! factorarg)
+			goto finish;
+
+		errno = 0;
+		class->respawn_backoff = strtol (factorarg, &endptr, 10);
+		if (errno || *endptr || (class->respawn_backoff < 1))
+			nih_return_error (-1, PARSE_ILLEGAL_BACKOFF,
+					  _(PARSE_ILLEGAL_BACKOFF_STR));
+
+		/* Update error position to the maximum value */
+		*pos = a_pos;
+		if (lineno)
+			*lineno = a_lineno;
+
+		/* Parse the maximum value */
+		maxarg = nih_config_next_arg (NULL, file, len,
+					      &a_pos, &a_lineno);
+		if (! maxarg)
+			goto finish;
+
+		errno = 0;
+		class->respawn_delay_max = strtol (maxarg, &endptr, 10);
+		if (errno || *endptr || (class->respawn_delay_max < 0))
+			nih_return_error (-1, PARSE_ILLEGAL_INTERVAL,
+					  _(PARSE_ILLEGAL_INTERVAL_STR));
+
+		ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
 	} else {
 		nih_return_error (-1, NIH_CONFIG_UNKNOWN_STANZA,
 				  _(NIH_CONFIG_UNKNOWN_STANZA_STR));
@@ -2623,6 +2753,183 @@ finish:
 	return ret;
 }
 
+/**
+ * stanza_concurrency:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a concurrency stanza from @file, extracting a single argument
+ * containing the maximum number of instances that may be starting at once.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_concurrency (JobClass        *class,
+		    NihConfigStanza *stanza,
+		    const char      *file,
+		    size_t           len,
+		    size_t          *pos,
+		    size_t          *lineno)
+{
+	nih_local char *arg = NULL;
+	char           *endptr;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	errno = 0;
+	class->concurrency = (int)strtol (arg, &endptr, 10);
+	if (errno || *endptr || (class->concurrency < 1))
+		nih_return_error (-1, PARSE_ILLEGAL_CONCURRENCY,
+				  _(PARSE_ILLEGAL_CONCURRENCY_STR));
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * stanza_priority:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a priority stanza from @file, extracting a single argument
+ * containing the start priority of the job; jobs with a higher priority
+ * are started ahead of those with a lower one.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_priority (JobClass        *class,
+		 NihConfigStanza *stanza,
+		 const char      *file,
+		 size_t           len,
+		 size_t          *pos,
+		 size_t          *lineno)
+{
+	nih_local char *arg = NULL;
+	char           *endptr;
+	long            priority;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	errno = 0;
+	priority = strtol (arg, &endptr, 10);
+	if (errno || *endptr || (priority < INT_MIN) || (priority > INT_MAX))
+		nih_return_error (-1, PARSE_ILLEGAL_PRIORITY,
+				  _(PARSE_ILLEGAL_PRIORITY_STR));
+
+	class->priority = (int)priority;
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * stanza_defer_under_pressure:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a defer-under-pressure stanza from @file, extracting an optional
+ * argument containing the maximum number of seconds the job may be held
+ * back for.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_defer_under_pressure (JobClass        *class,
+			     NihConfigStanza *stanza,
+			     const char      *file,
+			     size_t           len,
+			     size_t          *pos,
+			     size_t          *lineno)
+{
+	nih_local char *arg = NULL;
+	char           *endptr;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	/* Deal with the no-argument form first */
+	if (! nih_config_has_token (file, len, pos, lineno)) {
+		class->defer_under_pressure = PRESSURE_DEFAULT_DELAY;
+
+		return nih_config_skip_comment (file, len, pos, lineno);
+	}
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	errno = 0;
+	class->defer_under_pressure = (int)strtol (arg, &endptr, 10);
+	if (errno || *endptr || (class->defer_under_pressure < 1))
+		nih_return_error (-1, PARSE_ILLEGAL_INTERVAL,
+				  _(PARSE_ILLEGAL_INTERVAL_STR));
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
 /**
  * stanza_oom:
  * @class: job class being parsed,
@@ -3053,3 +3360,516 @@ stanza_cgroup (JobClass        *class,
 
 	return parse_cgroup (class, stanza, file, len, pos, lineno);
 }
+
+/**
+ * parse_resource_weight:
+ * @arg: argument to parse,
+ * @weight: pointer to store weight in.
+ *
+ * Parse @arg as a relative weight on the scale of the unified hierarchy,
+ * from 1 to 10000 with 100 being the default.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+parse_resource_weight (const char    *arg,
+		       unsigned long *weight)
+{
+	char *endptr;
+
+	nih_assert (arg != NULL);
+	nih_assert (weight != NULL);
+
+	errno = 0;
+	*weight = strtoul (arg, &endptr, 10);
+	if (errno || *endptr || (! isdigit (*arg))
+	    || (*weight < 1) || (*weight > 10000))
+		nih_return_error (-1, PARSE_ILLEGAL_WEIGHT,
+				  _(PARSE_ILLEGAL_WEIGHT_STR));
+
+	return 0;
+}
+
+/**
+ * parse_resource_size:
+ * @arg: argument to parse,
+ * @size: pointer to store size in.
+ *
+ * Parse @arg as a number of bytes, optionally followed by one of the
+ * binary multipliers K, M, G or T, or as "unlimited" which is stored
+ * as zero.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+parse_resource_size (const char         *arg,
+		     unsigned long long *size)
+{
+	char *endptr;
+	int   shift = 0;
+
+	nih_assert (arg != NULL);
+	nih_assert (size != NULL);
+
+	if (! strcmp (arg, "unlimited")) {
+		*size = 0;
+		return 0;
+	}
+
+	errno = 0;
+	*size = strtoull (arg, &endptr, 10);
+	if (errno || (! isdigit (*arg)) || (*size < 1))
+		goto error;
+
+	switch (*endptr) {
+	case 'T':
+	case 't':
+		shift += 10;
+		/* fall through */
+	case 'G':
+	case 'g':
+		shift += 10;
+		/* fall through */
+	case 'M':
+	case 'm':
+		shift += 10;
+		/* fall through */
+	case 'K':
+	case 'k':
+		shift += 10;
+		endptr++;
+	}
+
+	if (*endptr || (*size > (ULLONG_MAX >> shift)))
+		goto error;
+
+	*size <<= shift;
+
+	return 0;
+
+error:
+	nih_return_error (-1, PARSE_ILLEGAL_SIZE, _(PARSE_ILLEGAL_SIZE_STR));
+}
+
+/**
+ * parse_resource_list:
+ * @arg: argument to parse.
+ *
+ * Check that @arg is a list of CPU or memory node numbers, and ranges
+ * of them, separated by commas, in the form the cpuset controller
+ * accepts.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+parse_resource_list (const char *arg)
+{
+	const char *p;
+
+	nih_assert (arg != NULL);
+
+	p = arg;
+	for (;;) {
+		unsigned long  first, last;
+		char          *endptr;
+
+		if (! isdigit (*p))
+			break;
+
+		errno = 0;
+		first = last = strtoul (p, &endptr, 10);
+		p = endptr;
+
+		if (*p == '-') {
+			p++;
+			if (! isdigit (*p))
+				break;
+
+			last = strtoul (p, &endptr, 10);
+			p = endptr;
+		}
+
+		if (errno || (last < first))
+			break;
+
+		if (! *p)
+			return 0;
+
+		if (*p++ != ',')
+			break;
+	}
+
+	nih_return_error (-1, PARSE_ILLEGAL_CPUSET,
+			  _(PARSE_ILLEGAL_CPUSET_STR));
+}
+
+/**
+ * stanza_cpu_weight:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a cpu-weight stanza from @file, extracting a single argument
+ * containing the share of CPU time the job receives relative to others
+ * when the CPU is contended.  This is turned into a setting of the cpu
+ * controller by job_class_resources().
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_cpu_weight (JobClass        *class,
+		   NihConfigStanza *stanza,
+		   const char      *file,
+		   size_t           len,
+		   size_t          *pos,
+		   size_t          *lineno)
+{
+	nih_local char *arg = NULL;
+	unsigned long   weight;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	if (parse_resource_weight (arg, &weight) < 0)
+		return -1;
+
+	class->cpu_weight = weight;
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * stanza_cpu_quota:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a cpu-quota stanza from @file, extracting a single argument
+ * containing the percentage of one CPU the job may use at most, which
+ * may exceed 100 to allow more than one.  This is turned into settings
+ * of the cpu controller over a period of JOB_CPU_PERIOD by
+ * job_class_resources().
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_cpu_quota (JobClass        *class,
+		  NihConfigStanza *stanza,
+		  const char      *file,
+		  size_t           len,
+		  size_t          *pos,
+		  size_t          *lineno)
+{
+	nih_local char *arg = NULL;
+	char           *endptr;
+	unsigned long   percent;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	errno = 0;
+	percent = strtoul (arg, &endptr, 10);
+	if (*endptr == '%')
+		endptr++;
+
+	if (errno || *endptr || (! isdigit (*arg))
+	    || (percent < 1) || (percent > ULONG_MAX / JOB_CPU_PERIOD))
+		nih_return_error (-1, PARSE_ILLEGAL_QUOTA,
+				  _(PARSE_ILLEGAL_QUOTA_STR));
+
+	class->cpu_quota = percent;
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * parse_memory_limit:
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number,
+ * @limit: pointer to store limit in.
+ *
+ * Parse a single argument from @file containing a memory size, or
+ * "unlimited" which is stored as JOB_MEMORY_UNLIMITED.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+parse_memory_limit (const char         *file,
+		    size_t              len,
+		    size_t             *pos,
+		    size_t             *lineno,
+		    unsigned long long *limit)
+{
+	nih_local char     *arg = NULL;
+	unsigned long long  size;
+	size_t              a_pos, a_lineno;
+	int                 ret = -1;
+
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+	nih_assert (limit != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	if (parse_resource_size (arg, &size) < 0)
+		return -1;
+
+	*limit = size ? size : JOB_MEMORY_UNLIMITED;
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * stanza_memory_max:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a memory-max stanza from @file, extracting a single argument
+ * containing the memory the job may use before it is reclaimed from or
+ * killed by the OOM killer.  This is turned into a setting of the memory
+ * controller by job_class_resources().
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_memory_max (JobClass        *class,
+		   NihConfigStanza *stanza,
+		   const char      *file,
+		   size_t           len,
+		   size_t          *pos,
+		   size_t          *lineno)
+{
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	return parse_memory_limit (file, len, pos, lineno,
+				   &class->memory_max);
+}
+
+/**
+ * stanza_memory_high:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a memory-high stanza from @file, extracting a single argument
+ * containing the memory the job may use before it is throttled and its
+ * memory reclaimed aggressively.  This is turned into a setting of the
+ * memory controller by job_class_resources(); per-controller hierarchies
+ * only have the soft limit, which is the nearest equivalent.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_memory_high (JobClass        *class,
+		    NihConfigStanza *stanza,
+		    const char      *file,
+		    size_t           len,
+		    size_t          *pos,
+		    size_t          *lineno)
+{
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	return parse_memory_limit (file, len, pos, lineno,
+				   &class->memory_high);
+}
+
+/**
+ * stanza_io_weight:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse an io-weight stanza from @file, extracting a single argument
+ * containing the share of block I/O the job receives relative to others
+ * when devices are contended.  This is turned into a setting of the io
+ * or blkio controller by job_class_resources().
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_io_weight (JobClass        *class,
+		  NihConfigStanza *stanza,
+		  const char      *file,
+		  size_t           len,
+		  size_t          *pos,
+		  size_t          *lineno)
+{
+	nih_local char *arg = NULL;
+	unsigned long   weight;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	if (parse_resource_weight (arg, &weight) < 0)
+		return -1;
+
+	class->io_weight = weight;
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * stanza_cpuset:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a cpuset stanza from @file, extracting an argument containing
+ * the list of CPUs the job may run on and an optional argument containing
+ * the list of memory nodes it may allocate from.  These are turned into
+ * settings of the cpuset controller by job_class_resources().
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_cpuset (JobClass        *class,
+	       NihConfigStanza *stanza,
+	       const char      *file,
+	       size_t           len,
+	       size_t          *pos,
+	       size_t          *lineno)
+{
+	nih_local char *cpus = NULL;
+	nih_local char *mems = NULL;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	cpus = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! cpus)
+		goto finish;
+
+	if (parse_resource_list (cpus) < 0)
+		return -1;
+
+	if (nih_config_has_token (file, len, &a_pos, &a_lineno)) {
+		mems = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+		if (! mems)
+			goto finish;
+
+		if (parse_resource_list (mems) < 0)
+			return -1;
+	}
+
+	if (class->cpuset_cpus)
+		nih_unref (class->cpuset_cpus, class);
+
+	class->cpuset_cpus = cpus;
+	nih_ref (class->cpuset_cpus, class);
+
+	if (class->cpuset_mems)
+		nih_unref (class->cpuset_mems, class);
+
+	class->cpuset_mems = mems;
+	if (class->cpuset_mems)
+		nih_ref (class->cpuset_mems, class);
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
@@ -0,0 +1,493 @@
+/* upstart
+ *
+ * pressure.c - deferral of job starts under resource pressure
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/io.h>
+#include <nih/logging.h>
+
+#include "environ.h"
+#include "event.h"
+#include "events.h"
+#include "job_class.h"
+#include "job.h"
+#include "job_queue.h"
+#include "trace.h"
+#include "wheel.h"
+#include "pressure.h"
+
+
+/* Prototypes for static functions */
+static int  pressure_check   (void);
+static void pressure_timer   (void *data, WheelTimer *timer);
+static void pressure_trigger (void *data, NihIoWatch *watch,
+			      NihIoEvents events);
+static void pressure_emit    (Job *job, const char *name,
+			      const char *var, const char *value);
+
+
+/**
+ * pressure_threshold:
+ *
+ * Percentage of time, averaged over ten seconds, that some tasks may be
+ * stalled on any one resource before jobs that defer under pressure are
+ * held back.  Set with the --pressure-threshold option.
+ **/
+int pressure_threshold = PRESSURE_DEFAULT_THRESHOLD;
+
+/**
+ * pressure_path:
+ *
+ * Directory containing the pressure stall information files, overridden
+ * by the test suite.
+ **/
+const char *pressure_path = PRESSURE_PATH;
+
+/**
+ * pressure_deferred:
+ *
+ * Number of job starts that have been deferred because of pressure.
+ **/
+unsigned int pressure_deferred = 0;
+
+/**
+ * pressure_relieved:
+ *
+ * Number of deferred job starts that were admitted once pressure fell
+ * below the threshold.
+ **/
+unsigned int pressure_relieved = 0;
+
+/**
+ * pressure_expired:
+ *
+ * Number of deferred job starts that were admitted because they had been
+ * deferred for their maximum delay.
+ **/
+unsigned int pressure_expired = 0;
+
+/**
+ * pressure_watches:
+ *
+ * Main loop watches on the kernel trigger placed on each pressure file,
+ * or NULL where triggers are not supported.
+ **/
+static NihIoWatch *pressure_watches[PRESSURE_LAST] = { NULL };
+
+/**
+ * pressure_triggered:
+ *
+ * Monotonic time, in microseconds, that a trigger last fired.
+ **/
+static unsigned long long pressure_triggered = 0;
+
+/**
+ * pressure_check_timer:
+ *
+ * Timer used to check pressure again while jobs are deferred, or NULL
+ * if none are.
+ **/
+static WheelTimer *pressure_check_timer = NULL;
+
+
+/**
+ * pressure_init:
+ *
+ * Place a kernel trigger on each pressure file that fires whenever some
+ * tasks are stalled on that resource for more than pressure_threshold
+ * percent of a PRESSURE_TRIGGER_WINDOW.  While none fire, pressure_admit()
+ * need not read the files at all.
+ *
+ * Triggers are only used if they can be placed on all of the files, which
+ * requires a kernel with pressure stall information and write access to
+ * the files; otherwise the files are read for each admission decision.
+ **/
+void
+pressure_init (void)
+{
+	char trigger[64];
+	int  fds[PRESSURE_LAST];
+	int  i;
+
+	if (pressure_watches[0])
+		return;
+
+	snprintf (trigger, sizeof (trigger), "some %d %d",
+		  (PRESSURE_TRIGGER_WINDOW / 100) * pressure_threshold,
+		  PRESSURE_TRIGGER_WINDOW);
+
+	for (i = 0; i < PRESSURE_LAST; i++) {
+		char path[PATH_MAX];
+
+		snprintf (path, sizeof (path), "%s/%s", pressure_path,
+			  pressure_resource_name (i));
+
+		fds[i] = open (path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fds[i] < 0)
+			break;
+
+		if (write (fds[i], trigger, strlen (trigger) + 1) < 0) {
+			close (fds[i]);
+			break;
+		}
+	}
+
+	if (i < PRESSURE_LAST) {
+		nih_debug ("Pressure triggers not available: %s",
+			   strerror (errno));
+
+		while (i-- > 0)
+			close (fds[i]);
+
+		return;
+	}
+
+	for (i = 0; i < PRESSURE_LAST; i++)
+		pressure_watches[i] = NIH_MUST (nih_io_add_watch (
+				NULL, fds[i], NIH_IO_EXCEPT,
+				pressure_trigger, NULL));
+
+	/* Read the files on the first admission decision since the
+	 * triggers can't tell us about pressure before they were placed.
+	 */
+	pressure_triggered = trace_now ();
+}
+
+
+/**
+ * pressure_admit:
+ * @job: job in the queued state.
+ *
+ * Decide whether @job may be given a spawn slot; jobs of classes that
+ * defer under pressure are held back while any resource is under
+ * pressure, until they have been deferred for their class's maximum
+ * delay.  The first time @job is held back a "deferred" event is emitted,
+ * and once a deferred job is admitted an "admitted" event is emitted
+ * giving the reason.
+ *
+ * Returns: TRUE if @job may be given a spawn slot, FALSE if it should be
+ * left in the queue.
+ **/
+int
+pressure_admit (Job *job)
+{
+	unsigned long long now;
+	unsigned long long delay;
+	int                resource;
+
+	nih_assert (job != NULL);
+	nih_assert (job->timing != NULL);
+
+	if (! job->class->defer_under_pressure)
+		return TRUE;
+
+	resource = pressure_check ();
+	if (resource < 0) {
+		if (job->deferred) {
+			nih_info (_("Admitting %s, pressure relieved"),
+				  job_name (job));
+
+			job->deferred = FALSE;
+			pressure_relieved++;
+
+			pressure_emit (job, JOB_ADMITTED_EVENT,
+				       "REASON", "relieved");
+		}
+
+		return TRUE;
+	}
+
+	now = trace_now ();
+	delay = (unsigned long long)job->class->defer_under_pressure * 1000000;
+
+	if (now >= job->timing->entered[JOB_QUEUED] + delay) {
+		if (job->deferred) {
+			nih_info (_("Admitting %s, deferred for %ds"),
+				  job_name (job),
+				  job->class->defer_under_pressure);
+
+			job->deferred = FALSE;
+			pressure_expired++;
+
+			pressure_emit (job, JOB_ADMITTED_EVENT,
+				       "REASON", "timeout");
+		}
+
+		return TRUE;
+	}
+
+	if (! job->deferred) {
+		nih_info (_("Deferring %s, %s under pressure"),
+			  job_name (job), pressure_resource_name (resource));
+
+		job->deferred = TRUE;
+		pressure_deferred++;
+
+		pressure_emit (job, JOB_DEFERRED_EVENT, "RESOURCE",
+			       pressure_resource_name (resource));
+	}
+
+	pressure_arm ();
+
+	return FALSE;
+}
+
+/**
+ * pressure_arm:
+ *
+ * Arrange for pressure to be checked again shortly, if not already, so
+ * that deferred jobs are admitted once it is relieved or their delay
+ * expires.
+ **/
+void
+pressure_arm (void)
+{
+	if (pressure_check_timer)
+		return;
+
+	pressure_check_timer = NIH_MUST (wheel_timer_add_periodic (
+			NULL, PRESSURE_CHECK_INTERVAL, pressure_timer, NULL));
+}
+
+/**
+ * pressure_waiting:
+ *
+ * Returns: TRUE if any job in the spawn queue has been deferred.
+ **/
+int
+pressure_waiting (void)
+{
+	job_queue_init ();
+
+	NIH_LIST_FOREACH (job_queue, iter) {
+		NihListEntry *entry = (NihListEntry *)iter;
+		Job          *job = (Job *)entry->data;
+
+		if (job->deferred)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/**
+ * pressure_level:
+ * @resource: resource to read.
+ *
+ * Returns: percentage of time, averaged over ten seconds, that some tasks
+ * were stalled on @resource, or a negative value if not known.
+ **/
+double
+pressure_level (PressureResource resource)
+{
+	char   path[PATH_MAX];
+	double avg10;
+
+	nih_assert (resource < PRESSURE_LAST);
+
+	snprintf (path, sizeof (path), "%s/%s", pressure_path,
+		  pressure_resource_name (resource));
+
+	if (pressure_read_file (path, &avg10) < 0)
+		return -1.0;
+
+	return avg10;
+}
+
+/**
+ * pressure_read_file:
+ * @path: pressure file to read,
+ * @avg10: pointer to store average in.
+ *
+ * Read the ten second average from the "some" line of the pressure stall
+ * information file @path, which is a percentage of time that some tasks
+ * were stalled, and store it in @avg10.
+ *
+ * Returns: zero on success, negative value if the file could not be read
+ * or parsed.
+ **/
+int
+pressure_read_file (const char *path,
+		    double     *avg10)
+{
+	FILE *file;
+	char  line[256];
+	int   ret = -1;
+
+	nih_assert (path != NULL);
+	nih_assert (avg10 != NULL);
+
+	file = fopen (path, "re");
+	if (! file)
+		return -1;
+
+	while (fgets (line, sizeof (line), file)) {
+		if (sscanf (line, "some avg10=%lf", avg10) == 1) {
+			ret = 0;
+			break;
+		}
+	}
+
+	fclose (file);
+
+	return ret;
+}
+
+/**
+ * pressure_resource_name:
+ * @resource: resource.
+ *
+ * Returns: name of @resource, which is also the name of its pressure file.
+ **/
+const char *
+pressure_resource_name (PressureResource resource)
+{
+	switch (resource) {
+	case PRESSURE_CPU:
+		return "cpu";
+	case PRESSURE_MEMORY:
+		return "memory";
+	case PRESSURE_IO:
+		return "io";
+	default:
+		nih_assert_not_reached ();
+	}
+}
+
+
+/**
+ * pressure_check:
+ *
+ * Check whether any resource is under pressure; when triggers are in
+ * place and none has fired for the period of the average, no resource
+ * can be and the files are not read.
+ *
+ * Returns: first resource under pressure, or -1 if none are.
+ **/
+static int
+pressure_check (void)
+{
+	if (pressure_watches[0]
+	    && (trace_now () >= pressure_triggered + PRESSURE_AVERAGE_PERIOD))
+		return -1;
+
+	for (int i = 0; i < PRESSURE_LAST; i++) {
+		if (pressure_level (i) >= pressure_threshold)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * pressure_timer:
+ * @data: unused,
+ * @timer: timer that triggered.
+ *
+ * Called periodically while jobs are deferred; asks the spawn queue to
+ * consider queued jobs again, which admits deferred jobs as appropriate,
+ * and stops checking once no deferred jobs remain.
+ **/
+static void
+pressure_timer (void       *data,
+		WheelTimer *timer)
+{
+	nih_assert (timer != NULL);
+	nih_assert (timer == pressure_check_timer);
+
+	job_queue_recheck ();
+
+	if (! pressure_waiting ()) {
+		nih_free (pressure_check_timer);
+		pressure_check_timer = NULL;
+	}
+}
+
+/**
+ * pressure_trigger:
+ * @data: unused,
+ * @watch: watch on pressure file,
+ * @events: events that occurred.
+ *
+ * Called when the kernel trigger on a pressure file fires; records the
+ * time so that the files are read for admission decisions.
+ **/
+static void
+pressure_trigger (void        *data,
+		  NihIoWatch  *watch,
+		  NihIoEvents  events)
+{
+	nih_assert (watch != NULL);
+
+	pressure_triggered = trace_now ();
+}
+
+/**
+ * pressure_emit:
+ * @job: job concerned,
+ * @name: name of event,
+ * @var: name of additional variable,
+ * @value: value of @var.
+ *
+ * Emit the event @name with the job and instance name of @job, and the
+ * additional variable @var set to @value.
+ **/
+static void
+pressure_emit (Job        *job,
+	       const char *name,
+	       const char *var,
+	       const char *value)
+{
+	nih_local char **env = NULL;
+	size_t           len = 0;
+	Event           *event;
+
+	nih_assert (job != NULL);
+	nih_assert (name != NULL);
+	nih_assert (var != NULL);
+	nih_assert (value != NULL);
+
+	env = NIH_MUST (nih_str_array_new (NULL));
+
+	NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+			       "JOB=%s", job->class->name));
+	NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+			       "INSTANCE=%s", job->name));
+	NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+			       "%s=%s", var, value));
+
+	event = NIH_MUST (event_new (NULL, name, env));
+	event_set_session (event, job->class->session);
+}
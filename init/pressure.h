@@ -0,0 +1,114 @@
+/* upstart
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_PRESSURE_H
+#define INIT_PRESSURE_H
+
+#include <nih/macros.h>
+
+#include "job.h"
+
+
+/**
+ * PRESSURE_PATH:
+ *
+ * Directory containing the kernel's pressure stall information files.
+ **/
+#define PRESSURE_PATH "/proc/pressure"
+
+/**
+ * PRESSURE_DEFAULT_THRESHOLD:
+ *
+ * Default percentage of time, averaged over ten seconds, that some tasks
+ * may be stalled on a resource before it is considered under pressure.
+ **/
+#define PRESSURE_DEFAULT_THRESHOLD 20
+
+/**
+ * PRESSURE_DEFAULT_DELAY:
+ *
+ * Default maximum number of seconds a job may be deferred for.
+ **/
+#define PRESSURE_DEFAULT_DELAY 30
+
+/**
+ * PRESSURE_TRIGGER_WINDOW:
+ *
+ * Window, in microseconds, of the kernel triggers placed on each pressure
+ * file; a trigger fires when tasks stall for more than the threshold
+ * percentage of the window.
+ **/
+#define PRESSURE_TRIGGER_WINDOW 1000000
+
+/**
+ * PRESSURE_AVERAGE_PERIOD:
+ *
+ * Period, in microseconds, of the average that is compared against the
+ * threshold; if no trigger has fired for this long, that average must be
+ * below the threshold and need not be read.
+ **/
+#define PRESSURE_AVERAGE_PERIOD 10000000
+
+/**
+ * PRESSURE_CHECK_INTERVAL:
+ *
+ * Number of seconds between checks of pressure while jobs are deferred.
+ **/
+#define PRESSURE_CHECK_INTERVAL 1
+
+
+/**
+ * PressureResource:
+ *
+ * Resources for which the kernel reports pressure stall information.
+ **/
+typedef enum pressure_resource {
+	PRESSURE_CPU,
+	PRESSURE_MEMORY,
+	PRESSURE_IO,
+	PRESSURE_LAST
+} PressureResource;
+
+
+NIH_BEGIN_EXTERN
+
+extern int          pressure_threshold;
+extern const char  *pressure_path;
+
+extern unsigned int pressure_deferred;
+extern unsigned int pressure_relieved;
+extern unsigned int pressure_expired;
+
+void        pressure_init          (void);
+
+int         pressure_admit         (Job *job);
+void        pressure_arm           (void);
+int         pressure_waiting       (void)
+	__attribute__ ((warn_unused_result));
+
+double      pressure_level         (PressureResource resource)
+	__attribute__ ((warn_unused_result));
+int         pressure_read_file     (const char *path, double *avg10)
+	__attribute__ ((warn_unused_result));
+
+const char *pressure_resource_name (PressureResource resource)
+	__attribute__ ((warn_unused_result));
+
+NIH_END_EXTERN
+
+#endif /* INIT_PRESSURE_H */
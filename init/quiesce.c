@@ -23,14 +23,24 @@
 # include <config.h>
 #endif /* HAVE_CONFIG_H */
 
+#include <errno.h>
+#include <unistd.h>
+
 #include "quiesce.h"
+#include "event.h"
 #include "events.h"
 #include "environ.h"
 #include "conf.h"
 #include "job_process.h"
+#include "job_queue.h"
 #include "control.h"
 
+#ifdef ENABLE_CGROUPS
+#include "cgroup.h"
+#endif /* ENABLE_CGROUPS */
+
 #include <nih/main.h>
+#include <nih/io.h>
 
 /**
  * quiesce_requester:
@@ -84,9 +94,91 @@ static time_t quiesce_start_time = 0;
  **/
 static int session_end_jobs = FALSE;
 
+/**
+ * quiesce_timer:
+ *
+ * Timer bounding how long the current phase may last.
+ **/
+static WheelTimer *quiesce_timer = NULL;
+
+/**
+ * quiesce_layered:
+ *
+ * TRUE while jobs are being stopped in dependency order during the kill
+ * phase; once a layer overruns its timeout, or there are no more jobs to
+ * stop in order, all remaining jobs are stopped together.
+ **/
+static int quiesce_layered = FALSE;
+
+/**
+ * quiesce_layers:
+ *
+ * Number of layers the running jobs were ordered in when the kill phase
+ * began, see quiesce_layers_order(); each job class is given its layer
+ * in its stop_layer member.
+ **/
+static int quiesce_layers = 0;
+
+/**
+ * quiesce_layer:
+ *
+ * Layer of jobs currently being stopped, or -1 before the first.
+ **/
+static int quiesce_layer = -1;
+
+/**
+ * quiesce_layer_changed:
+ *
+ * TRUE once a job in quiesce_layer has changed state since the layer was
+ * last checked by quiesce_poll(), see quiesce_job_changed().
+ **/
+static int quiesce_layer_changed = FALSE;
+
+#ifdef ENABLE_CGROUPS
+/**
+ * quiesce_events_fd:
+ *
+ * Descriptor of the cgroup.events file of the parent of the job
+ * cgroups, or -1 if not being watched.
+ **/
+static int quiesce_events_fd = -1;
+
+/**
+ * quiesce_events_watch:
+ *
+ * Watch for notifications on quiesce_events_fd.
+ **/
+static NihIoWatch *quiesce_events_watch = NULL;
+
+/**
+ * quiesce_populated:
+ *
+ * TRUE while processes remain in the job cgroups, as last notified
+ * through quiesce_events_fd.
+ **/
+static int quiesce_populated = FALSE;
+#endif /* ENABLE_CGROUPS */
+
 static int quiesce_event_match (Event *event)
 	__attribute__ ((warn_unused_result));
 
+static void   quiesce_kill_phase     (void);
+static void   quiesce_layers_order   (void);
+static int    quiesce_stop_layer     (void)
+	__attribute__ ((warn_unused_result));
+static int    quiesce_layer_finished (void)
+	__attribute__ ((warn_unused_result));
+static void   quiesce_stop_rest      (void);
+static void   quiesce_timeout        (void *data, WheelTimer *timer);
+static void   quiesce_events_start   (void);
+static void   quiesce_events_stop    (void);
+static int    quiesce_escaped        (void)
+	__attribute__ ((warn_unused_result));
+#ifdef ENABLE_CGROUPS
+static void   quiesce_events_watcher (void *data, NihIoWatch *watch,
+				      NihIoEvents events);
+#endif /* ENABLE_CGROUPS */
+
 /* External definitions */
 extern int disable_respawn;
 
@@ -178,87 +270,504 @@ quiesce (QuiesceRequester requester)
 	}
 
 	if (quiesce_phase == QUIESCE_PHASE_KILL) {
-		/* We'll attempt to wait for this long, but system
-		 * policy may prevent it such that we just get killed
-		 * and job processes reparented to PID 1.
-		 */
-		max_kill_timeout = job_class_max_kill_timeout ();
+		quiesce_kill_phase ();
+	} else {
+		quiesce_timer = NIH_MUST (wheel_timer_add_timeout (
+				NULL, QUIESCE_DEFAULT_JOB_RUNTIME,
+				(WheelTimerCb)quiesce_timeout, NULL));
+	}
 
-		job_process_stop_all ();
+	quiesce_events_start ();
+}
+
+/**
+ * quiesce_kill_phase:
+ *
+ * Enter the kill phase, stopping jobs in dependency order and bounding
+ * how long we wait for each layer of them to finish.
+ **/
+static void
+quiesce_kill_phase (void)
+{
+	quiesce_phase = QUIESCE_PHASE_KILL;
+	quiesce_phase_time = time (NULL);
+
+	/* Overall bound, reported should the shutdown fail to complete */
+	max_kill_timeout = job_class_max_kill_timeout ();
+
+	quiesce_layered = TRUE;
+	quiesce_layers_order ();
+
+	if (! quiesce_stop_layer ())
+		quiesce_stop_rest ();
+}
+
+/**
+ * quiesce_layers_order:
+ *
+ * Order the running jobs in layers for quiesce_stop_layer() to stop in
+ * turn: the first holds the jobs that no other running job depends on,
+ * as determined by job_class_stop_depends(), and each following layer
+ * those that only jobs of earlier layers depend on.  Jobs that only
+ * depend on each other are put together in the last layer.
+ *
+ * This is done once as the kill phase begins; job classes that are not
+ * running are given no layer, and neither are those that start later,
+ * which are left for quiesce_stop_rest().
+ **/
+static void
+quiesce_layers_order (void)
+{
+	nih_local JobClass **running = NULL;
+	size_t               count = 0;
+	size_t               ordered = 0;
+
+	job_class_init ();
+
+	quiesce_layers = 0;
+	quiesce_layer = -1;
+	quiesce_layer_changed = FALSE;
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		class->stop_layer = -1;
+
+		if (! NIH_HASH_EMPTY (class->instances))
+			count++;
 	}
 
-	/* Check every second to see if all jobs have finished. If so,
-	 * we can exit early.
+	if (! count)
+		return;
+
+	running = NIH_MUST (nih_alloc (NULL, sizeof (JobClass *) * count));
+
+	count = 0;
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		if (! NIH_HASH_EMPTY (class->instances))
+			running[count++] = class;
+	}
+
+	/* A job is held back by those depending on it that are in no
+	 * earlier layer, including those just put in this one.
 	 */
-	NIH_MUST (nih_timer_add_periodic (NULL, 1,
-				(NihTimerCb)quiesce_wait_callback, NULL));
+	while (ordered < count) {
+		int layer = quiesce_layers++;
+		int found = FALSE;
+
+		for (size_t i = 0; i < count; i++) {
+			int held = FALSE;
+
+			if (running[i]->stop_layer >= 0)
+				continue;
+
+			for (size_t j = 0; j < count; j++) {
+				if ((j == i)
+				    || ((running[j]->stop_layer >= 0)
+					&& (running[j]->stop_layer < layer)))
+					continue;
+
+				if (job_class_stop_depends (running[j],
+							    running[i])) {
+					held = TRUE;
+					break;
+				}
+			}
+
+			if (held)
+				continue;
+
+			running[i]->stop_layer = layer;
+			ordered++;
+			found = TRUE;
+		}
+
+		if (found)
+			continue;
+
+		nih_debug ("Stopping jobs that depend on each other together");
+
+		for (size_t i = 0; i < count; i++) {
+			if (running[i]->stop_layer < 0) {
+				running[i]->stop_layer = layer;
+				ordered++;
+			}
+		}
+	}
 }
 
 /**
- * quiesce_wait_callback:
+ * quiesce_stop_layer:
  *
- * @data: not used,
- * @timer: timer that caused us to be called.
+ * Move on to the next layer of jobs ordered by quiesce_layers_order()
+ * that still has jobs running, and stop them; how long we wait for them
+ * is bounded by the largest kill timeout of those jobs, which may be
+ * zero.
  *
- * Callback used to check if all jobs have finished and if so
- * finalise Session Init shutdown.
+ * Returns: TRUE if a layer of jobs was stopped, FALSE if no layers with
+ * jobs running remain.
  **/
-void
-quiesce_wait_callback (void *data, NihTimer *timer)
+static int
+quiesce_stop_layer (void)
 {
-	time_t now;
+	time_t timeout = 0;
+	int    found = FALSE;
 
-	nih_assert (timer);
-	nih_assert (quiesce_phase_time);
-	nih_assert (quiesce_requester != QUIESCE_REQUESTER_INVALID);
+	job_class_init ();
 
-	now = time (NULL);
+	quiesce_layer_changed = FALSE;
 
-	if (quiesce_phase == QUIESCE_PHASE_KILL) {
-		nih_assert (max_kill_timeout);
+	while ((! found) && (quiesce_layer + 1 < quiesce_layers)) {
+		quiesce_layer++;
 
-		if ((now - quiesce_phase_time) > max_kill_timeout)
-			goto timed_out;
+		NIH_HASH_FOREACH_SAFE (job_classes, iter) {
+			JobClass *class = (JobClass *)iter;
 
-	} else if (quiesce_phase == QUIESCE_PHASE_WAIT) {
-		int  timed_out = 0;
+			if (class->stop_layer != quiesce_layer)
+				continue;
 
-		timed_out = ((now - quiesce_phase_time) >= QUIESCE_DEFAULT_JOB_RUNTIME);
+			if (NIH_HASH_EMPTY (class->instances))
+				continue;
 
-		if (timed_out
-			|| (session_end_jobs && ! job_process_jobs_running ())
-			|| ! job_process_jobs_running ()) {
+			/* Jobs already being stopped are waited for too */
+			found = TRUE;
 
-			quiesce_phase = QUIESCE_PHASE_KILL;
+			if (class->kill_timeout > timeout)
+				timeout = class->kill_timeout;
 
-			/* reset for new phase */
-			quiesce_phase_time = time (NULL);
+			NIH_HASH_FOREACH_SAFE (class->instances, job_iter) {
+				Job *job = (Job *)job_iter;
 
-			max_kill_timeout = job_class_max_kill_timeout ();
+				if (job->goal != JOB_STOP)
+					job_change_goal (job, JOB_STOP);
+			}
+		}
+	}
 
-			job_process_stop_all ();
+	if (! found)
+		return FALSE;
+
+	if (quiesce_timer)
+		nih_free (quiesce_timer);
+
+	quiesce_timer = NIH_MUST (wheel_timer_add_timeout (
+			NULL, timeout + 1,
+			(WheelTimerCb)quiesce_timeout, NULL));
+
+	return TRUE;
+}
+
+/**
+ * quiesce_layer_finished:
+ *
+ * Returns: TRUE once no jobs of the layer being stopped remain, else
+ * FALSE.
+ **/
+static int
+quiesce_layer_finished (void)
+{
+	job_class_init ();
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		if ((class->stop_layer == quiesce_layer)
+		    && (! NIH_HASH_EMPTY (class->instances)))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * quiesce_job_changed:
+ * @job: job that changed state.
+ *
+ * Called by job_change_state() so that quiesce_poll() only checks whether
+ * the layer of jobs being stopped has finished once one of them changes
+ * state.
+ **/
+void
+quiesce_job_changed (Job *job)
+{
+	nih_assert (job != NULL);
+
+	if (quiesce_layered && (job->class->stop_layer == quiesce_layer))
+		quiesce_layer_changed = TRUE;
+}
+
+/**
+ * quiesce_stop_rest:
+ *
+ * Stop all remaining jobs at once, including any started since the kill
+ * phase began, bounding how long we wait for them by the largest kill
+ * timeout of all running jobs.
+ **/
+static void
+quiesce_stop_rest (void)
+{
+	quiesce_layered = FALSE;
+
+	/* We'll attempt to wait for this long, plus a second for the
+	 * final SIGKILL to take effect, but system policy may prevent it
+	 * such that we just get killed and job processes reparented to
+	 * PID 1.
+	 */
+	max_kill_timeout = job_class_max_kill_timeout ();
+
+	if (quiesce_timer)
+		nih_free (quiesce_timer);
+
+	quiesce_timer = NIH_MUST (wheel_timer_add_timeout (
+			NULL, max_kill_timeout + 1,
+			(WheelTimerCb)quiesce_timeout, NULL));
+
+	job_process_stop_all ();
+}
+
+/**
+ * quiesce_timeout:
+ *
+ * @data: not used,
+ * @timer: timer that caused us to be called.
+ *
+ * Called when the current phase has lasted as long as it may; the wait
+ * phase is followed by the kill phase, a layer of the kill phase by
+ * stopping all remaining jobs, and that by shutdown regardless of the
+ * jobs that have failed to stop.
+ **/
+static void
+quiesce_timeout (void *data, WheelTimer *timer)
+{
+	nih_assert (timer);
+	nih_assert (timer == quiesce_timer);
+	nih_assert (quiesce_requester != QUIESCE_REQUESTER_INVALID);
+
+	/* Freed once we return */
+	quiesce_timer = NULL;
+
+	switch (quiesce_phase) {
+	case QUIESCE_PHASE_WAIT:
+		quiesce_kill_phase ();
+		break;
+
+	case QUIESCE_PHASE_KILL:
+		if (quiesce_layered) {
+			nih_debug ("Stopping all remaining jobs");
+			quiesce_stop_rest ();
+			break;
 		}
-	} else {
+
+		quiesce_show_slow_jobs ();
+		quiesce_complete ();
+		break;
+
+	default:
 		nih_assert_not_reached ();
 	}
+}
 
-	if (! job_process_jobs_running ())
-		goto out;
+/**
+ * quiesce_poll:
+ *
+ * Move on to the next phase of shutdown as soon as all job processes
+ * have ended, rather than waiting for the current phase to time out.
+ * This is called from the main loop, rather than as processes end, since
+ * processes end from within job_process_terminated() for a job whose
+ * state is still being changed.
+ **/
+void
+quiesce_poll (void)
+{
+	if ((quiesce_phase != QUIESCE_PHASE_WAIT)
+	    && (quiesce_phase != QUIESCE_PHASE_KILL))
+		return;
 
-	return;
+	/* The next layer of jobs is stopped once those of the current
+	 * layer have all finished, each layer bounded by its own kill
+	 * timeout; after the last, any jobs started since are stopped.
+	 */
+	if (quiesce_layered && quiesce_layer_changed
+	    && quiesce_layer_finished ()
+	    && (! quiesce_stop_layer ()))
+		quiesce_stop_rest ();
 
-timed_out:
-	quiesce_show_slow_jobs ();
+	if (job_process_jobs_running ())
+		return;
+
+	if (quiesce_phase == QUIESCE_PHASE_WAIT) {
+		/* Jobs that start on the session end event may still be
+		 * waiting to do so.
+		 */
+		if (! NIH_LIST_EMPTY (events) || job_queue_depth ())
+			return;
+
+		quiesce_kill_phase ();
+
+		/* Stopping jobs may have run their pre-stop or post-stop
+		 * processes.
+		 */
+		if (job_process_jobs_running ())
+			return;
+	}
+
+	/* Anything left in the job cgroups once no job processes remain
+	 * escaped its job, and would otherwise survive the shutdown.
+	 */
+	if (quiesce_escaped ())
+		return;
 
-out:
 	/* Note that we might skip the kill phase for the session
 	 * requestor if no jobs are actually running at this point.
 	 */
-	quiesce_phase = QUIESCE_PHASE_CLEANUP;
-	quiesce_finalise ();
+	quiesce_complete ();
+}
+
+/**
+ * quiesce_events_start:
+ *
+ * Watch for the kernel notifying that processes no longer remain in
+ * the job cgroups, which is only possible in the unified cgroup
+ * hierarchy; otherwise only the periodic check is made.
+ **/
+static void
+quiesce_events_start (void)
+{
+#ifdef ENABLE_CGROUPS
+	NihError *err;
+	int       populated;
+
+	if (! cgroup_support_enabled ())
+		return;
+
+	quiesce_events_fd = cgroup_events_open ();
+	if (quiesce_events_fd < 0)
+		goto error;
+
+	populated = cgroup_events_populated (quiesce_events_fd);
+	if (populated < 0)
+		goto error;
+
+	quiesce_populated = populated;
+
+	quiesce_events_watch = NIH_MUST (nih_io_add_watch (
+			NULL, quiesce_events_fd, NIH_IO_EXCEPT,
+			quiesce_events_watcher, NULL));
+
+	return;
+
+error:
+	err = nih_error_get ();
+	nih_debug ("Not watching job cgroups: %s", err->message);
+	nih_free (err);
+
+	quiesce_events_stop ();
+#endif /* ENABLE_CGROUPS */
+}
+
+/**
+ * quiesce_events_stop:
+ *
+ * Stop watching the job cgroups.
+ **/
+static void
+quiesce_events_stop (void)
+{
+#ifdef ENABLE_CGROUPS
+	if (quiesce_events_watch) {
+		nih_free (quiesce_events_watch);
+		quiesce_events_watch = NULL;
+	}
+
+	if (quiesce_events_fd >= 0) {
+		close (quiesce_events_fd);
+		quiesce_events_fd = -1;
+	}
+
+	quiesce_populated = FALSE;
+#endif /* ENABLE_CGROUPS */
+}
+
+#ifdef ENABLE_CGROUPS
+/**
+ * quiesce_events_watcher:
+ * @data: not used,
+ * @watch: NihIoWatch for quiesce_events_fd,
+ * @events: events that occurred.
+ *
+ * Called when the kernel notifies a change to the job cgroups; the new
+ * state is read, which also acknowledges the notification.
+ **/
+static void
+quiesce_events_watcher (void        *data,
+			NihIoWatch  *watch,
+			NihIoEvents  events)
+{
+	int populated;
+
+	nih_assert (watch != NULL);
+
+	populated = cgroup_events_populated (quiesce_events_fd);
+	if (populated < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_debug ("Not watching job cgroups: %s", err->message);
+		nih_free (err);
 
-	/* Deregister */
-	nih_free (timer);
+		quiesce_events_stop ();
+		return;
+	}
+
+	/* Acted upon by quiesce_poll() on the way back round the main
+	 * loop.
+	 */
+	quiesce_populated = populated;
+}
+#endif /* ENABLE_CGROUPS */
+
+/**
+ * quiesce_escaped:
+ *
+ * Check whether processes that escaped their jobs remain in the job
+ * cgroups once no job processes remain, and if so kill them all.
+ *
+ * Returns: TRUE if such processes remain, else FALSE.
+ **/
+static int
+quiesce_escaped (void)
+{
+#ifdef ENABLE_CGROUPS
+	static int killed = FALSE;
+
+	if (! quiesce_populated)
+		return FALSE;
+
+	/* Wait to be notified that they have gone */
+	if (killed)
+		return TRUE;
+
+	killed = TRUE;
+
+	nih_debug ("Killing processes remaining in job cgroups");
+
+	if (! cgroup_kill_all ()) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_warn (_("Failed to kill processes remaining in job cgroups: %s"),
+			  err->message);
+		nih_free (err);
+
+		return FALSE;
+	}
+
+	return TRUE;
+#else
+	return FALSE;
+#endif /* ENABLE_CGROUPS */
 }
 
 /**
@@ -330,6 +839,13 @@ quiesce_complete (void)
 {
 	quiesce_phase = QUIESCE_PHASE_CLEANUP;
 
+	if (quiesce_timer) {
+		nih_free (quiesce_timer);
+		quiesce_timer = NULL;
+	}
+
+	quiesce_events_stop ();
+
 	quiesce_finalise ();
 }
 
@@ -20,7 +20,8 @@
 #ifndef INIT_QUIESCE_H
 #define INIT_QUIESCE_H
 
-#include <nih/timer.h>
+#include "job.h"
+#include "wheel.h"
 
 /**
  * QUIESCE_DEFAULT_JOB_RUNTIME:
@@ -67,7 +68,8 @@ typedef enum quiesce_phase {
 NIH_BEGIN_EXTERN
 
 void    quiesce                (QuiesceRequester requester);
-void    quiesce_wait_callback  (void *data, NihTimer *timer);
+void    quiesce_poll           (void);
+void    quiesce_job_changed    (Job *job);
 void    quiesce_show_slow_jobs (void);
 void    quiesce_finalise       (void);
 void    quiesce_complete       (void);
@@ -45,6 +45,7 @@
 
 #include "session.h"
 #include "conf.h"
+#include "event.h"
 #include "paths.h"
 
 extern json_object *json_sessions;
@@ -56,6 +57,8 @@ static json_object  *session_serialise   (const Session *session)
 static Session *session_deserialise (json_object *json)
 	__attribute__ ((warn_unused_result));
 
+static int session_free (Session *session);
+
 
 /**
  * sessions:
@@ -73,6 +76,15 @@ NihList *sessions = NULL;
  **/
 int chroot_sessions = FALSE;
 
+/**
+ * session_event_limit:
+ *
+ * Maximum number of events of each chroot session that may be pending at
+ * once, further events emitted from the session being refused; zero for
+ * no limit.  Set with the --session-event-limit option.
+ **/
+int session_event_limit = 0;
+
 
 /* Prototypes for static functions */
 static void session_create_conf_source (Session *sesson, int deserialised);
@@ -135,13 +147,55 @@ session_new (const void *parent,
 
 	session->conf_path = NULL;
 
-	nih_alloc_set_destructor (session, nih_list_destroy);
+	session->classes = nih_list_new (session);
+	if (! session->classes) {
+		nih_free (session);
+		return NULL;
+	}
+
+	session->events_pending = 0;
+	session->events_handled = 0;
+	session->events_refused = 0;
+	session->events_credit = 0;
+
+	nih_alloc_set_destructor (session, session_free);
 
 	nih_list_add (sessions, &session->entry);
 
 	return session;
 }
 
+/**
+ * session_free:
+ * @session: session to be freed.
+ *
+ * Removes @session from the sessions list, and detaches any events of
+ * the session from it so that they are handled as if emitted outside
+ * any session.
+ *
+ * Normally used or called from an nih_alloc() destructor.
+ *
+ * Returns: zero.
+ **/
+static int
+session_free (Session *session)
+{
+	nih_assert (session != NULL);
+
+	if (events) {
+		NIH_LIST_FOREACH (events, iter) {
+			Event *event = (Event *)iter;
+
+			if (event->session == session)
+				event_set_session (event, NULL);
+		}
+	}
+
+	nih_list_destroy (&session->entry);
+
+	return 0;
+}
+
 /**
  * session_from_dbus:
  * @parent: parent,
@@ -33,7 +33,15 @@
  * Session:
  * @entry: list header,
  * @chroot: path all jobs are chrooted to,
- * @conf_path: configuration path (full path to chroot root).
+ * @conf_path: configuration path (full path to chroot root),
+ * @classes: index of the job classes of the session, each item an
+ *           NihListEntry whose data is a JobClass,
+ * @events_pending: number of events of the session pending,
+ * @events_handled: number of events of the session handled,
+ * @events_refused: number of events refused because the event queue was
+ *                  full, see event_queue_full(),
+ * @events_credit: number of pending events of the session that may still
+ *                 be handled in the current pass of event_poll().
  *
  * This structure is used to identify collections of jobs
  * that share a common @chroot (*). Note that @conf_path is
@@ -67,15 +75,23 @@
  *
  **/
 typedef struct session {
-	NihList entry;
-	char *  chroot;
-	char *  conf_path;
+	NihList       entry;
+	char *        chroot;
+	char *        conf_path;
+
+	NihList *     classes;
+
+	unsigned int  events_pending;
+	unsigned int  events_handled;
+	unsigned int  events_refused;
+	unsigned int  events_credit;
 } Session;
 
 
 NIH_BEGIN_EXTERN
 
 extern NihList *sessions;
+extern int      session_event_limit;
 
 void           session_init        (void);
 void           session_destroy     (void);
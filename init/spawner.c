@@ -0,0 +1,353 @@
+/* upstart
+ *
+ * spawner.c - helper process to spawn job processes
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/signal.h>
+#include <nih/logging.h>
+#include <nih/error.h>
+
+#include "spawner.h"
+
+
+/* Prototypes for static functions */
+static void spawner_main (int sock, SpawnerHandler handler)
+	__attribute__ ((noreturn));
+
+
+/**
+ * spawner_pid:
+ *
+ * Process id of the spawn helper, or zero if it is not running.
+ **/
+pid_t spawner_pid = 0;
+
+/**
+ * spawner_fd:
+ *
+ * Our end of the socket connected to the spawn helper, or -1.
+ **/
+static int spawner_fd = -1;
+
+
+/**
+ * spawner_start:
+ * @handler: function to handle requests.
+ *
+ * Fork the spawn helper process, which receives requests sent with
+ * spawner_request() over a socket and calls @handler for each in turn.
+ *
+ * The helper is forked from us so it should be started early, while our
+ * heap is small, since that is what makes it cheaper to fork from.  It
+ * exits once our end of the socket is closed, including when we exec.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+spawner_start (SpawnerHandler handler)
+{
+	int   fds[2];
+	pid_t pid;
+
+	nih_assert (handler != NULL);
+	nih_assert (spawner_fd < 0);
+
+	if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0)
+		nih_return_system_error (-1);
+
+	pid = fork ();
+	if (pid < 0) {
+		nih_error_raise_system ();
+		close (fds[0]);
+		close (fds[1]);
+		return -1;
+	} else if (pid == 0) {
+		close (fds[0]);
+		spawner_main (fds[1], handler);
+	}
+
+	close (fds[1]);
+
+	spawner_fd = fds[0];
+	spawner_pid = pid;
+
+	nih_debug ("Started spawn helper (%d)", spawner_pid);
+
+	return 0;
+}
+
+/**
+ * spawner_stop:
+ *
+ * Close our end of the socket to the spawn helper, causing it to exit;
+ * subsequent spawns are made by the caller directly.  The helper is our
+ * child so is reaped like any other.
+ **/
+void
+spawner_stop (void)
+{
+	if (spawner_fd < 0)
+		return;
+
+	nih_debug ("Stopping spawn helper (%d)", spawner_pid);
+
+	close (spawner_fd);
+
+	spawner_fd = -1;
+	spawner_pid = 0;
+}
+
+/**
+ * spawner_available:
+ *
+ * Returns: TRUE if requests may be sent to the spawn helper.
+ **/
+int
+spawner_available (void)
+{
+	return spawner_fd >= 0;
+}
+
+
+/**
+ * spawner_request:
+ * @buf: request,
+ * @len: length of @buf,
+ * @fds: file descriptors to send with request,
+ * @nfds: number of entries in @fds.
+ *
+ * Send the request in @buf, along with copies of the file descriptors in
+ * @fds, to the spawn helper and wait for it to be handled.
+ *
+ * If the helper cannot be communicated with, it is stopped so that
+ * spawner_available() returns FALSE and the caller may spawn the process
+ * itself instead.
+ *
+ * Returns: process id of new process on success, negative value with errno
+ * set on failure.
+ **/
+pid_t
+spawner_request (const char *buf,
+		 size_t      len,
+		 const int  *fds,
+		 size_t      nfds)
+{
+	struct msghdr  msg;
+	struct iovec   iov;
+	char           control[CMSG_SPACE (sizeof (int) * SPAWNER_FDS_MAX)];
+	struct pollfd  pfd;
+	pid_t          reply;
+	ssize_t        ret;
+	int            saved_errno;
+
+	nih_assert (buf != NULL);
+	nih_assert (len > 0);
+	nih_assert (len <= SPAWNER_MESSAGE_MAX);
+	nih_assert (nfds <= SPAWNER_FDS_MAX);
+	nih_assert ((fds != NULL) || (nfds == 0));
+	nih_assert (spawner_available ());
+
+	memset (&msg, 0, sizeof (msg));
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (nfds) {
+		struct cmsghdr *cmsg;
+
+		memset (control, 0, sizeof (control));
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE (sizeof (int) * nfds);
+
+		cmsg = CMSG_FIRSTHDR (&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN (sizeof (int) * nfds);
+		memcpy (CMSG_DATA (cmsg), fds, sizeof (int) * nfds);
+	}
+
+	while (sendmsg (spawner_fd, &msg, MSG_NOSIGNAL) < 0) {
+		if (errno != EINTR)
+			goto error;
+	}
+
+	/* The helper only forks and replies so should be quick; if it
+	 * isn't, it's wedged and we're better off without it.
+	 */
+	pfd.fd = spawner_fd;
+	pfd.events = POLLIN;
+
+	for (;;) {
+		ret = poll (&pfd, 1, SPAWNER_TIMEOUT);
+		if (ret > 0)
+			break;
+
+		if (ret == 0) {
+			errno = ETIMEDOUT;
+			goto error;
+		} else if (errno != EINTR) {
+			goto error;
+		}
+	}
+
+	do {
+		ret = recv (spawner_fd, &reply, sizeof (reply), 0);
+	} while ((ret < 0) && (errno == EINTR));
+
+	if (ret != sizeof (reply)) {
+		if (ret >= 0)
+			errno = ECONNRESET;
+		goto error;
+	}
+
+	if (reply < 0) {
+		errno = -reply;
+		return -1;
+	}
+
+	return reply;
+
+error:
+	saved_errno = errno;
+
+	if (errno == ETIMEDOUT)
+		kill (spawner_pid, SIGKILL);
+	spawner_stop ();
+
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * spawner_main:
+ * @sock: helper end of the socket,
+ * @handler: function to handle requests.
+ *
+ * Main loop of the spawn helper: receives each request on @sock, calls
+ * @handler and replies with the process id or negated errno it returned.
+ *
+ * The helper holds no descriptors other than @sock and its standard ones,
+ * so processes it spawns inherit nothing from us by accident, and runs
+ * with all signals blocked and reset to their defaults.
+ *
+ * This function exits, so never returns.
+ **/
+static void
+spawner_main (int            sock,
+	      SpawnerHandler handler)
+{
+	static char buf[SPAWNER_MESSAGE_MAX];
+	sigset_t    mask;
+	long        max_fd;
+
+	sigfillset (&mask);
+	sigprocmask (SIG_BLOCK, &mask, NULL);
+	nih_signal_reset ();
+
+	prctl (PR_SET_PDEATHSIG, SIGKILL);
+	prctl (PR_SET_NAME, "init-spawner");
+
+	max_fd = sysconf (_SC_OPEN_MAX);
+	if (max_fd < 0)
+		max_fd = 1024;
+
+	for (int fd = 3; fd < max_fd; fd++)
+		if (fd != sock)
+			close (fd);
+
+	for (;;) {
+		struct msghdr   msg;
+		struct iovec    iov;
+		struct cmsghdr *cmsg;
+		char            control[CMSG_SPACE (sizeof (int)
+						   * SPAWNER_FDS_MAX)];
+		int             fds[SPAWNER_FDS_MAX];
+		size_t          nfds = 0;
+		ssize_t         len;
+		pid_t           reply;
+
+		memset (&msg, 0, sizeof (msg));
+		iov.iov_base = buf;
+		iov.iov_len = sizeof (buf);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof (control);
+
+		len = recvmsg (sock, &msg, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+
+			_exit (1);
+		} else if (len == 0) {
+			_exit (0);
+		}
+
+		for (cmsg = CMSG_FIRSTHDR (&msg); cmsg;
+		     cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+			size_t n;
+
+			if ((cmsg->cmsg_level != SOL_SOCKET)
+			    || (cmsg->cmsg_type != SCM_RIGHTS))
+				continue;
+
+			n = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+			if (n > SPAWNER_FDS_MAX - nfds)
+				n = SPAWNER_FDS_MAX - nfds;
+
+			memcpy (fds + nfds, CMSG_DATA (cmsg), sizeof (int) * n);
+			nfds += n;
+		}
+
+		if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+			reply = -EMSGSIZE;
+		} else {
+			reply = handler (buf, len, fds, nfds);
+			if (reply < 0)
+				reply = errno ? -errno : -EINVAL;
+		}
+
+		for (size_t i = 0; i < nfds; i++)
+			close (fds[i]);
+
+		while (send (sock, &reply, sizeof (reply), MSG_NOSIGNAL) < 0) {
+			if (errno != EINTR)
+				_exit (1);
+		}
+	}
+}
@@ -0,0 +1,84 @@
+/* upstart
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_SPAWNER_H
+#define INIT_SPAWNER_H
+
+#include <sys/types.h>
+
+#include <nih/macros.h>
+
+
+/**
+ * SPAWNER_MESSAGE_MAX:
+ *
+ * Largest request that may be sent to the spawn helper; larger requests
+ * must be handled locally.
+ **/
+#define SPAWNER_MESSAGE_MAX 65536
+
+/**
+ * SPAWNER_FDS_MAX:
+ *
+ * Maximum number of file descriptors that may accompany a request.
+ **/
+#define SPAWNER_FDS_MAX 4
+
+/**
+ * SPAWNER_TIMEOUT:
+ *
+ * Milliseconds to wait for the spawn helper to reply to a request before
+ * giving up on it.
+ **/
+#define SPAWNER_TIMEOUT 5000
+
+
+/**
+ * SpawnerHandler:
+ * @buf: request,
+ * @len: length of @buf,
+ * @fds: file descriptors received with request,
+ * @nfds: number of entries in @fds.
+ *
+ * Function called within the spawn helper process for each request
+ * received.  The file descriptors in @fds are closed once it returns.
+ *
+ * Returns: process id of new process or negative value with errno set.
+ **/
+typedef pid_t (*SpawnerHandler) (const char *buf, size_t len,
+				 int *fds, size_t nfds);
+
+
+NIH_BEGIN_EXTERN
+
+extern pid_t spawner_pid;
+
+
+int   spawner_start     (SpawnerHandler handler)
+	__attribute__ ((warn_unused_result));
+void  spawner_stop      (void);
+
+int   spawner_available (void);
+
+pid_t spawner_request   (const char *buf, size_t len,
+			 const int *fds, size_t nfds)
+	__attribute__ ((warn_unused_result));
+
+NIH_END_EXTERN
+
+#endif /* INIT_SPAWNER_H */
@@ -27,9 +27,12 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/mount.h>
+#include <sys/syscall.h>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <termios.h>
@@ -71,6 +74,148 @@ system_kill (pid_t pid,
 	return 0;
 }
 
+/**
+ * system_pidfd_open:
+ * @pid: process id of process.
+ *
+ * Obtain a file descriptor referring to the process @pid, which remains
+ * valid, and becomes readable, once the process has exited; unlike @pid
+ * it can never come to refer to a different process.  The descriptor
+ * is close-on-exec.
+ *
+ * The error raised is ENOSYS when the running kernel, or the headers we
+ * were built against, don't support process file descriptors.
+ *
+ * Returns: file descriptor on success, negative value on raised error.
+ **/
+int
+system_pidfd_open (pid_t pid)
+{
+	int fd;
+
+	nih_assert (pid > 0);
+
+#ifdef __NR_pidfd_open
+	fd = syscall (__NR_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	fd = -1;
+#endif /* __NR_pidfd_open */
+	if (fd < 0)
+		nih_return_system_error (-1);
+
+	return fd;
+}
+
+/**
+ * system_kill_pidfd:
+ * @pidfd: process file descriptor of process,
+ * @pid: process id of process,
+ * @signal: signal to send.
+ *
+ * Behaves as system_kill(), but first checks by way of @pidfd that @pid
+ * is still the process we opened it for.  Once it has been reaped its
+ * process id may be reused by an unrelated process, whose process group
+ * would otherwise receive @signal.
+ *
+ * The error raised is ESRCH once the process has exited.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+system_kill_pidfd (int   pidfd,
+		   pid_t pid,
+		   int   signal)
+{
+	pid_t pgid;
+	int   ret;
+
+	nih_assert (pidfd >= 0);
+	nih_assert (pid > 0);
+
+	/* While the process has not been reaped, its process id and so its
+	 * process group are still its own.
+	 */
+#ifdef __NR_pidfd_send_signal
+	ret = syscall (__NR_pidfd_send_signal, pidfd, 0, NULL, 0);
+#else
+	errno = ENOSYS;
+	ret = -1;
+#endif /* __NR_pidfd_send_signal */
+	if (ret < 0) {
+		if (errno == ENOSYS)
+			return system_kill (pid, signal);
+
+		nih_return_system_error (-1);
+	}
+
+	pgid = getpgid (pid);
+	if (pgid > 0) {
+		ret = kill (-pgid, signal);
+	} else {
+#ifdef __NR_pidfd_send_signal
+		ret = syscall (__NR_pidfd_send_signal, pidfd, signal, NULL, 0);
+#endif /* __NR_pidfd_send_signal */
+	}
+
+	if (ret < 0)
+		nih_return_system_error (-1);
+
+	return 0;
+}
+
+/**
+ * system_descendant:
+ * @pid: process id of process,
+ * @ancestor: process id of possible ancestor.
+ *
+ * Determine whether @pid is a child of @ancestor, or of one of its
+ * descendants, by following the parent of each process upwards from @pid
+ * as given in /proc.  A process whose parent has exited has been
+ * reparented, so is no longer considered a descendant.
+ *
+ * Returns: TRUE if @pid is a descendant of @ancestor, else FALSE.
+ **/
+int
+system_descendant (pid_t pid,
+		   pid_t ancestor)
+{
+	nih_assert (pid > 0);
+	nih_assert (ancestor > 0);
+
+	while (pid > 1) {
+		char    path[32];
+		char    buf[512];
+		char   *ptr;
+		FILE   *stream;
+		size_t  len;
+		int     parent;
+
+		snprintf (path, sizeof (path), "/proc/%d/stat", (int)pid);
+
+		stream = fopen (path, "r");
+		if (! stream)
+			return FALSE;
+
+		len = fread (buf, 1, sizeof (buf) - 1, stream);
+		fclose (stream);
+
+		buf[len] = '\0';
+
+		/* The command name may itself contain parentheses */
+		ptr = strrchr (buf, ')');
+		if ((! ptr) || (sscanf (ptr + 1, " %*c %d", &parent) != 1))
+			return FALSE;
+
+		if ((pid_t)parent == ancestor)
+			return TRUE;
+
+		pid = (pid_t)parent;
+	}
+
+	return FALSE;
+}
+
 
 /**
  * system_setup_console:
@@ -31,6 +31,12 @@ NIH_BEGIN_EXTERN
 
 int system_kill          (pid_t pid, int signal)
 	__attribute__ ((warn_unused_result));
+int system_pidfd_open    (pid_t pid)
+	__attribute__ ((warn_unused_result));
+int system_kill_pidfd    (int pidfd, pid_t pid, int signal)
+	__attribute__ ((warn_unused_result));
+int system_descendant    (pid_t pid, pid_t ancestor)
+	__attribute__ ((warn_unused_result));
 
 int system_setup_console (ConsoleType type, int reset)
 	__attribute__ ((warn_unused_result));
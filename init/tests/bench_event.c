@@ -0,0 +1,197 @@
+/* upstart
+ *
+ * bench_event.c - allocation benchmark for event handling
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/hash.h>
+#include <nih/main.h>
+
+#include "job_class.h"
+#include "job.h"
+#include "event.h"
+#include "event_operator.h"
+#include "blocked.h"
+#include "intern.h"
+
+
+/**
+ * bench_allocs, bench_frees:
+ *
+ * Number of calls made to the nih_alloc() backend while the benchmark
+ * is running.
+ **/
+static size_t bench_allocs = 0;
+static size_t bench_frees = 0;
+
+static void *(*bench_malloc) (size_t size) = NULL;
+static void  (*bench_free)   (void *ptr) = NULL;
+
+
+static void *
+bench_count_malloc (size_t size)
+{
+	bench_allocs++;
+	return bench_malloc (size);
+}
+
+static void
+bench_count_free (void *ptr)
+{
+	if (ptr)
+		bench_frees++;
+	bench_free (ptr);
+}
+
+
+/**
+ * bench_class_new:
+ * @i: index of class.
+ *
+ * Registers a job class without processes that is started by the
+ * benchmark event with ID=start and stopped by that with ID=stop, so
+ * every emitted event is compared against every class and starts or
+ * stops an instance of each, with the starting and stopping events
+ * blocking the instances and the benchmark event blocked by them.
+ **/
+static void
+bench_class_new (int i)
+{
+	nih_local char  *name = NULL;
+	JobClass        *class;
+	char           **env;
+
+	name = NIH_MUST (nih_sprintf (NULL, "bench-%d", i));
+	class = NIH_MUST (job_class_new (NULL, name, NULL));
+
+	env = NIH_MUST (nih_str_array_new (NULL));
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "ID=start"));
+	class->start_on = NIH_MUST (event_operator_new (class, EVENT_MATCH,
+							"bench", env));
+
+	env = NIH_MUST (nih_str_array_new (NULL));
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "ID=stop"));
+	class->stop_on = NIH_MUST (event_operator_new (class, EVENT_MATCH,
+						       "bench", env));
+
+	nih_hash_add (job_classes, &class->entry);
+}
+
+/**
+ * bench_run:
+ * @num_classes: number of classes,
+ * @num_events: number of events to emit,
+ * @pools: whether structures are kept for reuse.
+ *
+ * Emits @num_events benchmark events, alternately starting and stopping
+ * every class, and reports the allocations and time taken for each with
+ * the pools of Blocked structures and collapse stack entries enabled
+ * or disabled as given by @pools.
+ **/
+static void
+bench_run (int num_classes,
+	   int num_events,
+	   int pools)
+{
+	struct timespec start, end;
+	double          elapsed;
+	int             i;
+
+	blocked_pool_max = pools ? BLOCKED_POOL_MAX : 0;
+	event_operator_scratch_max = pools ? EVENT_OPERATOR_SCRATCH_MAX : 0;
+
+	bench_allocs = 0;
+	bench_frees = 0;
+
+	bench_malloc = __nih_malloc;
+	bench_free = __nih_free;
+	__nih_malloc = bench_count_malloc;
+	__nih_free = bench_count_free;
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < num_events; i++) {
+		char **env;
+
+		env = NIH_MUST (nih_str_array_new (NULL));
+		NIH_MUST (nih_str_array_add (&env, NULL, NULL,
+					     i % 2 ? "ID=stop" : "ID=start"));
+		NIH_MUST (event_new (NULL, "bench", env));
+
+		event_poll ();
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &end);
+
+	__nih_malloc = bench_malloc;
+	__nih_free = bench_free;
+
+	elapsed = (end.tv_sec - start.tv_sec) * 1e6
+		+ (end.tv_nsec - start.tv_nsec) / 1e3;
+
+	printf ("%d classes, %d events, pools %s\n", num_classes, num_events,
+		pools ? "on" : "off");
+	printf ("allocations per event: %.2f\n",
+		(double)bench_allocs / num_events);
+	printf ("frees per event:       %.2f\n",
+		(double)bench_frees / num_events);
+	printf ("outstanding:           %zd\n",
+		(ssize_t)(bench_allocs - bench_frees));
+	printf ("blocked pool:          %u in use (peak %u), %u free, "
+		"%u reused\n", blocked_in_use, blocked_peak, blocked_pooled,
+		blocked_reused);
+	printf ("interned strings:      %zu\n", intern_count ());
+	printf ("time per event:        %.1f us\n", elapsed / num_events);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	int num_classes = 1000;
+	int num_events = 1000;
+	int i;
+
+	if (argc > 1)
+		num_classes = atoi (argv[1]);
+	if (argc > 2)
+		num_events = atoi (argv[2]);
+
+	/* Every instance started is stopped again by the next event */
+	num_events += num_events % 2;
+
+	nih_main_loop_init ();
+	job_class_init ();
+	event_init ();
+
+	for (i = 0; i < num_classes; i++)
+		bench_class_new (i);
+
+	bench_run (num_classes, num_events, FALSE);
+	printf ("\n");
+	bench_run (num_classes, num_events, TRUE);
+
+	return 0;
+}
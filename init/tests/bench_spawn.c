@@ -0,0 +1,153 @@
+/* upstart
+ *
+ * bench_spawn.c - latency benchmark for spawning job processes
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/main.h>
+
+#include "job_class.h"
+#include "job_process.h"
+#include "job.h"
+
+
+extern int disable_clone_spawn;
+
+
+/**
+ * bench_elapsed:
+ * @start: start time,
+ * @end: end time.
+ *
+ * Returns: microseconds between @start and @end.
+ **/
+static double
+bench_elapsed (const struct timespec *start,
+	       const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e6
+		+ (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/**
+ * bench_spawn:
+ * @job: job to spawn process for,
+ * @iterations: number of processes to spawn,
+ * @name: name of spawn engine.
+ *
+ * Spawns @iterations processes of /bin/true for @job one after another,
+ * reporting the mean time until the spawn returned to us and until the
+ * process had exited and been reaped.
+ **/
+static void
+bench_spawn (Job        *job,
+	     int         iterations,
+	     const char *name)
+{
+	char * const    args[] = { "/bin/true", NULL };
+	struct timespec start, spawned, reaped;
+	double          spawn_time = 0.0;
+	double          total_time = 0.0;
+	int             i;
+
+	for (i = 0; i < iterations; i++) {
+		pid_t pid;
+		int   job_process_fd = -1;
+
+		clock_gettime (CLOCK_MONOTONIC, &start);
+
+		pid = job_process_spawn_with_fd (job, args, NULL, FALSE, -1,
+						 PROCESS_MAIN, &job_process_fd);
+		if (pid < 0) {
+			fprintf (stderr, "spawn failed\n");
+			exit (1);
+		}
+
+		clock_gettime (CLOCK_MONOTONIC, &spawned);
+
+		waitpid (pid, NULL, 0);
+
+		clock_gettime (CLOCK_MONOTONIC, &reaped);
+
+		close (job_process_fd);
+
+		spawn_time += bench_elapsed (&start, &spawned);
+		total_time += bench_elapsed (&start, &reaped);
+	}
+
+	printf ("%-6s spawn: %8.1f us  spawn to exit: %8.1f us\n", name,
+		spawn_time / iterations, total_time / iterations);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	JobClass *class;
+	Job      *job;
+	size_t    heap_mb = 256;
+	int       iterations = 200;
+	char     *heap;
+
+	if (argc > 1)
+		heap_mb = strtoul (argv[1], NULL, 10);
+	if (argc > 2)
+		iterations = atoi (argv[2]);
+
+	nih_main_loop_init ();
+	job_class_init ();
+
+	/* Make ourselves look like an init with a large heap; the pages
+	 * must be touched so that fork() has to copy their page tables.
+	 */
+	heap = malloc (heap_mb << 20);
+	if (heap_mb && (! heap)) {
+		fprintf (stderr, "cannot allocate %zu MiB\n", heap_mb);
+		exit (1);
+	}
+	memset (heap, 1, heap_mb << 20);
+
+	class = NIH_MUST (job_class_new (NULL, "bench", NULL));
+	class->console = CONSOLE_NONE;
+
+	job = NIH_MUST (job_new (class, ""));
+
+	printf ("%zu MiB heap, %d spawns\n", heap_mb, iterations);
+
+	disable_clone_spawn = TRUE;
+	bench_spawn (job, iterations, "fork");
+
+	disable_clone_spawn = FALSE;
+	bench_spawn (job, iterations, "clone");
+
+	nih_free (class);
+	free (heap);
+
+	return 0;
+}
@@ -359,6 +359,122 @@ test_new (void)
 	}
 }
 
+void
+test_release (void)
+{
+	Blocked        *blocked;
+	Blocked        *reused;
+	JobClass       *class;
+	Job            *job;
+	Event          *event;
+	NihDBusMessage *message;
+	unsigned int    in_use;
+	unsigned int    reuse;
+
+	TEST_FUNCTION ("blocked_release");
+	class = job_class_new (NULL, "test", NULL);
+	job = job_new (class, "");
+	event = event_new (NULL, "test", NULL);
+
+
+	/* Check that a released structure is removed from its list and
+	 * kept for reuse rather than freed, no longer counted as in use,
+	 * and is returned by the next call to blocked_new() with its new
+	 * parent in place of the old.
+	 */
+	TEST_FEATURE ("with structure kept");
+	in_use = blocked_in_use;
+	reuse = blocked_reused;
+
+	blocked = blocked_new (job, BLOCKED_EVENT, event);
+	nih_list_add (&job->blocking, &blocked->entry);
+
+	TEST_EQ (blocked_in_use, in_use + 1);
+	TEST_GE (blocked_peak, blocked_in_use);
+
+	TEST_FREE_TAG (blocked);
+
+	blocked_release (blocked, job);
+
+	TEST_NOT_FREE (blocked);
+	TEST_LIST_EMPTY (&job->blocking);
+	TEST_FALSE (nih_alloc_parent (blocked, job));
+	TEST_EQ (blocked_pooled, 1);
+	TEST_EQ (blocked_in_use, in_use);
+
+	reused = blocked_new (event, BLOCKED_JOB, job);
+
+	TEST_EQ_P (reused, blocked);
+	TEST_ALLOC_PARENT (reused, event);
+	TEST_LIST_EMPTY (&reused->entry);
+	TEST_EQ (reused->type, BLOCKED_JOB);
+	TEST_EQ_P (reused->job, job);
+	TEST_EQ (blocked_pooled, 0);
+	TEST_EQ (blocked_reused, reuse + 1);
+	TEST_EQ (blocked_in_use, in_use + 1);
+
+	nih_free (reused);
+	TEST_FREE (blocked);
+	TEST_EQ (blocked_in_use, in_use);
+
+
+	/* Check that the reference to a D-Bus message is dropped when the
+	 * structure is kept, freeing the message if nothing else holds it.
+	 */
+	TEST_FEATURE ("with D-Bus method");
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = NULL;
+	message->message = NULL;
+
+	blocked = blocked_new (job, BLOCKED_INSTANCE_START_METHOD, message);
+	nih_discard (message);
+
+	TEST_FREE_TAG (message);
+
+	blocked_release (blocked, job);
+
+	TEST_FREE (message);
+	TEST_EQ (blocked_pooled, 1);
+
+	reused = blocked_new (job, BLOCKED_EVENT, event);
+	TEST_EQ_P (reused, blocked);
+	nih_free (reused);
+
+
+	/* Check that a structure is freed rather than kept once the pool
+	 * is full.
+	 */
+	TEST_FEATURE ("with pool full");
+	blocked_pool_max = 0;
+
+	blocked = blocked_new (job, BLOCKED_EVENT, event);
+	TEST_FREE_TAG (blocked);
+
+	blocked_release (blocked, job);
+
+	TEST_FREE (blocked);
+	TEST_EQ (blocked_pooled, 0);
+	TEST_EQ (blocked_in_use, in_use);
+
+	blocked_pool_max = BLOCKED_POOL_MAX;
+
+
+	/* Check that a structure without a parent is always freed.
+	 */
+	TEST_FEATURE ("without parent");
+	blocked = blocked_new (NULL, BLOCKED_EVENT, event);
+	TEST_FREE_TAG (blocked);
+
+	blocked_release (blocked, NULL);
+
+	TEST_FREE (blocked);
+	TEST_EQ (blocked_pooled, 0);
+
+
+	nih_free (event);
+	nih_free (class);
+}
+
 
 int
 main (int   argc,
@@ -368,6 +484,7 @@ main (int   argc,
 	setenv ("UPSTART_NO_SESSIONS", "1", 1);
 
 	test_new ();
+	test_release ();
 
 	return 0;
 }
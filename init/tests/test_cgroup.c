@@ -19,8 +19,15 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <unistd.h>
+
 #include <nih/string.h>
 #include <nih/file.h>
+#include <nih/error.h>
 #include <nih/test.h>
 
 #include "cgroup.h"
@@ -28,6 +35,7 @@
 #include "test_util_common.h"
 
 extern NihHash *cgroup_paths;
+extern int      user_mode;
 
 void
 test_cgroup_new (void)
@@ -123,6 +131,7 @@ test_cgroup_name_new (void)
 		TEST_ALLOC_PARENT (cgname->name, cgname);
 
 		TEST_LIST_EMPTY (&cgname->settings);
+		TEST_LIST_EMPTY (&cgname->paths);
 	}
 
 	TEST_FEATURE ("parent, name");
@@ -146,6 +155,7 @@ test_cgroup_name_new (void)
 		TEST_ALLOC_PARENT (cgname->name, cgname);
 
 		TEST_LIST_EMPTY (&cgname->settings);
+		TEST_LIST_EMPTY (&cgname->paths);
 	}
 }
 
@@ -243,6 +253,799 @@ test_cgroup_setting_new (void)
 	}
 }
 
+void
+test_cgroup_fs (void)
+{
+	char            dirname[PATH_MAX];
+	char            selfname[PATH_MAX];
+	nih_local char *path = NULL;
+	nih_local char *contents = NULL;
+	NihList         settings;
+	CGroupSetting  *setting;
+	size_t          len;
+
+	TEST_GROUP ("cgroup filesystem handling");
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	cgroup_fs_root = dirname;
+	cgroup_backend = CGROUP_BACKEND_AUTO;
+
+	nih_list_init (&settings);
+
+	/*******************************************************************/
+	/* Check that no backend is available while the cgroup filesystem
+	 * is not mounted, and the cgroup manager has not been contacted.
+	 */
+	TEST_FEATURE ("with cgroup filesystem not mounted");
+	cgroup_fs_reset ();
+
+	TEST_FALSE (cgroup_fs_available ());
+	TEST_FALSE (cgroup_available ());
+
+	/*******************************************************************/
+	/* Check that a cgroup is created in a per-controller hierarchy,
+	 * that settings are written to the files of that controller, and
+	 * that a pid may be placed in it.
+	 */
+	TEST_FEATURE ("with per-controller hierarchy");
+	path = NIH_MUST (nih_sprintf (NULL, "%s/memory", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+	CREATE_FILE (path, "cgroup.procs", "\n");
+	nih_free (path);
+
+	cgroup_fs_reset ();
+
+	TEST_TRUE (cgroup_fs_available ());
+	TEST_TRUE (cgroup_available ());
+
+	TEST_TRUE (cgroup_create ("memory", "upstart/foo"));
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/memory/upstart/foo", dirname));
+	TEST_TRUE (file_exists (path));
+
+	CREATE_FILE (path, "memory.limit_in_bytes", "\n");
+	CREATE_FILE (path, "cgroup.procs", "\n");
+
+	setting = cgroup_setting_new (NULL, "limit_in_bytes", "1048576");
+	TEST_NE_P (setting, NULL);
+	nih_list_add (&settings, &setting->entry);
+
+	TEST_TRUE (cgroup_settings_apply ("memory", "upstart/foo", &settings));
+
+	contents = nih_file_read (NULL, NIH_MUST (nih_sprintf (NULL,
+					"%s/memory.limit_in_bytes", path)), &len);
+	TEST_NE_P (contents, NULL);
+	TEST_EQ (len, strlen ("1048576"));
+	TEST_EQ_STRN (contents, "1048576");
+	nih_free (contents);
+
+	TEST_TRUE (cgroup_enter ("memory", "upstart/foo", 1234));
+
+	contents = nih_file_read (NULL, NIH_MUST (nih_sprintf (NULL,
+					"%s/cgroup.procs", path)), &len);
+	TEST_NE_P (contents, NULL);
+	TEST_EQ (len, strlen ("1234"));
+	TEST_EQ_STRN (contents, "1234");
+	nih_free (contents);
+
+	/*******************************************************************/
+	/* Check that a controller that is not mounted is an error. */
+	TEST_FEATURE ("with controller not mounted");
+	TEST_FALSE (cgroup_create ("cpu", "upstart/foo"));
+
+	nih_free (nih_error_get ());
+
+	/*******************************************************************/
+	/* Check that a setting the kernel does not provide is an error,
+	 * rather than a file being created for it.
+	 */
+	TEST_FEATURE ("with unknown setting");
+	setting->key = NIH_MUST (nih_strdup (setting, "bogus"));
+
+	TEST_FALSE (cgroup_settings_apply ("memory", "upstart/foo", &settings));
+
+	nih_free (nih_error_get ());
+
+	DELETE_FILE (path, "cgroup.procs");
+	DELETE_FILE (path, "memory.limit_in_bytes");
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/memory/upstart", dirname));
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/memory", dirname));
+	DELETE_FILE (path, "cgroup.procs");
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	/*******************************************************************/
+	/* Check that the unified hierarchy is preferred, that a cgroup
+	 * is created at the top of it, and that the controller is enabled
+	 * for each parent cgroup.
+	 */
+	TEST_FEATURE ("with unified hierarchy");
+	CREATE_FILE (dirname, "cgroup.controllers", "cpu io memory pids");
+	CREATE_FILE (dirname, "cgroup.subtree_control", "\n");
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/upstart", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+	CREATE_FILE (path, "cgroup.subtree_control", "\n");
+	nih_free (path);
+
+	cgroup_fs_reset ();
+
+	TEST_TRUE (cgroup_fs_available ());
+
+	TEST_TRUE (cgroup_create ("memory", "upstart/foo"));
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/upstart/foo", dirname));
+	TEST_TRUE (file_exists (path));
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	contents = nih_file_read (NULL, NIH_MUST (nih_sprintf (NULL,
+					"%s/cgroup.subtree_control", dirname)), &len);
+	TEST_NE_P (contents, NULL);
+	TEST_EQ (len, strlen ("+memory"));
+	TEST_EQ_STRN (contents, "+memory");
+	nih_free (contents);
+
+	contents = nih_file_read (NULL, NIH_MUST (nih_sprintf (NULL,
+					"%s/upstart/cgroup.subtree_control", dirname)), &len);
+	TEST_NE_P (contents, NULL);
+	TEST_EQ (len, strlen ("+memory"));
+	TEST_EQ_STRN (contents, "+memory");
+	nih_free (contents);
+	contents = NULL;
+
+	/*******************************************************************/
+	/* Check that a path with an empty, "." or ".." component is
+	 * refused, and nothing is created for it.
+	 */
+	TEST_FEATURE ("with invalid path");
+	TEST_FALSE (cgroup_create ("memory", "upstart/../../escaped"));
+	nih_free (nih_error_get ());
+
+	TEST_FALSE (cgroup_create ("memory", "upstart/./foo"));
+	nih_free (nih_error_get ());
+
+	TEST_FALSE (cgroup_create ("memory", "upstart//foo"));
+	nih_free (nih_error_get ());
+
+	TEST_FALSE (cgroup_create ("memory", "upstart/foo/"));
+	nih_free (nih_error_get ());
+
+	TEST_FALSE (cgroup_enter ("memory", "upstart/..", 1234));
+	nih_free (nih_error_get ());
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/../escaped", dirname));
+	TEST_FALSE (file_exists (path));
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/upstart/foo", dirname));
+	TEST_FALSE (file_exists (path));
+	nih_free (path);
+
+	/*******************************************************************/
+	/* Check that a Session Init moves itself into a leaf of the
+	 * session's cgroup, so that controllers may be enabled for the
+	 * session's cgroup, and that cgroups are then created below the
+	 * session's cgroup rather than the leaf.
+	 */
+	TEST_FEATURE ("with session init");
+	user_mode = TRUE;
+
+	snprintf (selfname, sizeof (selfname), "%s/self", dirname);
+	cgroup_fs_self = selfname;
+	CREATE_FILE (dirname, "self", "0::/user/session\n");
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/user", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/user/session", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+	CREATE_FILE (path, "cgroup.subtree_control", "\n");
+
+	contents = NIH_MUST (nih_sprintf (NULL, "%s/%s", path,
+					  CGROUP_FS_SCOPE));
+	TEST_EQ (mkdir (contents, 0755), 0);
+	CREATE_FILE (contents, "cgroup.procs", "\n");
+	nih_free (contents);
+
+	contents = NIH_MUST (nih_sprintf (NULL, "%s/upstart", path));
+	TEST_EQ (mkdir (contents, 0755), 0);
+	CREATE_FILE (contents, "cgroup.subtree_control", "\n");
+	nih_free (contents);
+	nih_free (path);
+
+	cgroup_fs_reset ();
+
+	TEST_TRUE (cgroup_scope ());
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/user/session/%s/cgroup.procs",
+				      dirname, CGROUP_FS_SCOPE));
+	contents = nih_file_read (NULL, path, &len);
+	TEST_NE_P (contents, NULL);
+	TEST_EQ (strtol (contents, NULL, 10), getpid ());
+	nih_free (contents);
+	nih_free (path);
+
+	/* Once in the leaf, /proc/self/cgroup names it, as it will after
+	 * a re-exec; the session's cgroup must still be used.
+	 */
+	CREATE_FILE (dirname, "self", "0::/user/session/" CGROUP_FS_SCOPE "\n");
+	cgroup_fs_reset ();
+
+	TEST_TRUE (cgroup_create ("memory", "upstart/foo"));
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/user/session/upstart/foo",
+				      dirname));
+	TEST_TRUE (file_exists (path));
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL,
+				      "%s/user/session/cgroup.subtree_control",
+				      dirname));
+	contents = nih_file_read (NULL, path, &len);
+	TEST_NE_P (contents, NULL);
+	TEST_EQ (len, strlen ("+memory"));
+	TEST_EQ_STRN (contents, "+memory");
+	nih_free (contents);
+	contents = NULL;
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/user/session", dirname));
+	DELETE_FILE (path, CGROUP_FS_SCOPE "/cgroup.procs");
+	DELETE_FILE (path, "upstart/cgroup.subtree_control");
+	DELETE_FILE (path, "cgroup.subtree_control");
+
+	contents = NIH_MUST (nih_sprintf (NULL, "%s/%s", path,
+					  CGROUP_FS_SCOPE));
+	TEST_EQ (rmdir (contents), 0);
+	nih_free (contents);
+
+	contents = NIH_MUST (nih_sprintf (NULL, "%s/upstart", path));
+	TEST_EQ (rmdir (contents), 0);
+	nih_free (contents);
+	contents = NULL;
+
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/user", dirname));
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	DELETE_FILE (dirname, "self");
+
+	cgroup_fs_self = CGROUP_FS_SELF;
+	user_mode = FALSE;
+	cgroup_fs_reset ();
+
+	/*******************************************************************/
+	/* Check that the cgroup filesystem is not used when the cgroup
+	 * manager backend is selected.
+	 */
+	TEST_FEATURE ("with cgroup manager backend");
+	cgroup_backend = CGROUP_BACKEND_CGMANAGER;
+
+	TEST_FALSE (cgroup_fs_available ());
+	TEST_FALSE (cgroup_available ());
+
+	cgroup_backend = CGROUP_BACKEND_AUTO;
+
+	/*******************************************************************/
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/upstart", dirname));
+	DELETE_FILE (path, "cgroup.subtree_control");
+	TEST_EQ (rmdir (path), 0);
+
+	DELETE_FILE (dirname, "cgroup.subtree_control");
+	DELETE_FILE (dirname, "cgroup.controllers");
+	TEST_EQ (rmdir (dirname), 0);
+
+	nih_free (setting);
+
+	cgroup_fs_root = CGROUP_FS_ROOT;
+	cgroup_fs_reset ();
+}
+
+void
+test_cgroup_record (void)
+{
+	char              dirname[PATH_MAX];
+	nih_local char   *path = NULL;
+	NihList           cgroups;
+	CGroup           *cgroup;
+	CGroupName       *cgname;
+	CGroupName       *record;
+	CGroupName       *copy;
+	CGroupSetting    *setting;
+	json_object      *json;
+	char             *env[] = {
+		"UPSTART_JOB=foo",
+		"UPSTART_INSTANCE=",
+		NULL
+	};
+
+	TEST_FUNCTION ("cgroup_record");
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	cgroup_fs_root = dirname;
+	cgroup_fs_reset ();
+
+	/* The cgroup filesystem only holds the files the kernel provides,
+	 * so create those the tests expect to exist.
+	 */
+	path = NIH_MUST (nih_sprintf (NULL, "%s/memory", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+	CREATE_FILE (path, "cgroup.procs", "\n");
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/memory/foo", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+
+	nih_list_init (&cgroups);
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "memory", "foo",
+			       "limit_in_bytes", "1024"));
+
+	cgroup = (CGroup *)cgroups.next;
+	cgname = (CGroupName *)cgroup->names.next;
+
+	/*******************************************************************/
+	/* Check that the cgroups set up by a spawn are recorded with the
+	 * expanded path and the settings applied.
+	 */
+	TEST_FEATURE ("with cgroup set up");
+	CREATE_FILE (path, "memory.limit_in_bytes", "\n");
+
+	TEST_TRUE (cgroup_setup (&cgroups, env, geteuid (), getegid ()));
+
+	TEST_LIST_EMPTY (&cgname->paths);
+
+	TEST_TRUE (cgroup_record (&cgroups, env));
+
+	TEST_LIST_NOT_EMPTY (&cgname->paths);
+	record = (CGroupName *)cgname->paths.next;
+	TEST_ALLOC_PARENT (record, cgname);
+	TEST_EQ_STR (record->name, "foo");
+	TEST_EQ_P (record->entry.next, &cgname->paths);
+
+	TEST_LIST_NOT_EMPTY (&record->settings);
+	setting = (CGroupSetting *)record->settings.next;
+	TEST_EQ_STR (setting->key, "limit_in_bytes");
+	TEST_EQ_STR (setting->value, "1024");
+
+	/*******************************************************************/
+	/* Check that recording the same cgroups again keeps the existing
+	 * record.
+	 */
+	TEST_FEATURE ("with cgroup already recorded");
+	TEST_TRUE (cgroup_record (&cgroups, env));
+
+	TEST_EQ_P (cgname->paths.next, &record->entry);
+	TEST_EQ_P (record->entry.next, &cgname->paths);
+
+	/*******************************************************************/
+	/* Check that a recorded cgroup is neither created nor configured
+	 * again, which would fail without the setting file.
+	 */
+	TEST_FEATURE ("with recorded cgroup");
+	DELETE_FILE (path, "memory.limit_in_bytes");
+
+	TEST_TRUE (cgroup_setup (&cgroups, env, geteuid (), getegid ()));
+
+	/*******************************************************************/
+	/* Check that a changed setting is applied again. */
+	TEST_FEATURE ("with changed setting");
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "memory", "foo",
+			       "limit_in_bytes", "2048"));
+
+	TEST_FALSE (cgroup_setup (&cgroups, env, geteuid (), getegid ()));
+	nih_free (nih_error_get ());
+
+	CREATE_FILE (path, "memory.limit_in_bytes", "\n");
+	TEST_TRUE (cgroup_setup (&cgroups, env, geteuid (), getegid ()));
+
+	TEST_TRUE (cgroup_record (&cgroups, env));
+
+	record = (CGroupName *)cgname->paths.next;
+	TEST_EQ_P (record->entry.next, &cgname->paths);
+	setting = (CGroupSetting *)record->settings.next;
+	TEST_EQ_STR (setting->value, "2048");
+
+	/*******************************************************************/
+	/* Check that records are serialised with the cgroup name. */
+	TEST_FEATURE ("with serialisation");
+	json = cgroup_name_serialise (cgname);
+	TEST_NE_P (json, NULL);
+
+	copy = cgroup_name_deserialise (NULL, json);
+	TEST_NE_P (copy, NULL);
+	json_object_put (json);
+
+	TEST_LIST_NOT_EMPTY (&copy->paths);
+	record = (CGroupName *)copy->paths.next;
+	TEST_ALLOC_PARENT (record, copy);
+	TEST_EQ_STR (record->name, "foo");
+	TEST_EQ_P (record->entry.next, &copy->paths);
+	setting = (CGroupSetting *)record->settings.next;
+	TEST_EQ_STR (setting->value, "2048");
+
+	nih_free (copy);
+
+	/*******************************************************************/
+	/* Check that forgetting the records discards them. */
+	TEST_FEATURE ("with records forgotten");
+	cgroup_forget (&cgroups);
+
+	TEST_LIST_EMPTY (&cgname->paths);
+
+	/*******************************************************************/
+
+	nih_free (cgroup);
+
+	DELETE_FILE (path, "memory.limit_in_bytes");
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/memory", dirname));
+	DELETE_FILE (path, "cgroup.procs");
+	TEST_EQ (rmdir (path), 0);
+
+	TEST_EQ (rmdir (dirname), 0);
+
+	cgroup_fs_root = CGROUP_FS_ROOT;
+	cgroup_fs_reset ();
+}
+
+void
+test_cgroup_usage_read (void)
+{
+	char              dirname[PATH_MAX];
+	nih_local char   *path = NULL;
+	NihList           cgroups;
+	uint64_t          cpu;
+	uint64_t          memory;
+	uint64_t          io_read;
+	uint64_t          io_write;
+	char             *env[] = {
+		"UPSTART_JOB=foo",
+		"UPSTART_INSTANCE=",
+		NULL
+	};
+
+	TEST_FUNCTION ("cgroup_usage_read");
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	cgroup_fs_root = dirname;
+	cgroup_fs_reset ();
+
+	nih_list_init (&cgroups);
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "cpu", "foo", NULL, NULL));
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "memory", "foo", NULL, NULL));
+
+	/*******************************************************************/
+	/* Check that usage cannot be read without the cgroup filesystem. */
+	TEST_FEATURE ("with cgroup filesystem not mounted");
+	TEST_FALSE (cgroup_usage_read (&cgroups, env, &cpu, &memory,
+				       &io_read, &io_write));
+	nih_free (nih_error_get ());
+
+	/*******************************************************************/
+	/* Check that the counters of a cgroup in the unified hierarchy
+	 * are read, summing those of each device, and that a directory
+	 * shared by two controllers is only counted once.
+	 */
+	TEST_FEATURE ("with unified hierarchy");
+	CREATE_FILE (dirname, "cgroup.controllers", "cpu io memory");
+	cgroup_fs_reset ();
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/foo", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+	CREATE_FILE (path, "cpu.stat", "usage_usec 1500\nuser_usec 1000");
+	CREATE_FILE (path, "memory.current", "4096");
+	CREATE_FILE (path, "io.stat",
+		     "8:0 rbytes=100 wbytes=200 rios=1 wios=2\n"
+		     "8:16 rbytes=10 wbytes=20 rios=1 wios=1");
+
+	TEST_TRUE (cgroup_usage_read (&cgroups, env, &cpu, &memory,
+				      &io_read, &io_write));
+
+	TEST_EQ (cpu, 1500);
+	TEST_EQ (memory, 4096);
+	TEST_EQ (io_read, 110);
+	TEST_EQ (io_write, 220);
+
+	/*******************************************************************/
+	/* Check that the counters of a cgroup that does not exist are
+	 * zero.
+	 */
+	TEST_FEATURE ("with missing cgroup");
+	DELETE_FILE (path, "cpu.stat");
+	DELETE_FILE (path, "memory.current");
+	DELETE_FILE (path, "io.stat");
+	TEST_EQ (rmdir (path), 0);
+
+	TEST_TRUE (cgroup_usage_read (&cgroups, env, &cpu, &memory,
+				      &io_read, &io_write));
+
+	TEST_EQ (cpu, 0);
+	TEST_EQ (memory, 0);
+	TEST_EQ (io_read, 0);
+	TEST_EQ (io_write, 0);
+
+	DELETE_FILE (dirname, "cgroup.controllers");
+	nih_free (path);
+
+	/*******************************************************************/
+	/* Check that the counters of per-controller hierarchies are read,
+	 * with CPU time converted from nanoseconds.
+	 */
+	TEST_FEATURE ("with per-controller hierarchies");
+	path = NIH_MUST (nih_sprintf (NULL, "%s/cpu", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+	CREATE_FILE (path, "cgroup.procs", "\n");
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/cpu/foo", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+	CREATE_FILE (path, "cpuacct.usage", "2500000");
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/memory", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/memory/foo", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+	CREATE_FILE (path, "memory.usage_in_bytes", "8192");
+	CREATE_FILE (path, "blkio.throttle.io_service_bytes",
+		     "8:0 Read 300\n8:0 Write 400\n8:0 Total 700\nTotal 700");
+
+	cgroup_fs_reset ();
+
+	TEST_TRUE (cgroup_usage_read (&cgroups, env, &cpu, &memory,
+				      &io_read, &io_write));
+
+	TEST_EQ (cpu, 2500);
+	TEST_EQ (memory, 8192);
+	TEST_EQ (io_read, 300);
+	TEST_EQ (io_write, 400);
+
+	/*******************************************************************/
+
+	NIH_LIST_FOREACH_SAFE (&cgroups, iter) {
+		nih_free (iter);
+	}
+
+	DELETE_FILE (path, "memory.usage_in_bytes");
+	DELETE_FILE (path, "blkio.throttle.io_service_bytes");
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/memory", dirname));
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/cpu/foo", dirname));
+	DELETE_FILE (path, "cpuacct.usage");
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/cpu", dirname));
+	DELETE_FILE (path, "cgroup.procs");
+	TEST_EQ (rmdir (path), 0);
+
+	TEST_EQ (rmdir (dirname), 0);
+
+	cgroup_fs_root = CGROUP_FS_ROOT;
+	cgroup_fs_reset ();
+}
+
+void
+test_cgroup_kill (void)
+{
+	char              dirname[PATH_MAX];
+	nih_local char   *path = NULL;
+	nih_local char   *procs = NULL;
+	NihList           cgroups;
+	pid_t             pid1;
+	pid_t             pid2;
+	int               status;
+	char             *env[] = {
+		"UPSTART_JOB=foo",
+		"UPSTART_INSTANCE=",
+		NULL
+	};
+
+	TEST_FUNCTION ("cgroup_kill");
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	CREATE_FILE (dirname, "cgroup.controllers", "cpu memory");
+
+	cgroup_fs_root = dirname;
+	cgroup_fs_reset ();
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/upstart", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/upstart/foo", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+
+	nih_list_init (&cgroups);
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "cpu", NULL, NULL, NULL));
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "memory", "shared",
+			       NULL, NULL));
+
+	/*******************************************************************/
+	/* Check that every process listed in the job-unique cgroup is
+	 * sent the signal, other than those of the process group given.
+	 */
+	TEST_FEATURE ("with processes in job cgroup");
+	TEST_CHILD (pid1) {
+		pause ();
+	}
+
+	TEST_CHILD (pid2) {
+		setpgid (0, 0);
+		pause ();
+	}
+
+	/* Make sure the second child is in its own process group */
+	while (getpgid (pid2) != pid2)
+		usleep (1000);
+
+	procs = NIH_MUST (nih_sprintf (NULL, "%d\n%d", pid1, pid2));
+	CREATE_FILE (path, "cgroup.procs", procs);
+
+	TEST_TRUE (cgroup_kill (&cgroups, env, SIGTERM, pid2));
+
+	TEST_EQ (waitpid (pid1, &status, 0), pid1);
+	TEST_TRUE (WIFSIGNALED (status));
+	TEST_EQ (WTERMSIG (status), SIGTERM);
+
+	TEST_EQ (waitpid (pid2, &status, WNOHANG), 0);
+
+	/*******************************************************************/
+	/* Check that SIGKILL is sent by listing the processes when the
+	 * kernel provides no cgroup.kill file.
+	 */
+	TEST_FEATURE ("without cgroup.kill");
+	nih_free (procs);
+	procs = NIH_MUST (nih_sprintf (NULL, "%d", pid2));
+	CREATE_FILE (path, "cgroup.procs", procs);
+
+	TEST_TRUE (cgroup_kill (&cgroups, env, SIGKILL, 0));
+
+	TEST_EQ (waitpid (pid2, &status, 0), pid2);
+	TEST_TRUE (WIFSIGNALED (status));
+	TEST_EQ (WTERMSIG (status), SIGKILL);
+
+	/*******************************************************************/
+	/* Check that processes in a cgroup that is not unique to the job
+	 * are left alone.
+	 */
+	TEST_FEATURE ("with processes in shared cgroup");
+	DELETE_FILE (path, "cgroup.procs");
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/shared", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+
+	TEST_CHILD (pid1) {
+		pause ();
+	}
+
+	nih_free (procs);
+	procs = NIH_MUST (nih_sprintf (NULL, "%d", pid1));
+	CREATE_FILE (path, "cgroup.procs", procs);
+
+	TEST_TRUE (cgroup_kill (&cgroups, env, SIGKILL, 0));
+
+	TEST_EQ (waitpid (pid1, &status, WNOHANG), 0);
+
+	kill (pid1, SIGKILL);
+	waitpid (pid1, NULL, 0);
+
+	/*******************************************************************/
+
+	NIH_LIST_FOREACH_SAFE (&cgroups, iter) {
+		nih_free (iter);
+	}
+
+	DELETE_FILE (path, "cgroup.procs");
+	TEST_EQ (rmdir (path), 0);
+	nih_free (path);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/upstart", dirname));
+	TEST_EQ (rmdir (path), 0);
+
+	DELETE_FILE (dirname, "cgroup.controllers");
+	TEST_EQ (rmdir (dirname), 0);
+
+	cgroup_fs_root = CGROUP_FS_ROOT;
+	cgroup_fs_reset ();
+}
+
+void
+test_cgroup_events (void)
+{
+	char              dirname[PATH_MAX];
+	nih_local char   *path = NULL;
+	int               fd;
+
+	TEST_FUNCTION ("cgroup_events_populated");
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	cgroup_fs_root = dirname;
+	cgroup_fs_reset ();
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/upstart", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+
+	CREATE_FILE (path, "cgroup.events", "populated 1\nfrozen 0");
+
+	/*******************************************************************/
+	/* Check that the events of the job cgroups cannot be watched
+	 * without the unified hierarchy.
+	 */
+	TEST_FEATURE ("without unified hierarchy");
+	TEST_LT (cgroup_events_open (), 0);
+	nih_free (nih_error_get ());
+
+	/*******************************************************************/
+	/* Check that the events file of the parent of the job cgroups is
+	 * opened, and that it is read as populated.
+	 */
+	TEST_FEATURE ("with processes remaining");
+	CREATE_FILE (dirname, "cgroup.controllers", "cpu");
+	cgroup_fs_reset ();
+
+	fd = cgroup_events_open ();
+	TEST_GE (fd, 0);
+
+	TEST_EQ (cgroup_events_populated (fd), TRUE);
+
+	/*******************************************************************/
+	/* Check that the same descriptor is read again from the start,
+	 * as after a notification, and found to be unpopulated.
+	 */
+	TEST_FEATURE ("with no processes remaining");
+	CREATE_FILE (path, "cgroup.events", "populated 0\nfrozen 0");
+
+	TEST_EQ (cgroup_events_populated (fd), FALSE);
+
+	close (fd);
+
+	/*******************************************************************/
+
+	DELETE_FILE (path, "cgroup.events");
+	TEST_EQ (rmdir (path), 0);
+
+	DELETE_FILE (dirname, "cgroup.controllers");
+	TEST_EQ (rmdir (dirname), 0);
+
+	cgroup_fs_root = CGROUP_FS_ROOT;
+	cgroup_fs_reset ();
+}
+
 void
 test_cgroup_job_start (void)
 {
@@ -258,6 +1061,7 @@ test_cgroup_job_start (void)
 	nih_local char  *logfile = NULL;
 	nih_local char  *logfile_name = NULL;
 	nih_local char  *contents = NULL;
+	char            *extra[2];
 
 	if (geteuid ()) {
 		printf ("INFO: skipping %s tests as not running as root\n", __func__);
@@ -299,7 +1103,11 @@ test_cgroup_job_start (void)
 				logdir,
 				"cgroup.log"));
 
-	start_upstart_common (&upstart_pid, FALSE, FALSE, confdir, logdir, NULL);
+	/* Don't use the cgroup filesystem, which is already mounted */
+	extra[0] = "--cgroup-backend=cgmanager";
+	extra[1] = NULL;
+
+	start_upstart_common (&upstart_pid, FALSE, FALSE, confdir, logdir, extra);
 
 	cmd = nih_sprintf (NULL, "%s status %s 2>&1", get_initctl (), "cgroup");
 	TEST_NE_P (cmd, NULL);
@@ -382,6 +1190,11 @@ main (int   argc,
 	test_cgroup_new ();
 	test_cgroup_name_new ();
 	test_cgroup_setting_new ();
+	test_cgroup_fs ();
+	test_cgroup_record ();
+	test_cgroup_usage_read ();
+	test_cgroup_kill ();
+	test_cgroup_events ();
 	test_cgroup_job_start ();
 
 	return 0;
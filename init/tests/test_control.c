@@ -23,6 +23,7 @@
 #include <nih-dbus/test_dbus.h>
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/wait.h>
@@ -60,11 +61,15 @@
 #include "conf.h"
 #include "control.h"
 #include "errors.h"
+#include "event.h"
+#include "session.h"
+#include "trace.h"
 
 #include "test_util_common.h"
 
 extern const char *control_server_address;
 extern int no_inherit_env;
+extern int chroot_sessions;
 
 void
 test_server_open (void)
@@ -1214,6 +1219,12 @@ test_emit_event (void)
 	Blocked *        blocked;
 	NihError        *error;
 	NihDBusError    *dbus_error;
+	NihListEntry    *entry;
+	DBusConnection  *server_conn;
+	Session         *session;
+	char             chroot_dir[PATH_MAX];
+	pid_t            pid;
+	int              wait_fd, status;
 
 	TEST_FUNCTION ("control_emit_event");
 	nih_error_init ();
@@ -1618,6 +1629,123 @@ test_emit_event (void)
 	dbus_message_unref (method);
 
 
+	/* Check that once a chroot session has session_event_limit events
+	 * pending, an event emitted from within that chroot is refused with
+	 * the EventQueueFull error and counted against the session, without
+	 * being added to the queue.  The caller must be on our own server
+	 * for its process to be known, and chroot needs root.
+	 */
+	TEST_FEATURE ("with session event limit reached");
+	if (geteuid ()) {
+		printf ("INFO: skipping %s tests as not running as root\n",
+			__func__);
+		fflush (NULL);
+		goto not_root;
+	}
+
+	TEST_FILENAME (chroot_dir);
+	assert0 (mkdir (chroot_dir, 0755));
+
+	control_init ();
+	control_server_address = "unix:abstract=/com/ubuntu/upstart/test";
+	assert0 (control_server_open ());
+
+	TEST_CHILD_WAIT (pid, wait_fd) {
+		DBusConnection *conn;
+
+		control_server_close ();
+
+		nih_signal_set_handler (SIGTERM, nih_signal_handler);
+		assert (nih_signal_add_handler (NULL, SIGTERM,
+						nih_main_term_signal, NULL));
+
+		conn = nih_dbus_connect ("unix:abstract=/com/ubuntu/upstart/test", NULL);
+		assert (conn != NULL);
+
+		assert0 (chroot (chroot_dir));
+
+		TEST_CHILD_RELEASE (wait_fd);
+
+		nih_main_loop ();
+
+		dbus_connection_unref (conn);
+
+		dbus_shutdown ();
+
+		exit (0);
+	}
+
+	assert (nih_timer_add_timeout (NULL, 1,
+				       (NihTimerCb)nih_main_term_signal, NULL));
+
+	nih_main_loop ();
+
+	assert (! NIH_LIST_EMPTY (control_conns));
+	entry = (NihListEntry *)control_conns->next;
+	server_conn = entry->data;
+
+	unsetenv ("UPSTART_NO_SESSIONS");
+	chroot_sessions = TRUE;
+	session_event_limit = 1;
+
+	session = session_new (NULL, chroot_dir);
+	event = event_new (NULL, "test", NULL);
+	event_set_session (event, session);
+
+	method = dbus_message_new_method_call (
+		NULL,
+		DBUS_PATH_UPSTART,
+		DBUS_INTERFACE_UPSTART,
+		"EmitEvent");
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = server_conn;
+	message->message = method;
+
+	env = nih_str_array_new (message);
+
+	ret = control_emit_event (NULL, message, "test", env, FALSE);
+
+	TEST_LT (ret, 0);
+
+	dbus_error = (NihDBusError *)nih_error_get ();
+	TEST_ALLOC_SIZE (dbus_error, sizeof (NihDBusError));
+	TEST_EQ (dbus_error->number, NIH_DBUS_ERROR);
+	TEST_EQ_STR (dbus_error->name,
+		     DBUS_INTERFACE_UPSTART ".Error.EventQueueFull");
+	nih_free (dbus_error);
+
+	TEST_EQ (session->events_pending, 1);
+	TEST_EQ (session->events_refused, 1);
+
+	TEST_EQ_P (events->next, &event->entry);
+	TEST_EQ_P (event->entry.next, events);
+
+	nih_free (message);
+	dbus_message_unref (method);
+
+	nih_free (event);
+	nih_free (session);
+
+	session_event_limit = 0;
+	chroot_sessions = FALSE;
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	kill (pid, SIGTERM);
+	waitpid (pid, &status, 0);
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+
+	dbus_connection_close (server_conn);
+	dbus_connection_unref (server_conn);
+
+	nih_free (entry);
+
+	control_server_close ();
+
+	assert0 (rmdir (chroot_dir));
+
+not_root:
 	TEST_DBUS_CLOSE (conn);
 	TEST_DBUS_CLOSE (client_conn);
 	TEST_DBUS_END (dbus_pid);
@@ -2177,6 +2305,87 @@ test_set_log_priority (void)
 	nih_log_priority = NIH_LOG_UNKNOWN;
 }
 
+void
+test_get_event_trace (void)
+{
+	NihDBusMessage  *message = NULL;
+	char           **records;
+	char           **histograms;
+	int              value;
+	int              ret;
+
+	TEST_FUNCTION ("control_get_event_trace");
+	nih_error_init ();
+	job_class_init ();
+	event_init ();
+
+	/* Check that setting the trace_events property enables tracing
+	 * and that the property reflects that.
+	 */
+	TEST_FEATURE ("with tracing enabled");
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = NULL;
+	message->message = NULL;
+
+	ret = control_set_trace_events (NULL, message, TRUE);
+
+	TEST_EQ (ret, 0);
+
+	ret = control_get_trace_events (NULL, message, &value);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (value, TRUE);
+
+
+	/* Check that an event emitted while tracing is returned as a
+	 * record and a histogram, both allocated as children of the
+	 * message.
+	 */
+	TEST_FEATURE ("with traced event");
+	TEST_NE_P (event_new (NULL, "wibble", NULL), NULL);
+	event_poll ();
+
+	ret = control_get_event_trace (NULL, message, &records, &histograms);
+
+	TEST_EQ (ret, 0);
+
+	TEST_ALLOC_PARENT (records, message);
+	TEST_NE_P (records[0], NULL);
+	TEST_TRUE (! strncmp (records[0], "wibble ", 7));
+	TEST_EQ_P (records[1], NULL);
+
+	TEST_ALLOC_PARENT (histograms, message);
+	TEST_NE_P (histograms[0], NULL);
+	TEST_TRUE (! strncmp (histograms[0], "wibble 1 ", 9));
+	TEST_EQ_P (histograms[1], NULL);
+
+	nih_free (message);
+
+
+	/* Check that events are not recorded once tracing is disabled,
+	 * but that existing records are kept.
+	 */
+	TEST_FEATURE ("with tracing disabled");
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = NULL;
+	message->message = NULL;
+
+	ret = control_set_trace_events (NULL, message, FALSE);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (trace_events, FALSE);
+
+	TEST_NE_P (event_new (NULL, "wibble", NULL), NULL);
+	event_poll ();
+
+	TEST_EQ (trace_events_count (), 1);
+
+	nih_free (message);
+
+	trace_events_clear ();
+}
+
+
 void
 test_list_env (void)
 {
@@ -2703,6 +2912,11 @@ main (int   argc,
 	/* run tests in legacy (pre-session support) mode */
 	setenv ("UPSTART_NO_SESSIONS", "1", 1);
 
+	/* Blocked structures are checked to be freed once handled, so
+	 * they must not be kept for reuse.
+	 */
+	blocked_pool_max = 0;
+
 	test_server_open ();
 	test_server_connect ();
 	test_server_close ();
@@ -2724,6 +2938,8 @@ main (int   argc,
 	test_get_log_priority ();
 	test_set_log_priority ();
 
+	test_get_event_trace ();
+
 	test_list_env ();
 	test_get_env ();
 	test_set_env ();
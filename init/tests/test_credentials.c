@@ -0,0 +1,144 @@
+/* upstart
+ *
+ * test_credentials.c - test suite for init/credentials.c
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <sys/types.h>
+
+#include <grp.h>
+#include <pwd.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+
+#include "credentials.h"
+
+
+void
+test_lookup (void)
+{
+	const Credentials *creds;
+	const Credentials *cached;
+	struct passwd     *pwd;
+
+	TEST_FUNCTION ("credentials_lookup");
+
+	/* Check that with neither user nor group, the credentials are
+	 * left unchanged, but the supplementary groups of our own user
+	 * are found when we're root.
+	 */
+	TEST_FEATURE ("with no user or group");
+	creds = credentials_lookup (NULL, NULL);
+
+	TEST_NE_P (creds, NULL);
+	TEST_EQ (creds->uid, (uid_t)-1);
+	TEST_EQ (creds->gid, (gid_t)-1);
+
+	if (geteuid () == 0) {
+		TEST_NE_P (creds->groups, NULL);
+	} else {
+		TEST_EQ_P (creds->groups, NULL);
+		TEST_EQ (creds->ngroups, 0);
+	}
+
+
+	/* Check that a user is looked up to its user and primary group. */
+	TEST_FEATURE ("with user");
+	pwd = getpwuid (getuid ());
+	TEST_NE_P (pwd, NULL);
+
+	creds = credentials_lookup (pwd->pw_name, NULL);
+
+	TEST_NE_P (creds, NULL);
+	TEST_EQ (creds->uid, getuid ());
+	TEST_EQ (creds->gid, pwd->pw_gid);
+
+
+	/* Check that the same credentials are returned from the cache when
+	 * looked up again.
+	 */
+	TEST_FEATURE ("with cached user");
+	pwd = getpwuid (getuid ());
+	TEST_NE_P (pwd, NULL);
+
+	cached = credentials_lookup (pwd->pw_name, NULL);
+
+	TEST_EQ_P (cached, creds);
+
+
+	/* Check that a group overrides the primary group of the user. */
+	TEST_FEATURE ("with user and group");
+	pwd = getpwuid (getuid ());
+	TEST_NE_P (pwd, NULL);
+
+	creds = credentials_lookup (pwd->pw_name,
+				    getgrgid (getgid ())->gr_name);
+
+	TEST_NE_P (creds, NULL);
+	TEST_NE_P (creds, cached);
+	TEST_EQ (creds->uid, getuid ());
+	TEST_EQ (creds->gid, getgid ());
+
+
+	/* Check that an unknown user fails the lookup. */
+	TEST_FEATURE ("with unknown user");
+	creds = credentials_lookup ("nosuchuser-upstart-test", NULL);
+
+	TEST_EQ_P (creds, NULL);
+
+
+	/* Check that an unknown group fails the lookup. */
+	TEST_FEATURE ("with unknown group");
+	creds = credentials_lookup (NULL, "nosuchgroup-upstart-test");
+
+	TEST_EQ_P (creds, NULL);
+}
+
+
+void
+test_flush (void)
+{
+	Credentials *creds;
+
+	TEST_FUNCTION ("credentials_flush");
+
+	/* Check that flushing the cache frees cached credentials. */
+	TEST_FEATURE ("with cached credentials");
+	creds = (Credentials *)credentials_lookup (NULL, NULL);
+	TEST_NE_P (creds, NULL);
+
+	TEST_FREE_TAG (creds);
+
+	credentials_flush ();
+
+	TEST_FREE (creds);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_lookup ();
+	test_flush ();
+
+	return 0;
+}
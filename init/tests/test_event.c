@@ -25,6 +25,8 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <string.h>
+
 #include <nih/macros.h>
 #include <nih/alloc.h>
 #include <nih/string.h>
@@ -37,8 +39,10 @@
 
 #include "control.h"
 #include "job.h"
+#include "job_process.h"
 #include "event.h"
 #include "blocked.h"
+#include "job_queue.h"
 
 
 void
@@ -314,8 +318,8 @@ void
 test_pending_handle_jobs (void)
 {
 	FILE           *output;
-	JobClass       *class = NULL;
-	Job            *job = NULL, *ptr;
+	JobClass       *class = NULL, *class2 = NULL;
+	Job            *job = NULL, *job2 = NULL, *ptr;
 	Event          *event1 = NULL, *event2 = NULL;
 	Event          *event3 = NULL, *event4 = NULL;
 	EventOperator  *oper;
@@ -1207,9 +1211,8 @@ test_pending_handle_jobs (void)
 
 		job = (Job *)nih_hash_lookup (class->instances, "");
 
-		oper = job->stop_on;
-		TEST_EQ (oper->value, FALSE);
-		TEST_EQ_P (oper->event, NULL);
+		TEST_EQ (event_expr_value (job->stop_on), FALSE);
+		TEST_EQ_P (job->stop_on->event[0], NULL);
 
 		oper = class->stop_on;
 		TEST_EQ (oper->value, FALSE);
@@ -1272,9 +1275,8 @@ test_pending_handle_jobs (void)
 		TEST_EQ_P (job->stop_env[1], NULL);
 
 
-		oper = job->stop_on;
-		TEST_EQ (oper->value, FALSE);
-		TEST_EQ_P (oper->event, NULL);
+		TEST_EQ (event_expr_value (job->stop_on), FALSE);
+		TEST_EQ_P (job->stop_on->event[0], NULL);
 
 
 		TEST_LIST_NOT_EMPTY (&job->blocking);
@@ -1352,9 +1354,8 @@ test_pending_handle_jobs (void)
 		TEST_EQ_P (job->stop_env[3], NULL);
 
 
-		oper = job->stop_on;
-		TEST_EQ (oper->value, FALSE);
-		TEST_EQ_P (oper->event, NULL);
+		TEST_EQ (event_expr_value (job->stop_on), FALSE);
+		TEST_EQ_P (job->stop_on->event[0], NULL);
 
 
 		TEST_LIST_NOT_EMPTY (&job->blocking);
@@ -1458,9 +1459,8 @@ test_pending_handle_jobs (void)
 		TEST_EQ_P (job->stop_env[3], NULL);
 
 
-		oper = job->stop_on;
-		TEST_EQ (oper->value, FALSE);
-		TEST_EQ_P (oper->event, NULL);
+		TEST_EQ (event_expr_value (job->stop_on), FALSE);
+		TEST_EQ_P (job->stop_on->event[0], NULL);
 
 
 		TEST_FREE (event3);
@@ -1553,9 +1553,8 @@ test_pending_handle_jobs (void)
 		TEST_NOT_FREE (env1);
 		TEST_EQ_P (job->stop_env, env1);
 
-		oper = job->stop_on;
-		TEST_EQ (oper->value, FALSE);
-		TEST_EQ_P (oper->event, NULL);
+		TEST_EQ (event_expr_value (job->stop_on), FALSE);
+		TEST_EQ_P (job->stop_on->event[0], NULL);
 
 		TEST_NOT_FREE (event3);
 		TEST_NOT_FREE (event4);
@@ -1638,9 +1637,8 @@ test_pending_handle_jobs (void)
 		TEST_EQ_P (job->stop_env[3], NULL);
 
 
-		oper = job->stop_on;
-		TEST_EQ (oper->value, FALSE);
-		TEST_EQ_P (oper->event, NULL);
+		TEST_EQ (event_expr_value (job->stop_on), FALSE);
+		TEST_EQ_P (job->stop_on->event[0], NULL);
 
 
 		TEST_LIST_NOT_EMPTY (&job->blocking);
@@ -1658,6 +1656,65 @@ test_pending_handle_jobs (void)
 		nih_free (event1);
 	}
 
+
+	/* Check that when an event starts jobs of several classes, those
+	 * of the higher priority class are started first; with only one
+	 * spawn slot, the higher priority job should be running its
+	 * pre-start process while the lower one is left queued.
+	 */
+	TEST_FEATURE ("with start of jobs of different priority");
+	max_concurrent_spawns = 1;
+
+	event1 = event_new (NULL, "wibble", NULL);
+
+	class = job_class_new (NULL, "low", NULL);
+	class->console = CONSOLE_NONE;
+	class->task = TRUE;
+
+	class->process[PROCESS_PRE_START] = process_new (class);
+	class->process[PROCESS_PRE_START]->command = "echo";
+
+	class->start_on = event_operator_new (
+		class, EVENT_MATCH, "wibble", NULL);
+
+	nih_hash_add (job_classes, &class->entry);
+
+	class2 = job_class_new (NULL, "high", NULL);
+	class2->console = CONSOLE_NONE;
+	class2->task = TRUE;
+	class2->priority = 10;
+
+	class2->process[PROCESS_PRE_START] = process_new (class2);
+	class2->process[PROCESS_PRE_START]->command = "echo";
+
+	class2->start_on = event_operator_new (
+		class2, EVENT_MATCH, "wibble", NULL);
+
+	nih_hash_add (job_classes, &class2->entry);
+
+	event_poll ();
+
+	job = (Job *)nih_hash_lookup (class->instances, "");
+	TEST_NE_P (job, NULL);
+
+	job2 = (Job *)nih_hash_lookup (class2->instances, "");
+	TEST_NE_P (job2, NULL);
+
+	TEST_EQ (job2->state, JOB_PRE_START);
+	TEST_TRUE (job2->spawn_slot);
+	TEST_GT (job2->pid[PROCESS_PRE_START], 0);
+	waitpid (job2->pid[PROCESS_PRE_START], NULL, 0);
+
+	TEST_EQ (job->state, JOB_QUEUED);
+	TEST_FALSE (job->spawn_slot);
+	TEST_NE_P (job->queued, NULL);
+
+	nih_free (class);
+	nih_free (class2);
+	nih_free (event1);
+
+	max_concurrent_spawns = 0;
+
 	fclose (output);
 }
 
@@ -1965,7 +2022,7 @@ test_finished (void)
 			job = job_new (class, "");
 			job->goal = JOB_STOP;
 			job->state = JOB_STOPPING;
-			job->pid[PROCESS_POST_STOP] = 0;
+			job_process_set_pid (job, PROCESS_POST_STOP, 0);
 
 			job->blocker = event;
 
@@ -2011,7 +2068,7 @@ test_finished (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_STARTING;
-			job->pid[PROCESS_PRE_START] = 0;
+			job_process_set_pid (job, PROCESS_PRE_START, 0);
 
 			job->blocker = event;
 
@@ -2040,6 +2097,441 @@ test_finished (void)
 }
 
 
+void
+test_lanes (void)
+{
+	Event *bulk;
+	Event *event;
+
+	TEST_FUNCTION ("event_poll");
+	event_init ();
+
+	memset (event_lane_handled, 0, sizeof (event_lane_handled));
+	memset (event_lane_peak, 0, sizeof (event_lane_peak));
+	memset (event_lane_depth, 0, sizeof (event_lane_depth));
+	event_lane_yielded = 0;
+
+
+	/* Check that a new event waits in the priority lane, and that it
+	 * can be moved to the bulk lane.
+	 */
+	TEST_FEATURE ("with event moved to bulk lane");
+	bulk = event_new (NULL, "bulk", NULL);
+
+	TEST_EQ (bulk->lane, EVENT_LANE_PRIORITY);
+	TEST_EQ (event_lane_depth[EVENT_LANE_PRIORITY], 1);
+
+	event_set_lane (bulk, EVENT_LANE_BULK);
+
+	TEST_EQ (bulk->lane, EVENT_LANE_BULK);
+	TEST_EQ (event_lane_depth[EVENT_LANE_PRIORITY], 0);
+	TEST_EQ (event_lane_depth[EVENT_LANE_BULK], 1);
+	TEST_EQ (event_lane_peak[EVENT_LANE_BULK], 1);
+
+
+	/* Check that freeing a pending event removes it from its lane. */
+	TEST_FEATURE ("with pending event freed");
+	event = event_new (NULL, "test", NULL);
+	TEST_EQ (event_lane_depth[EVENT_LANE_PRIORITY], 1);
+
+	nih_free (event);
+
+	TEST_EQ (event_lane_depth[EVENT_LANE_PRIORITY], 0);
+
+
+	/* Check that priority events are handled before a bulk event
+	 * queued ahead of them, so that it is never handled while they
+	 * wait.
+	 */
+	TEST_FEATURE ("with priority events queued behind bulk event");
+	for (int i = 0; i < 3; i++)
+		event_new (NULL, "test", NULL);
+
+	event_poll ();
+
+	TEST_LIST_EMPTY (events);
+	TEST_EQ (event_lane_handled[EVENT_LANE_PRIORITY], 3);
+	TEST_EQ (event_lane_handled[EVENT_LANE_BULK], 1);
+	TEST_EQ (event_lane_depth[EVENT_LANE_PRIORITY], 0);
+	TEST_EQ (event_lane_depth[EVENT_LANE_BULK], 0);
+	TEST_EQ (event_lane_peak[EVENT_LANE_PRIORITY], 3);
+	TEST_EQ (event_lane_yielded, 0);
+
+
+	/* Check that a bulk event is handled after a burst of priority
+	 * events, ahead of those still waiting.
+	 */
+	TEST_FEATURE ("with more priority events than burst");
+	bulk = event_new (NULL, "bulk", NULL);
+	event_set_lane (bulk, EVENT_LANE_BULK);
+
+	for (int i = 0; i < EVENT_PRIORITY_BURST + 1; i++)
+		event_new (NULL, "test", NULL);
+
+	event_poll ();
+
+	TEST_LIST_EMPTY (events);
+	TEST_EQ (event_lane_handled[EVENT_LANE_PRIORITY],
+		 3 + EVENT_PRIORITY_BURST + 1);
+	TEST_EQ (event_lane_handled[EVENT_LANE_BULK], 2);
+	TEST_EQ (event_lane_yielded, 1);
+
+
+	/* Check that the events with which the system as a whole is
+	 * changed are recognised as administrative, but others are not.
+	 */
+	TEST_FEATURE ("with administrative events");
+	TEST_TRUE (event_administrative ("runlevel"));
+	TEST_TRUE (event_administrative ("control-alt-delete"));
+	TEST_FALSE (event_administrative ("net-device-added"));
+}
+
+
+/**
+ * handled:
+ *
+ * Sessions of the events freed by handle_record(), in the order they
+ * were handled.
+ **/
+static Session *handled[64];
+static int      handled_count = 0;
+
+/**
+ * handle_record:
+ * @session: session of the event being freed.
+ *
+ * Destructor of a child of an event, which is freed as soon as the
+ * event is handled, recording the session of the event in @handled.
+ **/
+static int
+handle_record (Session **session)
+{
+	assert (handled_count < 64);
+	handled[handled_count++] = *session;
+
+	return 0;
+}
+
+/**
+ * handle_event_new:
+ * @session: session of event.
+ *
+ * Returns: new pending event of @session whose handling is recorded in
+ * @handled.
+ **/
+static Event *
+handle_event_new (Session *session)
+{
+	Event    *event;
+	Session **record;
+
+	event = event_new (NULL, "test", NULL);
+	event_set_session (event, session);
+
+	record = nih_new (event, Session *);
+	assert (record != NULL);
+	*record = session;
+	nih_alloc_set_destructor (record, handle_record);
+
+	return event;
+}
+
+void
+test_sessions (void)
+{
+	Session        *session1;
+	Session        *session2;
+	JobClass       *class1;
+	JobClass       *class2;
+	EventOperator  *oper;
+	Event          *event;
+	Job            *job;
+
+	TEST_FUNCTION ("event_poll");
+	event_init ();
+	job_class_init ();
+	session_init ();
+
+	session1 = session_new (NULL, "/chroot1");
+	session2 = session_new (NULL, "/chroot2");
+
+
+	/* Check that a job class of a session is added to the index of
+	 * the session, and removed from it when freed.
+	 */
+	TEST_FEATURE ("with class index");
+	class1 = job_class_new (NULL, "test", session1);
+	job_class_add_safe (class1);
+
+	TEST_LIST_NOT_EMPTY (session1->classes);
+	TEST_EQ_P (((NihListEntry *)session1->classes->next)->data, class1);
+	TEST_LIST_EMPTY (session2->classes);
+
+	nih_free (class1);
+
+	TEST_LIST_EMPTY (session1->classes);
+
+
+	/* Check that an event of a session is only matched against the
+	 * job classes of that session.
+	 */
+	TEST_FEATURE ("with event of session");
+	class1 = job_class_new (NULL, "test", session1);
+	class2 = job_class_new (NULL, "test", session2);
+
+	class1->start_on = event_operator_new (class1, EVENT_AND, NULL, NULL);
+	oper = event_operator_new (class1->start_on, EVENT_MATCH, "wibble", NULL);
+	nih_tree_add (&class1->start_on->node, &oper->node, NIH_TREE_LEFT);
+	oper = event_operator_new (class1->start_on, EVENT_MATCH, "wobble", NULL);
+	nih_tree_add (&class1->start_on->node, &oper->node, NIH_TREE_RIGHT);
+
+	class2->start_on = event_operator_copy (class2, class1->start_on);
+
+	job_class_add_safe (class1);
+	job_class_add_safe (class2);
+
+	event = event_new (NULL, "wibble", NULL);
+	event_set_session (event, session1);
+
+	TEST_EQ (session1->events_pending, 1);
+
+	event_poll ();
+
+	TEST_EQ (session1->events_pending, 0);
+	TEST_EQ (session1->events_handled, 1);
+
+	oper = (EventOperator *)class1->start_on->node.left;
+	TEST_EQ (oper->value, TRUE);
+
+	oper = (EventOperator *)class2->start_on->node.left;
+	TEST_EQ (oper->value, FALSE);
+
+	nih_free (class2);
+	nih_free (class1);
+
+	event_poll ();
+
+	TEST_LIST_EMPTY (events);
+
+
+	/* Check that an event emitted by a job of a session counts as
+	 * pending for the session alongside one emitted for it over
+	 * D-Bus, so that none remain pending once both are handled.
+	 */
+	TEST_FEATURE ("with job of session emitting event");
+	class1 = job_class_new (NULL, "test", session1);
+	job_class_add_safe (class1);
+
+	job = job_new (class1, "");
+	job->goal = JOB_START;
+	job->state = JOB_RUNNING;
+
+	event = event_new (NULL, "wibble", NULL);
+	event_set_session (event, session1);
+
+	event = job_emit_event (job);
+
+	TEST_EQ_P (event->session, session1);
+	TEST_EQ (session1->events_pending, 2);
+
+	event_poll ();
+
+	TEST_LIST_EMPTY (events);
+	TEST_EQ (session1->events_pending, 0);
+	TEST_EQ (session1->events_handled, 3);
+
+	nih_free (class1);
+
+
+	/* Check that the events of a session flooding the queue are all
+	 * handled, a turn at a time; an event of no session and those of
+	 * another session queued behind them are handled after the first
+	 * turn of the flooding session rather than after all its events.
+	 */
+	TEST_FEATURE ("with session flooding queue");
+	handled_count = 0;
+
+	for (int i = 0; i < EVENT_SESSION_QUANTUM * 3; i++)
+		handle_event_new (session2);
+
+	handle_event_new (NULL);
+	handle_event_new (session1);
+	handle_event_new (session1);
+
+	TEST_EQ (session2->events_pending, EVENT_SESSION_QUANTUM * 3);
+
+	event_poll ();
+
+	TEST_LIST_EMPTY (events);
+	TEST_EQ (session2->events_pending, 0);
+	TEST_EQ (session2->events_handled, EVENT_SESSION_QUANTUM * 3);
+
+	TEST_EQ (handled_count, EVENT_SESSION_QUANTUM * 3 + 3);
+
+	for (int i = 0; i < EVENT_SESSION_QUANTUM; i++)
+		TEST_EQ_P (handled[i], session2);
+
+	TEST_EQ_P (handled[EVENT_SESSION_QUANTUM], NULL);
+	TEST_EQ_P (handled[EVENT_SESSION_QUANTUM + 1], session1);
+	TEST_EQ_P (handled[EVENT_SESSION_QUANTUM + 2], session1);
+
+	for (int i = EVENT_SESSION_QUANTUM + 3; i < handled_count; i++)
+		TEST_EQ_P (handled[i], session2);
+
+
+	/* Check that freeing a session detaches its pending events. */
+	TEST_FEATURE ("with session freed");
+	event = event_new (NULL, "test", NULL);
+	event_set_session (event, session2);
+
+	nih_free (session2);
+
+	TEST_EQ_P (event->session, NULL);
+
+	nih_free (event);
+	nih_free (session1);
+}
+
+
+void
+test_overflow (void)
+{
+	Session  *session;
+	Event    *event1;
+	Event    *event2;
+	Event    *existing;
+	Blocked  *blocked;
+	char     *env[] = { NULL };
+	char     *env_foo[] = { "FOO=BAR", NULL };
+
+	TEST_FUNCTION ("event_overflow");
+	event_init ();
+	session_init ();
+
+	session = session_new (NULL, "/chroot");
+
+	max_pending_events = 2;
+
+
+	/* Check that the queue is full once the maximum number of events
+	 * are pending, whatever the session.
+	 */
+	TEST_FEATURE ("with queue full");
+	event1 = event_new (NULL, "test", NULL);
+	event_set_lane (event1, EVENT_LANE_BULK);
+
+	TEST_FALSE (event_queue_full (NULL));
+
+	event2 = event_new (NULL, "test", NULL);
+	event_set_lane (event2, EVENT_LANE_BULK);
+
+	TEST_TRUE (event_queue_full (NULL));
+	TEST_TRUE (event_queue_full (session));
+
+
+	/* Check that an event is refused with the reject policy. */
+	TEST_FEATURE ("with reject policy");
+	event_overflow_policy = EVENT_OVERFLOW_REJECT;
+
+	TEST_LT (event_overflow ("test", env, -1, NULL, &existing), 0);
+	TEST_EQ_P (existing, NULL);
+	TEST_EQ (event_overflow_rejected, 1);
+
+
+	/* Check that an event identical to one pending is coalesced into
+	 * the oldest of them with the coalesce policy.
+	 */
+	TEST_FEATURE ("with coalesce policy");
+	event_overflow_policy = EVENT_OVERFLOW_COALESCE;
+
+	TEST_EQ (event_overflow ("test", env, -1, NULL, &existing), 0);
+	TEST_EQ_P (existing, event1);
+	TEST_EQ (event_overflow_coalesced, 1);
+
+
+	/* Check that an event differing in environment or session from
+	 * those pending, or with a socket, is refused with the coalesce
+	 * policy.
+	 */
+	TEST_FEATURE ("with coalesce policy and no duplicate");
+	TEST_LT (event_overflow ("test", env_foo, -1, NULL, &existing), 0);
+	TEST_LT (event_overflow ("test", env, -1, session, &existing), 0);
+	TEST_LT (event_overflow ("test", env, 0, NULL, &existing), 0);
+	TEST_EQ_P (existing, NULL);
+	TEST_EQ (event_overflow_rejected, 4);
+	TEST_EQ (event_overflow_coalesced, 1);
+
+
+	/* Check that the oldest bulk event is dropped to make room with
+	 * the drop-oldest policy.
+	 */
+	TEST_FEATURE ("with drop-oldest policy");
+	event_overflow_policy = EVENT_OVERFLOW_DROP_OLDEST;
+
+	TEST_FREE_TAG (event1);
+
+	TEST_EQ (event_overflow ("test", env, -1, NULL, &existing), 0);
+	TEST_EQ_P (existing, NULL);
+	TEST_FREE (event1);
+	TEST_EQ (event_overflow_dropped, 1);
+	TEST_FALSE (event_queue_full (NULL));
+
+
+	/* Check that neither an event being waited for nor one in the
+	 * priority lane is dropped, so the new event is refused.
+	 */
+	TEST_FEATURE ("with drop-oldest policy and nothing to drop");
+	event1 = event_new (NULL, "test", NULL);
+
+	blocked = blocked_new (event2, BLOCKED_EVENT, event1);
+	nih_list_add (&event2->blocking, &blocked->entry);
+
+	TEST_TRUE (event_queue_full (NULL));
+	TEST_LT (event_overflow ("test", env, -1, NULL, &existing), 0);
+	TEST_EQ (event_overflow_rejected, 5);
+	TEST_EQ (event_overflow_dropped, 1);
+
+	nih_free (event2);
+	nih_free (event1);
+
+
+	/* Check that only the events of a session that has reached its own
+	 * limit are dropped to make room for another of its events.
+	 */
+	TEST_FEATURE ("with drop-oldest policy and session limit");
+	max_pending_events = 0;
+	session_event_limit = 1;
+
+	event1 = event_new (NULL, "test", NULL);
+	event_set_lane (event1, EVENT_LANE_BULK);
+
+	event2 = event_new (NULL, "test", NULL);
+	event_set_lane (event2, EVENT_LANE_BULK);
+	event_set_session (event2, session);
+
+	TEST_FALSE (event_queue_full (NULL));
+	TEST_TRUE (event_queue_full (session));
+
+	TEST_FREE_TAG (event1);
+	TEST_FREE_TAG (event2);
+
+	TEST_EQ (event_overflow ("test", env, -1, session, &existing), 0);
+	TEST_NOT_FREE (event1);
+	TEST_FREE (event2);
+	TEST_EQ (session->events_pending, 0);
+
+	nih_free (event1);
+
+	session_event_limit = 0;
+	event_overflow_policy = EVENT_OVERFLOW_REJECT;
+	event_overflow_rejected = 0;
+	event_overflow_dropped = 0;
+	event_overflow_coalesced = 0;
+
+	nih_free (session);
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -2047,12 +2539,20 @@ main (int   argc,
 	/* run tests in legacy (pre-session support) mode */
 	setenv ("UPSTART_NO_SESSIONS", "1", 1);
 
+	/* Blocked structures are checked to be freed once handled, so
+	 * they must not be kept for reuse.
+	 */
+	blocked_pool_max = 0;
+
 	job_class_environment_init ();
 
 	test_new ();
 	test_block ();
 	test_unblock ();
 	test_poll ();
+	test_lanes ();
+	test_sessions ();
+	test_overflow ();
 
 	test_pending ();
 	test_pending_handle_jobs ();
@@ -203,6 +203,7 @@ test_operator_copy (void)
 		TEST_EQ (copy->value, TRUE);
 		TEST_EQ_STR (copy->name, "test");
 		TEST_ALLOC_PARENT (copy->name, copy);
+		TEST_EQ_P (copy->name, oper->name);
 		TEST_EQ_P (copy->env, NULL);
 		TEST_EQ_P (copy->event, NULL);
 
@@ -1407,6 +1408,11 @@ test_operator_serialisation (void)
 
 		TEST_EQ_STR (oper1_string, oper2_string);
 
+		/* Every stack entry is kept for reuse once done with */
+		TEST_EQ (event_operator_scratch_in_use, 0);
+		TEST_LE (event_operator_scratch_pooled,
+			 EVENT_OPERATOR_SCRATCH_MAX);
+
 
 		json_object_put (json);
 
@@ -1430,6 +1436,166 @@ test_operator_serialisation (void)
 		}
 	}
 
+	/* Collapsing the later operators took stack entries kept from the
+	 * earlier ones rather than allocating them.
+	 */
+	TEST_GT (event_operator_scratch_reused, 0);
+}
+
+void
+test_expr_new (void)
+{
+	EventOperator *oper1, *oper2, *oper3, *oper4, *oper5;
+	EventExpr     *expr;
+
+	/* Check that an operator tree is compiled into a single block of
+	 * nodes in post-order, with children linked by index and names
+	 * shared with the tree.
+	 */
+	TEST_FUNCTION ("event_expr_new");
+	oper1 = event_operator_new (NULL, EVENT_OR, NULL, NULL);
+	oper2 = event_operator_new (oper1, EVENT_AND, NULL, NULL);
+	oper3 = event_operator_new (oper1, EVENT_MATCH, "foo", NULL);
+	oper4 = event_operator_new (oper1, EVENT_MATCH, "bar", NULL);
+	oper5 = event_operator_new (oper1, EVENT_MATCH, "baz", NULL);
+	NIH_MUST (nih_str_array_add (&oper5->env, oper5, NULL, "BAR=$WIBBLE"));
+
+	nih_tree_add (&oper1->node, &oper2->node, NIH_TREE_LEFT);
+	nih_tree_add (&oper2->node, &oper3->node, NIH_TREE_LEFT);
+	nih_tree_add (&oper2->node, &oper4->node, NIH_TREE_RIGHT);
+	nih_tree_add (&oper1->node, &oper5->node, NIH_TREE_RIGHT);
+
+	TEST_ALLOC_FAIL {
+		expr = event_expr_new (NULL, oper1);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (expr, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_SIZE (expr, sizeof (EventExpr)
+				 + sizeof (EventExprNode) * 5);
+		TEST_EQ (expr->len, 5);
+
+		TEST_EQ (expr->nodes[0].type, EVENT_MATCH);
+		TEST_EQ_P (expr->nodes[0].name, oper3->name);
+		TEST_EQ (expr->nodes[0].parent, 2);
+
+		TEST_EQ (expr->nodes[1].type, EVENT_MATCH);
+		TEST_EQ_P (expr->nodes[1].name, oper4->name);
+		TEST_EQ (expr->nodes[1].parent, 2);
+
+		TEST_EQ (expr->nodes[2].type, EVENT_AND);
+		TEST_EQ (expr->nodes[2].left, 0);
+		TEST_EQ (expr->nodes[2].right, 1);
+		TEST_EQ (expr->nodes[2].parent, 4);
+
+		TEST_EQ (expr->nodes[3].type, EVENT_MATCH);
+		TEST_EQ_P (expr->nodes[3].name, oper5->name);
+		TEST_ALLOC_PARENT (expr->nodes[3].env, expr);
+		TEST_EQ_STR (expr->nodes[3].env[0], "BAR=$WIBBLE");
+		TEST_EQ_P (expr->nodes[3].env[1], NULL);
+		TEST_EQ (expr->nodes[3].parent, 4);
+
+		TEST_EQ (expr->nodes[4].type, EVENT_OR);
+		TEST_EQ (expr->nodes[4].left, 2);
+		TEST_EQ (expr->nodes[4].right, 3);
+		TEST_EQ (expr->nodes[4].parent, -1);
+
+		nih_free (expr);
+	}
+
+	nih_free (oper1);
+}
+
+void
+test_expr_handle (void)
+{
+	EventOperator  *oper1, *oper2, *oper3, *oper4, *oper5;
+	EventExpr      *expr;
+	EventExprState *state;
+	Event          *event1, *event2;
+	char          **env = NULL;
+	size_t          len = 0;
+	int             ret;
+
+	TEST_FUNCTION ("event_expr_handle");
+	oper1 = event_operator_new (NULL, EVENT_OR, NULL, NULL);
+	oper2 = event_operator_new (oper1, EVENT_AND, NULL, NULL);
+	oper3 = event_operator_new (oper1, EVENT_MATCH, "foo", NULL);
+	oper4 = event_operator_new (oper1, EVENT_MATCH, "bar", NULL);
+	oper5 = event_operator_new (oper1, EVENT_MATCH, "baz", NULL);
+
+	nih_tree_add (&oper1->node, &oper2->node, NIH_TREE_LEFT);
+	nih_tree_add (&oper2->node, &oper3->node, NIH_TREE_LEFT);
+	nih_tree_add (&oper2->node, &oper4->node, NIH_TREE_RIGHT);
+	nih_tree_add (&oper1->node, &oper5->node, NIH_TREE_RIGHT);
+
+	expr = event_expr_new (NULL, oper1);
+	state = event_expr_state_new (NULL, expr);
+
+	TEST_ALLOC_PARENT (expr, state);
+	TEST_EQ (event_expr_value (state), FALSE);
+
+
+	/* Check that a matching event is blocked and recorded against the
+	 * node that matched it, without completing the expression.
+	 */
+	TEST_FEATURE ("with matching event");
+	event1 = event_new (NULL, "foo", NULL);
+	NIH_MUST (nih_str_array_add (&event1->env, event1, NULL, "A=1"));
+
+	ret = event_expr_handle (state, event1, NULL);
+
+	TEST_EQ (ret, TRUE);
+	TEST_EQ (state->value[0], TRUE);
+	TEST_EQ_P (state->event[0], event1);
+	TEST_EQ (state->value[2], FALSE);
+	TEST_EQ (event_expr_value (state), FALSE);
+	TEST_EQ (event1->blockers, 1);
+
+
+	/* Check that an event completing the expression updates the value
+	 * of the root, and that the environment of both events is then
+	 * collected in order.
+	 */
+	TEST_FEATURE ("with matching event and complete expression");
+	event2 = event_new (NULL, "bar", NULL);
+	NIH_MUST (nih_str_array_add (&event2->env, event2, NULL, "B=2"));
+
+	ret = event_expr_handle (state, event2, NULL);
+
+	TEST_EQ (ret, TRUE);
+	TEST_EQ (state->value[2], TRUE);
+	TEST_EQ (event_expr_value (state), TRUE);
+	TEST_EQ (event2->blockers, 1);
+
+	TEST_NE_P (event_expr_environment (state, &env, NULL, &len,
+					   "UPSTART_EVENTS"), NULL);
+	TEST_EQ (len, 3);
+	TEST_EQ_STR (env[0], "A=1");
+	TEST_EQ_STR (env[1], "B=2");
+	TEST_EQ_STR (env[2], "UPSTART_EVENTS=foo bar");
+	TEST_EQ_P (env[3], NULL);
+	nih_free (env);
+
+
+	/* Check that resetting the state unblocks the events and clears
+	 * every value.
+	 */
+	TEST_FEATURE ("with reset");
+	event_expr_reset (state);
+
+	TEST_EQ (event_expr_value (state), FALSE);
+	TEST_EQ_P (state->event[0], NULL);
+	TEST_EQ_P (state->event[1], NULL);
+	TEST_EQ (event1->blockers, 0);
+	TEST_EQ (event2->blockers, 0);
+
+	nih_free (state);
+	nih_free (oper1);
+
+	event_poll ();
 }
 
 int
@@ -1449,6 +1615,8 @@ main (int   argc,
 	test_operator_events ();
 	test_operator_reset ();
 	test_operator_serialisation ();
+	test_expr_new ();
+	test_expr_handle ();
 
 	return 0;
 }
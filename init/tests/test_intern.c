@@ -0,0 +1,124 @@
+/* upstart
+ *
+ * test_intern.c - test suite for init/intern.c
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/hash.h>
+
+#include "intern.h"
+
+
+void
+test_string (void)
+{
+	void *parent1;
+	void *parent2;
+	char *str1;
+	char *str2;
+	char *str3;
+
+	TEST_FUNCTION ("intern_string");
+	intern_init ();
+
+	/* Check that interning a string for the first time allocates a
+	 * copy referenced by the parent and adds it to the table.
+	 */
+	TEST_FEATURE ("with new string");
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			parent1 = nih_new (NULL, int);
+		}
+
+		str1 = intern_string (parent1, "foo");
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (str1, NULL);
+			TEST_EQ (intern_count (), 0);
+			TEST_EQ_P (nih_hash_lookup (intern_strings, "foo"), NULL);
+
+			nih_free (parent1);
+			continue;
+		}
+
+		TEST_EQ_STR (str1, "foo");
+		TEST_ALLOC_PARENT (str1, parent1);
+		TEST_EQ (intern_count (), 1);
+		TEST_NE_P (nih_hash_lookup (intern_strings, "foo"), NULL);
+
+		nih_free (parent1);
+
+		TEST_EQ (intern_count (), 0);
+		TEST_EQ_P (nih_hash_lookup (intern_strings, "foo"), NULL);
+	}
+
+
+	/* Check that interning an equal string returns the same pointer,
+	 * referenced by both parents, and that it is only freed once both
+	 * of those parents have gone.
+	 */
+	TEST_FEATURE ("with existing string");
+	parent1 = nih_new (NULL, int);
+	parent2 = nih_new (NULL, int);
+
+	str1 = intern_string (parent1, "foo");
+	str2 = intern_string (parent2, "foo");
+
+	TEST_EQ_P (str1, str2);
+	TEST_ALLOC_PARENT (str2, parent1);
+	TEST_ALLOC_PARENT (str2, parent2);
+	TEST_EQ (intern_count (), 1);
+
+	TEST_FREE_TAG (str1);
+
+	nih_free (parent1);
+	TEST_NOT_FREE (str1);
+	TEST_EQ (intern_count (), 1);
+
+	nih_free (parent2);
+	TEST_FREE (str1);
+	TEST_EQ (intern_count (), 0);
+
+
+	/* Check that different strings are interned separately. */
+	TEST_FEATURE ("with different strings");
+	parent1 = nih_new (NULL, int);
+
+	str1 = intern_string (parent1, "foo");
+	str3 = intern_string (parent1, "bar");
+
+	TEST_NE_P (str1, str3);
+	TEST_EQ_STR (str3, "bar");
+	TEST_EQ (intern_count (), 2);
+
+	nih_free (parent1);
+	TEST_EQ (intern_count (), 0);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_string ();
+
+	return 0;
+}
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <limits.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <nih/macros.h>
@@ -83,7 +84,6 @@ test_new (void)
 {
 	JobClass       *class;
 	Job            *job;
-	EventOperator  *oper;
 	pid_t           dbus_pid;
 	DBusError       dbus_error;
 	DBusConnection *conn, *client_conn;
@@ -108,6 +108,7 @@ test_new (void)
 	TEST_FEATURE ("with no name");
 	class = job_class_new (NULL, "test", NULL);
 	class->stop_on = event_operator_new (class, EVENT_MATCH, "baz", NULL);
+	class->stop_on_expr = event_expr_new (class, class->stop_on);
 
 	TEST_ALLOC_FAIL {
 		job = job_new (class, "");
@@ -136,13 +137,15 @@ test_new (void)
 		TEST_EQ_P (job->start_env, NULL);
 		TEST_EQ_P (job->stop_env, NULL);
 
-		oper = (EventOperator *)job->stop_on;
-		TEST_ALLOC_PARENT (oper, job);
-		TEST_ALLOC_SIZE (oper, sizeof (EventOperator));
-		TEST_EQ (oper->type, EVENT_MATCH);
-		TEST_EQ_STR (oper->name, "baz");
-		TEST_EQ_P (oper->env, NULL);
-		TEST_EQ (oper->value, FALSE);
+		TEST_ALLOC_PARENT (job->stop_on, job);
+		TEST_EQ_P (job->stop_on->expr, class->stop_on_expr);
+		TEST_EQ (job->stop_on->expr->len, 1);
+		TEST_EQ (job->stop_on->expr->nodes[0].type, EVENT_MATCH);
+		TEST_EQ_P (job->stop_on->expr->nodes[0].name,
+			   class->stop_on->name);
+		TEST_EQ_P (job->stop_on->expr->nodes[0].env, NULL);
+		TEST_EQ (event_expr_value (job->stop_on), FALSE);
+		TEST_EQ_P (job->stop_on->event[0], NULL);
 
 		TEST_NE_P (job->pid, NULL);
 		TEST_ALLOC_PARENT (job->pid, job);
@@ -179,7 +182,7 @@ test_new (void)
 			TEST_EQ_P (job->process_data[i], NULL);
 		}
 
-		event_operator_reset (job->stop_on);
+		event_expr_reset (job->stop_on);
 
 		nih_free (job);
 	}
@@ -206,7 +209,7 @@ test_new (void)
 		TEST_ALLOC_PARENT (job->path, job);
 		TEST_EQ_STR (job->path, DBUS_PATH_UPSTART "/jobs/test/fred");
 
-		event_operator_reset (job->stop_on);
+		event_expr_reset (job->stop_on);
 
 		nih_free (job);
 	}
@@ -270,7 +273,7 @@ test_new (void)
 
 	dbus_message_unref (message);
 
-	event_operator_reset (job->stop_on);
+	event_expr_reset (job->stop_on);
 
 	nih_free (job);
 
@@ -533,7 +536,7 @@ test_change_goal (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_KILLED;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job_change_goal (job, JOB_START);
 
@@ -558,7 +561,7 @@ test_change_goal (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job_change_goal (job, JOB_START);
 
@@ -583,7 +586,7 @@ test_change_goal (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job_change_goal (job, JOB_STOP);
 
@@ -653,7 +656,7 @@ test_change_goal (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_PRE_START] = 1;
+		job_process_set_pid (job, PROCESS_PRE_START, 1);
 
 		job_change_goal (job, JOB_STOP);
 
@@ -1065,8 +1068,8 @@ test_change_state (void)
 		}
 
 		job->goal = JOB_START;
-		job->state = JOB_SECURITY;
-		job->pid[PROCESS_PRE_START] = 0;
+		job->state = JOB_QUEUED;
+		job_process_set_pid (job, PROCESS_PRE_START, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1132,8 +1135,8 @@ test_change_state (void)
 		}
 
 		job->goal = JOB_START;
-		job->state = JOB_SECURITY;
-		job->pid[PROCESS_MAIN] = 0;
+		job->state = JOB_QUEUED;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1208,8 +1211,8 @@ test_change_state (void)
 		}
 
 		job->goal = JOB_START;
-		job->state = JOB_SECURITY;
-		job->pid[PROCESS_PRE_START] = 0;
+		job->state = JOB_QUEUED;
+		job_process_set_pid (job, PROCESS_PRE_START, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1297,7 +1300,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_MAIN] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1367,7 +1370,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_MAIN] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1449,7 +1452,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_MAIN] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1590,7 +1593,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_MAIN] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1679,7 +1682,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_MAIN] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1747,8 +1750,8 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1815,7 +1818,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1879,7 +1882,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1951,7 +1954,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -2012,7 +2015,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -2080,8 +2083,8 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_PRE_STOP] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_PRE_STOP, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -2148,7 +2151,7 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -2221,7 +2224,7 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -2306,7 +2309,7 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -2387,7 +2390,7 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -3061,7 +3064,7 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_STOPPING;
-		job->pid[PROCESS_POST_STOP] = 0;
+		job_process_set_pid (job, PROCESS_POST_STOP, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -3125,7 +3128,7 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_KILLED;
-		job->pid[PROCESS_POST_STOP] = 0;
+		job_process_set_pid (job, PROCESS_POST_STOP, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -4055,13 +4058,13 @@ test_next_state (void)
 	TEST_EQ (job_next_state (job), JOB_SECURITY);
 
 	/* Check that the next state if we're starting a security job is
-	 * pre-starting.
+	 * queued.
 	 */
 	TEST_FEATURE ("with security job and a goal of start");
 	job->goal = JOB_START;
 	job->state = JOB_SECURITY;
 
-	TEST_EQ (job_next_state (job), JOB_PRE_STARTING);
+	TEST_EQ (job_next_state (job), JOB_QUEUED);
 
 	/* Check that the next state if we're stopping an security job is
 	 * stopping.
@@ -4072,6 +4075,24 @@ test_next_state (void)
 
 	TEST_EQ (job_next_state (job), JOB_STOPPING);
 
+	/* Check that the next state if we're starting a queued job is
+	 * pre-starting.
+	 */
+	TEST_FEATURE ("with queued job and a goal of start");
+	job->goal = JOB_START;
+	job->state = JOB_QUEUED;
+
+	TEST_EQ (job_next_state (job), JOB_PRE_STARTING);
+
+	/* Check that the next state if we're stopping a queued job is
+	 * stopping.
+	 */
+	TEST_FEATURE ("with queued job and a goal of stop");
+	job->goal = JOB_STOP;
+	job->state = JOB_QUEUED;
+
+	TEST_EQ (job_next_state (job), JOB_STOPPING);
+
 	/* Check that the next state if we're starting a pre-starting job is
 	 * pre-start.
 	 */
@@ -4188,7 +4209,7 @@ test_next_state (void)
 	TEST_FEATURE ("with running job and a goal of stop");
 	job->goal = JOB_STOP;
 	job->state = JOB_RUNNING;
-	job->pid[PROCESS_MAIN] = 1;
+	job_process_set_pid (job, PROCESS_MAIN, 1);
 
 	TEST_EQ (job_next_state (job), JOB_PRE_STOPPING);
 
@@ -4199,7 +4220,7 @@ test_next_state (void)
 	TEST_FEATURE ("with pre-stopping job and a goal of stop");
 	job->goal = JOB_STOP;
 	job->state = JOB_PRE_STOPPING;
-	job->pid[PROCESS_MAIN] = 1;
+	job_process_set_pid (job, PROCESS_MAIN, 1);
 
 	TEST_EQ (job_next_state (job), JOB_PRE_STOP);
 
@@ -4211,7 +4232,7 @@ test_next_state (void)
 	TEST_FEATURE ("with dead running job and a goal of stop");
 	job->goal = JOB_STOP;
 	job->state = JOB_RUNNING;
-	job->pid[PROCESS_MAIN] = 0;
+	job_process_set_pid (job, PROCESS_MAIN, 0);
 
 	TEST_EQ (job_next_state (job), JOB_STOPPING);
 
@@ -5834,6 +5855,13 @@ test_state_name (void)
 	TEST_EQ_STR (name, "security");
 
 
+	/* Check that the JOB_QUEUED state returns the right string. */
+	TEST_FEATURE ("with queued state");
+	name = job_state_name (JOB_QUEUED);
+
+	TEST_EQ_STR (name, "queued");
+
+
 	/* Check that the JOB_PRE_START state returns the right string. */
 	TEST_FEATURE ("with pre-start state");
 	name = job_state_name (JOB_PRE_START);
@@ -5925,6 +5953,13 @@ test_state_from_name (void)
 	TEST_EQ (state, JOB_SECURITY);
 
 
+	/* Check that JOB_QUEUED is returned for the right string. */
+	TEST_FEATURE ("with queued state");
+	state = job_state_from_name ("queued");
+
+	TEST_EQ (state, JOB_QUEUED);
+
+
 	/* Check that JOB_PRE_START is returned for the right string. */
 	TEST_FEATURE ("with pre-start state");
 	state = job_state_from_name ("pre-start");
@@ -7138,7 +7173,7 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_PRE_START;
-			job->pid[PROCESS_PRE_START] = 1014;
+			job_process_set_pid (job, PROCESS_PRE_START, 1014);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7193,7 +7228,7 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_POST_START;
-			job->pid[PROCESS_POST_START] = 2137;
+			job_process_set_pid (job, PROCESS_POST_START, 2137);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7247,7 +7282,7 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_RUNNING;
-			job->pid[PROCESS_MAIN] = 3648;
+			job_process_set_pid (job, PROCESS_MAIN, 3648);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7304,8 +7339,8 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_POST_START;
-			job->pid[PROCESS_POST_START] = 2137;
-			job->pid[PROCESS_MAIN] = 3648;
+			job_process_set_pid (job, PROCESS_POST_START, 2137);
+			job_process_set_pid (job, PROCESS_MAIN, 3648);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7368,8 +7403,8 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_PRE_STOP;
-			job->pid[PROCESS_MAIN] = 3648;
-			job->pid[PROCESS_PRE_STOP] = 7864;
+			job_process_set_pid (job, PROCESS_MAIN, 3648);
+			job_process_set_pid (job, PROCESS_PRE_STOP, 7864);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7430,7 +7465,7 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_PRE_STOP;
-			job->pid[PROCESS_PRE_STOP] = 7864;
+			job_process_set_pid (job, PROCESS_PRE_STOP, 7864);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7484,7 +7519,7 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_POST_STOP;
-			job->pid[PROCESS_POST_STOP] = 9764;
+			job_process_set_pid (job, PROCESS_POST_STOP, 9764);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7525,6 +7560,57 @@ test_get_processes (void)
 	}
 }
 
+void
+test_get_next_respawn (void)
+{
+	NihDBusMessage *message = NULL;
+	JobClass       *class = NULL;
+	Job            *job = NULL;
+	int64_t         next_respawn;
+	time_t          now;
+	int             ret;
+
+	TEST_FUNCTION ("job_get_next_respawn");
+	nih_error_init ();
+	job_class_init ();
+
+	class = job_class_new (NULL, "test", NULL);
+	job = job_new (class, "");
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = NULL;
+	message->message = NULL;
+
+
+	/* Check that zero is returned when no respawn is pending. */
+	TEST_FEATURE ("without pending respawn");
+	next_respawn = -1;
+
+	ret = job_get_next_respawn (job, message, &next_respawn);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (next_respawn, 0);
+
+
+	/* Check that the wall-clock time of a pending respawn is returned. */
+	TEST_FEATURE ("with pending respawn");
+	job->goal = JOB_START;
+	job->state = JOB_POST_STOP;
+
+	now = time (NULL);
+	job_process_set_respawn_timer (job, 10);
+	TEST_NE_P (job->respawn_timer, NULL);
+
+	ret = job_get_next_respawn (job, message, &next_respawn);
+
+	TEST_EQ (ret, 0);
+	TEST_GE (next_respawn, now + 9);
+	TEST_LE (next_respawn, time (NULL) + 11);
+
+	nih_free (message);
+	nih_free (class);
+}
+
 void
 test_deserialise_ptrace (void)
 {
@@ -7587,7 +7673,7 @@ test_deserialise_ptrace (void)
 		TEST_NE_P (job, NULL);
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 		job->trace_forks = 0;
 		job->trace_state = TRACE_NORMAL;
 
@@ -7953,6 +8039,11 @@ main (int   argc,
 	/* run tests in legacy (pre-session support) mode */
 	setenv ("UPSTART_NO_SESSIONS", "1", 1);
 
+	/* Blocked structures are checked to be freed once handled, so
+	 * they must not be kept for reuse.
+	 */
+	blocked_pool_max = 0;
+
 	argv0 = argv[0];
 
 	nih_main_init (argv[0]);
@@ -7990,6 +8081,7 @@ main (int   argc,
 	test_get_state ();
 
 	test_get_processes ();
+	test_get_next_respawn ();
 
 	test_deserialise_ptrace ();
 
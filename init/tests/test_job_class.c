@@ -61,6 +61,12 @@
 #include "conf.h"
 #include "control.h"
 
+#ifdef ENABLE_CGROUPS
+#include "cgroup.h"
+#endif /* ENABLE_CGROUPS */
+
+#include "test_util_common.h"
+
 
 void
 test_new (void)
@@ -153,6 +159,14 @@ test_new (void)
 
 		TEST_LIST_EMPTY (&class->cgroups);
 
+		TEST_EQ (class->cpu_weight, 0);
+		TEST_EQ (class->cpu_quota, 0);
+		TEST_EQ (class->memory_max, 0);
+		TEST_EQ (class->memory_high, 0);
+		TEST_EQ (class->io_weight, 0);
+		TEST_EQ_P (class->cpuset_cpus, NULL);
+		TEST_EQ_P (class->cpuset_mems, NULL);
+
 		nih_free (class);
 	}
 }
@@ -3776,6 +3790,457 @@ test_get_emits (void)
 }
 
 
+void
+test_blame (void)
+{
+	JobClass  *class1;
+	JobClass  *class2;
+	JobClass  *class3;
+	Job       *job1;
+	char     **blame;
+
+	TEST_FUNCTION ("job_class_blame");
+	job_class_init ();
+
+	/* Check that jobs are listed slowest first by the time taken from
+	 * starting to running, that classes without instances use the
+	 * timing of their last instance and that jobs never started are
+	 * not listed.
+	 */
+	TEST_FEATURE ("with running job and finished task");
+	class1 = job_class_new (NULL, "foo", NULL);
+	nih_hash_add (job_classes, &class1->entry);
+
+	job1 = job_new (class1, "");
+	job1->timing->entered[JOB_STARTING] = 1000;
+	job1->timing->entered[JOB_RUNNING] = 3000;
+
+	class2 = job_class_new (NULL, "bar", NULL);
+	nih_hash_add (job_classes, &class2->entry);
+
+	class2->timing = job_timing_new (class2);
+	class2->timing->entered[JOB_STARTING] = 1500;
+	class2->timing->entered[JOB_RUNNING] = 1600;
+
+	class3 = job_class_new (NULL, "baz", NULL);
+	nih_hash_add (job_classes, &class3->entry);
+
+	TEST_NE_P (job_new (class3, ""), NULL);
+
+	TEST_ALLOC_FAIL {
+		blame = job_class_blame (NULL);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (blame, NULL);
+			continue;
+		}
+
+		TEST_NE_P (blame, NULL);
+		TEST_EQ_STR (blame[0], "2000 foo");
+		TEST_EQ_STR (blame[1], "100 bar");
+		TEST_EQ_P (blame[2], NULL);
+
+		nih_free (blame);
+	}
+
+	nih_free (class1);
+	nih_free (class2);
+	nih_free (class3);
+}
+
+void
+test_critical_chain (void)
+{
+	JobClass  *class1;
+	JobClass  *class2;
+	Job       *job1;
+	char     **chain;
+
+	TEST_FUNCTION ("job_class_critical_chain");
+	job_class_init ();
+
+	/* Check that the chain follows the job that emitted the event
+	 * which started each job back to an event not emitted by a job.
+	 */
+	TEST_FEATURE ("with chain of jobs");
+	class1 = job_class_new (NULL, "foo", NULL);
+	nih_hash_add (job_classes, &class1->entry);
+
+	job1 = job_new (class1, "");
+	job1->timing->entered[JOB_STARTING] = 2000;
+	job1->timing->entered[JOB_RUNNING] = 3000;
+	job1->timing->cause = nih_strdup (job1->timing, "started");
+	job1->timing->cause_job = nih_strdup (job1->timing, "bar");
+	job1->timing->cause_instance = nih_strdup (job1->timing, "");
+
+	class2 = job_class_new (NULL, "bar", NULL);
+	nih_hash_add (job_classes, &class2->entry);
+
+	class2->timing = job_timing_new (class2);
+	class2->timing->entered[JOB_STARTING] = 1000;
+	class2->timing->entered[JOB_RUNNING] = 1900;
+	class2->timing->cause = nih_strdup (class2->timing, "startup");
+
+	TEST_ALLOC_FAIL {
+		chain = job_class_critical_chain (NULL, class1);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (chain, NULL);
+			continue;
+		}
+
+		TEST_NE_P (chain, NULL);
+		TEST_EQ_STR (chain[0], "2000 3000 started foo");
+		TEST_EQ_STR (chain[1], "1000 1900 startup bar");
+		TEST_EQ_P (chain[2], NULL);
+
+		nih_free (chain);
+	}
+
+
+	/* Check that a job which has never been started has an empty
+	 * chain.
+	 */
+	TEST_FEATURE ("with job never started");
+	job1->timing->entered[JOB_STARTING] = 0;
+
+	chain = job_class_critical_chain (NULL, class1);
+
+	TEST_NE_P (chain, NULL);
+	TEST_EQ_P (chain[0], NULL);
+
+	nih_free (chain);
+
+	nih_free (class1);
+	nih_free (class2);
+}
+
+
+void
+test_add_starting (void)
+{
+	NihList      *starting;
+	NihListEntry *entry;
+	JobClass     *class1, *class2, *class3, *class4;
+
+	TEST_FUNCTION ("job_class_add_starting");
+	job_class_init ();
+
+	class1 = job_class_new (NULL, "foo", NULL);
+	class2 = job_class_new (NULL, "bar", NULL);
+	class2->priority = 10;
+	class3 = job_class_new (NULL, "baz", NULL);
+	class3->priority = -5;
+	class4 = job_class_new (NULL, "frodo", NULL);
+	class4->priority = 10;
+
+	starting = nih_list_new (NULL);
+
+
+	/* Check that classes are listed in order of priority, highest
+	 * first, and those of the same priority in the order added.
+	 */
+	TEST_FEATURE ("with classes of different priorities");
+	job_class_add_starting (starting, class1);
+	job_class_add_starting (starting, class2);
+	job_class_add_starting (starting, class3);
+	job_class_add_starting (starting, class4);
+
+	entry = (NihListEntry *)starting->next;
+	TEST_ALLOC_PARENT (entry, starting);
+	TEST_EQ_P (entry->data, class2);
+
+	entry = (NihListEntry *)entry->entry.next;
+	TEST_EQ_P (entry->data, class4);
+
+	entry = (NihListEntry *)entry->entry.next;
+	TEST_EQ_P (entry->data, class1);
+
+	entry = (NihListEntry *)entry->entry.next;
+	TEST_EQ_P (entry->data, class3);
+
+	TEST_EQ_P (entry->entry.next, starting);
+
+	nih_free (starting);
+	nih_free (class1);
+	nih_free (class2);
+	nih_free (class3);
+	nih_free (class4);
+}
+
+
+void
+test_stop_depends (void)
+{
+	JobClass       *class1;
+	JobClass       *class2;
+	EventOperator  *oper;
+
+	TEST_FUNCTION ("job_class_stop_depends");
+	job_class_init ();
+
+	class1 = job_class_new (NULL, "foo", NULL);
+	class2 = job_class_new (NULL, "bar", NULL);
+
+
+	/* Check that a job without start or stop conditions depends on
+	 * nothing.
+	 */
+	TEST_FEATURE ("without conditions");
+	TEST_FALSE (job_class_stop_depends (class1, class2));
+	TEST_FALSE (job_class_stop_depends (class2, class1));
+
+
+	/* Check that a job which starts once another has started depends
+	 * on it, but not the other way round.
+	 */
+	TEST_FEATURE ("with start on started");
+	class1->start_on = event_operator_new (
+		class1, EVENT_MATCH, "started", NULL);
+	class1->start_on->env = nih_str_array_new (class1->start_on);
+	NIH_MUST (nih_str_array_add (&class1->start_on->env,
+				     class1->start_on, NULL, "bar"));
+
+	TEST_TRUE (job_class_stop_depends (class1, class2));
+	TEST_FALSE (job_class_stop_depends (class2, class1));
+
+	nih_free (class1->start_on);
+	class1->start_on = NULL;
+
+
+	/* Check that a job which stops as another begins to stop depends
+	 * on it when that job is named by a pattern in the JOB variable.
+	 */
+	TEST_FEATURE ("with stop on stopping");
+	class1->stop_on = event_operator_new (
+		class1, EVENT_OR, NULL, NULL);
+
+	oper = event_operator_new (class1->stop_on, EVENT_MATCH,
+				   "runlevel", NULL);
+	nih_tree_add (&class1->stop_on->node, &oper->node, NIH_TREE_LEFT);
+
+	oper = event_operator_new (class1->stop_on, EVENT_MATCH,
+				   "stopping", NULL);
+	oper->env = nih_str_array_new (oper);
+	NIH_MUST (nih_str_array_add (&oper->env, oper, NULL, "JOB=b*"));
+	nih_tree_add (&class1->stop_on->node, &oper->node, NIH_TREE_RIGHT);
+
+	TEST_TRUE (job_class_stop_depends (class1, class2));
+	TEST_FALSE (job_class_stop_depends (class2, class1));
+
+
+	/* Check that a negated match does not name the job. */
+	TEST_FEATURE ("with negated match");
+	oper->env[0] = NIH_MUST (nih_strdup (oper->env, "JOB!=bar"));
+
+	TEST_FALSE (job_class_stop_depends (class1, class2));
+
+
+	/* Check that a match on another job event does not depend on the
+	 * job.
+	 */
+	TEST_FEATURE ("with other job event");
+	nih_free (class1->stop_on);
+	class1->stop_on = event_operator_new (
+		class1, EVENT_MATCH, "stopped", NULL);
+	class1->stop_on->env = nih_str_array_new (class1->stop_on);
+	NIH_MUST (nih_str_array_add (&class1->stop_on->env,
+				     class1->stop_on, NULL, "bar"));
+
+	TEST_FALSE (job_class_stop_depends (class1, class2));
+
+	nih_free (class1);
+	nih_free (class2);
+}
+
+#ifdef ENABLE_CGROUPS
+
+/**
+ * resource_setting:
+ * @class: job class,
+ * @controller: cgroup controller,
+ * @key: name of setting.
+ *
+ * Returns: value of @key for the default cgroup of @controller in @class,
+ * or NULL if not set.
+ **/
+static const char *
+resource_setting (JobClass   *class,
+		  const char *controller,
+		  const char *key)
+{
+	NIH_LIST_FOREACH (&class->cgroups, iter) {
+		CGroup *cgroup = (CGroup *)iter;
+
+		if (strcmp (cgroup->controller, controller))
+			continue;
+
+		NIH_LIST_FOREACH (&cgroup->names, iter2) {
+			CGroupName *cgname = (CGroupName *)iter2;
+
+			if (strcmp (cgname->name, UPSTART_CGROUP_SHELL_ENVVAR))
+				continue;
+
+			NIH_LIST_FOREACH (&cgname->settings, iter3) {
+				CGroupSetting *setting = (CGroupSetting *)iter3;
+
+				if (! strcmp (setting->key, key))
+					return setting->value;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * resource_class:
+ *
+ * Returns: new job class with every resource-control stanza set.
+ **/
+static JobClass *
+resource_class (void)
+{
+	JobClass *class;
+
+	class = job_class_new (NULL, "test", NULL);
+	TEST_NE_P (class, NULL);
+
+	class->cpu_weight = 200;
+	class->cpu_quota = 250;
+	class->memory_max = 536870912ULL;
+	class->memory_high = JOB_MEMORY_UNLIMITED;
+	class->io_weight = 50;
+	class->cpuset_cpus = NIH_MUST (nih_strdup (class, "0-3,6"));
+
+	return class;
+}
+
+void
+test_resources (void)
+{
+	JobClass *class;
+	char      dirname[PATH_MAX];
+	int       settings;
+
+	TEST_FUNCTION ("job_class_resources");
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	/* Check that the resource-control stanzas of a job are needed to
+	 * be in cgroups, and are turned into the settings of
+	 * per-controller hierarchies when the unified hierarchy is not
+	 * in use, scaling weights so that the defaults are equal.
+	 */
+	TEST_FEATURE ("with per-controller hierarchies");
+	cgroup_fs_root = "/nonexistent";
+	cgroup_fs_reset ();
+
+	class = resource_class ();
+
+	TEST_LIST_EMPTY (&class->cgroups);
+	TEST_TRUE (job_class_cgroups (class));
+
+	TEST_TRUE (job_class_resources (class));
+
+	TEST_EQ_STR (resource_setting (class, "cpu", "shares"), "2048");
+	TEST_EQ_STR (resource_setting (class, "cpu", "cfs_period_us"), "100000");
+	TEST_EQ_STR (resource_setting (class, "cpu", "cfs_quota_us"), "250000");
+	TEST_EQ_STR (resource_setting (class, "memory", "limit_in_bytes"),
+		     "536870912");
+	TEST_EQ_STR (resource_setting (class, "memory", "soft_limit_in_bytes"),
+		     "-1");
+	TEST_EQ_STR (resource_setting (class, "blkio", "weight"), "250");
+	TEST_EQ_STR (resource_setting (class, "cpuset", "cpus"), "0-3,6");
+	TEST_EQ_STR (resource_setting (class, "cpuset", "mems"), "0");
+
+	TEST_EQ_P (resource_setting (class, "cpu", "weight"), NULL);
+	TEST_EQ_P (resource_setting (class, "io", "weight"), NULL);
+
+	nih_free (class);
+
+
+	/* Check that a weight beyond the range of blkio.weight is limited
+	 * to it.
+	 */
+	TEST_FEATURE ("with weight beyond blkio range");
+	class = resource_class ();
+	class->io_weight = 5000;
+
+	TEST_TRUE (job_class_resources (class));
+	TEST_EQ_STR (resource_setting (class, "blkio", "weight"), "1000");
+
+	nih_free (class);
+
+
+	/* Check that a job parsed before the cgroup filesystem is known
+	 * gets the settings of the unified hierarchy when it turns out to
+	 * be in use at spawn time, leaving the memory nodes alone since
+	 * the unified hierarchy doesn't require them.
+	 */
+	TEST_FEATURE ("with unified hierarchy");
+	class = resource_class ();
+
+	CREATE_FILE (dirname, "cgroup.controllers", "cpu cpuset io memory");
+	cgroup_fs_root = dirname;
+	cgroup_fs_reset ();
+
+	TEST_TRUE (job_class_resources (class));
+
+	TEST_EQ_STR (resource_setting (class, "cpu", "weight"), "200");
+	TEST_EQ_STR (resource_setting (class, "cpu", "max"), "250000 100000");
+	TEST_EQ_STR (resource_setting (class, "memory", "max"), "536870912");
+	TEST_EQ_STR (resource_setting (class, "memory", "high"), "max");
+	TEST_EQ_STR (resource_setting (class, "io", "weight"), "default 50");
+	TEST_EQ_STR (resource_setting (class, "cpuset", "cpus"), "0-3,6");
+
+	TEST_EQ_P (resource_setting (class, "cpu", "shares"), NULL);
+	TEST_EQ_P (resource_setting (class, "cpu", "cfs_quota_us"), NULL);
+	TEST_EQ_P (resource_setting (class, "memory", "limit_in_bytes"), NULL);
+	TEST_EQ_P (resource_setting (class, "blkio", "weight"), NULL);
+	TEST_EQ_P (resource_setting (class, "cpuset", "mems"), NULL);
+
+	nih_free (class);
+
+
+	/* Check that given memory nodes are set, and that turning the
+	 * stanzas into settings again replaces rather than adds to them.
+	 */
+	TEST_FEATURE ("with memory nodes");
+	class = resource_class ();
+	class->cpuset_mems = NIH_MUST (nih_strdup (class, "0-1"));
+
+	TEST_TRUE (job_class_resources (class));
+	TEST_TRUE (job_class_resources (class));
+
+	TEST_EQ_STR (resource_setting (class, "cpuset", "mems"), "0-1");
+
+	settings = 0;
+	NIH_LIST_FOREACH (&class->cgroups, iter) {
+		CGroup *cgroup = (CGroup *)iter;
+
+		NIH_LIST_FOREACH (&cgroup->names, iter2) {
+			CGroupName *cgname = (CGroupName *)iter2;
+
+			NIH_LIST_FOREACH (&cgname->settings, iter3)
+				settings++;
+		}
+	}
+
+	TEST_EQ (settings, 7);
+
+	nih_free (class);
+
+	DELETE_FILE (dirname, "cgroup.controllers");
+	TEST_EQ (rmdir (dirname), 0);
+
+	cgroup_fs_root = CGROUP_FS_ROOT;
+	cgroup_fs_reset ();
+}
+
+#endif /* ENABLE_CGROUPS */
+
+
 int
 main (int   argc,
       char *argv[])
@@ -3783,6 +4248,11 @@ main (int   argc,
 	/* run tests in legacy (pre-session support) mode */
 	setenv ("UPSTART_NO_SESSIONS", "1", 1);
 
+	/* Blocked structures are checked to be freed once handled, so
+	 * they must not be kept for reuse.
+	 */
+	blocked_pool_max = 0;
+
 	test_new ();
 	test_consider ();
 	test_reconsider ();
@@ -3806,5 +4276,16 @@ main (int   argc,
 	test_get_stop_on ();
 	test_get_emits ();
 
+	test_blame ();
+	test_critical_chain ();
+
+	test_add_starting ();
+
+	test_stop_depends ();
+
+#ifdef ENABLE_CGROUPS
+	test_resources ();
+#endif /* ENABLE_CGROUPS */
+
 	return 0;
 }
@@ -60,8 +60,12 @@
 #include "blocked.h"
 #include "conf.h"
 #include "errors.h"
+#include "spawner.h"
 #include "test_util_common.h"
 
+extern int disable_clone_spawn;
+extern int use_pidfd;
+
 #define EXPECTED_JOB_LOGDIR       "/var/log/upstart"
 #define TEST_SHELL                "/bin/sh"
 #define TEST_SHELL_ARG            "-e"
@@ -4299,6 +4303,7 @@ test_spawn (void)
 	struct stat       statbuf;
 	int               ret;
 	int               job_process_fd = -1;
+	pid_t             helper_pid;
 	nih_local NihIoBuffer *buffer = NULL;
 
 	log_unflushed_init ();
@@ -4557,6 +4562,209 @@ test_spawn (void)
 	nih_free (class);
 
 
+	/* Check that a job spawned with fork() rather than clone() has
+	 * the same process tree.
+	 */
+	TEST_FEATURE ("with fork spawn");
+	TEST_HASH_EMPTY (job_classes);
+
+	sprintf (function, "%d", TEST_PIDS);
+	disable_clone_spawn = TRUE;
+
+	class = job_class_new (NULL, "test", NULL);
+	class->console = CONSOLE_NONE;
+	job   = job_new (class, "");
+
+	pid = job_process_spawn_with_fd (job, args, NULL, FALSE, -1, PROCESS_MAIN, &job_process_fd);
+	TEST_GT (pid, 0);
+
+	waitpid (pid, NULL, 0);
+	output = fopen (filename, "r");
+
+	sprintf (buf, "pid: %d\n", pid);
+	TEST_FILE_EQ (output, buf);
+
+	sprintf (buf, "ppid: %d\n", getpid ());
+	TEST_FILE_EQ (output, buf);
+
+	sprintf (buf, "pgrp: %d\n", pid);
+	TEST_FILE_EQ (output, buf);
+
+	sprintf (buf, "sid: %d\n", pid);
+	TEST_FILE_EQ (output, buf);
+
+	TEST_FILE_END (output);
+
+	fclose (output);
+	assert0 (unlink (filename));
+
+	disable_clone_spawn = FALSE;
+	nih_free (class);
+
+
+	/* Check that a job spawned with clone() which fails during setup
+	 * reports the step that failed and the error through the pipe.
+	 */
+	TEST_FEATURE ("with clone spawn and missing working directory");
+	TEST_HASH_EMPTY (job_classes);
+
+	sprintf (function, "%d", TEST_SIMPLE);
+
+	class = job_class_new (NULL, "test", NULL);
+	class->console = CONSOLE_NONE;
+	class->chdir = "/does/not/exist";
+	job = job_new (class, "");
+
+	pid = job_process_spawn_with_fd (job, args, NULL, FALSE, -1, PROCESS_MAIN, &job_process_fd);
+	TEST_GT (pid, 0);
+
+	assert0 (waitid (P_PID, pid, &info, WEXITED | WSTOPPED | WCONTINUED));
+	TEST_EQ (info.si_code, CLD_EXITED);
+	TEST_EQ (info.si_status, 255);
+
+	buffer = read_from_fd (NULL, job_process_fd);
+	TEST_NE_P (buffer, NULL);
+	close (job_process_fd);
+
+	job_process_error_handler (buffer->buf, buffer->len);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, JOB_PROCESS_ERROR);
+	{
+		JobProcessError *perr = (JobProcessError *)err;
+
+		TEST_EQ (perr->type, JOB_PROCESS_ERROR_CHDIR);
+		TEST_EQ (perr->errnum, ENOENT);
+	}
+	nih_free (err);
+
+	nih_free (buffer);
+	buffer = NULL;
+
+	nih_free (class);
+
+
+	/* Check that a job spawned with clone() whose binary has no path
+	 * is found on the PATH in its environment.
+	 */
+	TEST_FEATURE ("with clone spawn and path search");
+	TEST_HASH_EMPTY (job_classes);
+
+	args[0] = "true";
+	args[1] = NULL;
+
+	env[0] = "PATH=/does/not/exist:/usr/bin:/bin";
+	env[1] = NULL;
+
+	class = job_class_new (NULL, "test", NULL);
+	class->console = CONSOLE_NONE;
+	job = job_new (class, "");
+
+	pid = job_process_spawn_with_fd (job, args, env, FALSE, -1, PROCESS_MAIN, &job_process_fd);
+	TEST_GT (pid, 0);
+
+	assert0 (waitid (P_PID, pid, &info, WEXITED | WSTOPPED | WCONTINUED));
+	TEST_EQ (info.si_code, CLD_EXITED);
+	TEST_EQ (info.si_status, 0);
+
+	close (job_process_fd);
+
+	args[0] = argv0;
+	args[1] = function;
+	args[2] = filename;
+	args[3] = NULL;
+
+	nih_free (class);
+
+
+	/* Check that a job spawned by the spawn helper is our child, not
+	 * the helper's, and otherwise has the same process tree.
+	 */
+	TEST_FEATURE ("with spawn helper");
+	TEST_HASH_EMPTY (job_classes);
+
+	sprintf (function, "%d", TEST_PIDS);
+
+	TEST_EQ (spawner_start (job_process_spawn_helper), 0);
+	helper_pid = spawner_pid;
+
+	class = job_class_new (NULL, "test", NULL);
+	class->console = CONSOLE_NONE;
+	job   = job_new (class, "");
+
+	pid = job_process_spawn_with_fd (job, args, NULL, FALSE, -1, PROCESS_MAIN, &job_process_fd);
+	TEST_GT (pid, 0);
+	TEST_NE (pid, helper_pid);
+
+	TEST_EQ (waitpid (pid, NULL, 0), pid);
+	output = fopen (filename, "r");
+
+	sprintf (buf, "pid: %d\n", pid);
+	TEST_FILE_EQ (output, buf);
+
+	sprintf (buf, "ppid: %d\n", getpid ());
+	TEST_FILE_EQ (output, buf);
+
+	sprintf (buf, "pgrp: %d\n", pid);
+	TEST_FILE_EQ (output, buf);
+
+	sprintf (buf, "sid: %d\n", pid);
+	TEST_FILE_EQ (output, buf);
+
+	TEST_FILE_END (output);
+
+	fclose (output);
+	assert0 (unlink (filename));
+	close (job_process_fd);
+
+	nih_free (class);
+
+
+	/* Check that a job spawned by the spawn helper which fails during
+	 * setup reports the error through the pipe to us.
+	 */
+	TEST_FEATURE ("with spawn helper and missing working directory");
+	TEST_HASH_EMPTY (job_classes);
+
+	sprintf (function, "%d", TEST_SIMPLE);
+
+	class = job_class_new (NULL, "test", NULL);
+	class->console = CONSOLE_NONE;
+	class->chdir = "/does/not/exist";
+	job = job_new (class, "");
+
+	pid = job_process_spawn_with_fd (job, args, NULL, FALSE, -1, PROCESS_MAIN, &job_process_fd);
+	TEST_GT (pid, 0);
+
+	assert0 (waitid (P_PID, pid, &info, WEXITED | WSTOPPED | WCONTINUED));
+	TEST_EQ (info.si_code, CLD_EXITED);
+	TEST_EQ (info.si_status, 255);
+
+	buffer = read_from_fd (NULL, job_process_fd);
+	TEST_NE_P (buffer, NULL);
+	close (job_process_fd);
+
+	job_process_error_handler (buffer->buf, buffer->len);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, JOB_PROCESS_ERROR);
+	{
+		JobProcessError *perr = (JobProcessError *)err;
+
+		TEST_EQ (perr->type, JOB_PROCESS_ERROR_CHDIR);
+		TEST_EQ (perr->errnum, ENOENT);
+	}
+	nih_free (err);
+
+	nih_free (buffer);
+	buffer = NULL;
+
+	nih_free (class);
+
+	spawner_stop ();
+	TEST_EQ (waitpid (helper_pid, NULL, 0), helper_pid);
+
+
 #if 0
 	/* Check that attempting to spawn a binary that doesn't exist returns
 	 * an error immediately with all of the expected information in the
@@ -4812,10 +5020,10 @@ test_spawn (void)
 	args[2] = filebuf;
 	args[3] = NULL;
 
-	job->pid[PROCESS_MAIN] = job_process_spawn_with_fd (job, args, NULL,
-							    FALSE, -1, PROCESS_MAIN, &job_process_fd);
-	pid = job->pid[PROCESS_MAIN];
+	pid = job_process_spawn_with_fd (job, args, NULL,
+					 FALSE, -1, PROCESS_MAIN, &job_process_fd);
 	TEST_GT (pid, 0);
+	job_process_set_pid (job, PROCESS_MAIN, pid);
 
 	/* The main process is now running, but paused. It should have
 	 * produced some output so check that now.
@@ -4839,10 +5047,10 @@ test_spawn (void)
 	args[2] = filebuf;
 	args[3] = NULL;
 
-	job->pid[PROCESS_POST_START] = job_process_spawn_with_fd (job, args, NULL,
-								  FALSE, -1, PROCESS_POST_START, &job_process_fd);
-	pid = job->pid[PROCESS_POST_START];
+	pid = job_process_spawn_with_fd (job, args, NULL,
+					 FALSE, -1, PROCESS_POST_START, &job_process_fd);
 	TEST_GT (pid, 0);
+	job_process_set_pid (job, PROCESS_POST_START, pid);
 
 	/* wait for post-start process to end */
 	waitpid (pid, &status, 0);
@@ -5450,7 +5658,7 @@ test_kill (void)
 {
 	JobClass *      class;
 	Job *           job = NULL;
-	NihTimer *      timer;
+	WheelTimer *    timer;
 	struct timespec now;
 	pid_t           pid;
 	int             status;
@@ -5499,7 +5707,7 @@ test_kill (void)
 		assert0 (clock_gettime (CLOCK_MONOTONIC, &now));
 
 		TEST_NE_P (job->kill_timer, NULL);
-		TEST_ALLOC_SIZE (job->kill_timer, sizeof (NihTimer));
+		TEST_ALLOC_SIZE (job->kill_timer, sizeof (WheelTimer));
 		TEST_ALLOC_PARENT (job->kill_timer, job);
 		TEST_GE (job->kill_timer->due, now.tv_sec + 950);
 		TEST_LE (job->kill_timer->due, now.tv_sec + 1000);
@@ -5557,7 +5765,7 @@ test_kill (void)
 		assert0 (clock_gettime (CLOCK_MONOTONIC, &now));
 
 		TEST_NE_P (job->kill_timer, NULL);
-		TEST_ALLOC_SIZE (job->kill_timer, sizeof (NihTimer));
+		TEST_ALLOC_SIZE (job->kill_timer, sizeof (WheelTimer));
 		TEST_ALLOC_PARENT (job->kill_timer, job);
 		TEST_GE (job->kill_timer->due, now.tv_sec + 950);
 		TEST_LE (job->kill_timer->due, now.tv_sec + 1000);
@@ -5654,7 +5862,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -5705,7 +5913,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -5758,7 +5966,7 @@ test_handler (void)
 	 */
 	TEST_FEATURE ("with kill timer");
 	TEST_ALLOC_FAIL {
-		NihTimer *timer = NULL;
+		WheelTimer *timer = NULL;
 
 		TEST_ALLOC_SAFE {
 			job = job_new (class, "");
@@ -5770,7 +5978,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_KILLED;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -5809,7 +6017,7 @@ test_handler (void)
 	 */
 	TEST_FEATURE ("with restarting process");
 	TEST_ALLOC_FAIL {
-		NihTimer *timer = NULL;
+		WheelTimer *timer = NULL;
 
 		TEST_ALLOC_SAFE {
 			job = job_new (class, "");
@@ -5821,7 +6029,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_KILLED;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -5905,8 +6113,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_MAIN] = 0;
-		job->pid[PROCESS_PRE_START] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
+		job_process_set_pid (job, PROCESS_PRE_START, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -5970,7 +6178,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_PRE_START] = 1;
+		job_process_set_pid (job, PROCESS_PRE_START, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6045,7 +6253,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_PRE_START] = 1;
+		job_process_set_pid (job, PROCESS_PRE_START, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6124,7 +6332,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6188,6 +6396,85 @@ test_handler (void)
 	class->respawn = FALSE;
 
 
+	/* Check that a service with a respawn delay goes into the stopping
+	 * state as usual but with a respawn timer set to hold it before it
+	 * starts again, and that consecutive respawns back off.
+	 */
+	TEST_FEATURE ("with delayed respawn of running service process");
+	class->respawn = TRUE;
+	class->respawn_limit = 5;
+	class->respawn_interval = 10;
+	class->respawn_delay = 10;
+	class->respawn_backoff = 2;
+	class->respawn_delay_max = 100;
+
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			job = job_new (class, "");
+		}
+
+		job->goal = JOB_START;
+		job->state = JOB_RUNNING;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+
+		TEST_DIVERT_STDERR (output) {
+			job_process_handler (NULL, 1, NIH_CHILD_EXITED, 1);
+		}
+		rewind (output);
+
+		TEST_EQ (job->goal, JOB_START);
+		TEST_EQ (job->state, JOB_STOPPING);
+		TEST_EQ (job->pid[PROCESS_MAIN], 0);
+
+		assert0 (clock_gettime (CLOCK_MONOTONIC, &now));
+
+		TEST_NE_P (job->respawn_timer, NULL);
+		TEST_ALLOC_PARENT (job->respawn_timer, job);
+		TEST_EQ (job->respawn_delay, 10);
+		TEST_GE (job->respawn_due, now.tv_sec + 7);
+		TEST_LE (job->respawn_due, now.tv_sec + 10);
+		TEST_EQ (job->respawn_timer->due, job->respawn_due);
+
+		TEST_EQ (job->failed, FALSE);
+
+		TEST_FILE_EQ (output, ("test: test main process (1) "
+				       "terminated with status 1\n"));
+		TEST_FILE_MATCH (output, ("test: test main process ended, "
+					  "respawning in * seconds\n"));
+		TEST_FILE_END (output);
+		TEST_FILE_RESET (output);
+
+		/* Failing again soon after the respawn doubles the delay */
+		nih_free (job->respawn_timer);
+		job->respawn_timer = NULL;
+
+		job->state = JOB_RUNNING;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+
+		blocked = (Blocked *)job->blocker->blocking.next;
+		nih_free (blocked);
+		job->blocker = NULL;
+
+		TEST_DIVERT_STDERR (output) {
+			job_process_handler (NULL, 1, NIH_CHILD_EXITED, 1);
+		}
+		TEST_FILE_RESET (output);
+
+		TEST_NE_P (job->respawn_timer, NULL);
+		TEST_EQ (job->respawn_delay, 20);
+
+		blocked = (Blocked *)job->blocker->blocking.next;
+		nih_free (blocked);
+
+		nih_free (job);
+	}
+
+	class->respawn = FALSE;
+	class->respawn_delay = 0;
+	class->respawn_backoff = 0;
+	class->respawn_delay_max = 0;
+
+
 	/* Check that we can catch the running task of a service stopping
 	 * with an error, and if the job is to be respawned, go into
 	 * the stopping state but don't change the goal to stop.
@@ -6212,7 +6499,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6302,7 +6589,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6379,7 +6666,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6449,7 +6736,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6530,7 +6817,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6598,7 +6885,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6669,7 +6956,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_KILLED;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6720,7 +7007,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6788,7 +7075,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6860,7 +7147,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6924,7 +7211,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_POST_STOP;
-		job->pid[PROCESS_POST_STOP] = 1;
+		job_process_set_pid (job, PROCESS_POST_STOP, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6969,7 +7256,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_POST_STOP;
-		job->pid[PROCESS_POST_STOP] = 1;
+		job_process_set_pid (job, PROCESS_POST_STOP, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7022,7 +7309,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_POST_STOP;
-		job->pid[PROCESS_POST_STOP] = 1;
+		job_process_set_pid (job, PROCESS_POST_STOP, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7077,8 +7364,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7142,7 +7429,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7211,8 +7498,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7271,8 +7558,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7362,8 +7649,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7462,8 +7749,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7569,8 +7856,8 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_PRE_STOP;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_PRE_STOP] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_PRE_STOP, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7647,7 +7934,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_PRE_STOP;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7715,8 +8002,8 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_PRE_STOP;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_PRE_STOP] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_PRE_STOP, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7779,8 +8066,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_STOP;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_PRE_STOP] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_PRE_STOP, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7889,8 +8176,8 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_PRE_STOP;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_PRE_STOP] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_PRE_STOP, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7988,7 +8275,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_STOPPING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -8060,8 +8347,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, pid);
 
 		TEST_FREE_TAG (blocked);
 
@@ -8133,8 +8420,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = pid;
-		job->pid[PROCESS_POST_START] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
+		job_process_set_pid (job, PROCESS_POST_START, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -8204,7 +8491,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_FREE_TAG (blocked);
 
@@ -8273,7 +8560,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_FREE_TAG (blocked);
 
@@ -8345,7 +8632,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_FREE_TAG (blocked);
 
@@ -8411,7 +8698,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid,
@@ -8458,7 +8745,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid,
@@ -8506,7 +8793,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid,
@@ -8555,7 +8842,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid,
@@ -8605,7 +8892,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid,
@@ -8680,7 +8967,7 @@ test_handler (void)
 		/* Now carry on with the test */
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid, NIH_CHILD_PTRACE,
@@ -8749,7 +9036,7 @@ test_handler (void)
 		/* Now carry on with the test */
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid, NIH_CHILD_PTRACE,
@@ -8808,7 +9095,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid, NIH_CHILD_PTRACE,
@@ -8863,7 +9150,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid, NIH_CHILD_PTRACE,
@@ -9206,20 +9493,20 @@ test_find (void)
 	nih_hash_add (job_classes, &class3->entry);
 
 	job1 = job_new (class1, "foo");
-	job1->pid[PROCESS_MAIN] = 10;
-	job1->pid[PROCESS_POST_START] = 15;
+	job_process_set_pid (job1, PROCESS_MAIN, 10);
+	job_process_set_pid (job1, PROCESS_POST_START, 15);
 
 	job2 = job_new (class1, "bar");
 
 	job3 = job_new (class2, "foo");
-	job3->pid[PROCESS_PRE_START] = 20;
+	job_process_set_pid (job3, PROCESS_PRE_START, 20);
 
 	job4 = job_new (class2, "bar");
-	job4->pid[PROCESS_MAIN] = 25;
-	job4->pid[PROCESS_PRE_STOP] = 30;
+	job_process_set_pid (job4, PROCESS_MAIN, 25);
+	job_process_set_pid (job4, PROCESS_PRE_STOP, 30);
 
 	job5 = job_new (class3, "");
-	job5->pid[PROCESS_POST_STOP] = 35;
+	job_process_set_pid (job5, PROCESS_POST_STOP, 35);
 
 
 	/* Check that we can find a job that exists by the pid of its
@@ -9310,6 +9597,189 @@ test_find (void)
 	TEST_EQ_P (ptr, NULL);
 }
 
+void
+test_set_pid (void)
+{
+	JobClass *class;
+	Job      *job;
+
+	TEST_FUNCTION ("job_process_set_pid");
+
+	class = job_class_new (NULL, "test", NULL);
+	job = job_new (class, "");
+
+
+	/* Check that no jobs are running before any process has been set. */
+	TEST_FEATURE ("without processes");
+	TEST_FALSE (job_process_jobs_running ());
+
+
+	/* Check that setting a process id counts the process as running. */
+	TEST_FEATURE ("with process set");
+	job_process_set_pid (job, PROCESS_MAIN, 1000);
+
+	TEST_EQ (job->pid[PROCESS_MAIN], 1000);
+	TEST_TRUE (job_process_jobs_running ());
+
+
+	/* Check that replacing a process id, as when following a fork,
+	 * doesn't count the process again.
+	 */
+	TEST_FEATURE ("with process replaced");
+	job_process_set_pid (job, PROCESS_POST_START, 1001);
+	job_process_set_pid (job, PROCESS_MAIN, 1002);
+	job_process_set_pid (job, PROCESS_MAIN, 0);
+
+	TEST_EQ (job->pid[PROCESS_MAIN], 0);
+	TEST_TRUE (job_process_jobs_running ());
+
+
+	/* Check that once the last process has ended, no jobs are running. */
+	TEST_FEATURE ("with last process ended");
+	job_process_set_pid (job, PROCESS_POST_START, 0);
+
+	TEST_FALSE (job_process_jobs_running ());
+
+	nih_free (job);
+
+
+	/* Check that the processes of a job are no longer counted once
+	 * the job has been freed.
+	 */
+	TEST_FEATURE ("with job freed");
+	job = job_new (class, "");
+	job_process_set_pid (job, PROCESS_MAIN, 1000);
+	job_process_set_pid (job, PROCESS_POST_START, 1001);
+
+	TEST_TRUE (job_process_jobs_running ());
+
+	nih_free (job);
+
+	TEST_FALSE (job_process_jobs_running ());
+
+	nih_free (class);
+}
+
+
+void
+test_watch (void)
+{
+	JobClass    *class;
+	Job         *job;
+	ProcessType  process;
+	FILE        *output;
+	siginfo_t    info;
+	pid_t        pid;
+	int          status;
+
+	TEST_FUNCTION ("job_process_watch_add");
+	nih_timer_init ();
+	event_init ();
+
+	use_pidfd = TRUE;
+
+	output = tmpfile ();
+
+	class = job_class_new (NULL, "test", NULL);
+	class->kill_timeout = 1000;
+	class->process[PROCESS_MAIN] = process_new (class);
+	nih_hash_add (job_classes, &class->entry);
+
+
+	/* Check that a process we hold a process file descriptor for is
+	 * found through it.
+	 */
+	TEST_FEATURE ("with running process");
+	job = job_new (class, "");
+	job->goal = JOB_STOP;
+	job->state = JOB_KILLED;
+
+	TEST_CHILD (pid) {
+		pause ();
+	}
+	setpgid (pid, pid);
+
+	job_process_set_pid (job, PROCESS_MAIN, pid);
+	job_process_watch_add (job, PROCESS_MAIN);
+
+	if (! use_pidfd) {
+		printf ("SKIP: process file descriptors not supported\n");
+		kill (pid, SIGKILL);
+		waitpid (pid, &status, 0);
+		nih_free (class);
+		fclose (output);
+		return;
+	}
+
+	TEST_EQ_P (job_process_find (pid, &process), job);
+	TEST_EQ (process, PROCESS_MAIN);
+
+
+	/* Check that once the process exits, it is reaped when its process
+	 * file descriptor becomes readable and that its exit is only
+	 * handled once the batch is polled.
+	 */
+	TEST_FEATURE ("with exited process");
+	kill (pid, SIGTERM);
+
+	memset (&info, 0, sizeof (info));
+	assert0 (waitid (P_PID, pid, &info, WEXITED | WNOWAIT));
+
+	TEST_WATCH_UPDATE ();
+
+	TEST_EQ (waitpid (pid, &status, WNOHANG), -1);
+	TEST_EQ (errno, ECHILD);
+
+	TEST_EQ (job->pid[PROCESS_MAIN], pid);
+
+	TEST_FREE_TAG (job);
+
+	TEST_DIVERT_STDERR (output) {
+		job_process_watch_poll ();
+	}
+	rewind (output);
+
+	TEST_FREE (job);
+
+	TEST_FILE_MATCH (output, "test main process (*) killed by TERM signal\n");
+	TEST_FILE_END (output);
+	TEST_FILE_RESET (output);
+
+
+	/* Check that a process reaped behind our back isn't signalled
+	 * through its process id, which may since have been reused.
+	 */
+	TEST_FEATURE ("with process reaped elsewhere");
+	job = job_new (class, "");
+	job->goal = JOB_STOP;
+	job->state = JOB_KILLED;
+
+	TEST_CHILD (pid) {
+		pause ();
+	}
+	setpgid (pid, pid);
+
+	job_process_set_pid (job, PROCESS_MAIN, pid);
+	job_process_watch_add (job, PROCESS_MAIN);
+
+	kill (pid, SIGKILL);
+	TEST_EQ (waitpid (pid, &status, 0), pid);
+
+	job_process_kill (job, PROCESS_MAIN);
+
+	TEST_EQ_P (job->kill_timer, NULL);
+	TEST_EQ (job->kill_process, PROCESS_INVALID);
+
+	nih_free (job);
+
+	event_poll ();
+
+	use_pidfd = FALSE;
+
+	nih_free (class);
+	fclose (output);
+}
+
 
 void
 test_utmp (void)
@@ -9355,7 +9825,7 @@ test_utmp (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -9420,7 +9890,7 @@ test_utmp (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -9488,7 +9958,7 @@ test_utmp (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -9558,6 +10028,8 @@ run_tests (void)
 	test_handler ();
 	test_utmp ();
 	test_find ();
+	test_set_pid ();
+	test_watch ();
 }
 
 /**
@@ -9735,6 +10207,11 @@ main (int   argc,
 	/* run tests in legacy (pre-session support) mode */
 	setenv ("UPSTART_NO_SESSIONS", "1", 1);
 
+	/* Blocked structures are checked to be freed once handled, so
+	 * they must not be kept for reuse.
+	 */
+	blocked_pool_max = 0;
+
 
 	/* We re-exec this binary to test various children features.  To
 	 * do that, we need to know the full path to the program.
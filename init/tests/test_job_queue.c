@@ -0,0 +1,412 @@
+/* upstart
+ *
+ * test_job_queue.c - test suite for init/job_queue.c
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+
+#include "job_class.h"
+#include "job.h"
+#include "event.h"
+#include "job_queue.h"
+#include "test_util_common.h"
+
+
+static Job *
+new_queued_job (JobClass   *class,
+		const char *name)
+{
+	Job *job;
+
+	job = job_new (class, name);
+	job->goal = JOB_START;
+	job->state = JOB_QUEUED;
+
+	return job;
+}
+
+
+void
+test_enter (void)
+{
+	JobClass *class1;
+	JobClass *class2;
+	Job      *job;
+	Job      *job1;
+	Job      *job2;
+	Job      *job3;
+
+	TEST_FUNCTION ("job_queue_enter");
+	job_class_init ();
+	event_init ();
+
+	class1 = job_class_new (NULL, "foo", NULL);
+	class2 = job_class_new (NULL, "bar", NULL);
+
+
+	/* Check that a job is given a spawn slot straight away when there
+	 * is no limit.
+	 */
+	TEST_FEATURE ("without limit");
+	job1 = new_queued_job (class1, "a");
+
+	TEST_TRUE (job_queue_enter (job1));
+
+	TEST_TRUE (job1->spawn_slot);
+	TEST_EQ_P (job1->queued, NULL);
+	TEST_EQ (class1->spawning, 1);
+	TEST_EQ (job_queue_spawning (), 1);
+	TEST_EQ (job_queue_depth (), 0);
+
+	nih_free (job1);
+
+	TEST_EQ (class1->spawning, 0);
+	TEST_EQ (job_queue_spawning (), 0);
+
+
+	/* Check that a job is queued when the global limit has been
+	 * reached, and that it is a child of the job.
+	 */
+	TEST_FEATURE ("with global limit reached");
+	max_concurrent_spawns = 1;
+
+	job1 = new_queued_job (class1, "a");
+	job2 = new_queued_job (class2, "b");
+
+	TEST_TRUE (job_queue_enter (job1));
+	TEST_FALSE (job_queue_enter (job2));
+
+	TEST_FALSE (job2->spawn_slot);
+	TEST_NE_P (job2->queued, NULL);
+	TEST_ALLOC_PARENT (job2->queued, job2);
+	TEST_EQ_P (job2->queued->data, job2);
+	TEST_EQ (job_queue_depth (), 1);
+
+	nih_free (job2);
+
+	TEST_EQ (job_queue_depth (), 0);
+
+	nih_free (job1);
+
+	max_concurrent_spawns = 0;
+
+
+	/* Check that a job is queued when its class limit has been
+	 * reached, but that a job of another class is not.
+	 */
+	TEST_FEATURE ("with class limit reached");
+	class1->concurrency = 1;
+
+	job1 = new_queued_job (class1, "a");
+	job2 = new_queued_job (class1, "b");
+	job3 = new_queued_job (class2, "c");
+
+	TEST_TRUE (job_queue_enter (job1));
+	TEST_FALSE (job_queue_enter (job2));
+	TEST_TRUE (job_queue_enter (job3));
+
+	TEST_EQ (class1->spawning, 1);
+	TEST_EQ (class2->spawning, 1);
+	TEST_EQ (job_queue_spawning (), 2);
+	TEST_EQ (job_queue_depth (), 1);
+
+	nih_free (job3);
+	nih_free (job2);
+	nih_free (job1);
+
+	class1->concurrency = 0;
+
+
+	/* Check that a job of a higher priority class is queued ahead of
+	 * those of lower priority, but behind those of the same priority
+	 * that were queued before it.
+	 */
+	TEST_FEATURE ("with higher priority");
+	max_concurrent_spawns = 1;
+	class2->priority = 10;
+
+	job1 = new_queued_job (class1, "a");
+	job2 = new_queued_job (class2, "b");
+	job3 = new_queued_job (class2, "c");
+
+	TEST_TRUE (job_queue_enter (job1));
+
+	job = new_queued_job (class1, "d");
+	TEST_FALSE (job_queue_enter (job));
+	TEST_FALSE (job_queue_enter (job2));
+	TEST_FALSE (job_queue_enter (job3));
+
+	TEST_EQ_P (job_queue->next, &job2->queued->entry);
+	TEST_EQ_P (job2->queued->entry.next, &job3->queued->entry);
+	TEST_EQ_P (job3->queued->entry.next, &job->queued->entry);
+
+	job_queue_leave (job1);
+
+	TEST_TRUE (job2->spawn_slot);
+	TEST_FALSE (job3->spawn_slot);
+	TEST_FALSE (job->spawn_slot);
+
+	nih_free (job);
+	nih_free (job3);
+	nih_free (job2);
+	nih_free (job1);
+
+	class2->priority = 0;
+	max_concurrent_spawns = 0;
+
+	nih_free (class2);
+	nih_free (class1);
+}
+
+
+void
+test_leave (void)
+{
+	JobClass *class;
+	Job      *job1;
+	Job      *job2;
+	Job      *job3;
+
+	TEST_FUNCTION ("job_queue_leave");
+	job_class_init ();
+	event_init ();
+
+	class = job_class_new (NULL, "test", NULL);
+
+
+	/* Check that releasing a spawn slot gives it to the first queued
+	 * job, which is left in the queued state until the queue is
+	 * polled.
+	 */
+	TEST_FEATURE ("with queued job");
+	max_concurrent_spawns = 1;
+
+	job1 = new_queued_job (class, "a");
+	job2 = new_queued_job (class, "b");
+	job3 = new_queued_job (class, "c");
+
+	TEST_TRUE (job_queue_enter (job1));
+	TEST_FALSE (job_queue_enter (job2));
+	TEST_FALSE (job_queue_enter (job3));
+
+	job_queue_leave (job1);
+
+	TEST_FALSE (job1->spawn_slot);
+	TEST_TRUE (job2->spawn_slot);
+	TEST_EQ (job2->state, JOB_QUEUED);
+	TEST_FALSE (job3->spawn_slot);
+	TEST_EQ (job_queue_spawning (), 1);
+	TEST_EQ (job_queue_depth (), 1);
+
+
+	/* Check that polling the queue moves the job given the slot on,
+	 * and that once it has finished starting the next job is given
+	 * the slot and moved on too.
+	 */
+	TEST_FEATURE ("with queue polled");
+	job_queue_poll ();
+
+	TEST_EQ (job2->state, JOB_RUNNING);
+	TEST_FALSE (job2->spawn_slot);
+	TEST_EQ_P (job2->queued, NULL);
+
+	TEST_EQ (job3->state, JOB_RUNNING);
+	TEST_FALSE (job3->spawn_slot);
+	TEST_EQ_P (job3->queued, NULL);
+
+	TEST_EQ (job_queue_spawning (), 0);
+	TEST_EQ (job_queue_depth (), 0);
+
+	event_poll ();
+
+	nih_free (job3);
+	nih_free (job2);
+
+
+	/* Check that a job given a slot but then stopped before the queue
+	 * is polled gives up the slot.
+	 */
+	TEST_FEATURE ("with job stopped");
+	job2 = new_queued_job (class, "b");
+
+	TEST_TRUE (job_queue_enter (job1));
+	TEST_FALSE (job_queue_enter (job2));
+
+	job_queue_leave (job1);
+
+	TEST_TRUE (job2->spawn_slot);
+
+	job_change_goal (job2, JOB_STOP);
+
+	TEST_EQ (job2->state, JOB_STOPPING);
+	TEST_FALSE (job2->spawn_slot);
+	TEST_EQ_P (job2->queued, NULL);
+	TEST_EQ (job_queue_spawning (), 0);
+
+	job_queue_poll ();
+
+	TEST_EQ (job2->state, JOB_STOPPING);
+
+	nih_free (job2->blocker);
+	job2->blocker = NULL;
+
+	nih_free (job2);
+	nih_free (job1);
+
+	event_poll ();
+
+	max_concurrent_spawns = 0;
+
+	nih_free (class);
+}
+
+
+void
+test_set_limit (void)
+{
+	JobClass *class;
+	Job      *job1;
+	Job      *job2;
+	Job      *job3;
+
+	TEST_FUNCTION ("job_queue_set_limit");
+	job_class_init ();
+	event_init ();
+
+	class = job_class_new (NULL, "test", NULL);
+
+
+	/* Check that raising the limit gives the new slots to queued
+	 * jobs in the order they were queued.
+	 */
+	TEST_FEATURE ("with limit raised");
+	job_queue_set_limit (1);
+
+	job1 = new_queued_job (class, "a");
+	job2 = new_queued_job (class, "b");
+	job3 = new_queued_job (class, "c");
+
+	TEST_TRUE (job_queue_enter (job1));
+	TEST_FALSE (job_queue_enter (job2));
+	TEST_FALSE (job_queue_enter (job3));
+
+	job_queue_set_limit (2);
+
+	TEST_EQ (max_concurrent_spawns, 2);
+	TEST_TRUE (job2->spawn_slot);
+	TEST_FALSE (job3->spawn_slot);
+	TEST_EQ (job_queue_spawning (), 2);
+	TEST_EQ (job_queue_depth (), 1);
+
+
+	/* Check that removing the limit gives every queued job a slot. */
+	TEST_FEATURE ("with limit removed");
+	job_queue_set_limit (0);
+
+	TEST_TRUE (job3->spawn_slot);
+	TEST_EQ (job_queue_spawning (), 3);
+	TEST_EQ (job_queue_depth (), 0);
+
+	nih_free (job3);
+	nih_free (job2);
+	nih_free (job1);
+
+	TEST_EQ (job_queue_spawning (), 0);
+
+	nih_free (class);
+}
+
+
+void
+test_jobs (void)
+{
+	JobClass  *class;
+	Job       *job1;
+	Job       *job2;
+	char     **jobs;
+	char      *name;
+
+	TEST_FUNCTION ("job_queue_jobs");
+	job_class_init ();
+	event_init ();
+
+	class = job_class_new (NULL, "test", NULL);
+
+	max_concurrent_spawns = 1;
+
+	job1 = new_queued_job (class, "a");
+	job2 = new_queued_job (class, "b");
+
+	TEST_TRUE (job_queue_enter (job1));
+	TEST_FALSE (job_queue_enter (job2));
+
+
+	/* Check that each queued job is described by the time it has
+	 * waited followed by its name.
+	 */
+	TEST_FEATURE ("with queued job");
+	TEST_ALLOC_FAIL {
+		jobs = job_queue_jobs (NULL);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (jobs, NULL);
+			continue;
+		}
+
+		TEST_NE_P (jobs[0], NULL);
+		TEST_ALLOC_PARENT (jobs[0], jobs);
+
+		strtoull (jobs[0], &name, 10);
+		TEST_EQ_STR (name, " test (b)");
+
+		TEST_EQ_P (jobs[1], NULL);
+
+		nih_free (jobs);
+	}
+
+	nih_free (job2);
+	nih_free (job1);
+
+	max_concurrent_spawns = 0;
+
+	nih_free (class);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	test_enter ();
+	test_leave ();
+	test_set_limit ();
+	test_jobs ();
+
+	return 0;
+}
@@ -0,0 +1,315 @@
+/* upstart
+ *
+ * test_notify.c - test suite for init/notify.c
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/hash.h>
+#include <nih/io.h>
+#include <nih/main.h>
+
+#include "job_class.h"
+#include "job_process.h"
+#include "job.h"
+#include "event.h"
+#include "notify.h"
+#include "test_util_common.h"
+
+
+void
+test_message (void)
+{
+	JobClass *class;
+	Job      *job;
+	FILE     *output;
+	pid_t     pid;
+	char      buf[128];
+	int       len;
+
+	TEST_FUNCTION ("notify_message");
+	event_init ();
+
+	output = tmpfile ();
+
+	class = job_class_new (NULL, "test", NULL);
+	class->expect = EXPECT_NOTIFY;
+	class->process[PROCESS_MAIN] = process_new (class);
+	nih_hash_add (job_classes, &class->entry);
+
+
+	/* Check that READY=1 from the main process moves the job out of
+	 * the spawned state.
+	 */
+	TEST_FEATURE ("with ready main process");
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_SPAWNED;
+	job_process_set_pid (job, PROCESS_MAIN, 1000);
+
+	notify_message (1000, "READY=1", 7);
+
+	TEST_EQ (job->goal, JOB_START);
+	TEST_EQ (job->state, JOB_RUNNING);
+	TEST_EQ (job->pid[PROCESS_MAIN], 1000);
+
+	nih_free (job);
+	event_poll ();
+
+
+	/* Check that MAINPID= changes the main process of the job to a
+	 * descendant of its main process, and is acted on before READY=1
+	 * in the same message.
+	 */
+	TEST_FEATURE ("with new main process");
+	TEST_CHILD (pid) {
+		pause ();
+	}
+
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_SPAWNED;
+	job_process_set_pid (job, PROCESS_MAIN, getpid ());
+
+	len = sprintf (buf, "STATUS=Starting\nREADY=1\nMAINPID=%d\n", pid);
+	notify_message (getpid (), buf, len);
+
+	TEST_EQ (job->state, JOB_RUNNING);
+	TEST_EQ (job->pid[PROCESS_MAIN], pid);
+
+	nih_free (job);
+	event_poll ();
+
+	kill (pid, SIGTERM);
+	waitpid (pid, NULL, 0);
+
+
+	/* Check that a MAINPID= process that is not a descendant of the
+	 * main process, nor in the job's cgroups, is warned about and
+	 * ignored so that the job cannot have another process supervised.
+	 */
+	TEST_FEATURE ("with foreign main process");
+	TEST_CHILD (pid) {
+		pause ();
+	}
+
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_SPAWNED;
+	job_process_set_pid (job, PROCESS_MAIN, pid);
+
+	len = sprintf (buf, "MAINPID=%d", getpid ());
+
+	TEST_DIVERT_STDERR (output) {
+		notify_message (pid, buf, len);
+	}
+	rewind (output);
+
+	TEST_EQ (job->state, JOB_SPAWNED);
+	TEST_EQ (job->pid[PROCESS_MAIN], pid);
+
+	sprintf (buf, "test: test main process (%d) sent main process (%d) "
+		 "not belonging to job\n", pid, getpid ());
+	TEST_FILE_EQ (output, buf);
+	TEST_FILE_END (output);
+	TEST_FILE_RESET (output);
+
+	nih_free (job);
+
+	kill (pid, SIGTERM);
+	waitpid (pid, NULL, 0);
+
+
+	/* Check that an invalid MAINPID= is warned about and ignored. */
+	TEST_FEATURE ("with invalid main process");
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_SPAWNED;
+	job_process_set_pid (job, PROCESS_MAIN, 1000);
+
+	TEST_DIVERT_STDERR (output) {
+		notify_message (1000, "MAINPID=foo", 11);
+	}
+	rewind (output);
+
+	TEST_EQ (job->state, JOB_SPAWNED);
+	TEST_EQ (job->pid[PROCESS_MAIN], 1000);
+
+	TEST_FILE_EQ (output, ("test: test main process (1000) sent "
+			       "invalid main process: foo\n"));
+	TEST_FILE_END (output);
+	TEST_FILE_RESET (output);
+
+	nih_free (job);
+
+
+	/* Check that a message from a process other than the main process
+	 * is ignored.
+	 */
+	TEST_FEATURE ("with other process");
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_SPAWNED;
+	job_process_set_pid (job, PROCESS_MAIN, 1000);
+	job_process_set_pid (job, PROCESS_POST_STOP, 1002);
+
+	notify_message (1002, "READY=1", 7);
+	notify_message (1003, "READY=1", 7);
+
+	TEST_EQ (job->state, JOB_SPAWNED);
+
+	nih_free (job);
+
+
+	/* Check that a message is ignored if the job doesn't expect to be
+	 * notified.
+	 */
+	TEST_FEATURE ("with job not expecting notification");
+	class->expect = EXPECT_NONE;
+
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_SPAWNED;
+	job_process_set_pid (job, PROCESS_MAIN, 1000);
+
+	notify_message (1000, "READY=1", 7);
+
+	TEST_EQ (job->state, JOB_SPAWNED);
+
+	nih_free (job);
+
+	class->expect = EXPECT_NOTIFY;
+
+
+	/* Check that READY=1 is ignored outside of the spawned state. */
+	TEST_FEATURE ("with job already running");
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_RUNNING;
+	job_process_set_pid (job, PROCESS_MAIN, 1000);
+
+	notify_message (1000, "READY=1", 7);
+
+	TEST_EQ (job->goal, JOB_START);
+	TEST_EQ (job->state, JOB_RUNNING);
+
+	nih_free (job);
+
+	nih_free (class);
+	fclose (output);
+}
+
+
+void
+test_socket (void)
+{
+	JobClass           *class;
+	Job                *job;
+	struct sockaddr_un  addr;
+	socklen_t           addrlen;
+	const char         *name;
+	int                 fd;
+
+	TEST_FUNCTION ("notify_init");
+	nih_io_init ();
+	event_init ();
+
+	class = job_class_new (NULL, "test", NULL);
+	class->expect = EXPECT_NOTIFY;
+	class->process[PROCESS_MAIN] = process_new (class);
+	nih_hash_add (job_classes, &class->entry);
+
+
+	/* Check that the socket is created in the abstract namespace with
+	 * a name that includes our process id.
+	 */
+	TEST_FEATURE ("with new socket");
+	TEST_FALSE (notify_available ());
+	TEST_EQ (notify_init (), 0);
+	TEST_TRUE (notify_available ());
+
+	name = notify_socket_name ();
+	TEST_EQ (name[0], '@');
+	TEST_NE_P (strstr (name, NOTIFY_SOCKET_PATH), NULL);
+
+	TEST_EQ (notify_init (), 0);
+	TEST_EQ_STR (notify_socket_name (), name);
+
+
+	/* Check that a message sent to the socket is received with the
+	 * credentials of the sender, and handled.
+	 */
+	TEST_FEATURE ("with message sent to socket");
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_SPAWNED;
+	job_process_set_pid (job, PROCESS_MAIN, getpid ());
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	memcpy (addr.sun_path, name, strlen (name));
+	addr.sun_path[0] = '\0';
+	addrlen = offsetof (struct sockaddr_un, sun_path) + strlen (name);
+
+	fd = socket (AF_UNIX, SOCK_DGRAM, 0);
+	TEST_GE (fd, 0);
+
+	TEST_EQ (sendto (fd, "READY=1\n", 8, 0,
+			 (struct sockaddr *)&addr, addrlen), 8);
+
+	TEST_WATCH_UPDATE ();
+
+	TEST_EQ (job->state, JOB_RUNNING);
+
+	close (fd);
+
+	nih_free (job);
+	event_poll ();
+
+	nih_free (class);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	job_class_init ();
+
+	test_message ();
+	test_socket ();
+
+	return 0;
+}
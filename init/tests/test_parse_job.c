@@ -37,6 +37,7 @@
 #include "parse_job.h"
 #include "errors.h"
 #include "apparmor.h"
+#include "pressure.h"
 
 #ifdef ENABLE_CGROUPS
 
@@ -4328,6 +4329,39 @@ test_stanza_expect (void)
 	}
 
 
+	/* Check that expect notify sets the job's expect member to
+	 * EXPECT_NOTIFY.
+	 */
+	TEST_FEATURE ("with notify argument");
+	strcpy (buf, "expect notify\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_EQ (job->expect, EXPECT_NOTIFY);
+
+		nih_free (job);
+	}
+
+
 	/* Check that expect none sets the job's expect member to
 	 * EXPECT_NONE.
 	 */
@@ -4836,6 +4870,134 @@ test_stanza_respawn (void)
 	nih_free (err);
 
 
+	/* Check that a respawn delay stanza sets the time to wait before
+	 * respawning.
+	 */
+	TEST_FEATURE ("with delay argument");
+	strcpy (buf, "respawn delay 5\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_FALSE (job->respawn);
+		TEST_EQ (job->respawn_delay, 5);
+		TEST_EQ (job->respawn_backoff, 0);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a respawn backoff stanza sets the factor and maximum
+	 * of the respawn delay.
+	 */
+	TEST_FEATURE ("with backoff arguments");
+	strcpy (buf, "respawn delay 1\n");
+	strcat (buf, "respawn backoff 2 60\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 3);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_EQ (job->respawn_delay, 1);
+		TEST_EQ (job->respawn_backoff, 2);
+		TEST_EQ (job->respawn_delay_max, 60);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a respawn delay stanza with a non-integer argument
+	 * results in a syntax error.
+	 */
+	TEST_FEATURE ("with non-integer delay argument");
+	strcpy (buf, "respawn delay foo\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_INTERVAL);
+	TEST_EQ (pos, 14);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a respawn backoff stanza with a zero factor results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with zero backoff factor");
+	strcpy (buf, "respawn backoff 0 60\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_BACKOFF);
+	TEST_EQ (pos, 16);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a respawn backoff stanza without a maximum results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with missing backoff maximum");
+	strcpy (buf, "respawn backoff 2\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_EXPECTED_TOKEN);
+	TEST_EQ (pos, 17);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
 	/* Check that a respawn stanza with an unknown second argument
 	 * results in a syntax error.
 	 */
@@ -8826,49 +8988,127 @@ test_stanza_usage (void)
 	nih_free (err);
 }
 
-#ifdef ENABLE_CGROUPS
-
 void
-test_stanza_cgroup (void)
+test_stanza_concurrency (void)
 {
-	JobClass       *job;
-	NihError       *err;
-	CGroup         *cgroup;
-	CGroupName     *cgname;
-	CGroupSetting  *setting;
-	size_t          pos;
-	size_t          lineno;
-	char            buf[1024];
-	int             len;
-	size_t          count;
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
 
-	TEST_FUNCTION ("stanza_cgroup");
+	TEST_FUNCTION ("stanza_concurrency");
 
-	TEST_FEATURE ("no arguments rejected");
+	/* Check that a concurrency stanza with a positive argument results
+	 * in it being stored in the job.
+	 */
+	TEST_FEATURE ("with positive argument");
+	strcpy (buf, "concurrency 4\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_EQ (job->concurrency, 4);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a concurrency stanza without an argument results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with missing argument");
+	strcpy (buf, "concurrency\n");
 
 	pos = 0;
 	lineno = 1;
-	len = sprintf (buf, "cgroup\n");
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
 
-	job = parse_job (NULL, NULL, NULL, "test", buf, len, &pos, &lineno);
 	TEST_EQ_P (job, NULL);
 
 	err = nih_error_get ();
 	TEST_EQ (err->number, NIH_CONFIG_EXPECTED_TOKEN);
+	TEST_EQ (pos, 11);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
 
-	/* Don't count NL */
-	TEST_EQ (pos, (size_t)len-1);
 
+	/* Check that a concurrency stanza with a zero argument results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with zero argument");
+	strcpy (buf, "concurrency 0\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_CONCURRENCY);
+	TEST_EQ (pos, 12);
 	TEST_EQ (lineno, 1);
 	nih_free (err);
 
-	TEST_FEATURE ("single argument (controller) accepted");
+
+	/* Check that a concurrency stanza with a non-integer argument
+	 * results in a syntax error.
+	 */
+	TEST_FEATURE ("with non-integer argument");
+	strcpy (buf, "concurrency foo\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_CONCURRENCY);
+	TEST_EQ (pos, 12);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_priority (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_priority");
+
+	/* Check that a priority stanza with a positive argument results
+	 * in it being stored in the job.
+	 */
+	TEST_FEATURE ("with positive argument");
+	strcpy (buf, "priority 10\n");
 
 	TEST_ALLOC_FAIL {
 		pos = 0;
 		lineno = 1;
-		len = sprintf (buf, "cgroup perf_event\n");
-		job = parse_job (NULL, NULL, NULL, "test", buf, len, &pos, &lineno);
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
 
 		if (test_alloc_failed) {
 			TEST_EQ_P (job, NULL);
@@ -8880,27 +9120,254 @@ test_stanza_cgroup (void)
 			continue;
 		}
 
-		TEST_NE_P (job, NULL);
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
 
-		TEST_LIST_NOT_EMPTY (&job->cgroups);
-		count = test_list_count (&job->cgroups);
-		TEST_EQ (count, 1);
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
 
-		cgroup = (CGroup *)test_list_get_index (&job->cgroups, 0);
-		TEST_NE_P (cgroup, NULL);
-		TEST_ALLOC_PARENT (cgroup, job);
-		TEST_ALLOC_SIZE (cgroup, sizeof (CGroup));
-		TEST_EQ_STR (cgroup->controller, "perf_event");
-		TEST_ALLOC_PARENT (cgroup->controller, cgroup);
-		TEST_ALLOC_SIZE (cgroup->controller, 1+strlen ("perf_event"));
+		TEST_EQ (job->priority, 10);
 
-		count = test_list_count (&cgroup->names);
-		TEST_EQ (count, 1);
+		nih_free (job);
+	}
 
-		cgname = (CGroupName *)test_list_get_index (&cgroup->names, 0);
-		TEST_NE_P (cgname, NULL);
 
-		TEST_ALLOC_PARENT (cgname, cgroup);
+	/* Check that a priority stanza with a negative argument results
+	 * in it being stored in the job.
+	 */
+	TEST_FEATURE ("with negative argument");
+	strcpy (buf, "priority -5\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_EQ (job->priority, -5);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a priority stanza without an argument results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with missing argument");
+	strcpy (buf, "priority\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_EXPECTED_TOKEN);
+	TEST_EQ (pos, 8);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a priority stanza with a non-integer argument results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with non-integer argument");
+	strcpy (buf, "priority foo\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_PRIORITY);
+	TEST_EQ (pos, 9);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_defer_under_pressure (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_defer_under_pressure");
+
+	/* Check that a defer-under-pressure stanza without an argument
+	 * results in the default maximum delay being stored in the job.
+	 */
+	TEST_FEATURE ("with no argument");
+	strcpy (buf, "defer-under-pressure\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_EQ (job->defer_under_pressure, PRESSURE_DEFAULT_DELAY);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a defer-under-pressure stanza with an argument
+	 * results in it being stored in the job as the maximum delay.
+	 */
+	TEST_FEATURE ("with delay");
+	strcpy (buf, "defer-under-pressure 60\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_EQ (job->defer_under_pressure, 60);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a defer-under-pressure stanza with a zero delay
+	 * results in a syntax error.
+	 */
+	TEST_FEATURE ("with zero delay");
+	strcpy (buf, "defer-under-pressure 0\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_INTERVAL);
+	TEST_EQ (pos, 21);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+#ifdef ENABLE_CGROUPS
+
+void
+test_stanza_cgroup (void)
+{
+	JobClass       *job;
+	NihError       *err;
+	CGroup         *cgroup;
+	CGroupName     *cgname;
+	CGroupSetting  *setting;
+	size_t          pos;
+	size_t          lineno;
+	char            buf[1024];
+	int             len;
+	size_t          count;
+
+	TEST_FUNCTION ("stanza_cgroup");
+
+	TEST_FEATURE ("no arguments rejected");
+
+	pos = 0;
+	lineno = 1;
+	len = sprintf (buf, "cgroup\n");
+
+	job = parse_job (NULL, NULL, NULL, "test", buf, len, &pos, &lineno);
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_EXPECTED_TOKEN);
+
+	/* Don't count NL */
+	TEST_EQ (pos, (size_t)len-1);
+
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+	TEST_FEATURE ("single argument (controller) accepted");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		len = sprintf (buf, "cgroup perf_event\n");
+		job = parse_job (NULL, NULL, NULL, "test", buf, len, &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_NE_P (job, NULL);
+
+		TEST_LIST_NOT_EMPTY (&job->cgroups);
+		count = test_list_count (&job->cgroups);
+		TEST_EQ (count, 1);
+
+		cgroup = (CGroup *)test_list_get_index (&job->cgroups, 0);
+		TEST_NE_P (cgroup, NULL);
+		TEST_ALLOC_PARENT (cgroup, job);
+		TEST_ALLOC_SIZE (cgroup, sizeof (CGroup));
+		TEST_EQ_STR (cgroup->controller, "perf_event");
+		TEST_ALLOC_PARENT (cgroup->controller, cgroup);
+		TEST_ALLOC_SIZE (cgroup->controller, 1+strlen ("perf_event"));
+
+		count = test_list_count (&cgroup->names);
+		TEST_EQ (count, 1);
+
+		cgname = (CGroupName *)test_list_get_index (&cgroup->names, 0);
+		TEST_NE_P (cgname, NULL);
+
+		TEST_ALLOC_PARENT (cgname, cgroup);
 		TEST_ALLOC_SIZE (cgname, sizeof (CGroupName));
 		TEST_EQ_STR (cgname->name, "$UPSTART_CGROUP");
 		TEST_ALLOC_PARENT (cgname->name, cgname);
@@ -9702,36 +10169,497 @@ test_stanza_cgroup (void)
 
 #endif /* ENABLE_CGROUPS */
 
-int
-main (int   argc,
-      char *argv[])
+void
+test_stanza_cpu_weight (void)
 {
-	/* run tests in legacy (pre-session support) mode */
-	setenv ("UPSTART_NO_SESSIONS", "1", 1);
-
-	test_parse_job ();
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
 
-	test_stanza_instance ();
+	TEST_FUNCTION ("stanza_cpu_weight");
 
-	test_stanza_description ();
-	test_stanza_version ();
-	test_stanza_author ();
+	/* Check that a cpu-weight stanza with an argument results in
+	 * it being stored in the job, whichever cgroup hierarchy is in
+	 * use.
+	 */
+	TEST_FEATURE ("with single argument");
+	strcpy (buf, "cpu-weight 200\n");
 
-	test_stanza_env ();
-	test_stanza_export ();
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
 
-	test_stanza_start ();
-	test_stanza_stop ();
-	test_stanza_emits ();
-	test_stanza_manual ();
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
 
-	test_stanza_exec ();
-	test_stanza_script ();
-	test_stanza_apparmor ();
-	test_stanza_pre_start ();
-	test_stanza_post_start ();
-	test_stanza_pre_stop ();
-	test_stanza_post_stop ();
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_EQ (job->cpu_weight, 200);
+		TEST_LIST_EMPTY (&job->cgroups);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a cpu-weight stanza with a weight out of range
+	 * results in a syntax error.
+	 */
+	TEST_FEATURE ("with weight out of range");
+	strcpy (buf, "cpu-weight 10001\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+			 &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_WEIGHT);
+	TEST_EQ (pos, 11);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a cpu-weight stanza without an argument results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with missing argument");
+	strcpy (buf, "cpu-weight\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+			 &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_EXPECTED_TOKEN);
+	TEST_EQ (pos, 10);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_cpu_quota (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_cpu_quota");
+
+	/* Check that a cpu-quota stanza with a percentage results in it
+	 * being stored in the job.
+	 */
+	TEST_FEATURE ("with percentage");
+	strcpy (buf, "cpu-quota 50%\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_EQ (job->cpu_quota, 50);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a cpu-quota stanza of more than one CPU, without the
+	 * percent sign, is accepted.
+	 */
+	TEST_FEATURE ("with more than one CPU");
+	strcpy (buf, "cpu-quota 250\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+			 &pos, &lineno);
+
+	TEST_NE_P (job, NULL);
+	TEST_EQ (job->cpu_quota, 250);
+
+	nih_free (job);
+
+
+	/* Check that a cpu-quota stanza with a zero quota results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with zero quota");
+	strcpy (buf, "cpu-quota 0%\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+			 &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_QUOTA);
+	TEST_EQ (pos, 10);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_memory_max (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_memory_max");
+
+	/* Check that a memory-max stanza with a suffixed size results in
+	 * the size in bytes being stored in the job.
+	 */
+	TEST_FEATURE ("with suffixed size");
+	strcpy (buf, "memory-max 512M\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_EQ (job->memory_max, 536870912ULL);
+
+		nih_free (job);
+	}
+
+
+	/* Check that an unlimited memory-max stanza is stored as
+	 * JOB_MEMORY_UNLIMITED.
+	 */
+	TEST_FEATURE ("with unlimited size");
+	strcpy (buf, "memory-max unlimited\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+			 &pos, &lineno);
+
+	TEST_NE_P (job, NULL);
+	TEST_EQ (job->memory_max, JOB_MEMORY_UNLIMITED);
+
+	nih_free (job);
+
+
+	/* Check that a memory-max stanza with an unknown suffix results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with unknown suffix");
+	strcpy (buf, "memory-max 12X\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+			 &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_SIZE);
+	TEST_EQ (pos, 11);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_memory_high (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_memory_high");
+
+	/* Check that a memory-high stanza results in the size in bytes
+	 * being stored in the job, leaving the maximum alone.
+	 */
+	TEST_FEATURE ("with suffixed size");
+	strcpy (buf, "memory-high 1G\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_EQ (job->memory_high, 1073741824ULL);
+		TEST_EQ (job->memory_max, 0);
+
+		nih_free (job);
+	}
+}
+
+void
+test_stanza_io_weight (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_io_weight");
+
+	/* Check that an io-weight stanza with an argument results in it
+	 * being stored in the job.
+	 */
+	TEST_FEATURE ("with single argument");
+	strcpy (buf, "io-weight 50\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_EQ (job->io_weight, 50);
+
+		nih_free (job);
+	}
+
+
+	/* Check that an io-weight stanza with a non-integer argument
+	 * results in a syntax error.
+	 */
+	TEST_FEATURE ("with non-integer argument");
+	strcpy (buf, "io-weight foo\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+			 &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_WEIGHT);
+	TEST_EQ (pos, 10);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_cpuset (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_cpuset");
+
+	/* Check that a cpuset stanza with only a list of CPUs results in
+	 * it being stored in the job without any memory nodes.
+	 */
+	TEST_FEATURE ("with list of CPUs");
+	strcpy (buf, "cpuset 0-3,6\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_PARENT (job->cpuset_cpus, job);
+		TEST_EQ_STR (job->cpuset_cpus, "0-3,6");
+		TEST_EQ_P (job->cpuset_mems, NULL);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a cpuset stanza with a list of memory nodes stores
+	 * them too.
+	 */
+	TEST_FEATURE ("with memory nodes");
+	strcpy (buf, "cpuset 2 0-1\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+			 &pos, &lineno);
+
+	TEST_NE_P (job, NULL);
+	TEST_EQ_STR (job->cpuset_cpus, "2");
+	TEST_ALLOC_PARENT (job->cpuset_mems, job);
+	TEST_EQ_STR (job->cpuset_mems, "0-1");
+
+	nih_free (job);
+
+
+	/* Check that the last of multiple cpuset stanzas is used,
+	 * including dropping the memory nodes of an earlier one.
+	 */
+	TEST_FEATURE ("with multiple stanzas");
+	strcpy (buf, "cpuset 2 0-1\n");
+	strcat (buf, "cpuset 4\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+			 &pos, &lineno);
+
+	TEST_NE_P (job, NULL);
+	TEST_EQ_STR (job->cpuset_cpus, "4");
+	TEST_EQ_P (job->cpuset_mems, NULL);
+
+	nih_free (job);
+
+
+	/* Check that a cpuset stanza with a backwards range results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with backwards range");
+	strcpy (buf, "cpuset 3-1\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+			 &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_CPUSET);
+	TEST_EQ (pos, 7);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a cpuset stanza with an empty list element results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with empty element");
+	strcpy (buf, "cpuset 1,,2\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+			 &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_CPUSET);
+	nih_free (err);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	test_parse_job ();
+
+	test_stanza_instance ();
+
+	test_stanza_description ();
+	test_stanza_version ();
+	test_stanza_author ();
+
+	test_stanza_env ();
+	test_stanza_export ();
+
+	test_stanza_start ();
+	test_stanza_stop ();
+	test_stanza_emits ();
+	test_stanza_manual ();
+
+	test_stanza_exec ();
+	test_stanza_script ();
+	test_stanza_apparmor ();
+	test_stanza_pre_start ();
+	test_stanza_post_start ();
+	test_stanza_pre_stop ();
+	test_stanza_post_stop ();
 
 	test_stanza_expect ();
 	test_stanza_task ();
@@ -9754,10 +10682,20 @@ main (int   argc,
 	test_stanza_setuid ();
 	test_stanza_setgid ();
 	test_stanza_usage ();
+	test_stanza_concurrency ();
+	test_stanza_priority ();
+	test_stanza_defer_under_pressure ();
 
 #ifdef ENABLE_CGROUPS
 	test_stanza_cgroup ();
 #endif /* ENABLE_CGROUPS */
 
+	test_stanza_cpu_weight ();
+	test_stanza_cpu_quota ();
+	test_stanza_memory_max ();
+	test_stanza_memory_high ();
+	test_stanza_io_weight ();
+	test_stanza_cpuset ();
+
 	return 0;
 }
@@ -0,0 +1,271 @@
+/* upstart
+ *
+ * test_pressure.c - test suite for init/pressure.c
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <sys/stat.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/list.h>
+
+#include "job_class.h"
+#include "job.h"
+#include "event.h"
+#include "trace.h"
+#include "pressure.h"
+#include "test_util_common.h"
+
+
+static void
+write_pressure (const char *dirname,
+		const char *resource,
+		const char *avg10)
+{
+	char  filename[PATH_MAX];
+	FILE *file;
+
+	snprintf (filename, sizeof (filename), "%s/%s", dirname, resource);
+
+	file = fopen (filename, "w");
+	TEST_NE_P (file, NULL);
+
+	fprintf (file, "some avg10=%s avg60=0.00 avg300=0.00 total=0\n",
+		 avg10);
+	fprintf (file, "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+
+	fclose (file);
+}
+
+static Event *
+last_event (const char *name)
+{
+	Event *event;
+
+	TEST_LIST_NOT_EMPTY (events);
+
+	event = (Event *)events->prev;
+	TEST_EQ_STR (event->name, name);
+
+	return event;
+}
+
+
+void
+test_read_file (void)
+{
+	char   dirname[PATH_MAX];
+	char   filename[PATH_MAX];
+	FILE  *file;
+	double avg10;
+
+	TEST_FUNCTION ("pressure_read_file");
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+
+	/* Check that the ten second average of the "some" line is read
+	 * from a pressure file.
+	 */
+	TEST_FEATURE ("with pressure file");
+	write_pressure (dirname, "memory", "12.50");
+	snprintf (filename, sizeof (filename), "%s/memory", dirname);
+
+	avg10 = -1.0;
+	TEST_EQ (pressure_read_file (filename, &avg10), 0);
+	TEST_TRUE (avg10 == 12.5);
+
+
+	/* Check that a file without a "some" line is an error. */
+	TEST_FEATURE ("with malformed file");
+	file = fopen (filename, "w");
+	fprintf (file, "full avg10=1.00 avg60=0.00 avg300=0.00 total=0\n");
+	fclose (file);
+
+	TEST_LT (pressure_read_file (filename, &avg10), 0);
+
+	unlink (filename);
+
+
+	/* Check that a missing file is an error. */
+	TEST_FEATURE ("with missing file");
+	TEST_LT (pressure_read_file (filename, &avg10), 0);
+
+	rmdir (dirname);
+}
+
+
+void
+test_admit (void)
+{
+	char      dirname[PATH_MAX];
+	char      filename[PATH_MAX];
+	JobClass *class;
+	Job      *job;
+	Event    *event;
+
+	TEST_FUNCTION ("pressure_admit");
+	job_class_init ();
+	event_init ();
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	write_pressure (dirname, "cpu", "0.00");
+	write_pressure (dirname, "memory", "0.00");
+	write_pressure (dirname, "io", "0.00");
+
+	pressure_path = dirname;
+	pressure_threshold = 20;
+
+	class = job_class_new (NULL, "test", NULL);
+	class->defer_under_pressure = 10;
+
+	job = job_new (class, "foo");
+	job->goal = JOB_START;
+	job->state = JOB_QUEUED;
+	job->timing->entered[JOB_QUEUED] = trace_now ();
+
+
+	/* Check that a job is admitted when no resource is under
+	 * pressure, and that no event is emitted.
+	 */
+	TEST_FEATURE ("without pressure");
+	TEST_TRUE (pressure_admit (job));
+
+	TEST_FALSE (job->deferred);
+	TEST_EQ (pressure_deferred, 0);
+	TEST_LIST_EMPTY (events);
+
+
+	/* Check that a job is deferred when a resource is under pressure,
+	 * and that a deferred event naming the resource is emitted.
+	 */
+	TEST_FEATURE ("with pressure");
+	write_pressure (dirname, "memory", "45.00");
+
+	TEST_FALSE (pressure_admit (job));
+
+	TEST_TRUE (job->deferred);
+	TEST_EQ (pressure_deferred, 1);
+
+	event = last_event ("deferred");
+	TEST_EQ_STR (event->env[0], "JOB=test");
+	TEST_EQ_STR (event->env[1], "INSTANCE=foo");
+	TEST_EQ_STR (event->env[2], "RESOURCE=memory");
+	TEST_EQ_P (event->env[3], NULL);
+	nih_free (event);
+
+
+	/* Check that a job still under pressure remains deferred, but no
+	 * further event is emitted.
+	 */
+	TEST_FEATURE ("with continued pressure");
+	TEST_FALSE (pressure_admit (job));
+
+	TEST_TRUE (job->deferred);
+	TEST_EQ (pressure_deferred, 1);
+	TEST_LIST_EMPTY (events);
+
+
+	/* Check that a deferred job is admitted once pressure is relieved,
+	 * and that an admitted event giving the reason is emitted.
+	 */
+	TEST_FEATURE ("with pressure relieved");
+	write_pressure (dirname, "memory", "5.00");
+
+	TEST_TRUE (pressure_admit (job));
+
+	TEST_FALSE (job->deferred);
+	TEST_EQ (pressure_relieved, 1);
+
+	event = last_event ("admitted");
+	TEST_EQ_STR (event->env[0], "JOB=test");
+	TEST_EQ_STR (event->env[1], "INSTANCE=foo");
+	TEST_EQ_STR (event->env[2], "REASON=relieved");
+	TEST_EQ_P (event->env[3], NULL);
+	nih_free (event);
+
+
+	/* Check that a deferred job is admitted under pressure once it has
+	 * waited for the class's maximum delay.
+	 */
+	TEST_FEATURE ("with delay expired");
+	write_pressure (dirname, "io", "80.00");
+
+	job->deferred = TRUE;
+	job->timing->entered[JOB_QUEUED] = trace_now () - 11000000ULL;
+
+	TEST_TRUE (pressure_admit (job));
+
+	TEST_FALSE (job->deferred);
+	TEST_EQ (pressure_expired, 1);
+
+	event = last_event ("admitted");
+	TEST_EQ_STR (event->env[2], "REASON=timeout");
+	nih_free (event);
+
+
+	/* Check that a job of a class that does not defer under pressure
+	 * is always admitted.
+	 */
+	TEST_FEATURE ("with class not deferring");
+	class->defer_under_pressure = 0;
+	job->timing->entered[JOB_QUEUED] = trace_now ();
+
+	TEST_TRUE (pressure_admit (job));
+
+	TEST_FALSE (job->deferred);
+	TEST_LIST_EMPTY (events);
+
+	nih_free (job);
+	nih_free (class);
+
+	pressure_path = PRESSURE_PATH;
+
+	snprintf (filename, sizeof (filename), "%s/cpu", dirname);
+	unlink (filename);
+	snprintf (filename, sizeof (filename), "%s/memory", dirname);
+	unlink (filename);
+	snprintf (filename, sizeof (filename), "%s/io", dirname);
+	unlink (filename);
+
+	rmdir (dirname);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	test_read_file ();
+	test_admit ();
+
+	return 0;
+}
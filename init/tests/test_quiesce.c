@@ -0,0 +1,207 @@
+/* upstart
+ *
+ * test_quiesce.c - test suite for init/quiesce.c
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+
+#include "job_class.h"
+#include "job.h"
+#include "job_process.h"
+#include "event.h"
+#include "event_operator.h"
+#include "control.h"
+#include "quiesce.h"
+#include "wheel.h"
+#include "test_util_common.h"
+
+
+/**
+ * new_running_class:
+ * @name: name of class,
+ * @after: name of class started before, or NULL,
+ * @pid: process id of the instance.
+ *
+ * Returns: new registered class, starting once @after has started, with
+ * a running instance whose main process is @pid; the class has no
+ * processes of its own, so the instance is never sent a signal.
+ **/
+static JobClass *
+new_running_class (const char *name,
+		   const char *after,
+		   pid_t       pid)
+{
+	JobClass *class;
+	Job      *job;
+
+	class = job_class_new (NULL, name, NULL);
+
+	if (after) {
+		class->start_on = event_operator_new (
+			class, EVENT_MATCH, "started", NULL);
+		class->start_on->env = nih_str_array_new (class->start_on);
+		NIH_MUST (nih_str_array_add (&class->start_on->env,
+					     class->start_on, NULL, after));
+	}
+
+	nih_hash_add (job_classes, &class->entry);
+
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_RUNNING;
+	job_process_set_pid (job, PROCESS_MAIN, pid);
+
+	return class;
+}
+
+/**
+ * class_goal:
+ * @class: class with a single instance.
+ *
+ * Returns: goal of the instance of @class.
+ **/
+static JobGoal
+class_goal (JobClass *class)
+{
+	NIH_HASH_FOREACH (class->instances, iter)
+		return ((Job *)iter)->goal;
+
+	nih_assert_not_reached ();
+}
+
+
+void
+test_layers (void)
+{
+	JobClass *app, *db, *storage, *foo, *bar;
+
+	TEST_FUNCTION ("quiesce");
+	job_class_init ();
+	control_init ();
+	event_init ();
+
+	/* app runs on db, which runs on storage; foo and bar each start
+	 * once the other has, and so depend on each other.
+	 */
+	storage = new_running_class ("storage", NULL, 1000);
+	db = new_running_class ("db", "storage", 1001);
+	app = new_running_class ("app", "db", 1002);
+	foo = new_running_class ("foo", "bar", 1003);
+	bar = new_running_class ("bar", "foo", 1004);
+
+	db->kill_timeout = 0;
+
+
+	/* Check that as the kill phase begins the running jobs are
+	 * ordered in layers, those that no other job depends on first and
+	 * those that only depend on each other together last, and only
+	 * the first layer is stopped.
+	 */
+	TEST_FEATURE ("with jobs depending on others");
+	quiesce (QUIESCE_REQUESTER_SYSTEM);
+
+	TEST_EQ (app->stop_layer, 0);
+	TEST_EQ (db->stop_layer, 1);
+	TEST_EQ (storage->stop_layer, 2);
+	TEST_EQ (foo->stop_layer, 3);
+	TEST_EQ (bar->stop_layer, 3);
+
+	TEST_EQ (class_goal (app), JOB_STOP);
+	TEST_EQ (class_goal (db), JOB_START);
+	TEST_EQ (class_goal (storage), JOB_START);
+	TEST_EQ (class_goal (foo), JOB_START);
+	TEST_EQ (class_goal (bar), JOB_START);
+
+
+	/* Check that the next layer is held back until the jobs of the
+	 * layer being stopped have finished, and is then stopped.
+	 */
+	TEST_FEATURE ("with layer finished");
+	quiesce_poll ();
+
+	TEST_EQ (class_goal (db), JOB_START);
+
+	event_poll ();
+
+	TEST_HASH_EMPTY (app->instances);
+	TEST_EQ (class_goal (db), JOB_START);
+
+	quiesce_poll ();
+
+	TEST_EQ (class_goal (db), JOB_STOP);
+	TEST_EQ (class_goal (storage), JOB_START);
+	TEST_EQ (class_goal (foo), JOB_START);
+	TEST_EQ (class_goal (bar), JOB_START);
+
+
+	/* Check that a layer of jobs whose kill timeout is zero is still
+	 * waited for before the next is stopped.
+	 */
+	TEST_FEATURE ("with zero kill timeout");
+	quiesce_poll ();
+
+	TEST_EQ (class_goal (storage), JOB_START);
+
+
+	/* Check that once a layer overruns its kill timeout, all the
+	 * remaining jobs are stopped together.
+	 */
+	TEST_FEATURE ("with layer overrunning");
+	sleep (2);
+	wheel_poll ();
+
+	TEST_EQ (class_goal (db), JOB_STOP);
+	TEST_EQ (class_goal (storage), JOB_STOP);
+	TEST_EQ (class_goal (foo), JOB_STOP);
+	TEST_EQ (class_goal (bar), JOB_STOP);
+
+	NIH_LIST_FOREACH_SAFE (events, iter) {
+		Event *event = (Event *)iter;
+
+		nih_free (event);
+	}
+
+	nih_free (db);
+	nih_free (storage);
+	nih_free (foo);
+	nih_free (bar);
+	nih_free (app);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	test_layers ();
+
+	return 0;
+}
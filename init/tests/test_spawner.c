@@ -0,0 +1,147 @@
+/* upstart
+ *
+ * test_spawner.c - test suite for init/spawner.c
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+
+#include "spawner.h"
+
+
+/**
+ * test_handler:
+ *
+ * Writes each request to the descriptors sent with it, replying with a
+ * value made from the length of the request and the number of
+ * descriptors, or failing with EPERM when the request is "fail".
+ **/
+static pid_t
+test_handler (const char *buf,
+	      size_t      len,
+	      int        *fds,
+	      size_t      nfds)
+{
+	if ((len == 4) && (! memcmp (buf, "fail", 4))) {
+		errno = EPERM;
+		return -1;
+	}
+
+	for (size_t i = 0; i < nfds; i++)
+		if (write (fds[i], buf, len) != (ssize_t)len)
+			_exit (1);
+
+	return (pid_t)(len + 1000 * nfds);
+}
+
+
+void
+test_request (void)
+{
+	pid_t  pid;
+	pid_t  ret;
+	int    fds[2];
+	char   buf[16];
+	int    status;
+
+	TEST_FUNCTION ("spawner_request");
+
+	/* Check that the helper can be started and that a request sent
+	 * to it is handled, with the descriptors sent along with it, and
+	 * the reply returned.
+	 */
+	TEST_FEATURE ("with request and descriptor");
+	TEST_FALSE (spawner_available ());
+	TEST_EQ (spawner_start (test_handler), 0);
+	TEST_TRUE (spawner_available ());
+	TEST_GT (spawner_pid, 0);
+
+	pid = spawner_pid;
+
+	TEST_EQ (pipe (fds), 0);
+
+	ret = spawner_request ("hello", 5, &fds[1], 1);
+	TEST_EQ (ret, 1005);
+
+	close (fds[1]);
+
+	memset (buf, 0, sizeof (buf));
+	TEST_EQ (read (fds[0], buf, sizeof (buf)), 5);
+	TEST_EQ_STR (buf, "hello");
+
+	/* Descriptors are closed by the helper once handled */
+	TEST_EQ (read (fds[0], buf, sizeof (buf)), 0);
+	close (fds[0]);
+
+
+	/* Check that a failure in the handler is returned with its errno
+	 * and leaves the helper running.
+	 */
+	TEST_FEATURE ("with failed request");
+	ret = spawner_request ("fail", 4, NULL, 0);
+	TEST_EQ (ret, -1);
+	TEST_EQ (errno, EPERM);
+	TEST_TRUE (spawner_available ());
+
+
+	/* Check that stopping the helper causes it to exit. */
+	TEST_FEATURE ("with helper stopped");
+	spawner_stop ();
+
+	TEST_FALSE (spawner_available ());
+	TEST_EQ (spawner_pid, 0);
+
+	TEST_EQ (waitpid (pid, &status, 0), pid);
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+
+
+	/* Check that a request to a helper that has died fails and stops
+	 * the helper so that the caller spawns processes itself.
+	 */
+	TEST_FEATURE ("with helper died");
+	TEST_EQ (spawner_start (test_handler), 0);
+
+	pid = spawner_pid;
+
+	TEST_EQ (kill (pid, SIGKILL), 0);
+	TEST_EQ (waitpid (pid, &status, 0), pid);
+
+	ret = spawner_request ("hello", 5, NULL, 0);
+	TEST_EQ (ret, -1);
+	TEST_FALSE (spawner_available ());
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_request ();
+
+	return 0;
+}
@@ -45,6 +45,7 @@
 #include "conf.h"
 #include "job_class.h"
 #include "job.h"
+#include "job_process.h"
 #include "log.h"
 #include "blocked.h"
 #include "control.h"
@@ -131,7 +132,7 @@ int process_diff (const Process *a, const Process *b)
 int event_diff (const Event *a, const Event *b, AlreadySeen seen)
 	__attribute__ ((warn_unused_result));
 
-int nih_timer_diff (const NihTimer *a, const NihTimer *b)
+int wheel_timer_diff (const WheelTimer *a, const WheelTimer *b)
 	__attribute__ ((warn_unused_result));
 
 int log_diff (const Log *a, const Log *b)
@@ -340,6 +341,9 @@ event_diff (const Event *a, const Event *b, AlreadySeen seen)
 	if (obj_num_check (a, b, progress))
 		goto fail;
 
+	if (obj_num_check (a, b, lane))
+		goto fail;
+
 	if (obj_num_check (a, b, failed))
 		goto fail;
 
@@ -356,16 +360,16 @@ fail:
 }
 
 /**
- * nih_timer_diff:
- * @a: first NihTimer,
- * @b: second NihTimer.
+ * wheel_timer_diff:
+ * @a: first WheelTimer,
+ * @b: second WheelTimer.
  *
- * Compare two NihTimer objects for equivalence.
+ * Compare two WheelTimer objects for equivalence.
  *
  * Returns: 0 if @a and @b are identical, else 1.
  **/
 int
-nih_timer_diff (const NihTimer *a, const NihTimer *b)
+wheel_timer_diff (const WheelTimer *a, const WheelTimer *b)
 {
 	if ((a == b) && !a)
 		return 0;
@@ -610,6 +614,45 @@ job_class_diff (const JobClass *a, const JobClass *b,
 	if (obj_num_check (a, b, respawn_interval))
 		goto fail;
 
+	if (obj_num_check (a, b, respawn_delay))
+		goto fail;
+
+	if (obj_num_check (a, b, respawn_backoff))
+		goto fail;
+
+	if (obj_num_check (a, b, respawn_delay_max))
+		goto fail;
+
+	if (obj_num_check (a, b, concurrency))
+		goto fail;
+
+	if (obj_num_check (a, b, priority))
+		goto fail;
+
+	if (obj_num_check (a, b, defer_under_pressure))
+		goto fail;
+
+	if (obj_num_check (a, b, cpu_weight))
+		goto fail;
+
+	if (obj_num_check (a, b, cpu_quota))
+		goto fail;
+
+	if (obj_num_check (a, b, memory_max))
+		goto fail;
+
+	if (obj_num_check (a, b, memory_high))
+		goto fail;
+
+	if (obj_num_check (a, b, io_weight))
+		goto fail;
+
+	if (obj_string_check (a, b, cpuset_cpus))
+		goto fail;
+
+	if (obj_string_check (a, b, cpuset_mems))
+		goto fail;
+
 	if (obj_num_check (a, b, normalexit_len))
 		goto fail;
 
@@ -737,10 +780,10 @@ job_diff (const Job *a, const Job *b, AlreadySeen seen, int check_class)
 		goto fail;
 
 	if (a->stop_on)
-		condition_a = event_operator_collapse (a->stop_on);
+		condition_a = event_expr_collapse (a->stop_on->expr);
 
 	if (b->stop_on)
-		condition_b = event_operator_collapse (b->stop_on);
+		condition_b = event_expr_collapse (b->stop_on->expr);
 
 	if (string_check (condition_a, condition_b))
 		goto fail;
@@ -763,7 +806,7 @@ job_diff (const Job *a, const Job *b, AlreadySeen seen, int check_class)
 	if (blocking_diff (&a->blocking, &b->blocking, seen))
 		goto fail;
 
-	if (nih_timer_diff (a->kill_timer, b->kill_timer))
+	if (wheel_timer_diff (a->kill_timer, b->kill_timer))
 		goto fail;
 
 	if (obj_num_check (a, b, kill_process))
@@ -784,6 +827,21 @@ job_diff (const Job *a, const Job *b, AlreadySeen seen, int check_class)
 	if (obj_num_check (a, b, respawn_count))
 		goto fail;
 
+	if (obj_num_check (a, b, respawn_delay))
+		goto fail;
+
+	if (obj_num_check (a, b, respawn_due))
+		goto fail;
+
+	if (wheel_timer_diff (a->respawn_timer, b->respawn_timer))
+		goto fail;
+
+	if (obj_num_check (a, b, spawn_slot))
+		goto fail;
+
+	if (obj_num_check (a, b, deferred))
+		goto fail;
+
 	if (obj_num_check (a, b, trace_forks))
 		goto fail;
 
@@ -2251,8 +2309,8 @@ test_job_class_serialise (void)
 
 	job1->goal = JOB_START;
 	job1->state = JOB_PRE_STOP;
-	job1->pid[PROCESS_MAIN] = 1234;
-	job1->pid[PROCESS_PRE_STOP] = 5678;
+	job_process_set_pid (job1, PROCESS_MAIN, 1234);
+	job_process_set_pid (job1, PROCESS_PRE_STOP, 5678);
 
 	json = job_class_serialise (class);
 	TEST_NE_P (json, NULL);
@@ -2308,15 +2366,15 @@ test_job_class_serialise (void)
 
 	job1->goal = JOB_START;
 	job1->state = JOB_PRE_STOP;
-	job1->pid[PROCESS_MAIN] = 1234;
-	job1->pid[PROCESS_PRE_STOP] = 5678;
+	job_process_set_pid (job1, PROCESS_MAIN, 1234);
+	job_process_set_pid (job1, PROCESS_PRE_STOP, 5678);
 
 	job2->goal = JOB_STOP;
 	job2->state = JOB_WAITING;
 
 	job3->goal = JOB_START;
 	job3->state = JOB_RUNNING;
-	job3->pid[PROCESS_MAIN] = 1;
+	job_process_set_pid (job3, PROCESS_MAIN, 1);
 
 	json = job_class_serialise (class);
 	TEST_NE_P (json, NULL);
@@ -2333,6 +2391,44 @@ test_job_class_serialise (void)
 	nih_free (new_class);
 	json_object_put (json);
 
+	/*******************************/
+	TEST_FEATURE ("JobClass with resource-control stanzas");
+
+	TEST_HASH_EMPTY (job_classes);
+
+	source = conf_source_new (NULL, "/tmp/foo", CONF_JOB_DIR);
+	TEST_NE_P (source, NULL);
+
+	file = conf_file_new (source, "/tmp/foo/bar.conf");
+	TEST_NE_P (file, NULL);
+
+	class = file->job = job_class_new (NULL, "bar", NULL);
+	TEST_NE_P (class, NULL);
+	class->cpu_weight = 200;
+	class->cpu_quota = 50;
+	class->memory_max = JOB_MEMORY_UNLIMITED;
+	class->memory_high = 1073741824ULL;
+	class->io_weight = 50;
+	class->cpuset_cpus = NIH_MUST (nih_strdup (class, "0-3"));
+	TEST_TRUE (job_class_consider (class));
+
+	json = job_class_serialise (class);
+	TEST_NE_P (json, NULL);
+
+	nih_list_remove (&class->entry);
+	TEST_HASH_EMPTY (job_classes);
+
+	new_class = job_class_deserialise (json);
+	TEST_NE_P (new_class, NULL);
+
+	assert0 (job_class_diff (class, new_class, ALREADY_SEEN_SET, TRUE));
+	TEST_EQ (new_class->memory_max, JOB_MEMORY_UNLIMITED);
+	TEST_EQ_P (new_class->cpuset_mems, NULL);
+
+	nih_free (source);
+	nih_free (new_class);
+	json_object_put (json);
+
 	/*******************************/
 }
 
@@ -2343,6 +2439,7 @@ test_job_serialise (void)
 	Job                  *job;
 	Job                  *new_job;
 	json_object          *json;
+	json_object          *json_state;
 
 
 	TEST_GROUP ("Job serialisation and deserialisation");
@@ -2378,6 +2475,36 @@ test_job_serialise (void)
 	nih_free (job);
 	json_object_put (json);
 
+	/*******************************/
+	TEST_FEATURE ("queued job");
+
+	job = job_new (class, "queued");
+	TEST_NE_P (job, NULL);
+
+	job->goal = JOB_START;
+	job->state = JOB_QUEUED;
+
+	json = job_serialise (job);
+	TEST_NE_P (json, NULL);
+
+	TEST_TRUE (json_object_object_get_ex (json, "state", &json_state));
+	TEST_EQ_STR (json_object_get_string (json_state), "JOB_QUEUED");
+
+	nih_list_remove (&job->entry);
+
+	new_job = job_deserialise (class, json);
+	TEST_NE_P (new_job, NULL);
+
+	assert0 (job_diff (job, new_job, ALREADY_SEEN_SET, TRUE));
+
+	/* The job takes its place in the spawn queue again */
+	TEST_EQ (new_job->state, JOB_QUEUED);
+	TEST_NE_P (new_job->queued, NULL);
+
+	nih_free (new_job);
+	nih_free (job);
+	json_object_put (json);
+
 	/*******************************/
 }
 
@@ -24,8 +24,12 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <errno.h>
+#include <stdio.h>
 #include <unistd.h>
 
+#include <nih/error.h>
+
 #include "system.h"
 
 
@@ -129,6 +133,108 @@ test_kill (void)
 }
 
 
+void
+test_kill_pidfd (void)
+{
+	NihError *err;
+	pid_t     pid1, pid2;
+	int       fd, ret, status;
+
+	TEST_FUNCTION ("system_kill_pidfd");
+
+	TEST_CHILD (pid1) {
+		pause ();
+	}
+	TEST_CHILD (pid2) {
+		pause ();
+	}
+
+	setpgid (pid1, pid1);
+	setpgid (pid2, pid1);
+
+	fd = system_pidfd_open (pid1);
+	if (fd < 0) {
+		err = nih_error_get ();
+		TEST_EQ (err->number, ENOSYS);
+		nih_free (err);
+
+		printf ("SKIP: process file descriptors not supported\n");
+
+		kill (-pid1, SIGKILL);
+		waitpid (pid1, &status, 0);
+		waitpid (pid2, &status, 0);
+		return;
+	}
+
+
+	/* Check that while the process is running, the signal is sent to
+	 * all processes in its process group.
+	 */
+	TEST_FEATURE ("with running process");
+	ret = system_kill_pidfd (fd, pid1, SIGTERM);
+	TEST_EQ (ret, 0);
+
+	waitpid (pid1, &status, 0);
+
+	TEST_TRUE (WIFSIGNALED (status));
+	TEST_EQ (WTERMSIG (status), SIGTERM);
+
+	waitpid (pid2, &status, 0);
+
+	TEST_TRUE (WIFSIGNALED (status));
+	TEST_EQ (WTERMSIG (status), SIGTERM);
+
+
+	/* Check that once the process has been reaped, nothing is sent and
+	 * ESRCH is raised, since its process id may have been reused.
+	 */
+	TEST_FEATURE ("with reaped process");
+	ret = system_kill_pidfd (fd, pid1, SIGTERM);
+	TEST_LT (ret, 0);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, ESRCH);
+	nih_free (err);
+
+	close (fd);
+}
+
+
+void
+test_descendant (void)
+{
+	pid_t pid;
+
+	TEST_FUNCTION ("system_descendant");
+	TEST_CHILD (pid) {
+		pause ();
+	}
+
+
+	/* Check that a child is a descendant of its parent. */
+	TEST_FEATURE ("with child");
+	TEST_TRUE (system_descendant (pid, getpid ()));
+
+
+	/* Check that a parent is not a descendant of its child. */
+	TEST_FEATURE ("with parent");
+	TEST_FALSE (system_descendant (getpid (), pid));
+
+
+	/* Check that init is not a descendant of anything. */
+	TEST_FEATURE ("with init");
+	TEST_FALSE (system_descendant (1, getpid ()));
+
+	kill (pid, SIGTERM);
+	waitpid (pid, NULL, 0);
+
+
+	/* Check that a process that has exited is not a descendant. */
+	TEST_FEATURE ("with exited process");
+	TEST_FALSE (system_descendant (pid, getpid ()));
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -137,6 +243,8 @@ main (int   argc,
 	setenv ("UPSTART_NO_SESSIONS", "1", 1);
 
 	test_kill ();
+	test_kill_pidfd ();
+	test_descendant ();
 
 	return 0;
 }
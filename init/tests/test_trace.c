@@ -0,0 +1,188 @@
+/* upstart
+ *
+ * test_trace.c - test suite for init/trace.c
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+
+#include "intern.h"
+#include "trace.h"
+
+
+static void
+make_trace (EventTrace         *trace,
+	    unsigned long long  pending,
+	    unsigned long long  latency)
+{
+	memset (trace, 0, sizeof (EventTrace));
+
+	trace->pending = pending;
+	trace->handling = pending + 1;
+	trace->handled = pending + 2;
+	trace->finished = pending + latency;
+	trace->matched = 3;
+	trace->blockers = 1;
+}
+
+
+void
+test_record (void)
+{
+	EventTrace   trace;
+	char       **records;
+
+	TEST_FUNCTION ("trace_event_record");
+
+	/* Check that nothing is recorded while tracing is disabled. */
+	TEST_FEATURE ("with tracing disabled");
+	trace_events_clear ();
+	trace_events_enable (FALSE);
+
+	make_trace (&trace, 100, 10);
+	trace_event_record ("foo", &trace);
+
+	TEST_EQ (trace_events_count (), 0);
+
+
+	/* Check that an event queued before tracing was enabled is not
+	 * recorded, since its timestamps are incomplete.
+	 */
+	TEST_FEATURE ("with untraced event");
+	trace_events_enable (TRUE);
+
+	make_trace (&trace, 0, 10);
+	trace_event_record ("foo", &trace);
+
+	TEST_EQ (trace_events_count (), 0);
+
+
+	/* Check that a record is formatted with the name, queue time and
+	 * the time spent in each stage.
+	 */
+	TEST_FEATURE ("with single record");
+	make_trace (&trace, 100, 10);
+	trace_event_record ("foo", &trace);
+
+	TEST_EQ (trace_events_count (), 1);
+	TEST_EQ (intern_count (), 1);
+
+	records = trace_events_records (NULL);
+
+	TEST_NE_P (records, NULL);
+	TEST_EQ_STR (records[0], "foo 100 1 1 8 3 1");
+	TEST_EQ_P (records[1], NULL);
+
+	nih_free (records);
+
+
+	/* Check that once the ring is full the oldest records are
+	 * overwritten, and their names released.
+	 */
+	TEST_FEATURE ("with full ring");
+	for (int i = 0; i < TRACE_EVENTS_SIZE; i++) {
+		make_trace (&trace, 1000 + i, 10);
+		trace_event_record ("bar", &trace);
+	}
+
+	TEST_EQ (trace_events_count (), TRACE_EVENTS_SIZE);
+	TEST_EQ (intern_count (), 1);
+
+	records = trace_events_records (NULL);
+
+	TEST_NE_P (records, NULL);
+	TEST_EQ_STR (records[0], "bar 1000 1 1 8 3 1");
+	TEST_EQ_P (records[TRACE_EVENTS_SIZE], NULL);
+
+	nih_free (records);
+
+
+	/* Check that clearing the ring discards all records. */
+	TEST_FEATURE ("with clear");
+	trace_events_clear ();
+
+	TEST_EQ (trace_events_count (), 0);
+	TEST_EQ (intern_count (), 0);
+
+	trace_events_enable (FALSE);
+}
+
+
+void
+test_histograms (void)
+{
+	EventTrace       trace;
+	char           **histograms;
+	nih_local char  *expected = NULL;
+
+	TEST_FUNCTION ("trace_events_histograms");
+	trace_events_clear ();
+	trace_events_enable (TRUE);
+
+	/* Check that a histogram is produced for each distinct name, in
+	 * order of first appearance, with each latency counted in the
+	 * bucket for the next power of two.
+	 */
+	TEST_FEATURE ("with multiple names");
+	make_trace (&trace, 100, 3);
+	trace_event_record ("foo", &trace);
+
+	make_trace (&trace, 200, 5);
+	trace_event_record ("bar", &trace);
+
+	make_trace (&trace, 300, 4);
+	trace_event_record ("foo", &trace);
+
+	histograms = trace_events_histograms (NULL);
+
+	TEST_NE_P (histograms, NULL);
+
+	expected = nih_strdup (NULL, "foo 2 0 0 1 1");
+	for (int i = 4; i < TRACE_HISTOGRAM_BUCKETS; i++)
+		NIH_MUST (nih_strcat (&expected, NULL, " 0"));
+	TEST_EQ_STR (histograms[0], expected);
+
+	nih_free (expected);
+	expected = nih_strdup (NULL, "bar 1 0 0 0 1");
+	for (int i = 4; i < TRACE_HISTOGRAM_BUCKETS; i++)
+		NIH_MUST (nih_strcat (&expected, NULL, " 0"));
+	TEST_EQ_STR (histograms[1], expected);
+
+	TEST_EQ_P (histograms[2], NULL);
+
+	nih_free (histograms);
+
+	trace_events_clear ();
+	trace_events_enable (FALSE);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_record ();
+	test_histograms ();
+
+	return 0;
+}
@@ -0,0 +1,196 @@
+/* upstart
+ *
+ * test_usage.c - test suite for init/usage.c
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <sys/stat.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+
+#include "job_class.h"
+#include "job.h"
+#include "event.h"
+#include "cgroup.h"
+#include "usage.h"
+#include "test_util_common.h"
+
+
+void
+test_jobs (void)
+{
+	char             dirname[PATH_MAX];
+	nih_local char  *path = NULL;
+	JobClass        *class;
+	JobClass        *other;
+	Job             *job;
+	Job             *waiting;
+	char           **jobs;
+	char            *name;
+	int64_t          window;
+	int64_t          sampled;
+	double           cpu;
+	unsigned long    memory;
+	unsigned long    io_read;
+
+	TEST_FUNCTION ("usage_jobs");
+	job_class_init ();
+	event_init ();
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	CREATE_FILE (dirname, "cgroup.controllers", "cpu io memory");
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/foo", dirname));
+	TEST_EQ (mkdir (path, 0755), 0);
+	CREATE_FILE (path, "cpu.stat", "usage_usec 0");
+	CREATE_FILE (path, "memory.current", "4096");
+	CREATE_FILE (path, "io.stat", "8:0 rbytes=0 wbytes=0");
+
+	cgroup_fs_root = dirname;
+	cgroup_fs_reset ();
+
+	class = job_class_new (NULL, "test", NULL);
+	TEST_TRUE (cgroup_add (class, &class->cgroups, "memory", "foo",
+			       NULL, NULL));
+	nih_hash_add (job_classes, &class->entry);
+
+	other = job_class_new (NULL, "other", NULL);
+	nih_hash_add (job_classes, &other->entry);
+
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_RUNNING;
+
+	waiting = job_new (class, "waiting");
+
+	job_new (other, "");
+
+
+	/* Check that a running job with cgroups is described by its
+	 * memory in use and rates of zero when it has no earlier sample,
+	 * that the window is zero, and that jobs which are not running or
+	 * have no cgroups are omitted.
+	 */
+	TEST_FEATURE ("without earlier sample");
+	jobs = usage_jobs (NULL, &window);
+
+	TEST_NE_P (jobs, NULL);
+	TEST_NE_P (jobs[0], NULL);
+	TEST_ALLOC_PARENT (jobs[0], jobs);
+	TEST_EQ_STR (jobs[0], "0.0 4096 0 0 test");
+	TEST_EQ_P (jobs[1], NULL);
+
+	TEST_EQ (window, 0);
+
+	TEST_NE_P (job->usage, NULL);
+	TEST_ALLOC_PARENT (job->usage, job);
+	TEST_EQ (job->usage->memory, 4096);
+	TEST_EQ_P (waiting->usage, NULL);
+
+	nih_free (jobs);
+
+
+	/* Check that rates are computed against the earlier sample, and
+	 * that it is replaced once at least the window old.
+	 */
+	TEST_FEATURE ("with earlier sample");
+	job->usage->time -= 2000000;
+	sampled = job->usage->time;
+
+	CREATE_FILE (path, "cpu.stat", "usage_usec 1000000");
+	CREATE_FILE (path, "io.stat", "8:0 rbytes=2000 wbytes=0");
+
+	jobs = usage_jobs (NULL, &window);
+
+	TEST_NE_P (jobs, NULL);
+	TEST_NE_P (jobs[0], NULL);
+
+	cpu = strtod (jobs[0], &name);
+	memory = strtoul (name, &name, 10);
+	io_read = strtoul (name, &name, 10);
+	strtoul (name, &name, 10);
+
+	TEST_TRUE ((cpu > 49.0) && (cpu <= 50.0));
+	TEST_EQ (memory, 4096);
+	TEST_TRUE ((io_read > 990) && (io_read <= 1000));
+	TEST_EQ_STR (name, " test");
+	TEST_EQ_P (jobs[1], NULL);
+
+	TEST_GE (window, 2000000);
+
+	TEST_GT (job->usage->time, sampled);
+	TEST_EQ (job->usage->cpu, 1000000);
+
+	nih_free (jobs);
+
+
+	/* Check that a sample younger than the window is kept, so that
+	 * the next rates are computed over at least the window.
+	 */
+	TEST_FEATURE ("with recent sample");
+	sampled = job->usage->time;
+
+	jobs = usage_jobs (NULL, &window);
+
+	TEST_NE_P (jobs, NULL);
+	TEST_LT (window, USAGE_WINDOW);
+	TEST_EQ (job->usage->time, sampled);
+
+	nih_free (jobs);
+
+
+	nih_free (other);
+	nih_free (class);
+
+	DELETE_FILE (path, "cpu.stat");
+	DELETE_FILE (path, "memory.current");
+	DELETE_FILE (path, "io.stat");
+	TEST_EQ (rmdir (path), 0);
+
+	DELETE_FILE (dirname, "cgroup.controllers");
+	TEST_EQ (rmdir (dirname), 0);
+
+	cgroup_fs_root = CGROUP_FS_ROOT;
+	cgroup_fs_reset ();
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	test_jobs ();
+
+	return 0;
+}
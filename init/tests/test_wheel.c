@@ -0,0 +1,252 @@
+/* upstart
+ *
+ * test_wheel.c - test suite for init/wheel.c
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/list.h>
+
+#include "wheel.h"
+
+
+static int         callback_called = 0;
+static void       *last_data = NULL;
+static WheelTimer *last_timer = NULL;
+
+static void
+my_callback (void       *data,
+	     WheelTimer *timer)
+{
+	callback_called++;
+	last_data = data;
+	last_timer = timer;
+}
+
+static void
+free_callback (void       *data,
+	       WheelTimer *timer)
+{
+	my_callback (data, timer);
+	nih_free (timer);
+}
+
+
+void
+test_add_timeout (void)
+{
+	WheelTimer      *timer;
+	struct timespec  now;
+
+	TEST_FUNCTION ("wheel_timer_add_timeout");
+
+	/* Adding the first timer also arms the main loop timer, which
+	 * then stays armed; do that first so that only the allocation of
+	 * the timer itself can fail below.
+	 */
+	timer = wheel_timer_add_timeout (NULL, 10, my_callback, NULL);
+	TEST_NE_P (timer, NULL);
+	nih_free (timer);
+
+
+	/* Check that a timeout timer is filed in the wheel with the
+	 * details given and a due time of the timeout from now.
+	 */
+	TEST_FEATURE ("with timeout");
+	TEST_ALLOC_FAIL {
+		TEST_EQ (clock_gettime (CLOCK_MONOTONIC, &now), 0);
+
+		timer = wheel_timer_add_timeout (NULL, 10, my_callback,
+						 &timer);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (timer, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_SIZE (timer, sizeof (WheelTimer));
+		TEST_LIST_NOT_EMPTY (&timer->entry);
+
+		TEST_EQ (timer->timeout, 10);
+		TEST_GE (timer->due, now.tv_sec + 10);
+		TEST_LE (timer->due, now.tv_sec + 11);
+		TEST_FALSE (timer->periodic);
+		TEST_EQ_P (timer->callback, my_callback);
+		TEST_EQ_P (timer->data, &timer);
+
+		nih_free (timer);
+	}
+
+
+	/* Check that a periodic timer is marked as such. */
+	TEST_FEATURE ("with periodic timer");
+	timer = wheel_timer_add_periodic (NULL, 5, my_callback, NULL);
+
+	TEST_NE_P (timer, NULL);
+	TEST_EQ (timer->timeout, 5);
+	TEST_TRUE (timer->periodic);
+
+	nih_free (timer);
+}
+
+
+void
+test_poll (void)
+{
+	WheelTimer      *timer;
+	struct timespec  now;
+
+	TEST_FUNCTION ("wheel_poll");
+
+
+	/* Check that a timer that is due has its callback called and is
+	 * then freed.
+	 */
+	TEST_FEATURE ("with due timer");
+	TEST_EQ (clock_gettime (CLOCK_MONOTONIC, &now), 0);
+
+	timer = wheel_timer_add_timeout (NULL, 10, my_callback, &timer);
+	wheel_timer_set_due (timer, now.tv_sec);
+
+	TEST_FREE_TAG (timer);
+
+	callback_called = 0;
+	wheel_poll ();
+
+	TEST_EQ (callback_called, 1);
+	TEST_EQ_P (last_data, &timer);
+	TEST_EQ_P (last_timer, timer);
+	TEST_FREE (timer);
+
+
+	/* Check that a timer whose due time is in the past, as it may be
+	 * after re-exec, is triggered.
+	 */
+	TEST_FEATURE ("with overdue timer");
+	timer = wheel_timer_add_timeout (NULL, 10, my_callback, NULL);
+	wheel_timer_set_due (timer, now.tv_sec - 100);
+
+	TEST_FREE_TAG (timer);
+
+	callback_called = 0;
+	wheel_poll ();
+
+	TEST_EQ (callback_called, 1);
+	TEST_FREE (timer);
+
+
+	/* Check that a timer that isn't yet due is left alone, and that
+	 * the wheel next needs processing at its due time.
+	 */
+	TEST_FEATURE ("with timer not yet due");
+	timer = wheel_timer_add_timeout (NULL, 10, my_callback, NULL);
+
+	TEST_FREE_TAG (timer);
+
+	callback_called = 0;
+	wheel_poll ();
+
+	TEST_EQ (callback_called, 0);
+	TEST_NOT_FREE (timer);
+	TEST_EQ (wheel_next_due (), timer->due);
+
+	nih_free (timer);
+
+
+	/* Check that a timer in a higher level of the wheel, which will
+	 * be cascaded down before being triggered, is left alone but is
+	 * triggered once moved to be due.
+	 */
+	TEST_FEATURE ("with distant timer");
+	timer = wheel_timer_add_timeout (NULL, 100000, my_callback, NULL);
+
+	TEST_FREE_TAG (timer);
+
+	callback_called = 0;
+	wheel_poll ();
+
+	TEST_EQ (callback_called, 0);
+	TEST_NOT_FREE (timer);
+	TEST_GT (wheel_next_due (), now.tv_sec);
+	TEST_LE (wheel_next_due (), timer->due);
+
+	wheel_timer_set_due (timer, now.tv_sec);
+	wheel_poll ();
+
+	TEST_EQ (callback_called, 1);
+	TEST_FREE (timer);
+
+
+	/* Check that a cancelled timer isn't triggered. */
+	TEST_FEATURE ("with cancelled timer");
+	timer = wheel_timer_add_timeout (NULL, 10, my_callback, NULL);
+	wheel_timer_set_due (timer, now.tv_sec);
+	nih_free (timer);
+
+	callback_called = 0;
+	wheel_poll ();
+
+	TEST_EQ (callback_called, 0);
+	TEST_EQ (wheel_next_due (), 0);
+
+
+	/* Check that a periodic timer is rescheduled rather than freed
+	 * once triggered.
+	 */
+	TEST_FEATURE ("with periodic timer");
+	timer = wheel_timer_add_periodic (NULL, 5, my_callback, NULL);
+	wheel_timer_set_due (timer, now.tv_sec);
+
+	TEST_FREE_TAG (timer);
+
+	callback_called = 0;
+	wheel_poll ();
+
+	TEST_EQ (callback_called, 1);
+	TEST_NOT_FREE (timer);
+	TEST_GE (timer->due, now.tv_sec + 5);
+	TEST_LIST_NOT_EMPTY (&timer->entry);
+
+
+	/* Check that a periodic timer may free itself to cancel itself. */
+	TEST_FEATURE ("with periodic timer freed by callback");
+	timer->callback = free_callback;
+	wheel_timer_set_due (timer, now.tv_sec);
+
+	callback_called = 0;
+	wheel_poll ();
+
+	TEST_EQ (callback_called, 1);
+	TEST_FREE (timer);
+	TEST_EQ (wheel_next_due (), 0);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_add_timeout ();
+	test_poll ();
+
+	return 0;
+}
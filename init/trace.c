@@ -0,0 +1,349 @@
+/* upstart
+ *
+ * trace.c - event lifecycle tracing
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <string.h>
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/logging.h>
+
+#include "intern.h"
+#include "trace.h"
+
+
+/**
+ * trace_events:
+ *
+ * TRUE if event lifecycle records should be collected; when FALSE the
+ * event code skips taking timestamps entirely.
+ **/
+int trace_events = FALSE;
+
+/**
+ * trace_ring:
+ *
+ * Array of TRACE_EVENTS_SIZE pointers to EventTrace records, allocated
+ * the first time an event is recorded.  Records are children of the ring
+ * and are allocated on first use of each slot, then reused.
+ **/
+static EventTrace **trace_ring = NULL;
+
+/**
+ * trace_ring_next:
+ *
+ * Index of the slot in trace_ring the next record is written to.
+ **/
+static size_t trace_ring_next = 0;
+
+/**
+ * trace_ring_len:
+ *
+ * Number of valid records in trace_ring.
+ **/
+static size_t trace_ring_len = 0;
+
+
+/**
+ * trace_now:
+ *
+ * Returns: current monotonic time in microseconds.
+ **/
+unsigned long long
+trace_now (void)
+{
+	struct timespec now;
+
+	if (clock_gettime (CLOCK_MONOTONIC, &now) < 0)
+		return 0;
+
+	return ((unsigned long long)now.tv_sec * 1000000ULL
+		+ (unsigned long long)now.tv_nsec / 1000ULL);
+}
+
+
+/**
+ * trace_events_enable:
+ * @enable: TRUE to collect event records.
+ *
+ * Enable or disable collection of event lifecycle records.  Records
+ * already collected are kept when disabling so they may still be
+ * retrieved; use trace_events_clear() to discard them.
+ **/
+void
+trace_events_enable (int enable)
+{
+	trace_events = enable ? TRUE : FALSE;
+
+	nih_debug ("Event tracing %s", trace_events ? "enabled" : "disabled");
+}
+
+/**
+ * trace_events_clear:
+ *
+ * Discard all collected event records.
+ **/
+void
+trace_events_clear (void)
+{
+	if (trace_ring)
+		nih_free (trace_ring);
+
+	trace_ring = NULL;
+	trace_ring_next = 0;
+	trace_ring_len = 0;
+}
+
+
+/**
+ * trace_event_record:
+ * @name: name of finished event,
+ * @trace: lifecycle record of event.
+ *
+ * Copy @trace into the trace ring under @name, overwriting the oldest
+ * record if the ring is full.  Nothing is recorded if tracing is disabled
+ * or was not enabled when the event was queued.
+ *
+ * Records are dropped rather than reported if memory is short, tracing
+ * must never cause event handling to fail.
+ **/
+void
+trace_event_record (const char       *name,
+		    const EventTrace *trace)
+{
+	EventTrace *record;
+	char       *interned;
+
+	nih_assert (name != NULL);
+	nih_assert (trace != NULL);
+
+	if (! trace_events || ! trace->pending)
+		return;
+
+	if (! trace_ring) {
+		trace_ring = nih_alloc (NULL, (sizeof (EventTrace *)
+					       * TRACE_EVENTS_SIZE));
+		if (! trace_ring)
+			return;
+
+		memset (trace_ring, 0,
+			sizeof (EventTrace *) * TRACE_EVENTS_SIZE);
+	}
+
+	record = trace_ring[trace_ring_next];
+	if (! record) {
+		record = nih_new (trace_ring, EventTrace);
+		if (! record)
+			return;
+
+		record->name = NULL;
+		trace_ring[trace_ring_next] = record;
+	}
+
+	/* Take the new name before dropping the old one so that a
+	 * failure leaves the record being overwritten intact.
+	 */
+	interned = intern_string (record, name);
+	if (! interned)
+		return;
+
+	if (record->name)
+		nih_unref (record->name, record);
+
+	*record = *trace;
+	record->name = interned;
+
+	trace_ring_next = (trace_ring_next + 1) % TRACE_EVENTS_SIZE;
+	if (trace_ring_len < TRACE_EVENTS_SIZE)
+		trace_ring_len++;
+}
+
+/**
+ * trace_events_count:
+ *
+ * Returns: number of event records currently held.
+ **/
+size_t
+trace_events_count (void)
+{
+	return trace_ring_len;
+}
+
+
+/**
+ * trace_events_record_at:
+ * @i: index of record, oldest first.
+ *
+ * Returns: @i'th oldest record in the ring.
+ **/
+static const EventTrace *
+trace_events_record_at (size_t i)
+{
+	nih_assert (i < trace_ring_len);
+
+	return trace_ring[(trace_ring_next + TRACE_EVENTS_SIZE
+			   - trace_ring_len + i) % TRACE_EVENTS_SIZE];
+}
+
+/**
+ * trace_events_records:
+ * @parent: parent object for new array.
+ *
+ * Formats each record in the trace ring, oldest first, as a string of
+ * space-separated fields: the event name, the time it was queued, the
+ * time spent pending, the time spent starting and stopping jobs, the time
+ * spent blocked before being finished (all in microseconds), the number
+ * of job classes matched and the number of blockers.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned array.  When all parents
+ * of the returned array are freed, the returned array will also be
+ * freed.
+ *
+ * Returns: newly allocated NULL-terminated array or NULL if insufficient
+ * memory.
+ **/
+char **
+trace_events_records (const void *parent)
+{
+	char   **records;
+	size_t   len = 0;
+
+	records = nih_str_array_new (parent);
+	if (! records)
+		return NULL;
+
+	for (size_t i = 0; i < trace_ring_len; i++) {
+		const EventTrace *trace = trace_events_record_at (i);
+		nih_local char   *record = NULL;
+
+		record = nih_sprintf (NULL, "%s %llu %llu %llu %llu %u %u",
+				      trace->name, trace->pending,
+				      trace->handling - trace->pending,
+				      trace->handled - trace->handling,
+				      trace->finished - trace->handled,
+				      trace->matched, trace->blockers);
+		if (! record)
+			goto error;
+
+		if (! nih_str_array_addp (&records, parent, &len, record))
+			goto error;
+	}
+
+	return records;
+
+error:
+	nih_free (records);
+	return NULL;
+}
+
+/**
+ * trace_events_histograms:
+ * @parent: parent object for new array.
+ *
+ * Derives a latency histogram for each distinct event name in the trace
+ * ring, measuring the time from the event being queued to it being
+ * finished.  Each histogram is formatted as a string of space-separated
+ * fields: the event name, the number of records and then the count in
+ * each of the TRACE_HISTOGRAM_BUCKETS buckets.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned array.  When all parents
+ * of the returned array are freed, the returned array will also be
+ * freed.
+ *
+ * Returns: newly allocated NULL-terminated array or NULL if insufficient
+ * memory.
+ **/
+char **
+trace_events_histograms (const void *parent)
+{
+	char   **histograms;
+	size_t   len = 0;
+
+	histograms = nih_str_array_new (parent);
+	if (! histograms)
+		return NULL;
+
+	for (size_t i = 0; i < trace_ring_len; i++) {
+		const EventTrace *trace = trace_events_record_at (i);
+		unsigned int      buckets[TRACE_HISTOGRAM_BUCKETS];
+		nih_local char   *histogram = NULL;
+		size_t            count = 0;
+		int               seen = FALSE;
+
+		/* Names are interned so may be compared by pointer; only
+		 * the first record with each name produces a histogram.
+		 */
+		for (size_t j = 0; j < i; j++) {
+			if (trace_events_record_at (j)->name == trace->name) {
+				seen = TRUE;
+				break;
+			}
+		}
+
+		if (seen)
+			continue;
+
+		memset (buckets, 0, sizeof (buckets));
+
+		for (size_t j = i; j < trace_ring_len; j++) {
+			const EventTrace   *other = trace_events_record_at (j);
+			unsigned long long  latency;
+			int                 bucket = 0;
+
+			if (other->name != trace->name)
+				continue;
+
+			latency = other->finished - other->pending;
+			while ((bucket < TRACE_HISTOGRAM_BUCKETS - 1)
+			       && (latency >= (1ULL << bucket)))
+				bucket++;
+
+			buckets[bucket]++;
+			count++;
+		}
+
+		histogram = nih_sprintf (NULL, "%s %zu", trace->name, count);
+		if (! histogram)
+			goto error;
+
+		for (int bucket = 0; bucket < TRACE_HISTOGRAM_BUCKETS; bucket++) {
+			if (! nih_strcat_sprintf (&histogram, NULL, " %u",
+						  buckets[bucket]))
+				goto error;
+		}
+
+		if (! nih_str_array_addp (&histograms, parent, &len, histogram))
+			goto error;
+	}
+
+	return histograms;
+
+error:
+	nih_free (histograms);
+	return NULL;
+}
@@ -0,0 +1,97 @@
+/* upstart
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_TRACE_H
+#define INIT_TRACE_H
+
+#include <stddef.h>
+
+#include <nih/macros.h>
+
+
+/**
+ * TRACE_EVENTS_SIZE:
+ *
+ * Number of event lifecycle records kept in the trace ring; once full,
+ * the oldest record is overwritten.
+ **/
+#define TRACE_EVENTS_SIZE 256
+
+/**
+ * TRACE_HISTOGRAM_BUCKETS:
+ *
+ * Number of buckets in each per-event histogram.  Bucket n counts events
+ * that took less than 2^n microseconds from being emitted to being
+ * finished; the last bucket counts everything slower.
+ **/
+#define TRACE_HISTOGRAM_BUCKETS 24
+
+
+/**
+ * EventTrace:
+ * @name: name of event (interned, only set once recorded in the ring),
+ * @pending: time event was queued,
+ * @handling: time event left the pending state,
+ * @handled: time jobs had been started and stopped for the event,
+ * @finished: time event was finished,
+ * @matched: number of job classes whose start or stop condition the
+ *           event was matched against successfully,
+ * @blockers: number of blockers the event had once jobs were handled.
+ *
+ * Lifecycle record for a single event.  Times are in microseconds from
+ * the monotonic clock; @pending is zero if tracing was not enabled when
+ * the event was queued.
+ **/
+typedef struct event_trace {
+	char               *name;
+
+	unsigned long long  pending;
+	unsigned long long  handling;
+	unsigned long long  handled;
+	unsigned long long  finished;
+
+	unsigned int        matched;
+	unsigned int        blockers;
+} EventTrace;
+
+
+NIH_BEGIN_EXTERN
+
+extern int trace_events;
+
+
+unsigned long long trace_now             (void)
+	__attribute__ ((warn_unused_result));
+
+void               trace_events_enable   (int enable);
+void               trace_events_clear    (void);
+
+void               trace_event_record    (const char *name,
+					  const EventTrace *trace);
+
+size_t             trace_events_count    (void)
+	__attribute__ ((warn_unused_result));
+
+char **            trace_events_records  (const void *parent)
+	__attribute__ ((warn_unused_result));
+char **            trace_events_histograms (const void *parent)
+	__attribute__ ((warn_unused_result));
+
+NIH_END_EXTERN
+
+#endif /* INIT_TRACE_H */
@@ -0,0 +1,236 @@
+/* upstart
+ *
+ * usage.c - per-job resource accounting from cgroups
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/logging.h>
+#include <nih/error.h>
+
+#include "errors.h"
+#include "job_class.h"
+#include "job.h"
+#include "job_process.h"
+#include "trace.h"
+#include "usage.h"
+
+#ifdef ENABLE_CGROUPS
+#include "cgroup.h"
+#endif /* ENABLE_CGROUPS */
+
+
+/* Prototypes for static functions */
+static double usage_rate (uint64_t now, uint64_t then, int64_t elapsed);
+
+
+/**
+ * usage_read:
+ * @job: job to read,
+ * @usage: structure to fill in.
+ *
+ * Read the resource usage counters of the cgroups of @job, as named for
+ * its main process, into @usage along with the time they were read.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+usage_read (Job      *job,
+	    JobUsage *usage)
+{
+#ifdef ENABLE_CGROUPS
+	nih_local char **env = NULL;
+	size_t           envc;
+#endif /* ENABLE_CGROUPS */
+
+	nih_assert (job != NULL);
+	nih_assert (usage != NULL);
+
+	memset (usage, 0, sizeof (JobUsage));
+	usage->time = trace_now ();
+
+#ifdef ENABLE_CGROUPS
+	env = job_process_environment (NULL, job, PROCESS_MAIN, &envc);
+	if (! env)
+		nih_return_no_memory_error (-1);
+
+	if (! cgroup_usage_read (&job->class->cgroups, env,
+				 &usage->cpu, &usage->memory,
+				 &usage->io_read, &usage->io_write))
+		return -1;
+
+	return 0;
+#else
+	nih_return_error (-1, CGROUP_ERROR, _("cgroup support not available"));
+#endif /* ENABLE_CGROUPS */
+}
+
+/**
+ * usage_rate:
+ * @now: current value of counter,
+ * @then: earlier value of counter,
+ * @elapsed: microseconds between @then and @now.
+ *
+ * Counters start again from zero when a job's cgroups are removed and
+ * created again, in which case no rate can be known.
+ *
+ * Returns: rate of increase of counter per second.
+ **/
+static double
+usage_rate (uint64_t now,
+	    uint64_t then,
+	    int64_t  elapsed)
+{
+	nih_assert (elapsed > 0);
+
+	if (now < then)
+		return 0.0;
+
+	return (double)(now - then) * 1000000.0 / elapsed;
+}
+
+/**
+ * usage_jobs:
+ * @parent: parent object for new array,
+ * @window: pointer for shortest period rates were computed over.
+ *
+ * Read the resource usage of every running job instance that has
+ * cgroups in one pass, and describe each as an element of the form
+ * "CPU MEMORY READ WRITE NAME" where CPU is the percentage of one CPU
+ * used, MEMORY the bytes of memory in use, READ and WRITE the bytes per
+ * second read from and written to block devices, and NAME the name of
+ * the job as returned by job_name().
+ *
+ * Rates are computed against the sample kept by each job from an
+ * earlier call, which is replaced once at least USAGE_WINDOW old.  A job
+ * without such a sample reports rates of zero; @window is set to the
+ * shortest period in microseconds that any rates were computed over, so
+ * is zero if any job reported rates of zero for this reason.
+ *
+ * Jobs whose usage cannot be read are omitted.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned array.  When all parents
+ * of the returned array are freed, the returned array will also be
+ * freed.
+ *
+ * Returns: newly allocated NULL-terminated array or NULL if insufficient
+ * memory.
+ **/
+char **
+usage_jobs (const void *parent,
+	    int64_t    *window)
+{
+	char   **jobs;
+	size_t   len = 0;
+	int64_t  shortest = -1;
+
+	nih_assert (window != NULL);
+
+	job_class_init ();
+
+	jobs = nih_str_array_new (parent);
+	if (! jobs)
+		return NULL;
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		if (NIH_LIST_EMPTY (&class->cgroups))
+			continue;
+
+		NIH_HASH_FOREACH (class->instances, job_iter) {
+			Job      *job = (Job *)job_iter;
+			JobUsage  now;
+			int64_t   elapsed = 0;
+			double    cpu = 0.0;
+			uint64_t  io_read = 0;
+			uint64_t  io_write = 0;
+			char     *line;
+
+			if (job->state == JOB_WAITING)
+				continue;
+
+			if (usage_read (job, &now) < 0) {
+				NihError *err;
+
+				err = nih_error_get ();
+				nih_debug ("%s: %s", job_name (job),
+					   err->message);
+				nih_free (err);
+				continue;
+			}
+
+			if (job->usage && (now.time > job->usage->time)) {
+				elapsed = now.time - job->usage->time;
+
+				cpu = usage_rate (now.cpu, job->usage->cpu,
+						  elapsed) / 10000.0;
+				io_read = usage_rate (now.io_read,
+						      job->usage->io_read,
+						      elapsed);
+				io_write = usage_rate (now.io_write,
+						       job->usage->io_write,
+						       elapsed);
+			}
+
+			if (! job->usage) {
+				job->usage = nih_new (job, JobUsage);
+				if (! job->usage)
+					goto error;
+			}
+
+			if ((! elapsed) || (elapsed >= USAGE_WINDOW))
+				*job->usage = now;
+
+			if ((shortest < 0) || (elapsed < shortest))
+				shortest = elapsed;
+
+			line = nih_sprintf (NULL, "%.1f %" PRIu64 " %" PRIu64
+					    " %" PRIu64 " %s", cpu, now.memory,
+					    io_read, io_write, job_name (job));
+			if (! line)
+				goto error;
+
+			if (! nih_str_array_addp (&jobs, parent, &len, line)) {
+				nih_free (line);
+				goto error;
+			}
+		}
+	}
+
+	*window = shortest > 0 ? shortest : 0;
+
+	return jobs;
+
+error:
+	nih_free (jobs);
+	return NULL;
+}
@@ -0,0 +1,48 @@
+/* upstart
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_USAGE_H
+#define INIT_USAGE_H
+
+#include <stdint.h>
+
+#include <nih/macros.h>
+
+#include "job.h"
+
+
+/**
+ * USAGE_WINDOW:
+ *
+ * Minimum period, in microseconds, over which rates are computed; the
+ * sample they are computed from is only replaced once it is this old,
+ * so that frequent callers do not see rates over tiny intervals.
+ **/
+#define USAGE_WINDOW 1000000
+
+
+NIH_BEGIN_EXTERN
+
+int    usage_read (Job *job, JobUsage *usage)
+	__attribute__ ((warn_unused_result));
+char **usage_jobs (const void *parent, int64_t *window)
+	__attribute__ ((warn_unused_result, malloc));
+
+NIH_END_EXTERN
+
+#endif /* INIT_USAGE_H */
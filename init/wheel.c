@@ -0,0 +1,519 @@
+/* upstart
+ *
+ * wheel.c - hierarchical timer wheel
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/list.h>
+#include <nih/timer.h>
+#include <nih/logging.h>
+
+#include "wheel.h"
+
+
+/* Prototypes for static functions */
+static time_t wheel_now           (void);
+static void   wheel_init          (void);
+static void   wheel_insert        (WheelTimer *timer);
+static void   wheel_cascade       (int level, time_t tick);
+static void   wheel_expire        (NihList *slot, time_t tick, time_t now);
+static void   wheel_arm           (time_t due);
+static void   wheel_alarm_cb      (void *data, NihTimer *timer);
+static int    wheel_timer_destroy (WheelTimer *timer);
+
+
+/**
+ * wheel_slots:
+ *
+ * Lists of timers, by level and slot.  Slots at level zero hold timers
+ * due on a particular second, slots at higher levels hold timers to be
+ * cascaded down a level once the wheel reaches the start of the slot.
+ **/
+static NihList wheel_slots[WHEEL_LEVELS][WHEEL_SLOTS];
+
+/**
+ * wheel_overdue:
+ *
+ * List of timers whose due time has already been processed, for example
+ * because it was adjusted into the past; these are triggered the next
+ * time the wheel is processed.
+ **/
+static NihList wheel_overdue;
+
+/**
+ * wheel_initialised:
+ *
+ * TRUE once wheel_slots has been initialised.
+ **/
+static int wheel_initialised = FALSE;
+
+/**
+ * wheel_time:
+ *
+ * Next second to be processed by the wheel.
+ **/
+static time_t wheel_time = 0;
+
+/**
+ * wheel_pending:
+ *
+ * Number of timers in the wheel.
+ **/
+static size_t wheel_pending = 0;
+
+/**
+ * wheel_alarm:
+ *
+ * Main loop timer armed for the next time the wheel needs to be processed.
+ **/
+static NihTimer *wheel_alarm = NULL;
+
+
+/**
+ * wheel_now:
+ *
+ * Returns: current monotonic time, as used by NihTimer.
+ **/
+static time_t
+wheel_now (void)
+{
+	struct timespec now;
+	int             ret;
+
+	ret = clock_gettime (CLOCK_MONOTONIC, &now);
+	nih_assert (ret == 0);
+
+	return now.tv_sec;
+}
+
+/**
+ * wheel_init:
+ *
+ * Initialise the timer wheel.
+ **/
+static void
+wheel_init (void)
+{
+	if (wheel_initialised)
+		return;
+
+	for (int level = 0; level < WHEEL_LEVELS; level++)
+		for (int slot = 0; slot < WHEEL_SLOTS; slot++)
+			nih_list_init (&wheel_slots[level][slot]);
+
+	nih_list_init (&wheel_overdue);
+
+	wheel_time = wheel_now ();
+	wheel_initialised = TRUE;
+}
+
+
+/**
+ * wheel_timer_add_timeout:
+ * @parent: parent object for new timer,
+ * @timeout: seconds to wait before triggering,
+ * @callback: function to be called,
+ * @data: pointer to pass to function as first argument.
+ *
+ * Arrange for @callback to be called in @timeout seconds time, after
+ * which the timer is freed; equivalent to nih_timer_add_timeout() except
+ * that the cost of adding and cancelling the timer doesn't depend on the
+ * number of other timers.
+ *
+ * The timer is cancelled by freeing it.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned timer.  When all parents
+ * of the returned timer are freed, the returned timer will also be
+ * freed.
+ *
+ * Returns: new timer or NULL if insufficient memory.
+ **/
+WheelTimer *
+wheel_timer_add_timeout (const void   *parent,
+			 time_t        timeout,
+			 WheelTimerCb  callback,
+			 void         *data)
+{
+	WheelTimer *timer;
+
+	nih_assert (callback != NULL);
+
+	wheel_init ();
+
+	timer = nih_new (parent, WheelTimer);
+	if (! timer)
+		return NULL;
+
+	nih_list_init (&timer->entry);
+	nih_alloc_set_destructor (timer, wheel_timer_destroy);
+
+	timer->timeout = timeout;
+	timer->due = wheel_now () + timeout;
+	timer->periodic = FALSE;
+
+	timer->callback = callback;
+	timer->data = data;
+
+	wheel_insert (timer);
+	wheel_pending++;
+
+	wheel_arm (timer->due);
+
+	return timer;
+}
+
+/**
+ * wheel_timer_add_periodic:
+ * @parent: parent object for new timer,
+ * @period: number of seconds between calls,
+ * @callback: function to be called,
+ * @data: pointer to pass to function as first argument.
+ *
+ * Arrange for @callback to be called every @period seconds until the
+ * timer is freed, which @callback itself may do.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned timer.  When all parents
+ * of the returned timer are freed, the returned timer will also be
+ * freed.
+ *
+ * Returns: new timer or NULL if insufficient memory.
+ **/
+WheelTimer *
+wheel_timer_add_periodic (const void   *parent,
+			  time_t        period,
+			  WheelTimerCb  callback,
+			  void         *data)
+{
+	WheelTimer *timer;
+
+	nih_assert (period > 0);
+
+	timer = wheel_timer_add_timeout (parent, period, callback, data);
+	if (! timer)
+		return NULL;
+
+	timer->periodic = TRUE;
+
+	return timer;
+}
+
+/**
+ * wheel_timer_set_due:
+ * @timer: timer to change,
+ * @due: new monotonic time of next trigger.
+ *
+ * Move @timer so that it next triggers at @due, which may be in the past
+ * in which case it triggers the next time the wheel is processed.
+ **/
+void
+wheel_timer_set_due (WheelTimer *timer,
+		     time_t      due)
+{
+	nih_assert (timer != NULL);
+
+	wheel_init ();
+
+	if (NIH_LIST_EMPTY (&timer->entry))
+		wheel_pending++;
+
+	nih_list_remove (&timer->entry);
+
+	timer->due = due;
+	wheel_insert (timer);
+
+	wheel_arm (timer->due);
+}
+
+/**
+ * wheel_timer_destroy:
+ * @timer: timer being freed.
+ *
+ * Destructor for timers, removes @timer from the wheel.
+ *
+ * Returns: always zero.
+ **/
+static int
+wheel_timer_destroy (WheelTimer *timer)
+{
+	nih_assert (timer != NULL);
+
+	if (! NIH_LIST_EMPTY (&timer->entry)) {
+		nih_assert (wheel_pending > 0);
+		wheel_pending--;
+	}
+
+	nih_list_destroy (&timer->entry);
+
+	return 0;
+}
+
+
+/**
+ * wheel_insert:
+ * @timer: timer to insert.
+ *
+ * File @timer in the slot of the lowest level of the wheel that covers
+ * its due time, or in wheel_overdue if that time has been processed.
+ **/
+static void
+wheel_insert (WheelTimer *timer)
+{
+	time_t due;
+	time_t delta;
+	int    level;
+
+	nih_assert (timer != NULL);
+	nih_assert (wheel_initialised);
+
+	if (timer->due < wheel_time) {
+		nih_list_add (&wheel_overdue, &timer->entry);
+		return;
+	}
+
+	due = timer->due;
+	delta = due - wheel_time;
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (delta < ((time_t)1 << (WHEEL_BITS * (level + 1))))
+			break;
+
+	/* Beyond the range of the wheel, park it in the last slot from
+	 * which it will be cascaded back to the top level.
+	 */
+	if (delta >= ((time_t)1 << (WHEEL_BITS * WHEEL_LEVELS)))
+		due = wheel_time + ((time_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+	nih_list_add (&wheel_slots[level][(due >> (WHEEL_BITS * level))
+					  & WHEEL_MASK],
+		      &timer->entry);
+}
+
+/**
+ * wheel_cascade:
+ * @level: level to cascade from,
+ * @tick: second being processed.
+ *
+ * Re-file the timers in the slot of @level that starts at @tick, each
+ * moving to a lower level.
+ **/
+static void
+wheel_cascade (int    level,
+	       time_t tick)
+{
+	NihList  timers;
+	NihList *slot;
+
+	nih_assert (level > 0);
+
+	slot = &wheel_slots[level][(tick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	if (NIH_LIST_EMPTY (slot))
+		return;
+
+	nih_list_init (&timers);
+
+	while (! NIH_LIST_EMPTY (slot))
+		nih_list_add (&timers, slot->next);
+
+	while (! NIH_LIST_EMPTY (&timers)) {
+		WheelTimer *timer = (WheelTimer *)timers.next;
+
+		nih_list_remove (&timer->entry);
+		wheel_insert (timer);
+	}
+}
+
+/**
+ * wheel_expire:
+ * @slot: list of timers,
+ * @tick: second being processed,
+ * @now: current time.
+ *
+ * Trigger the timers in @slot due by @tick.  The slot is drained rather
+ * than iterated since callbacks may add timers to it, or free other
+ * timers in it.
+ **/
+static void
+wheel_expire (NihList *slot,
+	      time_t   tick,
+	      time_t   now)
+{
+	nih_assert (slot != NULL);
+
+	while (! NIH_LIST_EMPTY (slot)) {
+		WheelTimer *timer = (WheelTimer *)slot->next;
+
+		nih_list_remove (&timer->entry);
+
+		if (timer->due > tick) {
+			wheel_insert (timer);
+			continue;
+		}
+
+		wheel_pending--;
+
+		if (timer->periodic) {
+			timer->due = now + timer->timeout;
+			wheel_insert (timer);
+			wheel_pending++;
+
+			timer->callback (timer->data, timer);
+		} else {
+			timer->callback (timer->data, timer);
+			nih_free (timer);
+		}
+	}
+}
+
+/**
+ * wheel_poll:
+ *
+ * Process the wheel up to the current time, triggering any timers that
+ * are due, and arm a main loop timer for the next time the wheel needs
+ * processing.
+ *
+ * This is normally called from the main loop timer itself, but may be
+ * called at any time.
+ **/
+void
+wheel_poll (void)
+{
+	time_t now;
+	time_t due;
+
+	if (! wheel_initialised)
+		return;
+
+	now = wheel_now ();
+
+	wheel_expire (&wheel_overdue, wheel_time - 1, now);
+
+	while (wheel_time <= now) {
+		time_t tick = wheel_time;
+
+		if (! wheel_pending) {
+			wheel_time = now + 1;
+			break;
+		}
+
+		for (int level = WHEEL_LEVELS - 1; level > 0; level--)
+			if (! (tick & (((time_t)1 << (WHEEL_BITS * level)) - 1)))
+				wheel_cascade (level, tick);
+
+		wheel_expire (&wheel_slots[0][tick & WHEEL_MASK], tick, now);
+
+		wheel_time = tick + 1;
+	}
+
+	wheel_expire (&wheel_overdue, wheel_time - 1, now);
+
+	due = wheel_next_due ();
+	if (due)
+		wheel_arm (due);
+}
+
+/**
+ * wheel_next_due:
+ *
+ * Find the next time the wheel needs to be processed, either because a
+ * timer is due or because timers must be cascaded to a lower level.  The
+ * search covers a fixed number of slots so doesn't depend on the number
+ * of timers.
+ *
+ * Returns: monotonic time, or zero if there are no timers.
+ **/
+time_t
+wheel_next_due (void)
+{
+	time_t next = 0;
+
+	if (! wheel_pending)
+		return 0;
+
+	if (! NIH_LIST_EMPTY (&wheel_overdue))
+		return wheel_time;
+
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		int    shift = WHEEL_BITS * level;
+		time_t base = wheel_time >> shift;
+
+		for (int i = 0; i <= WHEEL_SLOTS; i++) {
+			time_t tick = (base + i) << shift;
+
+			if (tick < wheel_time)
+				continue;
+			if (next && (tick >= next))
+				break;
+
+			if (! NIH_LIST_EMPTY (&wheel_slots[level][(base + i)
+								  & WHEEL_MASK])) {
+				next = tick;
+				break;
+			}
+		}
+	}
+
+	return next;
+}
+
+
+/**
+ * wheel_arm:
+ * @due: monotonic time.
+ *
+ * Ensure the main loop processes the wheel no later than @due.
+ **/
+static void
+wheel_arm (time_t due)
+{
+	if (! wheel_alarm)
+		wheel_alarm = NIH_MUST (nih_timer_add_timeout (
+						NULL, 0, wheel_alarm_cb, NULL));
+	else if (wheel_alarm->due <= due)
+		return;
+
+	wheel_alarm->due = due;
+}
+
+/**
+ * wheel_alarm_cb:
+ * @data: not used,
+ * @timer: timer that caused us to be called.
+ *
+ * Main loop timer callback, processes the wheel.  @timer is freed by
+ * libnih once we return, and wheel_poll() arms a new one if needed.
+ **/
+static void
+wheel_alarm_cb (void     *data,
+		NihTimer *timer)
+{
+	nih_assert (timer == wheel_alarm);
+
+	wheel_alarm = NULL;
+
+	wheel_poll ();
+}
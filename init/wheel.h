@@ -0,0 +1,105 @@
+/* upstart
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_WHEEL_H
+#define INIT_WHEEL_H
+
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/list.h>
+
+
+/**
+ * WHEEL_LEVELS:
+ *
+ * Number of levels in the timer wheel.
+ **/
+#define WHEEL_LEVELS 4
+
+/**
+ * WHEEL_BITS:
+ *
+ * Each level of the timer wheel has 1 << WHEEL_BITS slots, each slot
+ * covering as many seconds as the whole of the level below; with four
+ * levels this covers a little over 194 days, timers further in the future
+ * than that are parked in the last slot until they come into range.
+ **/
+#define WHEEL_BITS  6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK  (WHEEL_SLOTS - 1)
+
+
+/* Predefine the typedefs as we use them in the callbacks */
+typedef struct wheel_timer WheelTimer;
+
+/**
+ * WheelTimerCb:
+ * @data: pointer given when timer was added,
+ * @timer: timer that triggered the call.
+ *
+ * The timer callback is called whenever the timer has been triggered.
+ * Timeout timers are freed once the callback returns; periodic timers
+ * may be freed by the callback to cancel them.
+ **/
+typedef void (*WheelTimerCb) (void *data, WheelTimer *timer);
+
+/**
+ * WheelTimer:
+ * @entry: list header,
+ * @timeout: seconds between triggers, or seconds until triggered,
+ * @due: monotonic time of next trigger,
+ * @periodic: TRUE if timer is periodic,
+ * @callback: function called when timer triggered,
+ * @data: pointer passed to @callback.
+ *
+ * Timers held in the timer wheel; these have the same one second
+ * resolution as NihTimer, but are filed by their due time so that adding
+ * and cancelling a timer is O(1) however many are pending.
+ *
+ * Timers are cancelled by freeing them.
+ **/
+struct wheel_timer {
+	NihList       entry;
+
+	time_t        timeout;
+	time_t        due;
+	int           periodic;
+
+	WheelTimerCb  callback;
+	void         *data;
+};
+
+
+NIH_BEGIN_EXTERN
+
+WheelTimer *wheel_timer_add_timeout  (const void *parent, time_t timeout,
+				      WheelTimerCb callback, void *data)
+	__attribute__ ((warn_unused_result, malloc));
+WheelTimer *wheel_timer_add_periodic (const void *parent, time_t period,
+				      WheelTimerCb callback, void *data)
+	__attribute__ ((warn_unused_result, malloc));
+
+void        wheel_timer_set_due      (WheelTimer *timer, time_t due);
+
+time_t      wheel_next_due           (void);
+void        wheel_poll               (void);
+
+NIH_END_EXTERN
+
+#endif /* INIT_WHEEL_H */
@@ -141,6 +141,11 @@ int list_env_action                      (NihCommand *command, char * const *arg
 int unset_env_action                     (NihCommand *command, char * const *args);
 int reset_env_action                     (NihCommand *command, char * const *args);
 int list_sessions_action                 (NihCommand *command, char * const *args);
+int trace_action                         (NihCommand *command, char * const *args);
+int blame_action                         (NihCommand *command, char * const *args);
+int critical_chain_action                (NihCommand *command, char * const *args);
+int queue_action                         (NihCommand *command, char * const *args);
+int top_action                           (NihCommand *command, char * const *args);
 
 /**
  * use_dbus:
@@ -239,6 +244,31 @@ CheckConfigData check_config_data;
  **/
 int apply_globally = FALSE;
 
+/**
+ * trace_enable, trace_disable:
+ *
+ * If TRUE, ask the init daemon to start or stop collecting trace records
+ * rather than displaying those already collected.
+ **/
+int trace_enable = FALSE;
+int trace_disable = FALSE;
+
+/**
+ * emit_priority:
+ *
+ * If TRUE, ask the init daemon to handle the emitted event before those
+ * emitted in bulk.
+ **/
+int emit_priority = FALSE;
+
+/**
+ * queue_limit:
+ *
+ * If not -1, ask the init daemon to change the maximum number of jobs
+ * that may be starting at once rather than displaying the queue.
+ **/
+int queue_limit = -1;
+
 /**
  * NihOption setter function to handle selection of appropriate D-Bus
  * bus.
@@ -1749,10 +1779,17 @@ emit_action (NihCommand *  command,
 	if (! upstart)
 		return 1;
 
-	pending_call = upstart_emit_event (upstart, args[0], &args[1], (! no_wait),
-					   (UpstartEmitEventReply)reply_handler,
-					   error_handler, &ret,
-					   NIH_DBUS_TIMEOUT_NEVER);
+	if (emit_priority) {
+		pending_call = upstart_emit_event_with_priority (
+			upstart, args[0], &args[1], (! no_wait), TRUE,
+			(UpstartEmitEventWithPriorityReply)reply_handler,
+			error_handler, &ret, NIH_DBUS_TIMEOUT_NEVER);
+	} else {
+		pending_call = upstart_emit_event (
+			upstart, args[0], &args[1], (! no_wait),
+			(UpstartEmitEventReply)reply_handler,
+			error_handler, &ret, NIH_DBUS_TIMEOUT_NEVER);
+	}
 	if (! pending_call)
 		goto error;
 
@@ -1894,6 +1931,526 @@ error:
 }
 
 
+/**
+ * trace_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "trace" command.
+ *
+ * Returns: command exit status.
+ **/
+int
+trace_action (NihCommand *  command,
+	      char * const *args)
+{
+	nih_local NihDBusProxy *upstart = NULL;
+	nih_local char        **records = NULL;
+	nih_local char        **histograms = NULL;
+	NihError *              err;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	if ((! args[0]) || strcmp (args[0], "events")) {
+		fprintf (stderr, _("%s: missing or unknown trace type\n"),
+			 program_name);
+		nih_main_suggest_help ();
+		return 1;
+	}
+
+	if (trace_enable && trace_disable) {
+		fprintf (stderr, _("%s: --enable and --disable are mutually exclusive\n"),
+			 program_name);
+		nih_main_suggest_help ();
+		return 1;
+	}
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	if (trace_enable || trace_disable) {
+		if (upstart_set_trace_events_sync (NULL, upstart,
+						   trace_enable) < 0)
+			goto error;
+
+		return 0;
+	}
+
+	if (upstart_get_event_trace_sync (NULL, upstart,
+					  &records, &histograms) < 0)
+		goto error;
+
+	nih_message ("%-32s %10s %10s %10s %8s %8s",
+		     _("EVENT"), _("PENDING"), _("HANDLE"), _("BLOCKED"),
+		     _("MATCHED"), _("BLOCKERS"));
+
+	for (char **record = records; record && *record; record++) {
+		nih_local char **fields = NULL;
+		size_t           len = 0;
+
+		fields = NIH_MUST (nih_str_split (NULL, *record, " ", TRUE));
+		while (fields[len])
+			len++;
+
+		if (len != 7)
+			continue;
+
+		nih_message ("%-32s %8sus %8sus %8sus %8s %8s",
+			     fields[0], fields[2], fields[3], fields[4],
+			     fields[5], fields[6]);
+	}
+
+	for (char **histogram = histograms; histogram && *histogram;
+	     histogram++) {
+		nih_local char **fields = NULL;
+		size_t           len = 0;
+
+		fields = NIH_MUST (nih_str_split (NULL, *histogram, " ", TRUE));
+		while (fields[len])
+			len++;
+
+		if (len < 3)
+			continue;
+
+		nih_message ("\n%s (%s)", fields[0], fields[1]);
+
+		/* Bucket n counts latencies below 2^n microseconds, the
+		 * last bucket counts everything slower.
+		 */
+		for (size_t i = 2; i < len; i++) {
+			unsigned long long bound = 1ULL << (i - 2);
+
+			if (! strcmp (fields[i], "0"))
+				continue;
+
+			if (i < len - 1) {
+				nih_message ("  < %10lluus %8s", bound,
+					     fields[i]);
+			} else {
+				nih_message ("  >= %9lluus %8s", bound / 2,
+					     fields[i]);
+			}
+		}
+	}
+
+	return 0;
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+
+	return 1;
+}
+
+
+/**
+ * blame_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "blame" command.
+ *
+ * Returns: command exit status.
+ **/
+int
+blame_action (NihCommand *  command,
+	      char * const *args)
+{
+	nih_local NihDBusProxy *upstart = NULL;
+	nih_local char        **blame = NULL;
+	NihError *              err;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	if (upstart_get_blame_sync (NULL, upstart, &blame) < 0)
+		goto error;
+
+	for (char **line = blame; line && *line; line++) {
+		long long  duration;
+		char      *name;
+
+		duration = strtoll (*line, &name, 10);
+		if (*name != ' ')
+			continue;
+
+		nih_message ("%10.3fs %s", duration / 1000000.0, name + 1);
+	}
+
+	return 0;
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+
+	return 1;
+}
+
+/**
+ * critical_chain_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "critical-chain" command.
+ *
+ * Returns: command exit status.
+ **/
+int
+critical_chain_action (NihCommand *  command,
+		       char * const *args)
+{
+	nih_local NihDBusProxy *upstart = NULL;
+	nih_local char        **chain = NULL;
+	NihError *              err;
+	size_t                  len = 0;
+	long long               origin;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	if (! args[0]) {
+		fprintf (stderr, _("%s: missing job name\n"), program_name);
+		nih_main_suggest_help ();
+		return 1;
+	}
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	if (upstart_get_critical_chain_sync (NULL, upstart, args[0],
+					     &chain) < 0)
+		goto error;
+
+	while (chain[len])
+		len++;
+
+	if (! len) {
+		nih_message (_("%s has not been started"), args[0]);
+		return 0;
+	}
+
+	/* The chain runs from the job back to the first cause, show it
+	 * the other way around with times relative to the first job.
+	 */
+	origin = strtoll (chain[len - 1], NULL, 10);
+
+	while (len--) {
+		long long  starting;
+		long long  running;
+		char      *p;
+		char      *cause;
+		char      *name;
+
+		starting = strtoll (chain[len], &p, 10);
+		running = strtoll (p, &p, 10);
+
+		cause = p + strspn (p, " ");
+		name = strchr (cause, ' ');
+		if (! name)
+			continue;
+
+		*(name++) = '\0';
+
+		if (running) {
+			nih_message ("%s @%.3fs +%.3fs (%s)", name,
+				     (starting - origin) / 1000000.0,
+				     (running - starting) / 1000000.0,
+				     cause);
+		} else {
+			nih_message (_("%s @%.3fs not running (%s)"), name,
+				     (starting - origin) / 1000000.0,
+				     cause);
+		}
+	}
+
+	return 0;
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+
+	return 1;
+}
+
+/**
+ * queue_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "queue" command.
+ *
+ * Returns: command exit status.
+ **/
+int
+queue_action (NihCommand *  command,
+	      char * const *args)
+{
+	nih_local NihDBusProxy *upstart = NULL;
+	nih_local char        **jobs = NULL;
+	nih_local char        **sessions = NULL;
+	nih_local char        **pools = NULL;
+	nih_local char         *policy = NULL;
+	NihError *              err;
+	int32_t                 limit;
+	int32_t                 spawning;
+	int64_t                 longest_wait;
+	double                  cpu;
+	double                  memory;
+	double                  io;
+	int32_t                 threshold;
+	uint32_t                deferred;
+	uint32_t                relieved;
+	uint32_t                expired;
+	uint32_t                priority_depth;
+	uint32_t                bulk_depth;
+	uint32_t                priority_peak;
+	uint32_t                bulk_peak;
+	uint32_t                priority_handled;
+	uint32_t                bulk_handled;
+	uint32_t                yielded;
+	int32_t                 max_pending;
+	uint32_t                rejected;
+	uint32_t                dropped;
+	uint32_t                coalesced;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	if (queue_limit >= 0) {
+		if (upstart_set_max_concurrent_spawns_sync (NULL, upstart,
+							    queue_limit) < 0)
+			goto error;
+
+		return 0;
+	}
+
+	if (upstart_get_max_concurrent_spawns_sync (NULL, upstart,
+						    &limit) < 0)
+		goto error;
+
+	if (upstart_get_spawn_queue_sync (NULL, upstart, &jobs, &spawning,
+					  &longest_wait) < 0)
+		goto error;
+
+	if (upstart_get_pressure_sync (NULL, upstart, &cpu, &memory, &io,
+				       &threshold, &deferred, &relieved,
+				       &expired) < 0)
+		goto error;
+
+	if (upstart_get_event_queue_sync (NULL, upstart, &priority_depth,
+					  &bulk_depth, &priority_peak,
+					  &bulk_peak, &priority_handled,
+					  &bulk_handled, &yielded) < 0)
+		goto error;
+
+	if (upstart_get_event_overflow_sync (NULL, upstart, &max_pending,
+					     &policy, &rejected, &dropped,
+					     &coalesced) < 0)
+		goto error;
+
+	if (upstart_get_session_events_sync (NULL, upstart, &sessions) < 0)
+		goto error;
+
+	if (upstart_get_event_pools_sync (NULL, upstart, &pools) < 0)
+		goto error;
+
+	if (limit > 0) {
+		nih_message (_("%d starting, limit %d"), spawning, limit);
+	} else {
+		nih_message (_("%d starting, no limit"), spawning);
+	}
+	nih_message (_("longest wait %.3fs"), longest_wait / 1000000.0);
+
+	if (cpu < 0) {
+		nih_message (_("pressure unknown, threshold %d%%"), threshold);
+	} else {
+		nih_message (_("pressure cpu %.2f%% memory %.2f%% io %.2f%%, "
+			       "threshold %d%%"), cpu, memory, io, threshold);
+	}
+	nih_message (_("%u deferred, %u admitted after relief, "
+		       "%u after timeout"), deferred, relieved, expired);
+	nih_message (_("events priority %u pending (peak %u, %u handled), "
+		       "bulk %u pending (peak %u, %u handled), %u yielded"),
+		     priority_depth, priority_peak, priority_handled,
+		     bulk_depth, bulk_peak, bulk_handled, yielded);
+
+	if (max_pending > 0) {
+		nih_message (_("events limit %d, %s on overflow: %u rejected, "
+			       "%u dropped, %u coalesced"), max_pending, policy,
+			     rejected, dropped, coalesced);
+	} else {
+		nih_message (_("events no limit, %s on overflow: %u rejected, "
+			       "%u dropped, %u coalesced"), policy,
+			     rejected, dropped, coalesced);
+	}
+
+	for (char **line = sessions; line && *line; line++) {
+		unsigned int pending;
+		unsigned int handled;
+		unsigned int refused;
+		int          offset = 0;
+
+		if (sscanf (*line, "%u %u %u %n", &pending, &handled,
+			    &refused, &offset) < 3 || ! offset)
+			continue;
+
+		nih_message (_("session %s: %u pending, %u handled, "
+			       "%u refused"), *line + offset,
+			     pending, handled, refused);
+	}
+
+	for (char **line = pools; line && *line; line++) {
+		unsigned int in_use;
+		unsigned int peak;
+		unsigned int pooled;
+		unsigned int reused;
+		int          offset = 0;
+
+		if (sscanf (*line, "%u %u %u %u %n", &in_use, &peak, &pooled,
+			    &reused, &offset) < 4 || ! offset)
+			continue;
+
+		nih_message (_("pool %s: %u in use (peak %u), %u free, "
+			       "%u reused"), *line + offset,
+			     in_use, peak, pooled, reused);
+	}
+
+	for (char **line = jobs; line && *line; line++) {
+		long long  wait;
+		char      *name;
+
+		wait = strtoll (*line, &name, 10);
+		if (*name != ' ')
+			continue;
+
+		nih_message ("%10.3fs %s", wait / 1000000.0, name + 1);
+	}
+
+	return 0;
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+
+	return 1;
+}
+
+
+/**
+ * top_qsort_compar:
+ *
+ * @a: first usage line to compare,
+ * @b: second usage line to compare.
+ *
+ * qsort() function to sort jobs by descending CPU usage for top_action().
+ **/
+static int
+top_qsort_compar (const void *a, const void *b)
+{
+	double cpu_a;
+	double cpu_b;
+
+	cpu_a = strtod (*(char * const *)a, NULL);
+	cpu_b = strtod (*(char * const *)b, NULL);
+
+	return (cpu_a < cpu_b) - (cpu_a > cpu_b);
+}
+
+/**
+ * top_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "top" command.
+ *
+ * If the init daemon has no earlier sample of some jobs to compute
+ * rates against, a second sample is taken after a short wait.
+ *
+ * Returns: command exit status.
+ **/
+int
+top_action (NihCommand *  command,
+	    char * const *args)
+{
+	nih_local NihDBusProxy *upstart = NULL;
+	nih_local char        **usage = NULL;
+	NihError *              err;
+	int64_t                 window;
+	size_t                  len = 0;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	if (upstart_get_job_usage_sync (NULL, upstart, &usage, &window) < 0)
+		goto error;
+
+	if (! window && usage && *usage) {
+		nih_free (usage);
+		usage = NULL;
+
+		sleep (1);
+
+		if (upstart_get_job_usage_sync (NULL, upstart,
+						&usage, &window) < 0)
+			goto error;
+	}
+
+	while (usage && usage[len])
+		len++;
+
+	qsort (usage, len, sizeof (usage[0]), top_qsort_compar);
+
+	nih_message ("%6s %12s %12s %12s %s", _("CPU%"), _("MEMORY"),
+		     _("READ/s"), _("WRITE/s"), _("JOB"));
+
+	for (size_t i = 0; i < len; i++) {
+		double              cpu;
+		unsigned long long  memory;
+		unsigned long long  io_read;
+		unsigned long long  io_write;
+		char               *name;
+
+		cpu = strtod (usage[i], &name);
+		memory = strtoull (name, &name, 10);
+		io_read = strtoull (name, &name, 10);
+		io_write = strtoull (name, &name, 10);
+		if (*name != ' ')
+			continue;
+
+		nih_message ("%6.1f %12llu %12llu %12llu %s", cpu, memory,
+			     io_read, io_write, name + 1);
+	}
+
+	return 0;
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+
+	return 1;
+}
+
+
 /**
  * check_config_action:
  * @command: NihCommand invoked,
@@ -3020,6 +3577,8 @@ NihOption list_options[] = {
 NihOption emit_options[] = {
 	{ 'n', "no-wait", N_("do not wait for event to finish before exiting"),
 	  NULL, NULL, &no_wait, NULL },
+	{ 'p', "priority", N_("handle event before those emitted in bulk"),
+	  NULL, NULL, &emit_priority, NULL },
 
 	NIH_OPTION_LAST
 };
@@ -3136,6 +3695,30 @@ NihOption reset_env_options[] = {
 	NIH_OPTION_LAST
 };
 
+/**
+ * trace_options:
+ *
+ * Command-line options accepted for the trace command.
+ **/
+NihOption trace_options[] = {
+	{ 0, "enable", N_("start collecting trace records"),
+	  NULL, NULL, &trace_enable, NULL },
+	{ 0, "disable", N_("stop collecting trace records"),
+	  NULL, NULL, &trace_disable, NULL },
+	NIH_OPTION_LAST
+};
+
+/**
+ * queue_options:
+ *
+ * Command-line options accepted for the queue command.
+ **/
+NihOption queue_options[] = {
+	{ 0, "limit", N_("change the number of jobs that may start at once"),
+	  NULL, "NUMBER", &queue_limit, nih_option_int },
+	NIH_OPTION_LAST
+};
+
 /**
  * usage_options:
  *
@@ -3229,9 +3812,64 @@ static NihCommand commands[] = {
 	  N_("Emit an event."),
 	  N_("EVENT is the name of an event the init daemon should emit, "
 	     "this may be followed by zero or more environment variables "
-	     "to be included in the event.\n"),
+	     "to be included in the event.\n"
+	     "\n"
+	     "With --priority, the event is handled before events emitted "
+	     "in bulk, such as those for devices."),
 	  &event_commands, emit_options, emit_action },
 
+	{ "trace", N_("events"),
+	  N_("Show event lifecycle trace."),
+	  N_("Displays the time each recently finished event spent pending, "
+	     "starting and stopping jobs, and blocked waiting for jobs, "
+	     "followed by a latency histogram for each event name.\n"
+	     "\n"
+	     "Records are only collected once enabled with --enable; "
+	     "enabling discards any previous records."),
+	  &event_commands, trace_options, trace_action },
+
+	{ "blame", NULL,
+	  N_("List jobs by time taken to start."),
+	  N_("Displays each job that has reached the running state, "
+	     "slowest first, with the time it took from starting to "
+	     "running.  This includes time spent blocked on its starting "
+	     "event, and in its pre-start and post-start processes."),
+	  &job_commands, NULL, blame_action },
+
+	{ "critical-chain", N_("JOB"),
+	  N_("Show the chain of jobs that led to a job starting."),
+	  N_("JOB is the name of the job to start from.  Each job in the "
+	     "chain is shown with the time it began starting relative to "
+	     "the first, the time it took to reach running and the event "
+	     "that caused it to start; the job that emitted that event "
+	     "comes before it."),
+	  &job_commands, NULL, critical_chain_action },
+
+	{ "queue", NULL,
+	  N_("Show jobs waiting to start."),
+	  N_("Displays the number of jobs starting and the limit on "
+	     "that number, the longest time any job has waited to start, "
+	     "current resource pressure and the number of jobs deferred "
+	     "because of it, the events pending in each lane of the event "
+	     "queue, its limit and how often it has overflowed, the events "
+	     "pending from each chroot session, and then each job waiting "
+	     "in the queued state with the time it has waited so far, in "
+	     "the order they will be started.\n"
+	     "\n"
+	     "With --limit, changes the number of jobs that may be "
+	     "starting at once instead; zero removes the limit."),
+	  &job_commands, queue_options, queue_action },
+
+	{ "top", NULL,
+	  N_("Show resource usage of running jobs."),
+	  N_("Displays each running job that has cgroups with the "
+	     "percentage of one CPU it is using, the bytes of memory it "
+	     "has in use and the bytes per second it is reading from and "
+	     "writing to block devices, busiest first.  Rates are measured "
+	     "over at least one second.  Requires the cgroup filesystem "
+	     "to be mounted."),
+	  &job_commands, NULL, top_action },
+
 	{ "reload-configuration", NULL,
 	  N_("Reload the configuration of the init daemon."),
 	  NULL,